@@ -12,10 +12,28 @@ done
 
 echo "Building code"
 
-rm -f cfg_test
+rm -f cfg_test example cfg_num_bench cfg_bench cfg_hpp_test cfg_compile
 
-gcc -std=c99 -pedantic -Wall -Wextra -Werror -g -o cfg_test cfg.c hmap.c err.c cfg_test.c; if [ $? -ne 0 ]; then exit 1; fi
+gcc -std=c99 -pedantic -Wall -Wextra -Werror -g -pthread -o cfg_compile cfg.c cfg_num.c intern.c hamt.c phash.c hmap.c err.c cfg_compile.c; if [ $? -ne 0 ]; then exit 1; fi
 
-gcc -std=c99 -pedantic -Wall -Wextra -Werror -g -o example cfg.c hmap.c err.c example.c; if [ $? -ne 0 ]; then exit 1; fi
+# Test 28 links a table compiled from tst28.cfg. cfg_shm.c needs -lrt for
+# shm_open() on older glibc.
+./cfg_compile -n tst28_static tst28.cfg tst28_static.c; if [ $? -ne 0 ]; then exit 1; fi
+gcc -std=c99 -pedantic -Wall -Wextra -Werror -g -pthread -o cfg_test cfg.c cfg_num.c intern.c cfg_shm.c cfg_numa.c hamt.c phash.c hmap.c err.c cfg_test.c tst28_static.c -lrt; ST=$?
+rm -f tst28_static.c
+if [ $ST -ne 0 ]; then exit 1; fi
+
+gcc -std=c99 -pedantic -Wall -Wextra -Werror -g -pthread -o example cfg.c cfg_num.c intern.c hamt.c phash.c hmap.c err.c example.c; if [ $? -ne 0 ]; then exit 1; fi
+
+gcc -std=c99 -pedantic -Wall -Wextra -Werror -O2 -pthread -o cfg_num_bench cfg_num.c err.c cfg_num_bench.c; if [ $? -ne 0 ]; then exit 1; fi
+
+gcc -std=c99 -pedantic -Wall -Wextra -Werror -O2 -pthread -o cfg_bench cfg.c cfg_num.c intern.c hamt.c phash.c hmap.c err.c cfg_bench.c; if [ $? -ne 0 ]; then exit 1; fi
+
+# The C++ wrapper test links the C modules compiled as C. No -pedantic:
+# intern.h has a flexible array member (a g++ extension).
+gcc -std=c99 -pedantic -Wall -Wextra -Werror -g -pthread -c cfg.c cfg_num.c intern.c hamt.c phash.c hmap.c err.c; if [ $? -ne 0 ]; then exit 1; fi
+g++ -std=c++17 -Wall -Wextra -Werror -g -o cfg_hpp_test cfg_hpp_test.cpp cfg.o cfg_num.o intern.o hamt.o phash.o hmap.o err.o -pthread; ST=$?
+rm -f cfg.o cfg_num.o intern.o hamt.o phash.o hmap.o err.o
+if [ $ST -ne 0 ]; then exit 1; fi
 
 echo "Build successful"
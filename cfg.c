@@ -10,13 +10,21 @@
  * Project home: https://github.com/fordsfords/cfg
  */
 
+#define _POSIX_C_SOURCE 200809L  /* For clock_gettime(). */
 #include <stdlib.h>
 #include <string.h>
 #include <stdint.h>
+#include <time.h>
 #include <errno.h>
 #include <ctype.h>
+#include <unistd.h>
+#include <pthread.h>
+#if defined(__linux__)
+#include <sys/eventfd.h>
+#endif
 #include "err.h"
 #include "hmap.h"
+#include "cfg_num.h"
 #define CFG_C
 #include "cfg.h"
 
@@ -25,6 +33,40 @@
  * I wouldn't expect more than a few hundred options at the most. */
 #define CFG_OPTION_MAP_SIZE 1009
 
+/* Entries in an overlay's layer cache; see cfg_option_try_find_h(). A
+ * power of 2. */
+#define CFG_LAYER_CACHE_SIZE 1024
+
+/* Keys changed within one batch; most reloads touch only a handful. */
+#define CFG_PENDING_MAP_SIZE 101
+
+/* Public getters count reads while profiling. The option may belong to
+ * a frozen parent shared with other threads, hence the atomic. */
+#define CFG_COUNT_READ(cfg__cfg, cfg__option) do { \
+  if ((cfg__cfg)->profile_enabled) { \
+    __atomic_fetch_add(&(cfg__option)->num_reads, 1, __ATOMIC_RELAXED); \
+  } \
+} while (0)
+
+
+/* Entries in each thread's hot-key cache; see cfg_hot_cache_enable(). */
+#define CFG_HOT_CACHE_BITS 6
+#define CFG_HOT_CACHE_SIZE (1 << CFG_HOT_CACHE_BITS)
+
+/* Bumped by every cfg_delete(). A new cfg can reuse a deleted one's
+ * address, so each thread's hot-key cache empties when this changes. */
+uint64_t cfg_delete_generation;  /* Atomic. */
+
+
+/* A key changed during the current batch. Only the first old value is
+ * kept so that repeated sets of a key produce a single notification. */
+typedef struct cfg_pending_s cfg_pending_t;
+struct cfg_pending_s {
+  char *key;
+  char *old_value;  /* NULL if the key was added in this batch. */
+  cfg_pending_t *next;
+};
+
 
 char *cfg_trim(char *in_str) {
   /* Skip over initial whitespace. */
@@ -68,34 +110,158 @@ ERR_F cfg_key_valid(char *key) {
 }  /* cfg_key_valid */
 
 
+ERR_F cfg_mem_calloc(cfg_t *cfg, void **rtn_ptr, size_t nmemb, size_t size) {
+  ERR_ASSRT(*rtn_ptr = err_mem_calloc(cfg->allocator, nmemb, size), CFG_ERR_NOMEM);
+
+  return ERR_OK;
+}  /* cfg_mem_calloc */
+
+
+ERR_F cfg_mem_strdup(cfg_t *cfg, char **rtn_str, const char *src) {
+  size_t len = strlen(src) + 1;
+  ERR_ASSRT(*rtn_str = err_mem_alloc(cfg->allocator, len), CFG_ERR_NOMEM);
+  memcpy(*rtn_str, src, len);
+
+  return ERR_OK;
+}  /* cfg_mem_strdup */
+
+
+/* For memory the cfg hands to the caller (e.g. cfg_profile_keys()). */
+void cfg_mem_free(cfg_t *cfg, void *ptr) {
+  err_mem_free(cfg->allocator, ptr);
+}  /* cfg_mem_free */
+
+
+/* Copy of a key, value, or location: interned if there's a pool. */
+ERR_F cfg_str_dup(cfg_t *cfg, char **rtn_str, const char *str) {
+  if (cfg->intern_pool) {
+    ERR(intern_get(cfg->intern_pool, str, rtn_str));
+  } else {
+    ERR(cfg_mem_strdup(cfg, rtn_str, str));
+  }
+
+  return ERR_OK;
+}  /* cfg_str_dup */
+
+
+void cfg_str_free(cfg_t *cfg, char *str) {
+  if (cfg->intern_pool) {
+    intern_release(cfg->intern_pool, str);
+  } else {
+    err_mem_free(cfg->allocator, str);
+  }
+}  /* cfg_str_free */
+
+
 ERR_F cfg_create(cfg_t **rtn_cfg) {
-  cfg_t *cfg;
-  ERR_ASSRT(cfg = calloc(1, sizeof(cfg_t)), CFG_ERR_NOMEM);
+  ERR(cfg_create_ex(rtn_cfg, NULL));
+
+  return ERR_OK;
+}  /* cfg_create */
 
-  ERR(hmap_create(&(cfg->option_vals), CFG_OPTION_MAP_SIZE));
+
+/* Option maps start in small mode, so a cfg with a few keys never
+ * allocates its tables. */
+ERR_F cfg_hmap_create(hmap_t **rtn_hmap, size_t table_size, const err_allocator_t *allocator) {
+  ERR(hmap_create_ex(rtn_hmap, table_size, allocator));
+  ERR(hmap_set_flags(*rtn_hmap, HMAP_FLAG_SMALL));
+
+  return ERR_OK;
+}  /* cfg_hmap_create */
+
+
+ERR_F cfg_create_ex(cfg_t **rtn_cfg, const cfg_create_opts_t *opts) {
+  const err_allocator_t *allocator = (opts && opts->allocator) ? opts->allocator : err_get_allocator();
+  size_t map_size = CFG_OPTION_MAP_SIZE;
+  cfg_t *cfg;
+  ERR_ASSRT(rtn_cfg, CFG_ERR_PARAM);
+  ERR_ASSRT(cfg = err_mem_calloc(allocator, 1, sizeof(cfg_t)), CFG_ERR_NOMEM);
+  cfg->allocator = allocator;
+  if (opts && opts->expected_keys > 0) {
+    map_size = opts->expected_keys | 1;  /* Odd sizes spread hashes better. */
+  }
 
   err_t *err;
-  err = hmap_create(&(cfg->option_locations), CFG_OPTION_MAP_SIZE);
+  err = cfg_hmap_create(&(cfg->option_vals), map_size, allocator);
+  if (err) {
+    err_mem_free(allocator, cfg);
+    ERR_RETHROW(err, err->code);
+  }
+
+  err = cfg_hmap_create(&(cfg->option_locations), map_size, allocator);
+  if (err) {
+    ERR(hmap_delete(cfg->option_vals));
+    err_mem_free(allocator, cfg);
+    ERR_RETHROW(err, err->code);
+  }
+
+  err = cfg_hmap_create(&(cfg->option_infos), map_size, allocator);
   if (err) {
     ERR(hmap_delete(cfg->option_vals));
+    ERR(hmap_delete(cfg->option_locations));
+    err_mem_free(allocator, cfg);
     ERR_RETHROW(err, err->code);
   }
 
+  cfg->notify_fd = -1;
+  pthread_mutex_init(&cfg->queue_lock, NULL);
+  pthread_mutex_init(&cfg->memo_lock, NULL);
+  cfg->load_fd = -1;
+  pthread_mutex_init(&cfg->load_lock, NULL);
+  pthread_cond_init(&cfg->load_cond, NULL);
+
   *rtn_cfg = cfg;
   return ERR_OK;
-}  /* cfg_create */
+}  /* cfg_create_ex */
+
+
+/* All but the key and value, which the caller owns. */
+void cfg_option_free(cfg_t *cfg, cfg_option_t *option) {
+  err_mem_free(cfg->allocator, option->expanded);
+  err_mem_free(cfg->allocator, option->dependents);
+  err_mem_free(cfg->allocator, option->str_list);
+  err_mem_free(cfg->allocator, option->long_list);
+  while (option->binds) {
+    cfg_bind_t *next_bind = option->binds->next;
+    err_mem_free(cfg->allocator, option->binds->str_copy);
+    err_mem_free(cfg->allocator, option->binds);
+    option->binds = next_bind;
+  }
+  err_mem_free(cfg->allocator, option);
+}  /* cfg_option_free */
+
+
+/* Called as each flush or drain finishes; the outermost one frees the
+ * subscriptions that callbacks unsubscribed while it ran. */
+void cfg_deliver_end(cfg_t *cfg) {
+  if (cfg->delivering > 0) {
+    cfg->delivering--;
+  }
+  if (cfg->delivering == 0) {
+    while (cfg->retired_subs) {
+      cfg_sub_t *next_sub = cfg->retired_subs->retired_next;
+      err_mem_free(cfg->allocator, cfg->retired_subs->key);
+      err_mem_free(cfg->allocator, cfg->retired_subs);
+      cfg->retired_subs = next_sub;
+    }
+  }
+}  /* cfg_deliver_end */
 
 
+void cfg_load_discard(cfg_t *cfg);
+
 ERR_F cfg_delete(cfg_t *cfg) {
   hmap_entry_t *entry;
 
+  cfg_load_discard(cfg);  /* Outstanding loads are not applied. */
+
   /* Free the option values. */
   entry = NULL;  /* Start at beginning. */
   do {
     ERR(hmap_next(cfg->option_vals, &entry));
     if (entry) {
         ERR_ASSRT(entry->value != NULL, CFG_ERR_INTERNAL);
-        free(entry->value);
+        cfg_str_free(cfg, entry->value);
     }
   } while (entry);
   ERR(hmap_delete(cfg->option_vals));
@@ -106,192 +272,3205 @@ ERR_F cfg_delete(cfg_t *cfg) {
     ERR(hmap_next(cfg->option_locations, &entry));
     if (entry) {
         ERR_ASSRT(entry->value != NULL, CFG_ERR_INTERNAL);
-        free(entry->value);
+        cfg_str_free(cfg, entry->value);
     }
   } while (entry);
   ERR(hmap_delete(cfg->option_locations));
 
-  free(cfg);
+  /* Free the option infos. */
+  entry = NULL;  /* Start at beginning. */
+  do {
+    ERR(hmap_next(cfg->option_infos, &entry));
+    if (entry) {
+      cfg_option_t *option = (cfg_option_t *)entry->value;
+      ERR_ASSRT(option != NULL, CFG_ERR_INTERNAL);
+      cfg_str_free(cfg, option->key);  /* Interned keys are shared with the maps. */
+      cfg_option_free(cfg, option);
+    }
+  } while (entry);
+  ERR(hmap_delete(cfg->option_infos));
+  err_mem_free(cfg->allocator, cfg->layer_cache);  /* Options belong to the layers. */
+  if (cfg->history) {  /* Snapshots keep their own references. */
+    ERR(hamt_delete(cfg->history));
+  }
+  err_mem_free(cfg->allocator, cfg->rebinds);
+  err_mem_free(cfg->allocator, cfg->schema_options);
+  err_mem_free(cfg->allocator, cfg->key_index);
+  int i;
+  for (i = 0; i < cfg->num_retired_strs; i++) {
+    err_mem_free(cfg->allocator, cfg->retired_strs[i]);
+  }
+  err_mem_free(cfg->allocator, cfg->retired_strs);
+  for (i = 0; i < cfg->num_file_stats; i++) {
+    err_mem_free(cfg->allocator, cfg->file_stats[i].filename);
+  }
+  err_mem_free(cfg->allocator, cfg->file_stats);
+
+  /* Free subscriptions and any undelivered notifications. */
+  while (cfg->subs) {
+    cfg_sub_t *next_sub = cfg->subs->next;
+    err_mem_free(cfg->allocator, cfg->subs->key);
+    err_mem_free(cfg->allocator, cfg->subs);
+    cfg->subs = next_sub;
+  }
+  cfg->delivering = 0;  /* Free retired subscriptions too. */
+  cfg_deliver_end(cfg);
+  while (cfg->queue_head) {
+    cfg_notify_t *next_notify = cfg->queue_head->next;
+    err_mem_free(cfg->allocator, cfg->queue_head->key);
+    err_mem_free(cfg->allocator, cfg->queue_head->old_value);
+    err_mem_free(cfg->allocator, cfg->queue_head->new_value);
+    err_mem_free(cfg->allocator, cfg->queue_head);
+    cfg->queue_head = next_notify;
+  }
+  while (cfg->pending_head) {  /* Only if deleted inside a batch. */
+    cfg_pending_t *next_pending = cfg->pending_head->next;
+    err_mem_free(cfg->allocator, cfg->pending_head->key);
+    cfg_str_free(cfg, cfg->pending_head->old_value);
+    err_mem_free(cfg->allocator, cfg->pending_head);
+    cfg->pending_head = next_pending;
+  }
+  if (cfg->pending_changes) {
+    ERR(hmap_delete(cfg->pending_changes));
+  }
+  if (cfg->notify_fd != -1) {
+    close(cfg->notify_fd);
+  }
+  pthread_mutex_destroy(&cfg->queue_lock);
+  pthread_mutex_destroy(&cfg->memo_lock);
+  if (cfg->load_fd != -1) {
+    close(cfg->load_fd);
+  }
+  pthread_mutex_destroy(&cfg->load_lock);
+  pthread_cond_destroy(&cfg->load_cond);
+
+  if (cfg->static_options) {
+    uint32_t slot;
+    for (slot = 0; slot < cfg->static_base->index.table_size; slot++) {
+      if (cfg->static_options[slot]) {
+        cfg_option_free(cfg, cfg->static_options[slot]);
+      }
+    }
+    err_mem_free(cfg->allocator, cfg->static_options);
+  }
+
+  /* A new cfg at the same address must not hit old cache entries. */
+  __atomic_add_fetch(&cfg_delete_generation, 1, __ATOMIC_RELEASE);
+  err_mem_free(cfg->allocator, cfg);
 
   return ERR_OK;
 }  /* cfg_delete */
 
 
-ERR_F cfg_parse_line(cfg_t *cfg, int mode, const char *iline, const char *filename, int line_num) {
-  char *local_iline;
-  err_t *err;
+/* Share keys, values, and locations with other cfgs through an interning
+ * pool. Must be called before any options are added; the pool must
+ * outlive the cfg. */
+ERR_F cfg_intern_pool(cfg_t *cfg, intern_pool_t *pool) {
+  ERR_ASSRT(cfg, CFG_ERR_PARAM);
+  ERR_ASSRT(pool, CFG_ERR_PARAM);
+  ERR_ASSRT(cfg->option_infos->num_entries == 0, CFG_ERR_PARAM);
 
-  switch (mode) {  /* Check for valid mode. */
-  case CFG_MODE_UPDATE: break;
-  case CFG_MODE_ADD: break;
-  default: ERR_THROW(CFG_ERR_PARAM, "unrecognized mode %d", mode);
-  }
+  ERR(hmap_set_flags(cfg->option_vals, cfg->option_vals->flags | HMAP_FLAG_NOCOPY_KEYS));
+  ERR(hmap_set_flags(cfg->option_locations, cfg->option_locations->flags | HMAP_FLAG_NOCOPY_KEYS));
+  ERR(hmap_set_flags(cfg->option_infos, cfg->option_infos->flags | HMAP_FLAG_NOCOPY_KEYS));
+  cfg->intern_pool = pool;
 
-  ERR(err_strdup(&local_iline, iline));  /* Need local copy because we modify string. */
+  return ERR_OK;
+}  /* cfg_intern_pool */
 
-  /* Strip any comment from iline. */
-  char *hash = strchr(local_iline, '#');
-  if (hash) { *hash = '\0'; }
 
-  /* Skip blank lines. */
-  char *trimmed_iline = cfg_trim(local_iline);  /* Trim whitespace. */
-  if (*trimmed_iline == '\0') {
-    free(local_iline);
+/* Remember that a key changed in the current batch. Sets *rtn_pending
+ * to the new record, or NULL if nobody is listening or the key already
+ * changed in this batch (the first old value is kept). The caller
+ * fills in the old value once the set can no longer fail. */
+ERR_F cfg_pending_add(cfg_t *cfg, const char *key, cfg_pending_t **rtn_pending) {
+  cfg_pending_t *pending;
+
+  *rtn_pending = NULL;
+  if (cfg->subs == NULL) {  /* Nobody is listening. */
     return ERR_OK;
   }
 
-  /* Use equals sign to split key and value. */
-  char *equals = strchr(trimmed_iline, '=');
-  ERR_ASSRT(equals, CFG_ERR_NOEQUALS);
-  *equals = '\0';  /* Split into two strings. */
+  if (cfg->pending_changes == NULL) {
+    ERR(cfg_hmap_create(&(cfg->pending_changes), CFG_PENDING_MAP_SIZE, cfg->allocator));
+  }
 
-  char *key = cfg_trim(trimmed_iline);
-  ERR(cfg_key_valid(key));
-  ERR_ASSRT(strlen(key) > 0, CFG_ERR_NOKEY);
-  /* See if key already exists. */
-  err = hmap_slookup(cfg->option_vals, key, NULL);
-  if (err && err->code != HMAP_ERR_NOTFOUND) { /* An unexpected error. */
-    free(local_iline);  /* Clean up local copy. */
+  if (hmap_try_slookup(cfg->pending_changes, key, (void **)&pending)) {
+    return ERR_OK;
+  }
+
+  ERR(cfg_mem_calloc(cfg, (void **)&pending, 1, sizeof(cfg_pending_t)));
+  err_t *err = cfg_mem_strdup(cfg, &pending->key, key);
+  if (err == ERR_OK) {
+    err = hmap_swrite(cfg->pending_changes, key, pending);
+  }
+  if (err) {
+    err_mem_free(cfg->allocator, pending->key);
+    err_mem_free(cfg->allocator, pending);
     ERR_RETHROW(err, err->code);
   }
-  int key_exists = (err == NULL);  /* Key exists if no error. */
-  if (err) { err_dispose(err); }
 
-  switch (mode) {
-  case CFG_MODE_UPDATE:
-    if (! key_exists) { /* Key not exist is an error for UPDATE mode. */
-      free(local_iline);  /* Clean up local copy. */
-      ERR_THROW(CFG_ERR_UPDATE_KEY_NOT_FOUND, "");
+  if (cfg->pending_tail) {
+    cfg->pending_tail->next = pending;
+  } else {
+    cfg->pending_head = pending;
+  }
+  cfg->pending_tail = pending;
+
+  *rtn_pending = pending;
+  return ERR_OK;
+}  /* cfg_pending_add */
+
+
+/* Undo cfg_pending_add() for a set that failed. The record is the tail. */
+void cfg_pending_drop(cfg_t *cfg, cfg_pending_t *pending) {
+  cfg_pending_t **link = &cfg->pending_head;
+  cfg_pending_t *prev = NULL;
+
+  while (*link != pending) {
+    prev = *link;
+    link = &(*link)->next;
+  }
+  *link = NULL;
+  cfg->pending_tail = prev;
+  hmap_try_sremove(cfg->pending_changes, pending->key);
+  err_mem_free(cfg->allocator, pending->key);
+  err_mem_free(cfg->allocator, pending);
+}  /* cfg_pending_drop */
+
+
+int cfg_sub_matches(cfg_sub_t *sub, const char *key) {
+  if (sub->flags & CFG_SUB_PREFIX) {
+    return strncmp(sub->key, key, sub->key_len) == 0;
+  }
+  return strcmp(sub->key, key) == 0;
+}  /* cfg_sub_matches */
+
+
+ERR_F cfg_notify_enqueue(cfg_t *cfg, cfg_sub_t *sub, const char *key, const char *old_value, const char *new_value) {
+  cfg_notify_t *notify;
+
+  ERR(cfg_mem_calloc(cfg, (void **)&notify, 1, sizeof(cfg_notify_t)));
+  notify->sub = sub;
+  err_t *err = cfg_mem_strdup(cfg, &notify->key, key);
+  if (err == ERR_OK && old_value) {
+    err = cfg_mem_strdup(cfg, &notify->old_value, old_value);
+  }
+  if (err == ERR_OK) {
+    err = cfg_mem_strdup(cfg, &notify->new_value, new_value);
+  }
+  if (err) {
+    err_mem_free(cfg->allocator, notify->key);
+    err_mem_free(cfg->allocator, notify->old_value);
+    err_mem_free(cfg->allocator, notify);
+    ERR_RETHROW(err, err->code);
+  }
+
+  pthread_mutex_lock(&cfg->queue_lock);
+  if (cfg->queue_tail) {
+    cfg->queue_tail->next = notify;
+  } else {
+    cfg->queue_head = notify;
+  }
+  cfg->queue_tail = notify;
+  pthread_mutex_unlock(&cfg->queue_lock);
+
+  return ERR_OK;
+}  /* cfg_notify_enqueue */
+
+
+/* Wake up whoever is polling the notify fd. */
+void cfg_notify_signal(cfg_t *cfg) {
+  if (cfg->notify_fd != -1) {
+    uint64_t one = 1;
+    if (write(cfg->notify_fd, &one, sizeof(one)) < 0) {
+      /* Counter saturated or fd closed; drain will still find the queue. */
     }
-    break;
-  case CFG_MODE_ADD:
-    if (key_exists) { /* Key exist is an error for ADD mode. */
-      free(local_iline);  /* Clean up local copy. */
-      ERR_THROW(CFG_ERR_ADD_KEY_ALREADY_EXIST, "");
+  }
+}  /* cfg_notify_signal */
+
+
+/* Deliver one notification per key changed since the last flush. If a
+ * callback returns an error, the rest are still delivered and the first
+ * error is returned. */
+ERR_F cfg_notify_flush(cfg_t *cfg) {
+  err_t *first_err = ERR_OK;
+  int queued = 0;
+
+  /* Detach the batch; callbacks are allowed to parse more lines. */
+  cfg_pending_t *pending = cfg->pending_head;
+  hmap_t *pending_changes = cfg->pending_changes;
+  cfg->pending_head = NULL;
+  cfg->pending_tail = NULL;
+  cfg->pending_changes = NULL;
+  cfg->delivering++;
+
+  while (pending) {
+    cfg_pending_t *next_pending = pending->next;
+    char *new_value;
+    err_t *err = hmap_slookup(cfg->option_vals, pending->key, (void **)&new_value);
+
+    if (err) {
+      if (first_err == ERR_OK) { first_err = err; } else { err_dispose(err); }
     }
-    break;
-  default:
-    free(local_iline);  /* Clean up local copy. */
-    ERR_THROW(CFG_ERR_INTERNAL, "mode");
+    else if (pending->old_value == NULL ||
+        (pending->old_value != new_value && strcmp(pending->old_value, new_value) != 0)) {
+      cfg_sub_t *sub = cfg->subs;
+      while (sub) {
+        cfg_sub_t *next_sub = sub->next;  /* Kept valid by cfg_unsubscribe(). */
+        if (! sub->dead && cfg_sub_matches(sub, pending->key)) {
+          if (sub->flags & CFG_SUB_QUEUED) {
+            err = cfg_notify_enqueue(cfg, sub, pending->key, pending->old_value, new_value);
+            queued = 1;
+          } else {
+            err = sub->cb(cfg, pending->key, pending->old_value, new_value, sub->clientd);
+          }
+          if (err) {
+            if (first_err == ERR_OK) { first_err = err; } else { err_dispose(err); }
+          }
+        }
+        sub = next_sub;
+      }
+    }
+
+    err_mem_free(cfg->allocator, pending->key);
+    cfg_str_free(cfg, pending->old_value);
+    err_mem_free(cfg->allocator, pending);
+    pending = next_pending;
   }
 
-  /* Get value into its own mem segment to store in hash. */
-  char *value = equals + 1;
-  value = cfg_trim(value);
-  ERR(err_strdup(&value, value));
+  cfg_deliver_end(cfg);
 
-  ERR(hmap_swrite(cfg->option_vals, key, value));
+  if (pending_changes) {
+    err_t *err = hmap_delete(pending_changes);
+    if (err) {
+      if (first_err == ERR_OK) { first_err = err; } else { err_dispose(err); }
+    }
+  }
 
-  /* Remember location for this option. */
-  char *location;
-  ERR(err_asprintf(&location, "%s:%d", filename, line_num));
-  ERR(hmap_swrite(cfg->option_locations, key, location));
+  if (queued) {
+    cfg_notify_signal(cfg);
+  }
 
-  free(local_iline);  /* Clean up local copy. */
+  if (first_err) {
+    ERR_RETHROW(first_err, first_err->code);
+  }
   return ERR_OK;
-}  /* cfg_parse_line */
+}  /* cfg_notify_flush */
 
 
-ERR_F cfg_parse_file(cfg_t *cfg, int mode, const char *filename) {
-  char iline[CFG_MAX_LINE_LEN + 3];  /* Room for cr/lf/null. */
-  FILE *file_fp;
+/* Append to a growable array of pointers. */
+ERR_F cfg_ptrs_push(cfg_t *cfg, void ***ptrs, int *num, int *max, void *ptr) {
+  if (*num == *max) {
+    int new_max = (*max == 0) ? 4 : *max * 2;
+    void **new_ptrs = err_mem_realloc(cfg->allocator, *ptrs, new_max * sizeof(void *));
+    ERR_ASSRT(new_ptrs, CFG_ERR_NOMEM);
+    *ptrs = new_ptrs;
+    *max = new_max;
+  }
+  (*ptrs)[(*num)++] = ptr;
 
-  ERR_ASSRT(cfg, CFG_ERR_PARAM);
-  ERR_ASSRT(filename, CFG_ERR_PARAM);
-  if (strcmp(filename, "-") == 0) {
-    file_fp = stdin;
-  } else {
-    file_fp = fopen(filename, "r");
+  return ERR_OK;
+}  /* cfg_ptrs_push */
+
+
+/* Make room for at least want pointers, so later stores can't fail. */
+ERR_F cfg_ptrs_reserve(cfg_t *cfg, void ***ptrs, int *max, int want) {
+  if (want > *max) {
+    int new_max = (*max == 0) ? 4 : *max * 2;
+    while (new_max < want) {
+      new_max *= 2;
+    }
+    void **new_ptrs = err_mem_realloc(cfg->allocator, *ptrs, new_max * sizeof(void *));
+    ERR_ASSRT(new_ptrs, CFG_ERR_NOMEM);
+    *ptrs = new_ptrs;
+    *max = new_max;
   }
-  ERR_ASSRT(file_fp, CFG_ERR_BADFILE);
 
-  int line_num = 0;
-  err_t *parse_err = ERR_OK;
-  while (fgets(iline, sizeof(iline), file_fp)) {
-    line_num++;
-    size_t len = strlen(iline);
-    ERR_ASSRT(len <= CFG_MAX_LINE_LEN, CFG_ERR_LINETOOLONG);
+  return ERR_OK;
+}  /* cfg_ptrs_reserve */
 
-    parse_err = cfg_parse_line(cfg, mode, iline, filename, line_num);
-    if (parse_err) { break; }
-  }  /* while */
-  int save_errno = errno;
-  if (ferror(file_fp)) {
-    ERR_THROW(CFG_ERR_READ_ERROR, "Error reading file %s: %s", filename, strerror(save_errno));
+
+/* Drop memoized expansions of the options that used this one, and of
+ * the ones that used those. Each re-registers when next expanded.
+ * Bound options are collected in cfg->rebinds to be refreshed; each is
+ * added at most once, and cfg_bind() keeps room for all of them. */
+void cfg_option_invalidate(cfg_t *cfg, cfg_option_t *option) {
+  int i;
+
+  for (i = 0; i < option->num_dependents; i++) {
+    cfg_option_t *dependent = option->dependents[i];
+    if (dependent->expanded) {
+      err_mem_free(cfg->allocator, dependent->expanded);
+      dependent->expanded = NULL;
+      dependent->conv_done = 0;
+      dependent->conv_bad = 0;
+      if (dependent->binds) {
+        cfg->rebinds[cfg->num_rebinds++] = dependent;
+      }
+      cfg_option_invalidate(cfg, dependent);
+    }
   }
+  option->num_dependents = 0;
+}  /* cfg_option_invalidate */
 
-  if (strcmp(filename, "-") == 0) {
-    /* Don't close stdin. */
-  } else {
-    fclose(file_fp);
+
+ERR_F cfg_option_add_dependent(cfg_option_t *option, cfg_option_t *dependent) {
+  int i;
+
+  for (i = 0; i < option->num_dependents; i++) {
+    if (option->dependents[i] == dependent) {
+      return ERR_OK;  /* Already there. */
+    }
   }
+  ERR(cfg_ptrs_push(option->owner, (void ***)&option->dependents, &option->num_dependents, &option->max_dependents, dependent));
 
-  if (parse_err) {
-    ERR_RETHROW(parse_err, parse_err->code);
+  return ERR_OK;
+}  /* cfg_option_add_dependent */
+
+
+void cfg_hkey_init(cfg_hkey_t *hkey, const char *key) {
+  hkey->key = key;
+  hkey->key_size = strlen(key) + 1;
+  hkey->hash = hmap_murmur3_32(key, hkey->key_size, HMAP_SEED);
+}  /* cfg_hkey_init */
+
+
+ERR_F cfg_static_option(cfg_t *cfg, uint32_t slot, cfg_option_t **rtn_option);
+
+/* Search a layer and its parents, without caching (they are frozen and
+ * may be shared by other threads). Sets NULL if not found. */
+ERR_F cfg_layer_find_h(cfg_t *layer, const cfg_hkey_t *hkey, cfg_option_t **rtn_option) {
+  for (; layer; layer = layer->parent) {
+    if (layer->static_base) {
+      int slot = phash_find(&layer->static_base->index, hkey->key, hkey->key_size);
+      if (slot >= 0) {
+        ERR(cfg_static_option(layer, slot, rtn_option));
+        return ERR_OK;
+      }
+    }
+    else if (hmap_try_lookup_hashed(layer->option_infos, hkey->hash, hkey->key, hkey->key_size, (void **)rtn_option)) {
+      return ERR_OK;
+    }
   }
+
+  *rtn_option = NULL;
   return ERR_OK;
-}  /* cfg_parse_file */
+}  /* cfg_layer_find_h */
 
 
-ERR_F cfg_parse_string_list(cfg_t *cfg, int mode, char **string_list) {
-  char *iline;
+ERR_F cfg_layer_find(cfg_t *layer, const char *key, cfg_option_t **rtn_option) {
+  cfg_hkey_t hkey;
 
-  ERR_ASSRT(cfg, CFG_ERR_PARAM);
-  ERR_ASSRT(string_list, CFG_ERR_PARAM);
+  cfg_hkey_init(&hkey, key);
+  ERR(cfg_layer_find_h(layer, &hkey, rtn_option));
 
-  int line_num = 0;
-  while ((iline = string_list[line_num])) {
-    line_num++;
+  return ERR_OK;
+}  /* cfg_layer_find */
 
-    ERR(cfg_parse_line(cfg, mode, iline, "string_list", line_num));
-  }  /* while */
+
+/* Find the option that supplies a key's value, or NULL. For an overlay,
+ * the layer cache makes this a single probe once the key has been seen.
+ * The cache is a fixed array of option pointers indexed by key hash, so
+ * a lookup never allocates, and readers racing to fill a slot all store
+ * the same answer. */
+ERR_F cfg_option_try_find_h(cfg_t *cfg, const cfg_hkey_t *hkey, cfg_option_t **rtn_option) {
+  if (cfg->static_base) {  /* Never has a parent. */
+    ERR(cfg_layer_find_h(cfg, hkey, rtn_option));
+    return ERR_OK;
+  }
+  if (cfg->parent == NULL) {
+    hmap_try_lookup_hashed(cfg->option_infos, hkey->hash, hkey->key, hkey->key_size, (void **)rtn_option);
+    return ERR_OK;
+  }
+
+  cfg_option_t **slot = &cfg->layer_cache[hkey->hash & (CFG_LAYER_CACHE_SIZE - 1)];
+  cfg_option_t *option = __atomic_load_n(slot, __ATOMIC_ACQUIRE);
+  if (option && strcmp(option->key, hkey->key) == 0) {
+    *rtn_option = option;
+    return ERR_OK;
+  }
+  /* Missed, or the slot holds another key: own keys, then lower layers. */
+  if (! hmap_try_lookup_hashed(cfg->option_infos, hkey->hash, hkey->key, hkey->key_size, (void **)rtn_option)) {
+    ERR(cfg_layer_find_h(cfg->parent, hkey, rtn_option));
+  }
+  if (*rtn_option) {
+    __atomic_store_n(slot, *rtn_option, __ATOMIC_RELEASE);
+  }
 
   return ERR_OK;
-}  /* cfg_parse_string_list */
+}  /* cfg_option_try_find_h */
 
 
-ERR_F cfg_get_str_val(cfg_t *cfg, const char *key, char **rtn_value) {
-  char *val_str;
+ERR_F cfg_option_try_find(cfg_t *cfg, const char *key, cfg_option_t **rtn_option) {
+  cfg_hkey_t hkey;
 
-  ERR(hmap_slookup(cfg->option_vals, key, (void **)&val_str));
+  cfg_hkey_init(&hkey, key);
+  ERR(cfg_option_try_find_h(cfg, &hkey, rtn_option));
 
-  *rtn_value = val_str;
   return ERR_OK;
-}  /* cfg_get_str_val */
+}  /* cfg_option_try_find */
 
 
-void cfg_remove_spaces(char *in_str) {
-  char *dst = in_str;
-  char *src = in_str;
-  while (*src != '\0') {
-    if (*src != ' ') {
-      *dst = *src;
-      dst++;
+ERR_F cfg_option_find(cfg_t *cfg, const char *key, cfg_option_t **rtn_option) {
+  ERR(cfg_option_try_find(cfg, key, rtn_option));
+  if (*rtn_option == NULL) {
+    ERR_THROW(HMAP_ERR_NOTFOUND, "key '%s' not found", key);
+  }
+
+  return ERR_OK;
+}  /* cfg_option_find */
+
+
+/* An overlay key now hides an inherited one. Own expansions don't track
+ * inherited references, so drop them all. */
+void cfg_layer_invalidate(cfg_t *cfg) {
+  hmap_entry_t *entry;
+
+  entry = NULL;  /* Start at beginning. */
+  /* hmap_next() only fails for a NULL map. */
+  while (hmap_next(cfg->option_infos, &entry) == ERR_OK && entry) {
+    cfg_option_t *option = (cfg_option_t *)entry->value;
+    if (option->expanded) {
+      err_mem_free(cfg->allocator, option->expanded);
+      option->expanded = NULL;
+      option->conv_done = 0;
+      option->conv_bad = 0;
+      if (option->binds) {
+        cfg->rebinds[cfg->num_rebinds++] = option;
+      }
     }
-    src ++;
   }
-  *dst = '\0';
-}  /* cfg_remove_spaces */
+}  /* cfg_layer_invalidate */
 
 
-ERR_F cfg_get_long_val(cfg_t *cfg, const char *key, long *rtn_value) {
-  long value;
-  err_t *err;
+/* Growable string for building expansions. */
+typedef struct cfg_strbuf_s cfg_strbuf_t;
+struct cfg_strbuf_s {
+  const err_allocator_t *allocator;
+  char *buf;
+  size_t len;
+  size_t size;
+};
 
-  char *val_str;
-  ERR(hmap_slookup(cfg->option_vals, key, (void **)&val_str));
+ERR_F cfg_strbuf_append(cfg_strbuf_t *strbuf, const char *str, size_t len) {
+  if (strbuf->len + len + 1 > strbuf->size) {
+    size_t new_size = (strbuf->size == 0) ? 64 : strbuf->size;
+    while (strbuf->len + len + 1 > new_size) {
+      new_size *= 2;
+    }
+    char *new_buf = err_mem_realloc(strbuf->allocator, strbuf->buf, new_size);
+    ERR_ASSRT(new_buf, CFG_ERR_NOMEM);
+    strbuf->buf = new_buf;
+    strbuf->size = new_size;
+  }
+  memcpy(&strbuf->buf[strbuf->len], str, len);
+  strbuf->len += len;
+  strbuf->buf[strbuf->len] = '\0';
+
+  return ERR_OK;
+}  /* cfg_strbuf_append */
 
-  char *local_val_str;  /* Local copy to remove spaces. */
-  ERR(err_strdup(&local_val_str, val_str));
 
-  cfg_remove_spaces(local_val_str);
-  err = err_atol(local_val_str, &value);
-  if (err) {
-    free(local_val_str);
-    ERR_RETHROW(err, err->code);
+ERR_F cfg_option_expand_locked(cfg_t *cfg, cfg_option_t *option);
+
+/* Append the value of one "${...}" reference. */
+ERR_F cfg_option_expand_ref(cfg_t *cfg, cfg_option_t *option, const char *name, cfg_strbuf_t *strbuf) {
+  if (strncmp(name, "env:", 4) == 0) {
+    char *env_val = getenv(&name[4]);
+    if (env_val == NULL) {
+      ERR_THROW(CFG_ERR_SUBST, "key '%s': environment variable '%s' not set", option->key, &name[4]);
+    }
+    ERR(cfg_strbuf_append(strbuf, env_val, strlen(env_val)));
+    return ERR_OK;
+  }
+  if (cfg->static_base) {  /* cfg_compile substitutes keys ahead of time. */
+    ERR_THROW(CFG_ERR_SUBST, "key '%s': compiled-in value refers to key '%s'", option->key, name);
+  }
+
+  cfg_option_t *ref;
+  ERR(cfg_option_try_find(cfg, name, &ref));
+  if (ref == NULL) {
+    ERR_THROW(CFG_ERR_SUBST, "key '%s': undefined key '%s'", option->key, name);
+  }
+
+  if (ref->owner == cfg) {  /* memo_lock is held. */
+    ERR(cfg_option_expand_locked(cfg, ref));
+    ERR(cfg_option_add_dependent(ref, option));
+  } else {  /* Inherited options never change. */
+    ERR(cfg_option_expand(ref->owner, ref));
   }
+  char *ref_val = ref->expanded ? ref->expanded : ref->value;
+  ERR(cfg_strbuf_append(strbuf, ref_val, strlen(ref_val)));
 
-  free(local_val_str);  /* Clean up local copy. */
-  *rtn_value = value;
   return ERR_OK;
-}  /* cfg_get_long_val */
+}  /* cfg_option_expand_ref */
+
+
+ERR_F cfg_option_expand_into(cfg_t *cfg, cfg_option_t *option, cfg_strbuf_t *strbuf) {
+  char name[CFG_MAX_LINE_LEN + 1];
+  const char *src = option->value;
+
+  ERR(cfg_strbuf_append(strbuf, "", 0));  /* Empty value still needs a buffer. */
+  while (*src != '\0') {
+    if (src[0] == '$' && src[1] == '$' && src[2] == '{') {  /* Escaped. */
+      ERR(cfg_strbuf_append(strbuf, "${", 2));
+      src += 3;
+    }
+    else if (src[0] == '$' && src[1] == '{') {
+      const char *close = strchr(&src[2], '}');
+      if (close == NULL) {
+        ERR_THROW(CFG_ERR_SUBST, "key '%s': unterminated '${'", option->key);
+      }
+      size_t name_len = close - &src[2];
+      if (name_len > CFG_MAX_LINE_LEN) {
+        ERR_THROW(CFG_ERR_SUBST, "key '%s': reference too long", option->key);
+      }
+      memcpy(name, &src[2], name_len);
+      name[name_len] = '\0';
+      ERR(cfg_option_expand_ref(cfg, option, name, strbuf));
+      src = close + 1;
+    }
+    else {
+      const char *dollar = strchr(src + 1, '$');
+      size_t len = dollar ? (size_t)(dollar - src) : strlen(src);
+      ERR(cfg_strbuf_append(strbuf, src, len));
+      src += len;
+    }
+  }
+
+  return ERR_OK;
+}  /* cfg_option_expand_into */
+
+
+/* Caller holds cfg->memo_lock. */
+ERR_F cfg_option_expand_locked(cfg_t *cfg, cfg_option_t *option) {
+  if (option->expanded || ! option->has_subst) {
+    return ERR_OK;
+  }
+  if (option->expanding) {
+    ERR_THROW(CFG_ERR_SUBST, "key '%s': reference loop", option->key);
+  }
+
+  cfg_strbuf_t strbuf = {cfg->allocator, NULL, 0, 0};
+  option->expanding = 1;
+  err_t *err = cfg_option_expand_into(cfg, option, &strbuf);
+  option->expanding = 0;
+  if (err) {
+    err_mem_free(cfg->allocator, strbuf.buf);
+    ERR_RETHROW(err, err->code);
+  }
+
+  __atomic_store_n(&option->expanded, strbuf.buf, __ATOMIC_RELEASE);
+  return ERR_OK;
+}  /* cfg_option_expand_locked */
+
+
+/* Resolve ${key} and ${env:VAR} references, memoizing the result. The
+ * first read expands under memo_lock and publishes the result, so
+ * concurrent readers expand it once and later reads don't lock. */
+ERR_F cfg_option_expand(cfg_t *cfg, cfg_option_t *option) {
+  if (! option->has_subst || __atomic_load_n(&option->expanded, __ATOMIC_ACQUIRE)) {
+    return ERR_OK;
+  }
+  if (cfg->frozen) {  /* A compiled-in value that failed when it was made. */
+    ERR_THROW(CFG_ERR_SUBST, "key '%s': environment variable not set in '%s'", option->key, option->value);
+  }
+
+  pthread_mutex_lock(&cfg->memo_lock);
+  err_t *err = cfg_option_expand_locked(cfg, option);
+  pthread_mutex_unlock(&cfg->memo_lock);
+  if (err) {
+    ERR_RETHROW(err, err->code);
+  }
+
+  return ERR_OK;
+}  /* cfg_option_expand */
+
+
+/* Look up a key and return its (expanded) value. */
+ERR_F cfg_option_val(cfg_t *cfg, const char *key, cfg_option_t **rtn_option, char **rtn_value) {
+  cfg_option_t *option;
+
+  ERR(cfg_option_find(cfg, key, &option));
+  CFG_COUNT_READ(cfg, option);
+  ERR(cfg_option_expand(option->owner, option));
+
+  if (rtn_option) {
+    *rtn_option = option;
+  }
+  *rtn_value = option->expanded ? option->expanded : option->value;
+  return ERR_OK;
+}  /* cfg_option_val */
+
+
+ERR_F cfg_option_rebind(cfg_t *cfg, cfg_option_t *option);
+
+/* Split a line, in place, into key and value. Sets *rtn_key to NULL
+ * for a blank or comment line. */
+ERR_F cfg_line_split(char *line, char **rtn_key, char **rtn_value) {
+  /* Strip any comment from line. */
+  char *hash = strchr(line, '#');
+  if (hash) { *hash = '\0'; }
+
+  /* Skip blank lines. */
+  char *trimmed_line = cfg_trim(line);  /* Trim whitespace. */
+  if (*trimmed_line == '\0') {
+    *rtn_key = NULL;
+    return ERR_OK;
+  }
+
+  /* Use equals sign to split key and value. */
+  char *equals = strchr(trimmed_line, '=');
+  ERR_ASSRT(equals, CFG_ERR_NOEQUALS);
+  *equals = '\0';  /* Split into two strings. */
+
+  char *key = cfg_trim(trimmed_line);
+  ERR(cfg_key_valid(key));
+  ERR_ASSRT(strlen(key) > 0, CFG_ERR_NOKEY);
+
+  *rtn_key = key;
+  *rtn_value = cfg_trim(equals + 1);
+  return ERR_OK;
+}  /* cfg_line_split */
+
+
+ERR_F cfg_parse_kv(cfg_t *cfg, int mode, const char *key, const char *value, const char *filename, int line_num);
+
+ERR_F cfg_parse_line(cfg_t *cfg, int mode, const char *iline, const char *filename, int line_num) {
+  char *local_iline;
+  char *key;
+  char *value;
+  err_t *err;
+
+  switch (mode) {  /* Check for valid mode. */
+  case CFG_MODE_UPDATE: break;
+  case CFG_MODE_ADD: break;
+  default: ERR_THROW(CFG_ERR_PARAM, "unrecognized mode %d", mode);
+  }
+  ERR_ASSRT(! cfg->frozen, CFG_ERR_FROZEN);
+
+  ERR(cfg_mem_strdup(cfg, &local_iline, iline));  /* Need local copy because we modify string. */
+
+  err = cfg_line_split(local_iline, &key, &value);
+  if (err == ERR_OK && key) {
+    err = cfg_parse_kv(cfg, mode, key, value, filename, line_num);
+  }
+  err_mem_free(cfg->allocator, local_iline);  /* Clean up local copy. */
+  if (err) {
+    ERR_RETHROW(err, err->code);
+  }
+
+  return ERR_OK;
+}  /* cfg_parse_line */
+
+
+/* Mirror a set into the snapshot history as "value\0location\0". */
+ERR_F cfg_history_write(cfg_t *cfg, const char *key, const char *value, const char *location) {
+  size_t value_size = strlen(value) + 1;
+  size_t location_size = strlen(location) + 1;
+  char *blob;
+  err_t *err;
+
+  ERR(cfg_mem_calloc(cfg, (void **)&blob, 1, value_size + location_size));
+  memcpy(blob, value, value_size);
+  memcpy(blob + value_size, location, location_size);
+  err = hamt_write(cfg->history, key, strlen(key) + 1, blob, value_size + location_size);
+  err_mem_free(cfg->allocator, blob);
+  if (err) {
+    ERR_RETHROW(err, err->code);
+  }
+
+  return ERR_OK;
+}  /* cfg_history_write */
+
+
+/* "file:line", interned if there's a pool. */
+ERR_F cfg_location_make(cfg_t *cfg, const char *filename, int line_num, char **rtn_location) {
+  char *location;
+  size_t location_size = snprintf(NULL, 0, "%s:%d", filename, line_num) + 1;
+
+  ERR(cfg_mem_calloc(cfg, (void **)&location, 1, location_size));
+  snprintf(location, location_size, "%s:%d", filename, line_num);
+  if (cfg->intern_pool) {
+    err_t *err = intern_get(cfg->intern_pool, location, rtn_location);
+    err_mem_free(cfg->allocator, location);
+    if (err) {
+      ERR_RETHROW(err, err->code);
+    }
+    return ERR_OK;
+  }
+
+  *rtn_location = location;
+  return ERR_OK;
+}  /* cfg_location_make */
+
+
+/* Take a new option back out of the maps (see cfg_option_insert()). */
+void cfg_option_uninsert(cfg_t *cfg, cfg_option_t *option) {
+  hmap_try_sremove(cfg->option_infos, option->key);
+  hmap_try_sremove(cfg->option_vals, option->key);
+  hmap_try_sremove(cfg->option_locations, option->key);
+}  /* cfg_option_uninsert */
+
+
+/* Put a new option, its value and location in the maps. On error, the
+ * maps are as they were. */
+ERR_F cfg_option_insert(cfg_t *cfg, cfg_option_t *option, char *value, char *location) {
+  /* With interning, option->key is the canonical key the maps share. */
+  err_t *err = hmap_swrite(cfg->option_infos, option->key, option);
+  if (err == ERR_OK) {
+    err = hmap_swrite(cfg->option_vals, option->key, value);
+  }
+  if (err == ERR_OK) {
+    err = hmap_swrite(cfg->option_locations, option->key, location);
+  }
+  if (err == ERR_OK && cfg->key_index_enabled) {  /* Sorted on next cfg_iterate_prefix(). */
+    err = cfg_ptrs_push(cfg, (void ***)&cfg->key_index, &cfg->num_key_index, &cfg->max_key_index, option);
+  }
+  if (err) {
+    cfg_option_uninsert(cfg, option);
+    ERR_RETHROW(err, err->code);
+  }
+
+  return ERR_OK;
+}  /* cfg_option_insert */
+
+
+/* Set one key from a split line. Everything that can fail is done first
+ * and undone on error, so a failed set leaves the cfg as it was. */
+ERR_F cfg_parse_kv(cfg_t *cfg, int mode, const char *key, const char *value, const char *filename, int line_num) {
+  err_t *err;
+
+  /* See if key already exists. */
+  char *old_value = NULL;
+  int key_exists = hmap_try_slookup(cfg->option_vals, key, (void **)&old_value);
+
+  /* For an overlay, a key may exist in a lower layer. */
+  cfg_option_t *inherited = NULL;
+  if (! key_exists && cfg->parent) {
+    err = cfg_layer_find(cfg->parent, key, &inherited);
+    if (err) {
+      ERR_RETHROW(err, err->code);
+    }
+  }
+
+  switch (mode) {
+  case CFG_MODE_UPDATE:
+    if (! key_exists && ! inherited) { /* Key not exist is an error for UPDATE mode. */
+      ERR_THROW(CFG_ERR_UPDATE_KEY_NOT_FOUND, "");
+    }
+    break;
+  case CFG_MODE_ADD:
+    if (key_exists || inherited) { /* Key exist is an error for ADD mode. */
+      ERR_THROW(CFG_ERR_ADD_KEY_ALREADY_EXIST, "");
+    }
+    break;
+  default:
+    ERR_THROW(CFG_ERR_INTERNAL, "mode");
+  }
+
+  /* Build the new value, location, and (for a new key) option. */
+  char *new_value = NULL;
+  char *location = NULL;
+  char *old_location = NULL;
+  cfg_option_t *option = NULL;
+  err = cfg_str_dup(cfg, &new_value, value);
+  if (err == ERR_OK) {
+    err = cfg_location_make(cfg, filename, line_num, &location);
+  }
+  if (err == ERR_OK && key_exists) {
+    err = hmap_slookup(cfg->option_infos, key, (void **)&option);
+    if (err == ERR_OK) {
+      err = hmap_slookup(cfg->option_locations, key, (void **)&old_location);
+    }
+  }
+  if (err == ERR_OK && ! key_exists) {
+    err = cfg_mem_calloc(cfg, (void **)&option, 1, sizeof(cfg_option_t));
+    if (err == ERR_OK) {
+      option->owner = cfg;
+      option->schema_idx = -1;
+      err = cfg_str_dup(cfg, &option->key, key);
+    }
+  }
+  if (err == ERR_OK && inherited) {
+    err = cfg_str_dup(cfg, &old_value, inherited->value);
+  }
+
+  /* Then the steps that change the cfg but can be undone. */
+  cfg_pending_t *pending = NULL;
+  int inserted = 0;
+  if (err == ERR_OK) {
+    err = cfg_pending_add(cfg, key, &pending);
+  }
+  if (err == ERR_OK && ! key_exists) {
+    err = cfg_option_insert(cfg, option, new_value, location);
+    inserted = (err == ERR_OK);
+  }
+  if (err == ERR_OK && cfg->history) {  /* Last, since it can't be undone. */
+    err = cfg_history_write(cfg, key, new_value, location);
+  }
+  if (err) {
+    if (inserted) {
+      cfg_option_uninsert(cfg, option);
+      if (cfg->key_index_enabled) {
+        cfg->num_key_index--;
+      }
+    }
+    if (pending) {
+      cfg_pending_drop(cfg, pending);
+    }
+    if (! key_exists) {
+      if (option) {
+        if (option->key) { cfg_str_free(cfg, option->key); }
+        cfg_option_free(cfg, option);
+      }
+      if (old_value) { cfg_str_free(cfg, old_value); }  /* Copy of the inherited value. */
+    }
+    if (location) { cfg_str_free(cfg, location); }
+    if (new_value) { cfg_str_free(cfg, new_value); }
+    ERR_RETHROW(err, err->code);
+  }
+
+  /* Nothing below can fail. Hot-key cache entries may point at the
+   * strings freed here. */
+  __atomic_add_fetch(&cfg->generation, 1, __ATOMIC_RELEASE);
+  if (key_exists) {
+    /* Replacing the value of a key already in a map doesn't allocate. */
+    ERR(hmap_swrite(cfg->option_vals, option->key, new_value));
+    ERR(hmap_swrite(cfg->option_locations, option->key, location));
+    cfg_str_free(cfg, old_location);
+    /* Derived state is recomputed on demand from the new value. */
+    err_mem_free(cfg->allocator, option->expanded);
+    option->expanded = NULL;
+    option->conv_done = 0;
+    option->conv_bad = 0;
+    cfg_option_invalidate(cfg, option);
+  }
+  if (cfg->parent && ! key_exists) {  /* The slot may hold an inherited option for this key. */
+    cfg_hkey_t hkey;
+    cfg_hkey_init(&hkey, option->key);
+    cfg->layer_cache[hkey.hash & (CFG_LAYER_CACHE_SIZE - 1)] = option;
+  }
+  if (inherited) {  /* Overriding a lower layer counts as an update. */
+    option->schema_idx = inherited->schema_idx;
+    if (option->schema_idx >= 0) {
+      cfg->schema_options[option->schema_idx] = option;
+    }
+    option->num_updates = inherited->num_updates;
+    cfg_layer_invalidate(cfg);
+  }
+  if (key_exists || inherited) {
+    option->num_updates++;
+  }
+  option->value = new_value;
+  option->has_subst = (strstr(new_value, "${") != NULL);
+  cfg->version++;
+
+  /* Old value is handed to the batch for change notification. */
+  if (pending) {
+    pending->old_value = old_value;
+  } else if (old_value) {
+    cfg_str_free(cfg, old_value);
+  }
+
+  /* Bound variables are updated right away, not at the end of the batch. */
+  err_t *bind_err = cfg_option_rebind(cfg, option);
+
+  if (cfg->batch_depth == 0) {  /* Not in a batch; line is its own batch. */
+    err = cfg_notify_flush(cfg);
+    if (err) {
+      if (bind_err) { err_dispose(bind_err); }
+      ERR_RETHROW(err, err->code);
+    }
+  }
+  ERR(bind_err);
+  return ERR_OK;
+}  /* cfg_parse_kv */
+
+
+uint64_t cfg_now_ns() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}  /* cfg_now_ns */
+
+
+ERR_F cfg_profile_file(cfg_t *cfg, const char *filename, uint64_t elapsed_ns, int num_lines, size_t num_bytes) {
+  cfg_file_stat_t *stat = NULL;
+  int i;
+
+  for (i = 0; i < cfg->num_file_stats; i++) {
+    if (strcmp(cfg->file_stats[i].filename, filename) == 0) {
+      stat = &cfg->file_stats[i];
+      break;
+    }
+  }
+  if (stat == NULL) {
+    if (cfg->num_file_stats == cfg->max_file_stats) {
+      int new_max = cfg->max_file_stats ? cfg->max_file_stats * 2 : 4;
+      cfg_file_stat_t *new_stats = err_mem_realloc(cfg->allocator, cfg->file_stats, new_max * sizeof(cfg_file_stat_t));
+      ERR_ASSRT(new_stats, CFG_ERR_NOMEM);
+      cfg->file_stats = new_stats;
+      cfg->max_file_stats = new_max;
+    }
+    stat = &cfg->file_stats[cfg->num_file_stats];
+    memset(stat, 0, sizeof(cfg_file_stat_t));
+    ERR(cfg_mem_strdup(cfg, &stat->filename, filename));
+    cfg->num_file_stats++;
+  }
+
+  stat->num_parses++;
+  stat->total_ns += elapsed_ns;
+  stat->last_ns = elapsed_ns;
+  stat->last_lines = num_lines;
+  stat->last_bytes = num_bytes;
+
+  return ERR_OK;
+}  /* cfg_profile_file */
+
+
+ERR_F cfg_parse_file(cfg_t *cfg, int mode, const char *filename) {
+  char iline[CFG_MAX_LINE_LEN + 3];  /* Room for cr/lf/null. */
+  FILE *file_fp;
+  uint64_t start_ns = 0;
+
+  ERR_ASSRT(cfg, CFG_ERR_PARAM);
+  ERR_ASSRT(filename, CFG_ERR_PARAM);
+  if (strcmp(filename, "-") == 0) {
+    file_fp = stdin;
+  } else {
+    file_fp = fopen(filename, "r");
+  }
+  ERR_ASSRT(file_fp, CFG_ERR_BADFILE);
+  if (cfg->profile_enabled) {
+    start_ns = cfg_now_ns();
+  }
+
+  err_t *err = cfg_batch_begin(cfg);  /* Notify once for the whole file. */
+  if (err) {
+    if (file_fp != stdin) { fclose(file_fp); }
+    ERR_RETHROW(err, err->code);
+  }
+
+  int line_num = 0;
+  size_t num_bytes = 0;
+  err_t *parse_err = ERR_OK;
+  while (fgets(iline, sizeof(iline), file_fp)) {
+    line_num++;
+    size_t len = strlen(iline);
+    num_bytes += len;
+    if (len > CFG_MAX_LINE_LEN) {
+      parse_err = err_throw_v(__FILE__, __LINE__, __func__, CFG_ERR_LINETOOLONG, "%s:%d", filename, line_num);
+      break;
+    }
+
+    parse_err = cfg_parse_line(cfg, mode, iline, filename, line_num);
+    if (parse_err) { break; }
+  }  /* while */
+  int save_errno = errno;
+  if (ferror(file_fp) && parse_err == ERR_OK) {  /* Still close and end the batch. */
+    parse_err = err_throw_v(__FILE__, __LINE__, __func__, CFG_ERR_READ_ERROR,
+      "Error reading file %s: %s", filename, strerror(save_errno));
+  }
+
+  if (strcmp(filename, "-") == 0) {
+    /* Don't close stdin. */
+  } else {
+    fclose(file_fp);
+  }
+
+  if (cfg->profile_enabled) {
+    err_t *profile_err = cfg_profile_file(cfg, filename, cfg_now_ns() - start_ns, line_num, num_bytes);
+    if (profile_err) {
+      if (parse_err) { err_dispose(profile_err); } else { parse_err = profile_err; }
+    }
+  }
+
+  /* Lines parsed before an error are still delivered. */
+  err_t *notify_err = cfg_batch_end(cfg);
+  if (parse_err) {
+    if (notify_err) { err_dispose(notify_err); }
+    ERR_RETHROW(parse_err, parse_err->code);
+  }
+  ERR(notify_err);
+  return ERR_OK;
+}  /* cfg_parse_file */
+
+
+ERR_F cfg_parse_string_list(cfg_t *cfg, int mode, char **string_list) {
+  char *iline;
+
+  ERR_ASSRT(cfg, CFG_ERR_PARAM);
+  ERR_ASSRT(string_list, CFG_ERR_PARAM);
+
+  ERR(cfg_batch_begin(cfg));
+
+  int line_num = 0;
+  err_t *parse_err = ERR_OK;
+  while ((iline = string_list[line_num])) {
+    line_num++;
+
+    parse_err = cfg_parse_line(cfg, mode, iline, "string_list", line_num);
+    if (parse_err) { break; }
+  }  /* while */
+
+  err_t *notify_err = cfg_batch_end(cfg);
+  if (parse_err) {
+    if (notify_err) { err_dispose(notify_err); }
+    ERR_RETHROW(parse_err, parse_err->code);
+  }
+  ERR(notify_err);
+  return ERR_OK;
+}  /* cfg_parse_string_list */
+
+
+/* One key/value line of a loaded file, as offsets into the load's buffer
+ * (which moves as it grows). */
+typedef struct cfg_load_line_s cfg_load_line_t;
+struct cfg_load_line_s {
+  size_t key_off;
+  size_t value_off;
+  int line_num;
+};
+
+/* A file submitted to cfg_load_submit(). The worker thread owns it until
+ * it sets done; after that, only the cfg's thread touches it. */
+typedef struct cfg_load_s cfg_load_t;
+struct cfg_load_s {
+  cfg_t *cfg;
+  int mode;
+  char *filename;
+  cfg_load_cb_t cb;
+  void *clientd;
+  pthread_t thread;
+  char *buf;  /* Split lines, null-terminated. */
+  size_t buf_len;
+  size_t buf_size;
+  cfg_load_line_t *lines;
+  int num_lines;
+  int max_lines;
+  int opened;  /* Unopened files aren't profiled. */
+  int num_file_lines;  /* For profiling. */
+  size_t num_bytes;
+  uint64_t read_ns;
+  err_t *err;  /* Read or syntax error; lines before it are still applied. */
+  int done;  /* Under cfg->load_lock. */
+  cfg_load_t *next;
+};
+
+
+void cfg_load_free(cfg_t *cfg, cfg_load_t *load) {
+  if (load->err) {
+    err_dispose(load->err);
+  }
+  err_mem_free(cfg->allocator, load->lines);
+  err_mem_free(cfg->allocator, load->buf);
+  err_mem_free(cfg->allocator, load->filename);
+  err_mem_free(cfg->allocator, load);
+}  /* cfg_load_free */
+
+
+/* Copy a line into the buffer, split it, and record it if not blank. */
+ERR_F cfg_load_add_line(cfg_load_t *load, const char *iline, size_t len, int line_num) {
+  const err_allocator_t *allocator = load->cfg->allocator;
+
+  if (load->buf_len + len + 1 > load->buf_size) {
+    size_t new_size = (load->buf_size == 0) ? 4096 : load->buf_size;
+    while (load->buf_len + len + 1 > new_size) {
+      new_size *= 2;
+    }
+    char *new_buf = err_mem_realloc(allocator, load->buf, new_size);
+    ERR_ASSRT(new_buf, CFG_ERR_NOMEM);
+    load->buf = new_buf;
+    load->buf_size = new_size;
+  }
+  char *line = &load->buf[load->buf_len];
+  memcpy(line, iline, len + 1);
+
+  char *key;
+  char *value;
+  ERR(cfg_line_split(line, &key, &value));
+  if (key == NULL) {
+    return ERR_OK;  /* Nothing to keep. */
+  }
+  load->buf_len += len + 1;
+
+  if (load->num_lines == load->max_lines) {
+    int new_max = (load->max_lines == 0) ? 64 : load->max_lines * 2;
+    cfg_load_line_t *new_lines = err_mem_realloc(allocator, load->lines, new_max * sizeof(cfg_load_line_t));
+    ERR_ASSRT(new_lines, CFG_ERR_NOMEM);
+    load->lines = new_lines;
+    load->max_lines = new_max;
+  }
+  load->lines[load->num_lines].key_off = key - load->buf;
+  load->lines[load->num_lines].value_off = value - load->buf;
+  load->lines[load->num_lines].line_num = line_num;
+  load->num_lines++;
+
+  return ERR_OK;
+}  /* cfg_load_add_line */
+
+
+/* Worker side: read and split the whole file without touching the cfg. */
+ERR_F cfg_load_read(cfg_load_t *load) {
+  char iline[CFG_MAX_LINE_LEN + 3];  /* Room for cr/lf/null. */
+  FILE *file_fp;
+
+  if (strcmp(load->filename, "-") == 0) {
+    file_fp = stdin;
+  } else {
+    file_fp = fopen(load->filename, "r");
+  }
+  ERR_ASSRT(file_fp, CFG_ERR_BADFILE);
+  load->opened = 1;
+
+  err_t *err = ERR_OK;
+  while (fgets(iline, sizeof(iline), file_fp)) {
+    load->num_file_lines++;
+    size_t len = strlen(iline);
+    load->num_bytes += len;
+    if (len > CFG_MAX_LINE_LEN) {
+      err = err_throw_v(__FILE__, __LINE__, __func__, CFG_ERR_LINETOOLONG, "%s:%d", load->filename, load->num_file_lines);
+      break;
+    }
+    err = cfg_load_add_line(load, iline, len, load->num_file_lines);
+    if (err) { break; }
+  }  /* while */
+  int save_errno = errno;
+  int read_error = ferror(file_fp);
+
+  if (file_fp != stdin) {
+    fclose(file_fp);
+  }
+
+  if (err) {
+    ERR_RETHROW(err, "%s:%d", load->filename, load->num_file_lines);
+  }
+  if (read_error) {
+    ERR_THROW(CFG_ERR_READ_ERROR, "Error reading file %s: %s", load->filename, strerror(save_errno));
+  }
+  return ERR_OK;
+}  /* cfg_load_read */
+
+
+void cfg_load_signal(cfg_t *cfg) {
+  if (cfg->load_fd != -1) {
+    uint64_t one = 1;
+    if (write(cfg->load_fd, &one, sizeof(one)) < 0) {
+      /* Counter saturated; poll will still find the load. */
+    }
+  }
+}  /* cfg_load_signal */
+
+
+void *cfg_load_thread(void *arg) {
+  cfg_load_t *load = (cfg_load_t *)arg;
+  cfg_t *cfg = load->cfg;
+
+  uint64_t start_ns = cfg_now_ns();
+  load->err = cfg_load_read(load);
+  load->read_ns = cfg_now_ns() - start_ns;
+
+  pthread_mutex_lock(&cfg->load_lock);
+  load->done = 1;
+  pthread_cond_broadcast(&cfg->load_cond);
+  cfg_load_signal(cfg);
+  pthread_mutex_unlock(&cfg->load_lock);
+
+  return NULL;
+}  /* cfg_load_thread */
+
+
+/* Read and split a file on a background thread. Its lines are applied
+ * by cfg_load_poll() or cfg_load_wait(), after those of earlier loads. */
+ERR_F cfg_load_submit(cfg_t *cfg, int mode, const char *filename, cfg_load_cb_t cb, void *clientd) {
+  cfg_load_t *load;
+  err_t *err;
+
+  ERR_ASSRT(cfg, CFG_ERR_PARAM);
+  ERR_ASSRT(filename, CFG_ERR_PARAM);
+  ERR_ASSRT(mode == CFG_MODE_ADD || mode == CFG_MODE_UPDATE, CFG_ERR_PARAM);
+  ERR_ASSRT(! cfg->frozen, CFG_ERR_FROZEN);
+
+  ERR(cfg_mem_calloc(cfg, (void **)&load, 1, sizeof(cfg_load_t)));
+  load->cfg = cfg;
+  load->mode = mode;
+  load->cb = cb;
+  load->clientd = clientd;
+  err = cfg_mem_strdup(cfg, &load->filename, filename);
+  if (err) {
+    cfg_load_free(cfg, load);
+    ERR_RETHROW(err, err->code);
+  }
+
+  if (pthread_create(&load->thread, NULL, cfg_load_thread, load) != 0) {
+    cfg_load_free(cfg, load);
+    ERR_THROW(CFG_ERR_INTERNAL, "pthread_create: %s", filename);
+  }
+
+  pthread_mutex_lock(&cfg->load_lock);
+  if (cfg->load_tail) {
+    cfg->load_tail->next = load;
+  } else {
+    cfg->load_head = load;
+  }
+  cfg->load_tail = load;
+  pthread_mutex_unlock(&cfg->load_lock);
+
+  return ERR_OK;
+}  /* cfg_load_submit */
+
+
+/* Set the lines of a finished load as one batch, like cfg_parse_file(). */
+ERR_F cfg_load_apply(cfg_t *cfg, cfg_load_t *load) {
+  uint64_t start_ns = 0;
+  int i;
+
+  ERR_ASSRT(! cfg->frozen, CFG_ERR_FROZEN);
+  if (cfg->profile_enabled) {
+    start_ns = cfg_now_ns();
+  }
+
+  ERR(cfg_batch_begin(cfg));
+
+  err_t *parse_err = ERR_OK;
+  for (i = 0; i < load->num_lines; i++) {
+    cfg_load_line_t *line = &load->lines[i];
+    parse_err = cfg_parse_kv(cfg, load->mode, &load->buf[line->key_off], &load->buf[line->value_off],
+      load->filename, line->line_num);
+    if (parse_err) { break; }
+  }
+  if (parse_err == ERR_OK) {
+    parse_err = load->err;  /* Error after the last good line, if any. */
+    load->err = ERR_OK;
+  }
+
+  if (cfg->profile_enabled && load->opened) {
+    err_t *profile_err = cfg_profile_file(cfg, load->filename, load->read_ns + (cfg_now_ns() - start_ns),
+      load->num_file_lines, load->num_bytes);
+    if (profile_err) {
+      if (parse_err) { err_dispose(profile_err); } else { parse_err = profile_err; }
+    }
+  }
+
+  err_t *notify_err = cfg_batch_end(cfg);
+  if (parse_err) {
+    if (notify_err) { err_dispose(notify_err); }
+    ERR_RETHROW(parse_err, parse_err->code);
+  }
+  ERR(notify_err);
+  return ERR_OK;
+}  /* cfg_load_apply */
+
+
+/* Apply a load, report it, and free it. Without a callback, the load's
+ * error is returned. */
+ERR_F cfg_load_finish(cfg_t *cfg, cfg_load_t *load) {
+  pthread_join(load->thread, NULL);
+
+  err_t *err = cfg_load_apply(cfg, load);
+  if (load->cb) {
+    err_t *load_err = err;
+    err = load->cb(cfg, load->filename, load_err, load->clientd);
+    if (load_err) { err_dispose(load_err); }
+  }
+  cfg_load_free(cfg, load);
+
+  if (err) {
+    ERR_RETHROW(err, err->code);
+  }
+  return ERR_OK;
+}  /* cfg_load_finish */
+
+
+ERR_F cfg_load_fd(cfg_t *cfg, int *rtn_fd) {
+  ERR_ASSRT(cfg, CFG_ERR_PARAM);
+  ERR_ASSRT(rtn_fd, CFG_ERR_PARAM);
+
+#if defined(__linux__)
+  pthread_mutex_lock(&cfg->load_lock);
+  if (cfg->load_fd == -1) {
+    cfg->load_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (cfg->load_fd != -1 && cfg->load_head && cfg->load_head->done) {
+      cfg_load_signal(cfg);  /* Finished before the fd existed. */
+    }
+  }
+  pthread_mutex_unlock(&cfg->load_lock);
+  ERR_ASSRT(cfg->load_fd != -1, CFG_ERR_INTERNAL);
+  *rtn_fd = cfg->load_fd;
+#else
+  ERR_THROW(CFG_ERR_PARAM, "load fd requires eventfd");
+#endif
+
+  return ERR_OK;
+}  /* cfg_load_fd */
+
+
+/* Apply the loads that are ready, in submission order, without blocking.
+ * A load that is still reading holds back the ones after it. */
+ERR_F cfg_load_poll(cfg_t *cfg, int *rtn_num_pending) {
+  err_t *first_err = ERR_OK;
+
+  ERR_ASSRT(cfg, CFG_ERR_PARAM);
+
+  pthread_mutex_lock(&cfg->load_lock);
+  if (cfg->load_fd != -1) {
+    uint64_t count;  /* Reset the eventfd counter. */
+    if (read(cfg->load_fd, &count, sizeof(count)) < 0) {
+      /* EAGAIN: nothing was signaled. */
+    }
+  }
+  while (cfg->load_head && cfg->load_head->done) {
+    cfg_load_t *load = cfg->load_head;
+    cfg->load_head = load->next;
+    if (cfg->load_head == NULL) {
+      cfg->load_tail = NULL;
+    }
+    pthread_mutex_unlock(&cfg->load_lock);  /* Callback may submit. */
+
+    err_t *err = cfg_load_finish(cfg, load);
+    if (err) {
+      if (first_err == ERR_OK) { first_err = err; } else { err_dispose(err); }
+    }
+
+    pthread_mutex_lock(&cfg->load_lock);
+  }
+  if (rtn_num_pending) {
+    cfg_load_t *load;
+    *rtn_num_pending = 0;
+    for (load = cfg->load_head; load; load = load->next) {
+      (*rtn_num_pending)++;
+    }
+  }
+  pthread_mutex_unlock(&cfg->load_lock);
+
+  if (first_err) {
+    ERR_RETHROW(first_err, first_err->code);
+  }
+  return ERR_OK;
+}  /* cfg_load_poll */
+
+
+/* Block until every submitted load (including ones submitted by
+ * callbacks) has been applied. */
+ERR_F cfg_load_wait(cfg_t *cfg) {
+  err_t *first_err = ERR_OK;
+
+  ERR_ASSRT(cfg, CFG_ERR_PARAM);
+
+  pthread_mutex_lock(&cfg->load_lock);
+  while (cfg->load_head) {
+    while (! cfg->load_head->done) {
+      pthread_cond_wait(&cfg->load_cond, &cfg->load_lock);
+    }
+    pthread_mutex_unlock(&cfg->load_lock);
+
+    err_t *err = cfg_load_poll(cfg, NULL);
+    if (err) {
+      if (first_err == ERR_OK) { first_err = err; } else { err_dispose(err); }
+    }
+
+    pthread_mutex_lock(&cfg->load_lock);
+  }
+  pthread_mutex_unlock(&cfg->load_lock);
+
+  if (first_err) {
+    ERR_RETHROW(first_err, first_err->code);
+  }
+  return ERR_OK;
+}  /* cfg_load_wait */
+
+
+/* Join and free outstanding loads without applying them. */
+void cfg_load_discard(cfg_t *cfg) {
+  while (cfg->load_head) {
+    cfg_load_t *load = cfg->load_head;
+    cfg->load_head = load->next;
+    pthread_join(load->thread, NULL);
+    cfg_load_free(cfg, load);
+  }
+  cfg->load_tail = NULL;
+}  /* cfg_load_discard */
+
+
+/* One key's resolved value, for one cfg. */
+typedef struct cfg_hot_entry_s cfg_hot_entry_t;
+struct cfg_hot_entry_s {
+  const cfg_t *cfg;
+  const char *key;  /* The caller's pointer, not the cfg's copy. */
+  uint64_t generation;  /* Of cfg->generation when filled. */
+  cfg_option_t *option;
+  char *value;  /* Expanded. */
+  long long_val;
+  int long_ok;  /* long_val has been converted. */
+};
+
+/* Direct-mapped by key pointer. */
+typedef struct cfg_hot_cache_s cfg_hot_cache_t;
+struct cfg_hot_cache_s {
+  uint64_t delete_generation;  /* Of cfg_delete_generation when emptied. */
+  cfg_hot_entry_t entries[CFG_HOT_CACHE_SIZE];
+};
+
+pthread_key_t cfg_hot_key;
+pthread_once_t cfg_hot_once = PTHREAD_ONCE_INIT;
+
+
+/* Thread exit. */
+void cfg_hot_destroy(void *arg) {
+  err_mem_free(NULL, arg);
+}  /* cfg_hot_destroy */
+
+
+void cfg_hot_key_create(void) {
+  pthread_key_create(&cfg_hot_key, cfg_hot_destroy);
+}  /* cfg_hot_key_create */
+
+
+/* The calling thread's slot for a key. Returns NULL if the cache can't
+ * be allocated; callers then do a normal lookup. *rtn_hit is 1 if the
+ * slot already holds the key's current value. Callers fill a slot with
+ * the *rtn_generation from before their lookup, so a concurrent set
+ * leaves it stale rather than wrong. */
+cfg_hot_entry_t *cfg_hot_slot(const cfg_t *cfg, const char *key, int *rtn_hit, uint64_t *rtn_generation) {
+  pthread_once(&cfg_hot_once, cfg_hot_key_create);
+  cfg_hot_cache_t *cache = (cfg_hot_cache_t *)pthread_getspecific(cfg_hot_key);
+  if (cache == NULL) {
+    cache = (cfg_hot_cache_t *)err_mem_calloc(NULL, 1, sizeof(cfg_hot_cache_t));
+    if (cache == NULL) {
+      return NULL;
+    }
+    if (pthread_setspecific(cfg_hot_key, cache) != 0) {
+      err_mem_free(NULL, cache);
+      return NULL;
+    }
+  }
+
+  /* Only a delete writes the counter, so reading it normally hits a
+   * clean line in this core's cache. */
+  uint64_t delete_generation = __atomic_load_n(&cfg_delete_generation, __ATOMIC_ACQUIRE);
+  if (cache->delete_generation != delete_generation) {
+    memset(cache->entries, 0, sizeof(cache->entries));
+    cache->delete_generation = delete_generation;
+  }
+
+  /* Parents are frozen, so only this cfg's sets can change what a key
+   * resolves to. */
+  uint64_t generation = __atomic_load_n(&cfg->generation, __ATOMIC_ACQUIRE);
+  *rtn_generation = generation;
+
+  uint64_t mix = ((uint64_t)(uintptr_t)key ^ ((uint64_t)(uintptr_t)cfg << 7)) * 0x9e3779b97f4a7c15ULL;
+  cfg_hot_entry_t *slot = &cache->entries[mix >> (64 - CFG_HOT_CACHE_BITS)];
+  *rtn_hit = (slot->cfg == cfg && slot->key == key && slot->generation == generation);
+  if (*rtn_hit && cfg->hot_cache_enabled == CFG_HOT_CACHE_CHECK_KEY) {
+    /* Catches a key buffer reused for a different key. */
+    *rtn_hit = (strcmp(slot->option->key, key) == 0);
+  }
+  return slot;
+}  /* cfg_hot_slot */
+
+
+/* Optional per-thread cache in front of cfg_get_str_val() and
+ * cfg_get_long_val(). Off by default. Entries are found by the key's
+ * address alone with CFG_HOT_CACHE_ON; CFG_HOT_CACHE_CHECK_KEY also
+ * compares the key, so a reused buffer works but only hits while it
+ * holds the same key. */
+ERR_F cfg_hot_cache_enable(cfg_t *cfg, int enable) {
+  ERR_ASSRT(cfg, CFG_ERR_PARAM);
+  ERR_ASSRT(enable == 0 || enable == CFG_HOT_CACHE_ON || enable == CFG_HOT_CACHE_CHECK_KEY, CFG_ERR_PARAM);
+
+  cfg->hot_cache_enabled = enable;
+
+  return ERR_OK;
+}  /* cfg_hot_cache_enable */
+
+
+ERR_F cfg_get_str_val(cfg_t *cfg, const char *key, char **rtn_value) {
+  cfg_hot_entry_t *slot = NULL;
+  cfg_option_t *option;
+  char *val_str;
+  uint64_t generation;
+  int hit;
+
+  if (cfg->hot_cache_enabled) {
+    slot = cfg_hot_slot(cfg, key, &hit, &generation);
+    if (slot && hit) {
+      CFG_COUNT_READ(cfg, slot->option);
+      *rtn_value = slot->value;
+      return ERR_OK;
+    }
+  }
+
+  ERR(cfg_option_val(cfg, key, &option, &val_str));
+  if (slot) {
+    slot->cfg = cfg;
+    slot->key = key;
+    slot->generation = generation;
+    slot->option = option;
+    slot->value = val_str;
+    slot->long_ok = 0;
+  }
+
+  *rtn_value = val_str;
+  return ERR_OK;
+}  /* cfg_get_str_val */
+
+
+/* For optional keys: a missing key sets *rtn_found to 0 instead of
+ * throwing, so probing costs no allocation. */
+ERR_F cfg_try_get_str_val(cfg_t *cfg, const char *key, char **rtn_value, int *rtn_found) {
+  cfg_option_t *option;
+
+  ERR(cfg_option_try_find(cfg, key, &option));
+  *rtn_found = (option != NULL);
+  if (option) {
+    CFG_COUNT_READ(cfg, option);
+    ERR(cfg_option_expand(option->owner, option));
+    *rtn_value = option->expanded ? option->expanded : option->value;
+  }
+
+  return ERR_OK;
+}  /* cfg_try_get_str_val */
+
+
+int cfg_conv_long(const char *val_str, long *rtn_value) {
+  return cfg_num_parse_long(val_str, strlen(val_str), rtn_value);
+}  /* cfg_conv_long */
+
+
+int cfg_conv_double(const char *val_str, double *rtn_value) {
+  return cfg_num_parse_double(val_str, strlen(val_str), rtn_value);
+}  /* cfg_conv_double */
+
+
+int cfg_conv_bool(const char *val_str, int *rtn_value) {
+  static const char *true_strs[] = {"1", "true", "yes", "on", NULL};
+  static const char *false_strs[] = {"0", "false", "no", "off", NULL};
+  char lower[8];
+  size_t len = strlen(val_str);
+  size_t i;
+
+  if (len >= sizeof(lower)) {
+    return -1;
+  }
+  for (i = 0; i <= len; i++) {
+    lower[i] = tolower((unsigned char)val_str[i]);
+  }
+
+  for (i = 0; true_strs[i]; i++) {
+    if (strcmp(lower, true_strs[i]) == 0) { *rtn_value = 1; return 0; }
+  }
+  for (i = 0; false_strs[i]; i++) {
+    if (strcmp(lower, false_strs[i]) == 0) { *rtn_value = 0; return 0; }
+  }
+  return -1;
+}  /* cfg_conv_bool */
+
+
+/* Length without trailing spaces. */
+size_t cfg_len_nospace(const char *val_str) {
+  size_t len = strlen(val_str);
+  while (len > 0 && val_str[len - 1] == ' ') {
+    len--;
+  }
+  return len;
+}  /* cfg_len_nospace */
+
+
+/* Integer with optional K, M, or G suffix (powers of 1024). */
+int cfg_conv_size(const char *val_str, size_t *rtn_value) {
+  size_t len = cfg_len_nospace(val_str);
+  size_t multiplier = 1;
+
+  if (len > 0) {
+    switch (toupper((unsigned char)val_str[len - 1])) {
+    case 'K': multiplier = (size_t)1 << 10; break;
+    case 'M': multiplier = (size_t)1 << 20; break;
+    case 'G': multiplier = (size_t)1 << 30; break;
+    }
+    if (multiplier > 1) {
+      len--;
+    }
+  }
+
+  long value;
+  if (cfg_num_parse_long(val_str, len, &value) != 0) {
+    return -1;
+  }
+  if (value < 0 || (size_t)value > SIZE_MAX / multiplier) {
+    return -1;
+  }
+  *rtn_value = (size_t)value * multiplier;
+  return 0;
+}  /* cfg_conv_size */
+
+
+/* Number with optional ms, s, m, or h suffix; no suffix means ms. */
+int cfg_conv_duration(const char *val_str, long *rtn_ms) {
+  size_t len = cfg_len_nospace(val_str);
+  double scale = 1.0;
+
+  if (len >= 2 && strncmp(&val_str[len - 2], "ms", 2) == 0) { len -= 2; }
+  else if (len >= 1 && val_str[len - 1] == 's') { scale = 1000.0; len--; }
+  else if (len >= 1 && val_str[len - 1] == 'm') { scale = 60000.0; len--; }
+  else if (len >= 1 && val_str[len - 1] == 'h') { scale = 3600000.0; len--; }
+
+  double value;
+  if (cfg_num_parse_double(val_str, len, &value) != 0) {
+    return -1;
+  }
+
+  double ms = value * scale;
+  /* Compare as double so huge values are rejected, not wrapped. */
+  if (ms < -9.2e18 || ms > 9.2e18) {
+    return -1;
+  }
+  *rtn_ms = (long)(ms < 0 ? ms - 0.5 : ms + 0.5);
+  return 0;
+}  /* cfg_conv_duration */
+
+
+/* Split a list value into spans. If the value has a comma, elements are
+ * separated by commas and trimmed (so they can contain spaces, like
+ * "1 000, 2 000"); otherwise they are separated by whitespace. */
+ERR_F cfg_option_split(cfg_option_t *option, const char *val_str) {
+  int has_comma = (strchr(val_str, ',') != NULL);
+  int pass;
+  int num = 0;
+
+  /* First pass counts, second fills in the spans. */
+  for (pass = 0; pass < 2; pass++) {
+    const char *p = val_str;
+    num = 0;
+    while (*p != '\0') {
+      while (isspace((unsigned char)*p)) { p++; }
+      if (*p == '\0' && ! has_comma) { break; }
+      const char *start = p;
+      if (has_comma) {
+        while (*p != '\0' && *p != ',') { p++; }
+      } else {
+        while (*p != '\0' && ! isspace((unsigned char)*p)) { p++; }
+      }
+      const char *end = p;
+      while (end > start && isspace((unsigned char)end[-1])) { end--; }
+      if (pass == 1) {
+        option->str_list[num].ptr = start;
+        option->str_list[num].len = end - start;
+      }
+      num++;
+      if (has_comma && *p == ',') {
+        p++;
+        if (*p == '\0') {  /* Trailing comma; empty last element. */
+          if (pass == 1) {
+            option->str_list[num].ptr = p;
+            option->str_list[num].len = 0;
+          }
+          num++;
+        }
+      }
+    }
+
+    if (pass == 0 && num > 0) {
+      cfg_span_t *new_list = err_mem_realloc(option->owner->allocator, option->str_list, num * sizeof(cfg_span_t));
+      ERR_ASSRT(new_list, CFG_ERR_NOMEM);
+      option->str_list = new_list;
+    }
+  }
+  option->num_strs = num;
+
+  return ERR_OK;
+}  /* cfg_option_split */
+
+
+/* Convert the (already split) elements to longs. */
+ERR_F cfg_option_longs(cfg_option_t *option, int *rtn_status) {
+  int i;
+
+  if (option->num_strs > 0) {
+    long *new_list = err_mem_realloc(option->owner->allocator, option->long_list, option->num_strs * sizeof(long));
+    ERR_ASSRT(new_list, CFG_ERR_NOMEM);
+    option->long_list = new_list;
+  }
+  option->num_longs = option->num_strs;
+
+  *rtn_status = 0;
+  for (i = 0; i < option->num_strs; i++) {
+    if (cfg_num_parse_long(option->str_list[i].ptr, option->str_list[i].len, &option->long_list[i]) != 0) {
+      *rtn_status = -1;
+      break;
+    }
+  }
+
+  return ERR_OK;
+}  /* cfg_option_longs */
+
+
+/* Caller holds cfg->memo_lock. Results are stored before conv_done is
+ * published, so a reader that sees the bit sees them too. */
+ERR_F cfg_option_convert_locked(cfg_t *cfg, cfg_option_t *option, const char *val_str, unsigned int conv) {
+  if (option->conv_done & conv) {  /* Another thread got here first. */
+    return ERR_OK;
+  }
+
+  int status = -1;
+  switch (conv) {
+  case CFG_CONV_LONG: status = cfg_conv_long(val_str, &option->long_val); break;
+  case CFG_CONV_DOUBLE: status = cfg_conv_double(val_str, &option->double_val); break;
+  case CFG_CONV_BOOL: status = cfg_conv_bool(val_str, &option->bool_val); break;
+  case CFG_CONV_SIZE: status = cfg_conv_size(val_str, &option->size_val); break;
+  case CFG_CONV_DURATION: status = cfg_conv_duration(val_str, &option->duration_ms_val); break;
+  case CFG_CONV_STR_LIST: ERR(cfg_option_split(option, val_str)); status = 0; break;
+  case CFG_CONV_LONG_LIST:
+    ERR(cfg_option_convert_locked(cfg, option, val_str, CFG_CONV_STR_LIST));
+    ERR(cfg_option_longs(option, &status));
+    break;
+  default: ERR_THROW(CFG_ERR_INTERNAL, "conv %u", conv);
+  }
+  if (status != 0) {
+    __atomic_store_n(&option->conv_bad, option->conv_bad | conv, __ATOMIC_RELAXED);
+  }
+  __atomic_store_n(&option->conv_done, option->conv_done | conv, __ATOMIC_RELEASE);
+
+  return ERR_OK;
+}  /* cfg_option_convert_locked */
+
+
+/* Make sure the requested conversion is cached. Failed conversions
+ * are cached too, and rethrown on each get. Like expansion, the first
+ * read converts under memo_lock and later reads don't lock. */
+ERR_F cfg_option_convert(cfg_t *cfg, cfg_option_t *option, unsigned int conv) {
+  ERR(cfg_option_expand(cfg, option));
+  char *val_str = option->expanded ? option->expanded : option->value;
+
+  if ((__atomic_load_n(&option->conv_done, __ATOMIC_ACQUIRE) & conv) == 0) {
+    pthread_mutex_lock(&cfg->memo_lock);
+    err_t *err = cfg_option_convert_locked(cfg, option, val_str, conv);
+    pthread_mutex_unlock(&cfg->memo_lock);
+    if (err) {
+      ERR_RETHROW(err, err->code);
+    }
+  }
+
+  if (__atomic_load_n(&option->conv_bad, __ATOMIC_RELAXED) & conv) {
+    ERR_THROW((conv == CFG_CONV_BOOL) ? CFG_ERR_BAD_BOOL : ERR_ERR_BAD_NUMBER,
+      "key '%s': bad value '%s'", option->key, val_str);
+  }
+
+  return ERR_OK;
+}  /* cfg_option_convert */
+
+
+ERR_F cfg_option_conv(cfg_t *cfg, const char *key, unsigned int conv, cfg_option_t **rtn_option) {
+  cfg_option_t *option;
+
+  ERR(cfg_option_find(cfg, key, &option));
+  CFG_COUNT_READ(cfg, option);
+  ERR(cfg_option_convert(option->owner, option, conv));
+
+  *rtn_option = option;
+  return ERR_OK;
+}  /* cfg_option_conv */
+
+
+ERR_F cfg_get_long_val(cfg_t *cfg, const char *key, long *rtn_value) {
+  cfg_hot_entry_t *slot = NULL;
+  cfg_option_t *option;
+  uint64_t generation;
+  int hit = 0;
+
+  if (cfg->hot_cache_enabled) {
+    slot = cfg_hot_slot(cfg, key, &hit, &generation);
+    if (slot && hit && slot->long_ok) {
+      CFG_COUNT_READ(cfg, slot->option);
+      *rtn_value = slot->long_val;
+      return ERR_OK;
+    }
+  }
+
+  if (slot && hit) {  /* Cached as a string; convert it once. */
+    option = slot->option;
+    CFG_COUNT_READ(cfg, option);
+    ERR(cfg_option_convert(option->owner, option, CFG_CONV_LONG));
+  } else {
+    ERR(cfg_option_conv(cfg, key, CFG_CONV_LONG, &option));
+  }
+  if (slot) {
+    slot->cfg = cfg;
+    slot->key = key;
+    slot->generation = generation;
+    slot->option = option;
+    slot->value = option->expanded ? option->expanded : option->value;
+    slot->long_val = option->long_val;
+    slot->long_ok = 1;
+  }
+
+  *rtn_value = option->long_val;
+  return ERR_OK;
+}  /* cfg_get_long_val */
+
+
+ERR_F cfg_try_get_long_val(cfg_t *cfg, const char *key, long *rtn_value, int *rtn_found) {
+  cfg_option_t *option;
+
+  ERR(cfg_option_try_find(cfg, key, &option));
+  *rtn_found = (option != NULL);
+  if (option) {
+    CFG_COUNT_READ(cfg, option);
+    ERR(cfg_option_convert(option->owner, option, CFG_CONV_LONG));
+    *rtn_value = option->long_val;
+  }
+
+  return ERR_OK;
+}  /* cfg_try_get_long_val */
+
+
+/* For wrappers (see cfg.hpp): find a key by its precomputed hash and
+ * make sure the value is expanded, and converted if conv is a CFG_CONV_*
+ * flag (0 for none). A missing key sets NULL instead of throwing. */
+ERR_F cfg_try_get_option_h(cfg_t *cfg, const cfg_hkey_t *hkey, unsigned int conv, cfg_option_t **rtn_option) {
+  cfg_option_t *option;
+
+  ERR(cfg_option_try_find_h(cfg, hkey, &option));
+  if (option) {
+    CFG_COUNT_READ(cfg, option);
+    if (conv == 0) {
+      ERR(cfg_option_expand(option->owner, option));
+    } else {
+      ERR(cfg_option_convert(option->owner, option, conv));
+    }
+  }
+
+  *rtn_option = option;
+  return ERR_OK;
+}  /* cfg_try_get_option_h */
+
+
+ERR_F cfg_get_double_val(cfg_t *cfg, const char *key, double *rtn_value) {
+  cfg_option_t *option;
+
+  ERR(cfg_option_conv(cfg, key, CFG_CONV_DOUBLE, &option));
+
+  *rtn_value = option->double_val;
+  return ERR_OK;
+}  /* cfg_get_double_val */
+
+
+ERR_F cfg_get_bool_val(cfg_t *cfg, const char *key, int *rtn_value) {
+  cfg_option_t *option;
+
+  ERR(cfg_option_conv(cfg, key, CFG_CONV_BOOL, &option));
+
+  *rtn_value = option->bool_val;
+  return ERR_OK;
+}  /* cfg_get_bool_val */
+
+
+ERR_F cfg_get_size_val(cfg_t *cfg, const char *key, size_t *rtn_value) {
+  cfg_option_t *option;
+
+  ERR(cfg_option_conv(cfg, key, CFG_CONV_SIZE, &option));
+
+  *rtn_value = option->size_val;
+  return ERR_OK;
+}  /* cfg_get_size_val */
+
+
+ERR_F cfg_get_duration_val(cfg_t *cfg, const char *key, long *rtn_ms) {
+  cfg_option_t *option;
+
+  ERR(cfg_option_conv(cfg, key, CFG_CONV_DURATION, &option));
+
+  *rtn_ms = option->duration_ms_val;
+  return ERR_OK;
+}  /* cfg_get_duration_val */
+
+
+ERR_F cfg_get_str_list(cfg_t *cfg, const char *key, const cfg_span_t **rtn_list, int *rtn_num) {
+  cfg_option_t *option;
+
+  ERR(cfg_option_conv(cfg, key, CFG_CONV_STR_LIST, &option));
+
+  *rtn_list = option->str_list;
+  *rtn_num = option->num_strs;
+  return ERR_OK;
+}  /* cfg_get_str_list */
+
+
+ERR_F cfg_get_long_list(cfg_t *cfg, const char *key, const long **rtn_list, int *rtn_num) {
+  cfg_option_t *option;
+
+  ERR(cfg_option_conv(cfg, key, CFG_CONV_LONG_LIST, &option));
+
+  *rtn_list = option->long_list;
+  *rtn_num = option->num_longs;
+  return ERR_OK;
+}  /* cfg_get_long_list */
+
+
+int cfg_option_key_cmp(const void *a, const void *b) {
+  const cfg_option_t *option_a = *(const cfg_option_t * const *)a;
+  const cfg_option_t *option_b = *(const cfg_option_t * const *)b;
+  return strcmp(option_a->key, option_b->key);
+}  /* cfg_option_key_cmp */
+
+
+/* Sort the keys added since the last call and merge them in. Keys are
+ * never removed, so the sorted part only ever grows. */
+ERR_F cfg_key_index_sort(cfg_t *cfg) {
+  int num_sorted = cfg->num_key_index_sorted;
+  int num_new = cfg->num_key_index - num_sorted;
+  cfg_option_t **index = cfg->key_index;
+
+  if (num_new == 0) {
+    return ERR_OK;
+  }
+  qsort(&index[num_sorted], num_new, sizeof(cfg_option_t *), cfg_option_key_cmp);
+
+  if (num_sorted > 0 && cfg_option_key_cmp(&index[num_sorted - 1], &index[num_sorted]) > 0) {
+    cfg_option_t **merged;
+    ERR(cfg_mem_calloc(cfg, (void **)&merged, cfg->num_key_index, sizeof(cfg_option_t *)));
+    int i = 0, j = num_sorted, k = 0;
+    while (i < num_sorted && j < cfg->num_key_index) {
+      merged[k++] = (cfg_option_key_cmp(&index[i], &index[j]) <= 0) ? index[i++] : index[j++];
+    }
+    while (i < num_sorted) { merged[k++] = index[i++]; }
+    while (j < cfg->num_key_index) { merged[k++] = index[j++]; }
+    memcpy(index, merged, cfg->num_key_index * sizeof(cfg_option_t *));
+    err_mem_free(cfg->allocator, merged);
+  }
+  cfg->num_key_index_sorted = cfg->num_key_index;
+
+  return ERR_OK;
+}  /* cfg_key_index_sort */
+
+
+/* Keep keys in order so cfg_iterate_prefix() is a binary search plus the
+ * matching keys, instead of a scan of every key. */
+ERR_F cfg_key_index_enable(cfg_t *cfg) {
+  hmap_entry_t *entry;
+
+  ERR_ASSRT(cfg, CFG_ERR_PARAM);
+  if (cfg->key_index_enabled) {
+    return ERR_OK;
+  }
+
+  entry = NULL;  /* Start at beginning. */
+  do {
+    ERR(hmap_next(cfg->option_infos, &entry));
+    if (entry) {
+      ERR(cfg_ptrs_push(cfg, (void ***)&cfg->key_index, &cfg->num_key_index, &cfg->max_key_index, entry->value));
+    }
+  } while (entry);
+  cfg->key_index_enabled = 1;
+
+  return ERR_OK;
+}  /* cfg_key_index_enable */
+
+
+/* Call cb for each key starting with prefix, in key order, with its
+ * value (substitutions resolved). Use "" for all keys. New keys added by
+ * cb are not visited. */
+ERR_F cfg_iterate_prefix(cfg_t *cfg, const char *prefix, cfg_iterate_cb_t cb, void *clientd) {
+  cfg_option_t **matches;
+  int num_matches;
+  size_t prefix_len;
+  int i;
+
+  ERR_ASSRT(cfg, CFG_ERR_PARAM);
+  ERR_ASSRT(prefix, CFG_ERR_PARAM);
+  ERR_ASSRT(cb, CFG_ERR_PARAM);
+  prefix_len = strlen(prefix);
+
+  if (cfg->key_index_enabled && cfg->parent == NULL && cfg->static_base == NULL) {
+    /* Readers on other threads may be sorting the index too. */
+    pthread_mutex_lock(&cfg->memo_lock);
+    err_t *err = cfg_key_index_sort(cfg);
+
+    /* Lower bound: first key >= prefix. */
+    int lo = 0, hi = cfg->num_key_index;
+    while (lo < hi) {
+      int mid = lo + (hi - lo) / 2;
+      if (strcmp(cfg->key_index[mid]->key, prefix) < 0) { lo = mid + 1; }
+      else { hi = mid; }
+    }
+    int end = lo;
+    while (end < cfg->num_key_index && strncmp(cfg->key_index[end]->key, prefix, prefix_len) == 0) {
+      end++;
+    }
+    num_matches = end - lo;
+    matches = NULL;
+    /* Copy, so cb can add keys (which can move the index). */
+    if (err == ERR_OK && num_matches > 0) {
+      err = cfg_mem_calloc(cfg, (void **)&matches, num_matches, sizeof(cfg_option_t *));
+    }
+    if (err == ERR_OK && num_matches > 0) {
+      memcpy(matches, &cfg->key_index[lo], num_matches * sizeof(cfg_option_t *));
+    }
+    pthread_mutex_unlock(&cfg->memo_lock);
+    if (err) {
+      ERR_RETHROW(err, err->code);
+    }
+    if (num_matches == 0) {
+      return ERR_OK;
+    }
+  } else {
+    /* No index (or an overlay); scan every key of every layer, skipping
+     * the ones hidden by a higher layer, and sort the matches. */
+    cfg_layer_pos_t pos;
+    cfg_option_t *option;
+    cfg_t *layer;
+    int max_matches = 0;
+    matches = NULL;
+    num_matches = 0;
+    for (layer = cfg; layer; layer = layer->parent) {
+      memset(&pos, 0, sizeof(pos));  /* Start at beginning. */
+      do {
+        err_t *err = cfg_layer_next(layer, &pos, &option);
+        if (err == ERR_OK && option && strncmp(option->key, prefix, prefix_len) == 0) {
+          cfg_option_t *visible = option;
+          if (layer != cfg) {
+            err = cfg_layer_find(cfg, option->key, &visible);
+          }
+          if (err == ERR_OK && visible == option) {
+            err = cfg_ptrs_push(cfg, (void ***)&matches, &num_matches, &max_matches, option);
+          }
+        }
+        if (err) {
+          err_mem_free(cfg->allocator, matches);
+          ERR_RETHROW(err, err->code);
+        }
+      } while (option);
+    }
+    if (num_matches == 0) {
+      return ERR_OK;
+    }
+    qsort(matches, num_matches, sizeof(cfg_option_t *), cfg_option_key_cmp);
+  }
+
+  err_t *err = ERR_OK;
+  for (i = 0; i < num_matches && err == ERR_OK; i++) {
+    err = cfg_option_expand(matches[i]->owner, matches[i]);
+    if (err == ERR_OK) {
+      const char *value = matches[i]->expanded ? matches[i]->expanded : matches[i]->value;
+      err = cb(cfg, matches[i]->key, value, clientd);
+    }
+  }
+  err_mem_free(cfg->allocator, matches);
+  if (err) {
+    ERR_RETHROW(err, err->code);
+  }
+
+  return ERR_OK;
+}  /* cfg_iterate_prefix */
+
+
+/* Do every conversion of an expanded option, so it never needs to be
+ * modified again. */
+ERR_F cfg_option_convert_all(cfg_t *cfg, cfg_option_t *option) {
+  static const unsigned int convs[] = {CFG_CONV_LONG, CFG_CONV_DOUBLE, CFG_CONV_BOOL,
+    CFG_CONV_SIZE, CFG_CONV_DURATION, CFG_CONV_STR_LIST, CFG_CONV_LONG_LIST};
+  size_t i;
+
+  for (i = 0; i < sizeof(convs) / sizeof(convs[0]); i++) {
+    err_t *err = cfg_option_convert(cfg, option, convs[i]);
+    /* Values that aren't numbers are normal; the failure is cached. */
+    if (err && err->code != ERR_ERR_BAD_NUMBER && err->code != CFG_ERR_BAD_BOOL) {
+      ERR_RETHROW(err, err->code);
+    }
+    if (err) { err_dispose(err); }
+  }
+
+  return ERR_OK;
+}  /* cfg_option_convert_all */
+
+
+/* Make the cfg read-only so overlays can share it. Everything derived
+ * from the values is computed now, so reads never modify a frozen cfg
+ * and it is safe to read from many threads. */
+ERR_F cfg_freeze(cfg_t *cfg) {
+  hmap_entry_t *entry;
+
+  ERR_ASSRT(cfg, CFG_ERR_PARAM);
+  ERR_ASSRT(cfg->batch_depth == 0, CFG_ERR_PARAM);
+  if (cfg->frozen) {
+    return ERR_OK;
+  }
+
+  entry = NULL;  /* Start at beginning. */
+  do {
+    ERR(hmap_next(cfg->option_infos, &entry));
+    if (entry) {
+      cfg_option_t *option = (cfg_option_t *)entry->value;
+      ERR(cfg_option_expand(cfg, option));
+      ERR(cfg_option_convert_all(cfg, option));
+    }
+  } while (entry);
+  cfg->frozen = 1;
+
+  return ERR_OK;
+}  /* cfg_freeze */
+
+
+/* A cfg that stores only its own keys and falls through to a frozen
+ * parent for the rest. Both modes see the parent's keys: "update" may
+ * override them and "add" may not repeat them. */
+ERR_F cfg_create_overlay(cfg_t **rtn_cfg, cfg_t *parent) {
+  cfg_t *cfg;
+  err_t *err;
+
+  ERR_ASSRT(rtn_cfg, CFG_ERR_PARAM);
+  ERR_ASSRT(parent, CFG_ERR_PARAM);
+  ERR_ASSRT(parent->frozen, CFG_ERR_PARAM);
+
+  cfg_create_opts_t opts = {parent->allocator, 0};
+  ERR(cfg_create_ex(&cfg, &opts));
+  err = cfg_mem_calloc(cfg, (void **)&cfg->layer_cache, CFG_LAYER_CACHE_SIZE, sizeof(cfg_option_t *));
+  if (err == ERR_OK && parent->intern_pool) {
+    err = cfg_intern_pool(cfg, parent->intern_pool);
+  }
+  if (err == ERR_OK && parent->schema) {  /* Indexes start out pointing at inherited options. */
+    err = cfg_mem_calloc(cfg, (void **)&cfg->schema_options, parent->num_schema_options, sizeof(cfg_option_t *));
+    if (err == ERR_OK) {
+      memcpy(cfg->schema_options, parent->schema_options, parent->num_schema_options * sizeof(cfg_option_t *));
+      cfg->schema = parent->schema;
+      cfg->num_schema_options = parent->num_schema_options;
+    }
+  }
+  if (err) {
+    err_t *delete_err = cfg_delete(cfg);
+    if (delete_err) { err_dispose(delete_err); }
+    ERR_RETHROW(err, err->code);
+  }
+  cfg->parent = parent;
+
+  *rtn_cfg = cfg;
+  return ERR_OK;
+}  /* cfg_create_overlay */
+
+
+/* Option for one slot of a compiled-in layer, made on first use. It is
+ * expanded and converted before other threads can see it, so it is
+ * never modified after. Threads that race to make one keep the first. */
+ERR_F cfg_static_option(cfg_t *cfg, uint32_t slot, cfg_option_t **rtn_option) {
+  cfg_option_t *option = __atomic_load_n(&cfg->static_options[slot], __ATOMIC_ACQUIRE);
+  err_t *err = ERR_OK;
+
+  if (option == NULL) {
+    const cfg_static_t *table = cfg->static_base;
+    ERR(cfg_mem_calloc(cfg, (void **)&option, 1, sizeof(cfg_option_t)));
+    option->owner = cfg;
+    option->key = (char *)table->index.keys[slot];
+    option->value = (char *)table->values[slot];
+    option->has_subst = (strstr(option->value, "${") != NULL);
+    option->schema_idx = -1;
+
+    if (option->has_subst) {
+      cfg_strbuf_t strbuf = {cfg->allocator, NULL, 0, 0};
+      err = cfg_option_expand_into(cfg, option, &strbuf);
+      if (err) {
+        err_mem_free(cfg->allocator, strbuf.buf);
+      } else {
+        option->expanded = strbuf.buf;
+      }
+      if (err && err->code == CFG_ERR_SUBST) {  /* Left unexpanded; getters report it. */
+        err_dispose(err);
+        err = ERR_OK;
+      }
+    }
+    if (err == ERR_OK && (option->expanded || ! option->has_subst)) {
+      err = cfg_option_convert_all(cfg, option);
+    }
+    if (err) {
+      cfg_option_free(cfg, option);
+      ERR_RETHROW(err, err->code);
+    }
+
+    cfg_option_t *first = NULL;
+    if (! __atomic_compare_exchange_n(&cfg->static_options[slot], &first, option, 0,
+        __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+      cfg_option_free(cfg, option);
+      option = first;
+    }
+  }
+
+  *rtn_option = option;
+  return ERR_OK;
+}  /* cfg_static_option */
+
+
+/* A frozen cfg whose keys come from a table generated by cfg_compile,
+ * to use as the bottom layer under cfg_create_overlay(). Nothing is
+ * parsed, copied, or hashed here; each key's option is made the first
+ * time it is looked up. The table must outlive the cfg. */
+ERR_F cfg_create_static(cfg_t **rtn_cfg, const cfg_static_t *table) {
+  cfg_t *cfg;
+
+  ERR_ASSRT(rtn_cfg, CFG_ERR_PARAM);
+  ERR_ASSRT(table, CFG_ERR_PARAM);
+
+  ERR(cfg_create_ex(&cfg, NULL));
+  cfg->static_options = err_mem_calloc(cfg->allocator, table->index.table_size, sizeof(cfg_option_t *));
+  if (cfg->static_options == NULL) {
+    ERR(cfg_delete(cfg));
+    ERR_THROW(CFG_ERR_NOMEM, "%u slots", (unsigned)table->index.table_size);
+  }
+  cfg->static_base = table;
+  cfg->frozen = 1;
+
+  *rtn_cfg = cfg;
+  return ERR_OK;
+}  /* cfg_create_static */
+
+
+/* Step through one layer's own options, not its parents'. Sets NULL at
+ * the end. A compiled-in layer's options are made as they are reached. */
+ERR_F cfg_layer_next(cfg_t *layer, cfg_layer_pos_t *pos, cfg_option_t **rtn_option) {
+  *rtn_option = NULL;
+
+  if (layer->static_base) {
+    const phash_t *index = &layer->static_base->index;
+    while (pos->slot < index->table_size) {
+      uint32_t slot = pos->slot++;
+      if (index->keys[slot]) {
+        ERR(cfg_static_option(layer, slot, rtn_option));
+        return ERR_OK;
+      }
+    }
+    return ERR_OK;
+  }
+
+  ERR(hmap_next(layer->option_infos, &pos->entry));
+  if (pos->entry) {
+    *rtn_option = (cfg_option_t *)pos->entry->value;
+  }
+
+  return ERR_OK;
+}  /* cfg_layer_next */
+
+
+/* Which layer supplied a key's value, and where it was read from. */
+ERR_F cfg_get_source(cfg_t *cfg, const char *key, cfg_t **rtn_layer, const char **rtn_location) {
+  cfg_option_t *option;
+  char *location;
+
+  ERR_ASSRT(cfg, CFG_ERR_PARAM);
+  ERR_ASSRT(key, CFG_ERR_PARAM);
+  ERR(cfg_option_find(cfg, key, &option));
+  const cfg_static_t *table = option->owner->static_base;
+  if (table) {
+    location = (char *)table->locations[phash_find(&table->index, option->key, strlen(option->key) + 1)];
+  } else {
+    ERR(hmap_slookup(option->owner->option_locations, option->key, (void **)&location));
+  }
+
+  if (rtn_layer) { *rtn_layer = option->owner; }
+  if (rtn_location) { *rtn_location = location; }
+  return ERR_OK;
+}  /* cfg_get_source */
+
+
+/* Write the option's current value into one bound variable. Stores
+ * are atomic so readers on other threads see old or new, never a mix. */
+ERR_F cfg_bind_store(cfg_t *cfg, cfg_option_t *option, cfg_bind_t *bind) {
+  switch (bind->type) {
+  case CFG_BIND_LONG:
+    ERR(cfg_option_convert(option->owner, option, CFG_CONV_LONG));
+    __atomic_store_n((long *)bind->var, option->long_val, __ATOMIC_RELEASE);
+    break;
+
+  case CFG_BIND_DOUBLE:
+    ERR(cfg_option_convert(option->owner, option, CFG_CONV_DOUBLE));
+    __atomic_store((double *)bind->var, &option->double_val, __ATOMIC_RELEASE);
+    break;
+
+  case CFG_BIND_STR: {
+    ERR(cfg_option_expand(option->owner, option));
+    char *new_copy;
+    ERR(cfg_mem_strdup(cfg, &new_copy, option->expanded ? option->expanded : option->value));
+    __atomic_store_n((char **)bind->var, new_copy, __ATOMIC_RELEASE);
+    /* A reader may still be using the previous string; keep it until
+     * cfg_bind_reclaim() or cfg_delete(). */
+    if (bind->str_copy) {
+      ERR(cfg_ptrs_push(cfg, (void ***)&cfg->retired_strs, &cfg->num_retired_strs, &cfg->max_retired_strs, bind->str_copy));
+    }
+    bind->str_copy = new_copy;
+    break;
+  }
+
+  default:
+    ERR_THROW(CFG_ERR_INTERNAL, "bind type %d", bind->type);
+  }
+
+  return ERR_OK;
+}  /* cfg_bind_store */
+
+
+/* Refresh bound variables of an updated option and of the options whose
+ * expansions used it. Every variable is attempted; first error returned. */
+ERR_F cfg_option_rebind(cfg_t *cfg, cfg_option_t *option) {
+  err_t *first_err = ERR_OK;
+  cfg_bind_t *bind;
+  int i;
+
+  for (i = -1; i < cfg->num_rebinds; i++) {
+    cfg_option_t *rebind = (i == -1) ? option : cfg->rebinds[i];
+    for (bind = rebind->binds; bind; bind = bind->next) {
+      err_t *err = cfg_bind_store(cfg, rebind, bind);
+      if (err) {
+        if (first_err == ERR_OK) { first_err = err; } else { err_dispose(err); }
+      }
+    }
+  }
+  cfg->num_rebinds = 0;
+
+  if (first_err) {
+    ERR_RETHROW(first_err, first_err->code);
+  }
+  return ERR_OK;
+}  /* cfg_option_rebind */
+
+
+ERR_F cfg_bind(cfg_t *cfg, const char *key, int type, void *var) {
+  cfg_option_t *option;
+  cfg_bind_t *bind;
+
+  ERR_ASSRT(cfg, CFG_ERR_PARAM);
+  ERR_ASSRT(key, CFG_ERR_PARAM);
+  ERR_ASSRT(var, CFG_ERR_PARAM);
+  ERR(cfg_option_find(cfg, key, &option));
+  ERR_ASSRT(option->owner == cfg, CFG_ERR_PARAM);  /* Can't bind an inherited key. */
+
+  if (option->binds == NULL) {  /* One more option an update may rebind. */
+    ERR(cfg_ptrs_reserve(cfg, (void ***)&cfg->rebinds, &cfg->max_rebinds, cfg->num_bound + 1));
+  }
+  ERR(cfg_mem_calloc(cfg, (void **)&bind, 1, sizeof(cfg_bind_t)));
+  bind->type = type;
+  bind->var = var;
+  err_t *err = cfg_bind_store(cfg, option, bind);
+  if (err) {
+    err_mem_free(cfg->allocator, bind);
+    ERR_RETHROW(err, err->code);
+  }
+
+  if (option->binds == NULL) {
+    cfg->num_bound++;
+  }
+  bind->next = option->binds;
+  option->binds = bind;
+  return ERR_OK;
+}  /* cfg_bind */
+
+
+ERR_F cfg_bind_long(cfg_t *cfg, const char *key, long *var) {
+  ERR(cfg_bind(cfg, key, CFG_BIND_LONG, var));
+  return ERR_OK;
+}  /* cfg_bind_long */
+
+
+ERR_F cfg_bind_str(cfg_t *cfg, const char *key, const char **var) {
+  ERR(cfg_bind(cfg, key, CFG_BIND_STR, (void *)var));
+  return ERR_OK;
+}  /* cfg_bind_str */
+
+
+ERR_F cfg_bind_double(cfg_t *cfg, const char *key, double *var) {
+  ERR(cfg_bind(cfg, key, CFG_BIND_DOUBLE, var));
+  return ERR_OK;
+}  /* cfg_bind_double */
+
+
+ERR_F cfg_unbind(cfg_t *cfg, const char *key, void *var) {
+  cfg_option_t *option;
+
+  ERR_ASSRT(cfg, CFG_ERR_PARAM);
+  ERR_ASSRT(key, CFG_ERR_PARAM);
+  ERR(cfg_option_find(cfg, key, &option));
+
+  cfg_bind_t **link = &option->binds;
+  while (*link && (*link)->var != var) {
+    link = &(*link)->next;
+  }
+  ERR_ASSRT(*link, CFG_ERR_PARAM);  /* Not bound to this key. */
+  cfg_bind_t *bind = *link;
+  *link = bind->next;
+  if (option->binds == NULL) {
+    cfg->num_bound--;
+  }
+
+  /* The variable may still point at the copy. */
+  if (bind->str_copy) {
+    err_t *err = cfg_ptrs_push(cfg, (void ***)&cfg->retired_strs, &cfg->num_retired_strs, &cfg->max_retired_strs, bind->str_copy);
+    if (err) {
+      err_mem_free(cfg->allocator, bind);
+      ERR_RETHROW(err, err->code);
+    }
+  }
+  err_mem_free(cfg->allocator, bind);
+  return ERR_OK;
+}  /* cfg_unbind */
+
+
+ERR_F cfg_bind_reclaim(cfg_t *cfg) {
+  int i;
+
+  ERR_ASSRT(cfg, CFG_ERR_PARAM);
+
+  /* Retired before the previous call, so readers have had a whole
+   * interval to drop them. */
+  for (i = 0; i < cfg->num_old_retired_strs; i++) {
+    err_mem_free(cfg->allocator, cfg->retired_strs[i]);
+  }
+  cfg->num_retired_strs -= cfg->num_old_retired_strs;
+  memmove(cfg->retired_strs, &cfg->retired_strs[cfg->num_old_retired_strs], cfg->num_retired_strs * sizeof(char *));
+  cfg->num_old_retired_strs = cfg->num_retired_strs;
+
+  return ERR_OK;
+}  /* cfg_bind_reclaim */
+
+
+/* Add the schema's options with their defaults, and index them. */
+ERR_F cfg_schema_apply(cfg_t *cfg, const cfg_schema_t *schema, int num_options) {
+  char iline[CFG_MAX_LINE_LEN + 1];
+  int i;
+
+  ERR_ASSRT(cfg, CFG_ERR_PARAM);
+  ERR_ASSRT(schema, CFG_ERR_PARAM);
+  ERR_ASSRT(num_options > 0, CFG_ERR_PARAM);
+  ERR_ASSRT(cfg->schema == NULL, CFG_ERR_PARAM);  /* Only one schema. */
+  ERR_ASSRT(cfg->static_base == NULL, CFG_ERR_PARAM);  /* Apply it to an overlay. */
+
+  for (i = 0; i < num_options; i++) {  /* Check the table before changing anything. */
+    if (schema[i].idx != i || schema[i].name == NULL) {
+      ERR_THROW(CFG_ERR_PARAM, "schema entry %d out of order", i);
+    }
+    if (schema[i].type < CFG_TYPE_STR || schema[i].type > CFG_TYPE_DURATION) {
+      ERR_THROW(CFG_ERR_PARAM, "schema entry '%s': bad type %d", schema[i].name, schema[i].type);
+    }
+  }
+
+  ERR(cfg_mem_calloc(cfg, (void **)&cfg->schema_options, num_options, sizeof(cfg_option_t *)));
+  cfg->schema = schema;
+  cfg->num_schema_options = num_options;
+
+  ERR(cfg_batch_begin(cfg));
+  err_t *err = ERR_OK;
+  for (i = 0; i < num_options && err == ERR_OK; i++) {
+    const char *default_val = schema[i].default_val ? schema[i].default_val : "";
+    int len = snprintf(iline, sizeof(iline), "%s=%s", schema[i].name, default_val);
+    if (len < 0 || len >= (int)sizeof(iline)) {
+      err = err_throw_v(__FILE__, __LINE__, __func__, CFG_ERR_LINETOOLONG, "schema entry '%s'", schema[i].name);
+      break;
+    }
+    err = cfg_parse_line(cfg, CFG_MODE_ADD, iline, "schema", i + 1);
+    if (err == ERR_OK) {
+      err = hmap_slookup(cfg->option_infos, schema[i].name, (void **)&cfg->schema_options[i]);
+    }
+    if (err == ERR_OK) {
+      cfg->schema_options[i]->schema_idx = i;
+    }
+  }
+  err_t *notify_err = cfg_batch_end(cfg);
+  if (err) {
+    if (notify_err) { err_dispose(notify_err); }
+    ERR_RETHROW(err, err->code);
+  }
+  ERR(notify_err);
+
+  return ERR_OK;
+}  /* cfg_schema_apply */
+
+
+/* Check that required options were set and that every schema option
+ * converts to its type and is within range. */
+ERR_F cfg_schema_validate(cfg_t *cfg) {
+  int i;
+
+  ERR_ASSRT(cfg, CFG_ERR_PARAM);
+  ERR_ASSRT(cfg->schema, CFG_ERR_PARAM);
+
+  for (i = 0; i < cfg->num_schema_options; i++) {
+    const cfg_schema_t *entry = &cfg->schema[i];
+    cfg_option_t *option = cfg->schema_options[i];
+    double value;
+
+    if (entry->required && option->num_updates == 0) {
+      ERR_THROW(CFG_ERR_REQUIRED, "key '%s' not set", entry->name);
+    }
+
+    switch (entry->type) {
+    case CFG_TYPE_STR:
+      ERR(cfg_option_expand(option->owner, option));
+      continue;  /* No range. */
+    case CFG_TYPE_BOOL:
+      ERR(cfg_option_convert(option->owner, option, CFG_CONV_BOOL));
+      continue;  /* No range. */
+    case CFG_TYPE_LONG:
+      ERR(cfg_option_convert(option->owner, option, CFG_CONV_LONG));
+      value = (double)option->long_val;
+      break;
+    case CFG_TYPE_DOUBLE:
+      ERR(cfg_option_convert(option->owner, option, CFG_CONV_DOUBLE));
+      value = option->double_val;
+      break;
+    case CFG_TYPE_SIZE:
+      ERR(cfg_option_convert(option->owner, option, CFG_CONV_SIZE));
+      value = (double)option->size_val;
+      break;
+    case CFG_TYPE_DURATION:
+      ERR(cfg_option_convert(option->owner, option, CFG_CONV_DURATION));
+      value = (double)option->duration_ms_val;
+      break;
+    default:
+      ERR_THROW(CFG_ERR_INTERNAL, "type %d", entry->type);
+    }
+
+    if (entry->min < entry->max && (value < entry->min || value > entry->max)) {
+      ERR_THROW(CFG_ERR_RANGE, "key '%s': %g not in range %g..%g", entry->name, value, entry->min, entry->max);
+    }
+  }
+
+  return ERR_OK;
+}  /* cfg_schema_validate */
+
+
+ERR_F cfg_schema_idx(cfg_t *cfg, const char *key, int *rtn_idx) {
+  cfg_option_t *option;
+
+  ERR_ASSRT(cfg, CFG_ERR_PARAM);
+  ERR_ASSRT(rtn_idx, CFG_ERR_PARAM);
+  ERR(cfg_option_find(cfg, key, &option));
+
+  *rtn_idx = option->schema_idx;  /* -1 if key not in schema. */
+  return ERR_OK;
+}  /* cfg_schema_idx */
+
+
+/* Direct array access; no hashing. */
+#define CFG_IDX_OPTION(cfg__cfg, cfg__idx, cfg__option) do { \
+  ERR_ASSRT((cfg__cfg) && (cfg__idx) >= 0 && (cfg__idx) < (cfg__cfg)->num_schema_options, CFG_ERR_PARAM); \
+  (cfg__option) = (cfg__cfg)->schema_options[cfg__idx]; \
+  CFG_COUNT_READ(cfg__cfg, cfg__option); \
+} while (0)
+
+
+ERR_F cfg_get_idx_str_val(cfg_t *cfg, int idx, char **rtn_value) {
+  cfg_option_t *option;
+  CFG_IDX_OPTION(cfg, idx, option);
+
+  ERR(cfg_option_expand(option->owner, option));
+
+  *rtn_value = option->expanded ? option->expanded : option->value;
+  return ERR_OK;
+}  /* cfg_get_idx_str_val */
+
+
+ERR_F cfg_get_idx_long_val(cfg_t *cfg, int idx, long *rtn_value) {
+  cfg_option_t *option;
+  CFG_IDX_OPTION(cfg, idx, option);
+
+  ERR(cfg_option_convert(option->owner, option, CFG_CONV_LONG));
+
+  *rtn_value = option->long_val;
+  return ERR_OK;
+}  /* cfg_get_idx_long_val */
+
+
+ERR_F cfg_get_idx_double_val(cfg_t *cfg, int idx, double *rtn_value) {
+  cfg_option_t *option;
+  CFG_IDX_OPTION(cfg, idx, option);
+
+  ERR(cfg_option_convert(option->owner, option, CFG_CONV_DOUBLE));
+
+  *rtn_value = option->double_val;
+  return ERR_OK;
+}  /* cfg_get_idx_double_val */
+
+
+ERR_F cfg_get_idx_bool_val(cfg_t *cfg, int idx, int *rtn_value) {
+  cfg_option_t *option;
+  CFG_IDX_OPTION(cfg, idx, option);
+
+  ERR(cfg_option_convert(option->owner, option, CFG_CONV_BOOL));
+
+  *rtn_value = option->bool_val;
+  return ERR_OK;
+}  /* cfg_get_idx_bool_val */
+
+
+ERR_F cfg_get_idx_size_val(cfg_t *cfg, int idx, size_t *rtn_value) {
+  cfg_option_t *option;
+  CFG_IDX_OPTION(cfg, idx, option);
+
+  ERR(cfg_option_convert(option->owner, option, CFG_CONV_SIZE));
+
+  *rtn_value = option->size_val;
+  return ERR_OK;
+}  /* cfg_get_idx_size_val */
+
+
+ERR_F cfg_get_idx_duration_val(cfg_t *cfg, int idx, long *rtn_ms) {
+  cfg_option_t *option;
+  CFG_IDX_OPTION(cfg, idx, option);
+
+  ERR(cfg_option_convert(option->owner, option, CFG_CONV_DURATION));
+
+  *rtn_ms = option->duration_ms_val;
+  return ERR_OK;
+}  /* cfg_get_idx_duration_val */
+
+
+ERR_F cfg_subscribe(cfg_t *cfg, const char *key, int flags, cfg_notify_cb_t cb, void *clientd, cfg_sub_t **rtn_sub) {
+  cfg_sub_t *sub;
+
+  ERR_ASSRT(cfg, CFG_ERR_PARAM);
+  ERR_ASSRT(key, CFG_ERR_PARAM);
+  ERR_ASSRT(cb, CFG_ERR_PARAM);
+  ERR_ASSRT((flags & ~(CFG_SUB_PREFIX | CFG_SUB_QUEUED)) == 0, CFG_ERR_PARAM);
+
+  ERR(cfg_mem_calloc(cfg, (void **)&sub, 1, sizeof(cfg_sub_t)));
+  err_t *err = cfg_mem_strdup(cfg, &sub->key, key);
+  if (err) {
+    err_mem_free(cfg->allocator, sub);
+    ERR_RETHROW(err, err->code);
+  }
+  sub->key_len = strlen(key);
+  sub->flags = flags;
+  sub->cb = cb;
+  sub->clientd = clientd;
+
+  sub->next = cfg->subs;
+  cfg->subs = sub;
+
+  if (rtn_sub) {
+    *rtn_sub = sub;
+  }
+  return ERR_OK;
+}  /* cfg_subscribe */
+
+
+ERR_F cfg_unsubscribe(cfg_t *cfg, cfg_sub_t *sub) {
+  ERR_ASSRT(cfg, CFG_ERR_PARAM);
+  ERR_ASSRT(sub, CFG_ERR_PARAM);
+
+  cfg_sub_t **link = &cfg->subs;
+  while (*link && *link != sub) {
+    link = &(*link)->next;
+  }
+  ERR_ASSRT(*link, CFG_ERR_PARAM);  /* Not subscribed to this cfg. */
+  *link = sub->next;
+
+  /* Drop undelivered notifications for this subscription. */
+  pthread_mutex_lock(&cfg->queue_lock);
+  cfg_notify_t **qlink = &cfg->queue_head;
+  cfg->queue_tail = NULL;
+  while (*qlink) {
+    cfg_notify_t *notify = *qlink;
+    if (notify->sub == sub) {
+      *qlink = notify->next;
+      err_mem_free(cfg->allocator, notify->key);
+      err_mem_free(cfg->allocator, notify->old_value);
+      err_mem_free(cfg->allocator, notify->new_value);
+      err_mem_free(cfg->allocator, notify);
+    } else {
+      cfg->queue_tail = notify;
+      qlink = &notify->next;
+    }
+  }
+  pthread_mutex_unlock(&cfg->queue_lock);
+
+  if (cfg->delivering) {  /* A callback's caller may still hold it. */
+    sub->dead = 1;
+    sub->retired_next = cfg->retired_subs;
+    cfg->retired_subs = sub;
+  } else {
+    err_mem_free(cfg->allocator, sub->key);
+    err_mem_free(cfg->allocator, sub);
+  }
+  return ERR_OK;
+}  /* cfg_unsubscribe */
+
+
+ERR_F cfg_batch_begin(cfg_t *cfg) {
+  ERR_ASSRT(cfg, CFG_ERR_PARAM);
+
+  cfg->batch_depth++;
+  return ERR_OK;
+}  /* cfg_batch_begin */
+
+
+ERR_F cfg_batch_end(cfg_t *cfg) {
+  ERR_ASSRT(cfg, CFG_ERR_PARAM);
+  ERR_ASSRT(cfg->batch_depth > 0, CFG_ERR_PARAM);
+
+  cfg->batch_depth--;
+  if (cfg->batch_depth == 0) {
+    ERR(cfg_notify_flush(cfg));
+  }
+  return ERR_OK;
+}  /* cfg_batch_end */
+
+
+ERR_F cfg_notify_fd(cfg_t *cfg, int *rtn_fd) {
+  ERR_ASSRT(cfg, CFG_ERR_PARAM);
+  ERR_ASSRT(rtn_fd, CFG_ERR_PARAM);
+
+#if defined(__linux__)
+  if (cfg->notify_fd == -1) {
+    cfg->notify_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    ERR_ASSRT(cfg->notify_fd != -1, CFG_ERR_INTERNAL);
+    if (cfg->queue_head) {  /* Notifications queued before the fd existed. */
+      cfg_notify_signal(cfg);
+    }
+  }
+  *rtn_fd = cfg->notify_fd;
+#else
+  ERR_THROW(CFG_ERR_PARAM, "notify fd requires eventfd");
+#endif
+
+  return ERR_OK;
+}  /* cfg_notify_fd */
+
+
+ERR_F cfg_notify_drain(cfg_t *cfg) {
+  err_t *first_err = ERR_OK;
+
+  ERR_ASSRT(cfg, CFG_ERR_PARAM);
+
+  pthread_mutex_lock(&cfg->queue_lock);
+  cfg_notify_t *notify = cfg->queue_head;
+  cfg->queue_head = NULL;
+  cfg->queue_tail = NULL;
+  if (cfg->notify_fd != -1) {
+    uint64_t count;  /* Reset the eventfd counter. */
+    if (read(cfg->notify_fd, &count, sizeof(count)) < 0) {
+      /* EAGAIN: nothing was signaled. */
+    }
+  }
+  pthread_mutex_unlock(&cfg->queue_lock);
+
+  cfg->delivering++;
+  while (notify) {
+    cfg_notify_t *next_notify = notify->next;
+    if (! notify->sub->dead) {  /* A callback may unsubscribe another. */
+      err_t *err = notify->sub->cb(cfg, notify->key, notify->old_value, notify->new_value, notify->sub->clientd);
+      if (err) {
+        if (first_err == ERR_OK) { first_err = err; } else { err_dispose(err); }
+      }
+    }
+    err_mem_free(cfg->allocator, notify->key);
+    err_mem_free(cfg->allocator, notify->old_value);
+    err_mem_free(cfg->allocator, notify->new_value);
+    err_mem_free(cfg->allocator, notify);
+    notify = next_notify;
+  }
+  cfg_deliver_end(cfg);
+
+  if (first_err) {
+    ERR_RETHROW(first_err, first_err->code);
+  }
+  return ERR_OK;
+}  /* cfg_notify_drain */
+
+
+/* Profiling is off by default. While on, public getters count reads of
+ * each key and cfg_parse_file() records timings. */
+ERR_F cfg_profile_enable(cfg_t *cfg, int enable) {
+  ERR_ASSRT(cfg, CFG_ERR_PARAM);
+
+  cfg->profile_enabled = enable;
+
+  return ERR_OK;
+}  /* cfg_profile_enable */
+
+
+ERR_F cfg_profile_reset(cfg_t *cfg) {
+  hmap_entry_t *entry = NULL;
+  int i;
+
+  ERR_ASSRT(cfg, CFG_ERR_PARAM);
+
+  do {
+    ERR(hmap_next(cfg->option_infos, &entry));
+    if (entry) {
+      cfg_option_t *option = (cfg_option_t *)entry->value;
+      __atomic_store_n(&option->num_reads, 0, __ATOMIC_RELAXED);
+    }
+  } while (entry);
+
+  for (i = 0; i < cfg->num_file_stats; i++) {
+    err_mem_free(cfg->allocator, cfg->file_stats[i].filename);
+  }
+  cfg->num_file_stats = 0;
+
+  return ERR_OK;
+}  /* cfg_profile_reset */
+
+
+int cfg_key_stat_cmp(const void *a, const void *b) {
+  const cfg_key_stat_t *sa = (const cfg_key_stat_t *)a;
+  const cfg_key_stat_t *sb = (const cfg_key_stat_t *)b;
+  if (sa->num_reads != sb->num_reads) { return (sa->num_reads < sb->num_reads) ? 1 : -1; }
+  return strcmp(sa->key, sb->key);
+}  /* cfg_key_stat_cmp */
+
+
+/* The cfg's own keys, most read first; never-read keys are at the end
+ * with num_reads 0. Caller frees the array with cfg_mem_free(cfg,
+ * stats); the key strings belong to the cfg. */
+ERR_F cfg_profile_keys(cfg_t *cfg, cfg_key_stat_t **rtn_stats, int *rtn_num_stats) {
+  hmap_entry_t *entry = NULL;
+  cfg_key_stat_t *stats;
+  int num_stats = 0;
+
+  ERR_ASSRT(cfg, CFG_ERR_PARAM);
+  ERR_ASSRT(rtn_stats, CFG_ERR_PARAM);
+  ERR_ASSRT(rtn_num_stats, CFG_ERR_PARAM);
+
+  ERR(cfg_mem_calloc(cfg, (void **)&stats, cfg->option_infos->num_entries + 1, sizeof(cfg_key_stat_t)));
+  do {
+    err_t *err = hmap_next(cfg->option_infos, &entry);
+    if (err) {
+      err_mem_free(cfg->allocator, stats);
+      ERR_RETHROW(err, err->code);
+    }
+    if (entry) {
+      cfg_option_t *option = (cfg_option_t *)entry->value;
+      stats[num_stats].key = option->key;
+      stats[num_stats].num_reads = __atomic_load_n(&option->num_reads, __ATOMIC_RELAXED);
+      num_stats++;
+    }
+  } while (entry);
+
+  if (num_stats > 1) {
+    qsort(stats, num_stats, sizeof(cfg_key_stat_t), cfg_key_stat_cmp);
+  }
+
+  *rtn_stats = stats;
+  *rtn_num_stats = num_stats;
+  return ERR_OK;
+}  /* cfg_profile_keys */
+
+
+/* Valid until the next cfg_parse_file() or cfg_profile_reset(). */
+ERR_F cfg_profile_files(cfg_t *cfg, const cfg_file_stat_t **rtn_stats, int *rtn_num_stats) {
+  ERR_ASSRT(cfg, CFG_ERR_PARAM);
+  ERR_ASSRT(rtn_stats, CFG_ERR_PARAM);
+  ERR_ASSRT(rtn_num_stats, CFG_ERR_PARAM);
+
+  *rtn_stats = cfg->file_stats;
+  *rtn_num_stats = cfg->num_file_stats;
+  return ERR_OK;
+}  /* cfg_profile_files */
+
+
+/* Buckets, entries, and copied keys. */
+ERR_F cfg_hmap_bytes(hmap_t *hmap, size_t *rtn_bytes) {
+  hmap_entry_t *entry = NULL;
+  size_t bytes = hmap->num_entries * sizeof(hmap_entry_t);
+
+  if (hmap->table) {
+    bytes += hmap->table_size * sizeof(hmap_entry_t *);
+  } else {
+    bytes += hmap->small_cap * (sizeof(hmap_entry_t *) + sizeof(uint64_t));
+  }
+
+  if (! (hmap->flags & HMAP_FLAG_NOCOPY_KEYS)) {
+    do {
+      ERR(hmap_next(hmap, &entry));
+      if (entry) {
+        bytes += entry->key_size;
+      }
+    } while (entry);
+  }
+
+  *rtn_bytes += bytes;
+  return ERR_OK;
+}  /* cfg_hmap_bytes */
+
+
+/* Approximate heap use of the cfg's own layer. Interned strings are
+ * counted in full even though they may be shared. */
+ERR_F cfg_profile_memory(cfg_t *cfg, cfg_mem_stat_t *rtn_stat) {
+  hmap_entry_t *entry = NULL;
+  cfg_mem_stat_t stat;
+
+  ERR_ASSRT(cfg, CFG_ERR_PARAM);
+  ERR_ASSRT(rtn_stat, CFG_ERR_PARAM);
+  memset(&stat, 0, sizeof(stat));
+
+  do {
+    ERR(hmap_next(cfg->option_infos, &entry));
+    if (entry) {
+      cfg_option_t *option = (cfg_option_t *)entry->value;
+      stat.num_keys++;
+      stat.key_bytes += strlen(option->key) + 1;
+      stat.value_bytes += strlen(option->value) + 1;
+      if (option->expanded) {
+        stat.value_bytes += strlen(option->expanded) + 1;
+      }
+      stat.value_bytes += option->num_strs * sizeof(cfg_span_t) + option->num_longs * sizeof(long);
+      stat.table_bytes += sizeof(cfg_option_t) + option->max_dependents * sizeof(cfg_option_t *);
+    }
+  } while (entry);
+
+  do {
+    ERR(hmap_next(cfg->option_locations, &entry));
+    if (entry) {
+      stat.location_bytes += strlen((char *)entry->value) + 1;
+    }
+  } while (entry);
+
+  ERR(cfg_hmap_bytes(cfg->option_vals, &stat.table_bytes));
+  ERR(cfg_hmap_bytes(cfg->option_locations, &stat.table_bytes));
+  ERR(cfg_hmap_bytes(cfg->option_infos, &stat.table_bytes));
+  if (cfg->layer_cache) {
+    stat.table_bytes += CFG_LAYER_CACHE_SIZE * sizeof(cfg_option_t *);
+  }
+  stat.table_bytes += sizeof(cfg_t);
+  stat.table_bytes += cfg->max_key_index * sizeof(cfg_option_t *);
+  stat.table_bytes += cfg->num_schema_options * sizeof(cfg_option_t *);
+
+  *rtn_stat = stat;
+  return ERR_OK;
+}  /* cfg_profile_memory */
+
+
+/* Text report: memory, then files, then keys, most read first. */
+ERR_F cfg_profile_dump(cfg_t *cfg, FILE *stream) {
+  cfg_mem_stat_t mem;
+  const cfg_file_stat_t *files;
+  cfg_key_stat_t *keys;
+  int num_files, num_keys, num_unread = 0;
+  int i;
+
+  ERR_ASSRT(cfg, CFG_ERR_PARAM);
+  ERR_ASSRT(stream, CFG_ERR_PARAM);
+
+  ERR(cfg_profile_memory(cfg, &mem));
+  ERR(cfg_profile_files(cfg, &files, &num_files));
+  ERR(cfg_profile_keys(cfg, &keys, &num_keys));
+
+  for (i = 0; i < num_keys; i++) {
+    if (keys[i].num_reads == 0) { num_unread++; }
+  }
+  fprintf(stream, "memory keys=%d key_bytes=%lu value_bytes=%lu location_bytes=%lu table_bytes=%lu\n",
+    mem.num_keys, (unsigned long)mem.key_bytes, (unsigned long)mem.value_bytes,
+    (unsigned long)mem.location_bytes, (unsigned long)mem.table_bytes);
+  for (i = 0; i < num_files; i++) {
+    fprintf(stream, "file %s parses=%d last_us=%.1f lines=%d bytes=%lu total_us=%.1f\n",
+      files[i].filename, files[i].num_parses, files[i].last_ns / 1000.0,
+      files[i].last_lines, (unsigned long)files[i].last_bytes, files[i].total_ns / 1000.0);
+  }
+  fprintf(stream, "reads keys=%d unread=%d\n", num_keys, num_unread);
+  for (i = 0; i < num_keys; i++) {
+    fprintf(stream, "key %s reads=%lu\n", keys[i].key, (unsigned long)keys[i].num_reads);
+  }
+  fflush(stream);
+
+  err_mem_free(cfg->allocator, keys);
+  return ERR_OK;
+}  /* cfg_profile_dump */
+
+
+/* Build the history from the current contents on the first snapshot.
+ * Until then sets don't pay for it. */
+ERR_F cfg_history_build(cfg_t *cfg) {
+  hmap_entry_t *entry = NULL;
+  err_t *err;
+
+  ERR(hamt_create(&cfg->history, cfg->allocator));
+  do {
+    err = hmap_next(cfg->option_infos, &entry);
+    if (err == ERR_OK && entry) {
+      cfg_option_t *option = (cfg_option_t *)entry->value;
+      char *location;
+      err = hmap_slookup(cfg->option_locations, option->key, (void **)&location);
+      if (err == ERR_OK) {
+        err = cfg_history_write(cfg, option->key, option->value, location);
+      }
+    }
+  } while (err == ERR_OK && entry);
+  if (err) {
+    ERR(hamt_delete(cfg->history));
+    cfg->history = NULL;
+    ERR_RETHROW(err, err->code);
+  }
+
+  return ERR_OK;
+}  /* cfg_history_build */
+
+
+/* O(1): the snapshot shares the cfg's current version of the history.
+ * Later sets copy only the paths to the keys they change. Covers the
+ * cfg's own layer, not a parent's. The snapshot may outlive the cfg. */
+ERR_F cfg_snapshot(cfg_t *cfg, cfg_snapshot_t **rtn_snap) {
+  cfg_snapshot_t *snap;
+  struct timespec ts;
+  err_t *err;
+
+  ERR_ASSRT(cfg, CFG_ERR_PARAM);
+  ERR_ASSRT(rtn_snap, CFG_ERR_PARAM);
+
+  if (cfg->history == NULL) {
+    ERR(cfg_history_build(cfg));
+  }
+  ERR(cfg_mem_calloc(cfg, (void **)&snap, 1, sizeof(cfg_snapshot_t)));
+  err = hamt_copy(&snap->map, cfg->history);
+  if (err) {
+    err_mem_free(cfg->allocator, snap);
+    ERR_RETHROW(err, err->code);
+  }
+  snap->version = cfg->version;
+  clock_gettime(CLOCK_REALTIME, &ts);
+  snap->time_ns = (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+
+  *rtn_snap = snap;
+  return ERR_OK;
+}  /* cfg_snapshot */
+
+
+ERR_F cfg_snapshot_delete(cfg_snapshot_t *snap) {
+  ERR_ASSRT(snap, CFG_ERR_PARAM);
+  const err_allocator_t *allocator = snap->map->allocator;
+
+  ERR(hamt_delete(snap->map));
+  err_mem_free(allocator, snap);
+
+  return ERR_OK;
+}  /* cfg_snapshot_delete */
+
+
+/* Value and location of a key as of the snapshot. Either output may be
+ * NULL. The strings are valid until the snapshot is deleted. */
+ERR_F cfg_snapshot_get(const cfg_snapshot_t *snap, const char *key, const char **rtn_value, const char **rtn_location) {
+  const void *blob;
+
+  ERR_ASSRT(snap, CFG_ERR_PARAM);
+  ERR_ASSRT(key, CFG_ERR_PARAM);
+
+  if (! hamt_try_lookup(snap->map, key, strlen(key) + 1, &blob, NULL)) {
+    ERR_THROW(HMAP_ERR_NOTFOUND, "key '%s' not found", key);
+  }
+  if (rtn_value) { *rtn_value = (const char *)blob; }
+  if (rtn_location) { *rtn_location = (const char *)blob + strlen((const char *)blob) + 1; }
+
+  return ERR_OK;
+}  /* cfg_snapshot_get */
+
+
+typedef struct cfg_snapshot_diff_s cfg_snapshot_diff_t;
+struct cfg_snapshot_diff_s {
+  cfg_snapshot_diff_cb_t cb;
+  void *clientd;
+};
+
+
+/* hamt_diff() callback: drop changes that only moved a key's location. */
+ERR_F cfg_snapshot_diff_entry(void *clientd, const void *key, size_t key_size,
+    const void *old_val, size_t old_val_size, const void *new_val, size_t new_val_size) {
+  cfg_snapshot_diff_t *diff = (cfg_snapshot_diff_t *)clientd;
+  (void)key_size; (void)old_val_size; (void)new_val_size;
+
+  if (old_val && new_val && strcmp((const char *)old_val, (const char *)new_val) == 0) {
+    return ERR_OK;
+  }
+  ERR(diff->cb((const char *)key, (const char *)old_val, (const char *)new_val, diff->clientd));
+
+  return ERR_OK;
+}  /* cfg_snapshot_diff_entry */
+
+
+/* Keys whose values differ between two snapshots of the same cfg. Only
+ * subtrees that differ are visited. The callback's strings are valid
+ * until the snapshots are deleted. */
+ERR_F cfg_snapshot_diff(const cfg_snapshot_t *from, const cfg_snapshot_t *to, cfg_snapshot_diff_cb_t cb, void *clientd) {
+  cfg_snapshot_diff_t diff;
+
+  ERR_ASSRT(from, CFG_ERR_PARAM);
+  ERR_ASSRT(to, CFG_ERR_PARAM);
+  ERR_ASSRT(cb, CFG_ERR_PARAM);
+  diff.cb = cb;
+  diff.clientd = clientd;
+
+  ERR(hamt_diff(from->map, to->map, cfg_snapshot_diff_entry, &diff));
+
+  return ERR_OK;
+}  /* cfg_snapshot_diff */
+
+
+/* hamt_diff() callback: keys can't be removed, so rollback is refused
+ * if any were added since the snapshot. */
+ERR_F cfg_rollback_check(void *clientd, const void *key, size_t key_size,
+    const void *old_val, size_t old_val_size, const void *new_val, size_t new_val_size) {
+  (void)clientd; (void)key_size; (void)old_val_size; (void)new_val_size;
+
+  if (old_val == NULL || new_val == NULL) {
+    ERR_THROW(CFG_ERR_ROLLBACK, "key '%s' was added after the snapshot", (const char *)key);
+  }
+
+  return ERR_OK;
+}  /* cfg_rollback_check */
+
+
+/* hamt_diff() callback: set a key back to its snapshot value and location. */
+ERR_F cfg_rollback_entry(void *clientd, const void *key, size_t key_size,
+    const void *old_val, size_t old_val_size, const void *new_val, size_t new_val_size) {
+  cfg_t *cfg = (cfg_t *)clientd;
+  const char *value = (const char *)old_val;
+  char *filename;
+  char *colon;
+  int line_num = 0;
+  err_t *err;
+  (void)key_size; (void)old_val_size; (void)new_val; (void)new_val_size;
+
+  ERR(cfg_mem_strdup(cfg, &filename, value + strlen(value) + 1));
+  colon = strrchr(filename, ':');
+  if (colon) {
+    *colon = '\0';
+    line_num = atoi(colon + 1);
+  }
+  err = cfg_parse_kv(cfg, CFG_MODE_UPDATE, (const char *)key, value, filename, line_num);
+  err_mem_free(cfg->allocator, filename);
+  if (err) {
+    ERR_RETHROW(err, err->code);
+  }
+
+  return ERR_OK;
+}  /* cfg_rollback_entry */
+
+
+/* Set every key changed since the snapshot back to its value and
+ * location then, as one batch. Only the changed keys are visited.
+ * Throws CFG_ERR_ROLLBACK (changing nothing) if keys were added since. */
+ERR_F cfg_rollback(cfg_t *cfg, const cfg_snapshot_t *snap) {
+  hamt_t *current;
+  err_t *err;
+
+  ERR_ASSRT(cfg, CFG_ERR_PARAM);
+  ERR_ASSRT(snap, CFG_ERR_PARAM);
+  ERR_ASSRT(! cfg->frozen, CFG_ERR_FROZEN);
+  ERR_ASSRT(cfg->history, CFG_ERR_PARAM);  /* No snapshot was taken of this cfg. */
+
+  /* The history moves on as keys are set; diff against a fixed version. */
+  ERR(hamt_copy(&current, cfg->history));
+  err = hamt_diff(snap->map, current, cfg_rollback_check, NULL);
+  if (err == ERR_OK) {
+    err = cfg_batch_begin(cfg);
+  }
+  if (err == ERR_OK) {
+    err = hamt_diff(snap->map, current, cfg_rollback_entry, cfg);
+    err_t *end_err = cfg_batch_end(cfg);
+    if (err == ERR_OK) {
+      err = end_err;
+    } else if (end_err) {
+      err_dispose(end_err);
+    }
+  }
+  ERR(hamt_delete(current));
+  if (err) {
+    ERR_RETHROW(err, err->code);
+  }
+
+  return ERR_OK;
+}  /* cfg_rollback */
@@ -15,20 +15,284 @@
 
 #include "err.h"
 #include "hmap.h"
+#include "hamt.h"
+#include "phash.h"
+#include "intern.h"
+#include <pthread.h>
 
 #ifdef __cplusplus
 extern "C" {
 #endif
 
-typedef struct cfg_s cfg_t;
+typedef struct cfg_s cfg_t;  /* Forward def. */
+
+/* Change notification callback. For a newly-added key, old_value is NULL.
+ * The strings are only valid for the duration of the call. */
+typedef err_t *(*cfg_notify_cb_t)(cfg_t *cfg, const char *key,
+  const char *old_value, const char *new_value, void *clientd);
+
+/* Callback for cfg_iterate_prefix(). Returning an error stops the
+ * iteration; the error is rethrown to the caller. */
+typedef err_t *(*cfg_iterate_cb_t)(cfg_t *cfg, const char *key, const char *value, void *clientd);
+
+/* Completion callback for cfg_load_submit(). load_err is NULL if the file
+ * was applied without error; it is disposed after the call. */
+typedef err_t *(*cfg_load_cb_t)(cfg_t *cfg, const char *filename, err_t *load_err, void *clientd);
+
+typedef struct cfg_sub_s cfg_sub_t;  /* Forward def. */
+struct cfg_sub_s {
+  char *key;  /* Key or key prefix. */
+  size_t key_len;
+  int flags;  /* CFG_SUB_* */
+  cfg_notify_cb_t cb;
+  void *clientd;
+  cfg_sub_t *next;
+  int dead;  /* Unsubscribed while callbacks were running. */
+  cfg_sub_t *retired_next;  /* Freed when the callbacks finish. */
+};
+
+/* Queued notification, waiting for cfg_notify_drain(). */
+typedef struct cfg_notify_s cfg_notify_t;  /* Forward def. */
+struct cfg_notify_s {
+  cfg_sub_t *sub;
+  char *key;
+  char *old_value;  /* NULL if key was added. */
+  char *new_value;
+  cfg_notify_t *next;
+};
+
+/* Typed conversions cached in cfg_option_t. */
+#define CFG_CONV_LONG 0x01
+#define CFG_CONV_DOUBLE 0x02
+#define CFG_CONV_BOOL 0x04
+#define CFG_CONV_SIZE 0x08
+#define CFG_CONV_DURATION 0x10
+#define CFG_CONV_STR_LIST 0x20
+#define CFG_CONV_LONG_LIST 0x40
+
+/* One element of a list value: a view into the value string, which is
+ * not null-terminated at the end of the element. */
+typedef struct cfg_span_s cfg_span_t;
+struct cfg_span_s {
+  const char *ptr;
+  size_t len;
+};
+
+/* Bound variable types. */
+#define CFG_BIND_LONG 1
+#define CFG_BIND_STR 2
+#define CFG_BIND_DOUBLE 3
+
+/* Application variable kept up to date by the library. */
+typedef struct cfg_bind_s cfg_bind_t;  /* Forward def. */
+struct cfg_bind_s {
+  int type;  /* CFG_BIND_* */
+  void *var;
+  char *str_copy;  /* CFG_BIND_STR: string the variable points at. */
+  cfg_bind_t *next;
+};
+
+/* Option types for schemas. */
+#define CFG_TYPE_STR 1
+#define CFG_TYPE_LONG 2
+#define CFG_TYPE_DOUBLE 3
+#define CFG_TYPE_BOOL 4
+#define CFG_TYPE_SIZE 5
+#define CFG_TYPE_DURATION 6
+
+/* One entry of a compiled-in option schema. Normally generated with an
+ * X-macro; see CFG_SCHEMA_ENUM and CFG_SCHEMA_TABLE. */
+typedef struct cfg_schema_s cfg_schema_t;
+struct cfg_schema_s {
+  int idx;  /* Must equal the entry's position in the table. */
+  const char *name;
+  int type;  /* CFG_TYPE_* */
+  const char *default_val;
+  int required;  /* Must be set after cfg_schema_apply(). */
+  double min;  /* Range checked for numeric types if min < max. */
+  double max;
+};
+
+/* Generators for an application's option list, which has the form:
+ *   #define MY_OPTIONS(X) \
+ *     X(OPT_MAX_LENGTH, "max_length", CFG_TYPE_LONG, "1024", 0, 1, 65536) \
+ *     X(OPT_TAG_NAME, "tag_name", CFG_TYPE_STR, "", 1, 0, 0)
+ *   enum { MY_OPTIONS(CFG_SCHEMA_ENUM) NUM_OPTS };
+ *   cfg_schema_t my_schema[] = { MY_OPTIONS(CFG_SCHEMA_TABLE) };
+ */
+#define CFG_SCHEMA_ENUM(idx, name, type, dflt, req, min, max) idx,
+#define CFG_SCHEMA_TABLE(idx, name, type, dflt, req, min, max) {idx, name, type, dflt, req, min, max},
+
+/* Per-option state derived from the value. Kept in cfg->option_infos. */
+typedef struct cfg_option_s cfg_option_t;  /* Forward def. */
+struct cfg_option_s {
+  cfg_t *owner;  /* Layer the option belongs to. */
+  char *key;
+  char *value;  /* Raw value; same pointer as in option_vals. */
+  char *expanded;  /* Memoized ${} substitution, NULL until first get; atomic. */
+  int has_subst;  /* Value contains "${". */
+  int expanding;  /* Loop detection, under owner's memo_lock. */
+  cfg_option_t **dependents;  /* Options whose expansion used this one. */
+  int num_dependents;
+  int max_dependents;
+  unsigned int conv_done;  /* CFG_CONV_* conversions attempted; atomic. */
+  unsigned int conv_bad;  /* CFG_CONV_* conversions that failed; atomic. */
+  long long_val;
+  double double_val;
+  int bool_val;
+  size_t size_val;
+  long duration_ms_val;
+  cfg_span_t *str_list;  /* Reused for the next value; see cfg_get_str_list(). */
+  int num_strs;
+  long *long_list;
+  int num_longs;
+  cfg_bind_t *binds;  /* Linked list. */
+  int schema_idx;  /* -1 if not in the schema. */
+  int num_updates;  /* Times set after being added. */
+  uint64_t num_reads;  /* Getter calls while profiling; atomic. */
+};
+
+/* Key with its hash computed ahead of time, for repeated lookups.
+ * key_size includes the null; hash is hmap_murmur3_32(key, key_size,
+ * HMAP_SEED). cfg.hpp builds these at compile time. */
+typedef struct cfg_hkey_s cfg_hkey_t;
+struct cfg_hkey_s {
+  const char *key;
+  size_t key_size;
+  uint32_t hash;
+};
+
+/* Parse profile of one file; see cfg_profile_enable(). */
+typedef struct cfg_file_stat_s cfg_file_stat_t;
+struct cfg_file_stat_s {
+  char *filename;
+  int num_parses;
+  uint64_t total_ns;  /* All parses. */
+  uint64_t last_ns;
+  int last_lines;
+  size_t last_bytes;
+};
+
+typedef struct cfg_key_stat_s cfg_key_stat_t;
+struct cfg_key_stat_s {
+  const char *key;
+  uint64_t num_reads;
+};
+
+typedef struct cfg_mem_stat_s cfg_mem_stat_t;
+struct cfg_mem_stat_s {
+  int num_keys;
+  size_t key_bytes;
+  size_t value_bytes;  /* Raw and expanded values, and lists. */
+  size_t location_bytes;
+  size_t table_bytes;  /* Hash maps, option structs, and indexes. */
+};
+
+/* Compiled-in keys, generated by cfg_compile; see cfg_create_static().
+ * Everything is const data. Arrays are indexed by slot (index.keys). */
+typedef struct cfg_static_s cfg_static_t;
+struct cfg_static_s {
+  phash_t index;
+  int num_keys;
+  const char *const *values;  /* Raw, but only ${env:} references remain. */
+  const char *const *locations;  /* "file:line" in the source .cfg. */
+};
+
+/* Position in one layer's own options; see cfg_layer_next(). Zero it to
+ * start. */
+typedef struct cfg_layer_pos_s cfg_layer_pos_t;
+struct cfg_layer_pos_s {
+  hmap_entry_t *entry;
+  uint32_t slot;  /* Compiled-in layer. */
+};
+
+/* Contents of a cfg at one point in time; see cfg_snapshot(). The map
+ * holds "value\0location\0" per key and shares unchanged entries with
+ * the cfg and other snapshots. */
+typedef struct cfg_snapshot_s cfg_snapshot_t;
+struct cfg_snapshot_s {
+  hamt_t *map;
+  uint64_t version;  /* Number of sets the cfg had seen. */
+  uint64_t time_ns;  /* CLOCK_REALTIME when taken. */
+};
+
+/* Called by cfg_snapshot_diff() for each key whose value differs.
+ * old_value or new_value is NULL if the key is only in one snapshot. */
+typedef err_t *(*cfg_snapshot_diff_cb_t)(const char *key,
+  const char *old_value, const char *new_value, void *clientd);
+
 struct cfg_s {
   hmap_t *option_vals;
   hmap_t *option_locations;
+  hmap_t *option_infos;  /* cfg_option_t per key. */
+  cfg_sub_t *subs;  /* Linked list of subscriptions. */
+  cfg_sub_t *retired_subs;  /* Unsubscribed during delivery; see dead. */
+  int delivering;  /* Depth of flushes and drains running callbacks. */
+  int batch_depth;  /* Notifications are delivered when this drops to 0. */
+  hmap_t *pending_changes;  /* Keys changed during current batch. */
+  struct cfg_pending_s *pending_head;  /* Order of first change. */
+  struct cfg_pending_s *pending_tail;
+  cfg_notify_t *queue_head;  /* For CFG_SUB_QUEUED subscriptions. */
+  cfg_notify_t *queue_tail;
+  pthread_mutex_t queue_lock;
+  pthread_mutex_t memo_lock;  /* Serializes the first expansion or conversion of a value. */
+  int notify_fd;  /* -1 if not created. */
+  cfg_option_t **rebinds;  /* Bound options invalidated by current update. */
+  int num_rebinds;
+  int max_rebinds;  /* At least num_bound, so an update can't fail to add one. */
+  int num_bound;  /* Options with at least one bound variable. */
+  char **retired_strs;  /* Strings bound variables used to point at. */
+  int num_retired_strs;
+  int max_retired_strs;
+  int num_old_retired_strs;  /* The first ones, retired before the last cfg_bind_reclaim(). */
+  const cfg_schema_t *schema;
+  cfg_option_t **schema_options;  /* Indexed by schema idx. */
+  int num_schema_options;
+  int key_index_enabled;
+  cfg_option_t **key_index;  /* Sorted by key up to num_key_index_sorted. */
+  int num_key_index;
+  int max_key_index;
+  int num_key_index_sorted;  /* Newer keys are appended unsorted. */
+  intern_pool_t *intern_pool;  /* NULL: keys, values, locations are malloced. */
+  int frozen;  /* No more changes; may be used as a parent. */
+  cfg_t *parent;  /* Overlay: lookups fall through to this frozen cfg. */
+  cfg_option_t **layer_cache;  /* Overlay: own or inherited option by key hash; atomic. */
+  int profile_enabled;
+  cfg_file_stat_t *file_stats;
+  int num_file_stats;
+  int max_file_stats;
+  const err_allocator_t *allocator;  /* Everything the cfg owns. */
+  struct cfg_load_s *load_head;  /* Async loads, in submission order. */
+  struct cfg_load_s *load_tail;
+  pthread_mutex_t load_lock;
+  pthread_cond_t load_cond;  /* A load finished reading. */
+  int load_fd;  /* -1 if not created. */
+  uint64_t version;  /* Incremented by every set. */
+  uint64_t generation;  /* Like version, for hot-key caches; atomic. */
+  hamt_t *history;  /* Current contents, for snapshots; NULL until the first. */
+  int hot_cache_enabled;  /* 0 or CFG_HOT_CACHE_*. */
+  const cfg_static_t *static_base;  /* Compiled-in layer: no maps of its own. */
+  cfg_option_t **static_options;  /* By slot, made on first lookup; atomic. */
+};
+
+/* Options for cfg_create_ex(). Zero-initialize for defaults. */
+typedef struct cfg_create_opts_s cfg_create_opts_t;
+struct cfg_create_opts_s {
+  const err_allocator_t *allocator;  /* NULL: err_get_allocator(). */
+  size_t expected_keys;  /* Sizes the tables; 0: default (1009 buckets). */
 };
 
 #define CFG_MODE_ADD 1
 #define CFG_MODE_UPDATE 2
 
+/* Subscription flags. */
+#define CFG_SUB_PREFIX 0x1  /* Key is a prefix; default is exact match. */
+#define CFG_SUB_QUEUED 0x2  /* Deliver from cfg_notify_drain() instead of inline. */
+
+/* cfg_hot_cache_enable() modes. */
+#define CFG_HOT_CACHE_ON 1  /* By key address; a key buffer must not be reused for another key. */
+#define CFG_HOT_CACHE_CHECK_KEY 2  /* Also compare the key, for reused buffers. */
+
 /* Maximum length of configuration line content (not including CR, LF, null). */
 #define CFG_MAX_LINE_LEN 1000  
 
@@ -49,15 +313,105 @@ ERR_CODE(CFG_ERR_NOEQUALS);
 ERR_CODE(CFG_ERR_NOKEY);
 ERR_CODE(CFG_ERR_UPDATE_KEY_NOT_FOUND);
 ERR_CODE(CFG_ERR_ADD_KEY_ALREADY_EXIST);
+ERR_CODE(CFG_ERR_SUBST);
+ERR_CODE(CFG_ERR_BAD_BOOL);
+ERR_CODE(CFG_ERR_REQUIRED);
+ERR_CODE(CFG_ERR_RANGE);
+ERR_CODE(CFG_ERR_FROZEN);
+ERR_CODE(CFG_ERR_ROLLBACK);
 #undef ERR_CODE
 
 ERR_F cfg_create(cfg_t **rtn_cfg);
+ERR_F cfg_create_ex(cfg_t **rtn_cfg, const cfg_create_opts_t *opts);
 ERR_F cfg_delete(cfg_t *cfg);
+ERR_F cfg_intern_pool(cfg_t *cfg, intern_pool_t *pool);
+ERR_F cfg_freeze(cfg_t *cfg);
+ERR_F cfg_create_overlay(cfg_t **rtn_cfg, cfg_t *parent);
+ERR_F cfg_create_static(cfg_t **rtn_cfg, const cfg_static_t *table);
+ERR_F cfg_layer_next(cfg_t *layer, cfg_layer_pos_t *pos, cfg_option_t **rtn_option);
+/* For code that walks layers: fill option->expanded (left NULL if the
+ * value has no references) without counting a read. cfg is the owner. */
+ERR_F cfg_option_expand(cfg_t *cfg, cfg_option_t *option);
+ERR_F cfg_get_source(cfg_t *cfg, const char *key, cfg_t **rtn_layer, const char **rtn_location);
 ERR_F cfg_parse_line(cfg_t *cfg, int mode, const char *iline, const char *filename, int line_num);
 ERR_F cfg_parse_file(cfg_t *cfg, int mode, const char *filename);
 ERR_F cfg_parse_string_list(cfg_t *cfg, int mode, char **string_list);
+ERR_F cfg_load_submit(cfg_t *cfg, int mode, const char *filename, cfg_load_cb_t cb, void *clientd);
+ERR_F cfg_load_fd(cfg_t *cfg, int *rtn_fd);
+ERR_F cfg_load_poll(cfg_t *cfg, int *rtn_num_pending);
+ERR_F cfg_load_wait(cfg_t *cfg);
+/* Getters may be called from any number of threads at once, frozen cfg
+ * or not; the first read of a value expands and converts it under a lock
+ * and later reads don't lock. Setting a key must not overlap any other
+ * call on the same cfg (freeze it, or use overlays, for lock-free sharing).
+ *
+ * The returned string is freed when the key is next set (or the cfg is
+ * deleted); copy it to keep it longer. Bound strings don't have this
+ * limit (see cfg_bind_str()). */
 ERR_F cfg_get_str_val(cfg_t *cfg, const char *key, char **rtn_value);
 ERR_F cfg_get_long_val(cfg_t *cfg, const char *key, long *rtn_value);
+ERR_F cfg_try_get_str_val(cfg_t *cfg, const char *key, char **rtn_value, int *rtn_found);
+ERR_F cfg_try_get_long_val(cfg_t *cfg, const char *key, long *rtn_value, int *rtn_found);
+void cfg_hkey_init(cfg_hkey_t *hkey, const char *key);
+ERR_F cfg_try_get_option_h(cfg_t *cfg, const cfg_hkey_t *hkey, unsigned int conv, cfg_option_t **rtn_option);
+ERR_F cfg_get_double_val(cfg_t *cfg, const char *key, double *rtn_value);
+ERR_F cfg_get_bool_val(cfg_t *cfg, const char *key, int *rtn_value);
+ERR_F cfg_get_size_val(cfg_t *cfg, const char *key, size_t *rtn_value);
+ERR_F cfg_get_duration_val(cfg_t *cfg, const char *key, long *rtn_ms);
+/* The typed getters' conversions, for values held elsewhere (see
+ * cfg_numa.c). Return 0 on success. */
+int cfg_conv_double(const char *val_str, double *rtn_value);
+int cfg_conv_bool(const char *val_str, int *rtn_value);
+int cfg_conv_size(const char *val_str, size_t *rtn_value);
+int cfg_conv_duration(const char *val_str, long *rtn_ms);
+/* The list and the strings its spans point into belong to the cfg. They
+ * stay valid until the key, or a key its value refers to, is next set;
+ * the next read after that splits the new value into the same buffer.
+ * Splitting happens once per value, under the cfg's memo_lock, so
+ * concurrent readers share one list. The same goes for long lists. */
+ERR_F cfg_get_str_list(cfg_t *cfg, const char *key, const cfg_span_t **rtn_list, int *rtn_num);
+ERR_F cfg_get_long_list(cfg_t *cfg, const char *key, const long **rtn_list, int *rtn_num);
+ERR_F cfg_bind_long(cfg_t *cfg, const char *key, long *var);
+ERR_F cfg_bind_str(cfg_t *cfg, const char *key, const char **var);
+ERR_F cfg_bind_double(cfg_t *cfg, const char *key, double *var);
+ERR_F cfg_unbind(cfg_t *cfg, const char *key, void *var);
+/* Free the strings bound variables stopped pointing at before the
+ * previous call; the ones retired since are kept until the next call.
+ * So a reader must not use a string loaded from a bound variable after
+ * the second call following the load. Calling it from a timer, say once
+ * a second, bounds both the memory and how long a reader may hold a
+ * string. Like a set, it must not overlap other calls on the cfg. */
+ERR_F cfg_bind_reclaim(cfg_t *cfg);
+ERR_F cfg_schema_apply(cfg_t *cfg, const cfg_schema_t *schema, int num_options);
+ERR_F cfg_schema_validate(cfg_t *cfg);
+ERR_F cfg_schema_idx(cfg_t *cfg, const char *key, int *rtn_idx);
+ERR_F cfg_get_idx_str_val(cfg_t *cfg, int idx, char **rtn_value);
+ERR_F cfg_get_idx_long_val(cfg_t *cfg, int idx, long *rtn_value);
+ERR_F cfg_get_idx_double_val(cfg_t *cfg, int idx, double *rtn_value);
+ERR_F cfg_get_idx_bool_val(cfg_t *cfg, int idx, int *rtn_value);
+ERR_F cfg_get_idx_size_val(cfg_t *cfg, int idx, size_t *rtn_value);
+ERR_F cfg_get_idx_duration_val(cfg_t *cfg, int idx, long *rtn_ms);
+ERR_F cfg_key_index_enable(cfg_t *cfg);
+ERR_F cfg_iterate_prefix(cfg_t *cfg, const char *prefix, cfg_iterate_cb_t cb, void *clientd);
+ERR_F cfg_subscribe(cfg_t *cfg, const char *key, int flags, cfg_notify_cb_t cb, void *clientd, cfg_sub_t **rtn_sub);
+ERR_F cfg_unsubscribe(cfg_t *cfg, cfg_sub_t *sub);
+ERR_F cfg_batch_begin(cfg_t *cfg);
+ERR_F cfg_batch_end(cfg_t *cfg);
+ERR_F cfg_notify_fd(cfg_t *cfg, int *rtn_fd);
+ERR_F cfg_notify_drain(cfg_t *cfg);
+ERR_F cfg_profile_enable(cfg_t *cfg, int enable);
+ERR_F cfg_profile_reset(cfg_t *cfg);
+ERR_F cfg_profile_keys(cfg_t *cfg, cfg_key_stat_t **rtn_stats, int *rtn_num_stats);
+ERR_F cfg_profile_files(cfg_t *cfg, const cfg_file_stat_t **rtn_stats, int *rtn_num_stats);
+ERR_F cfg_profile_memory(cfg_t *cfg, cfg_mem_stat_t *rtn_stat);
+ERR_F cfg_profile_dump(cfg_t *cfg, FILE *stream);
+ERR_F cfg_snapshot(cfg_t *cfg, cfg_snapshot_t **rtn_snap);
+ERR_F cfg_snapshot_delete(cfg_snapshot_t *snap);
+ERR_F cfg_snapshot_get(const cfg_snapshot_t *snap, const char *key, const char **rtn_value, const char **rtn_location);
+ERR_F cfg_snapshot_diff(const cfg_snapshot_t *from, const cfg_snapshot_t *to, cfg_snapshot_diff_cb_t cb, void *clientd);
+ERR_F cfg_rollback(cfg_t *cfg, const cfg_snapshot_t *snap);
+ERR_F cfg_hot_cache_enable(cfg_t *cfg, int enable);
+void cfg_mem_free(cfg_t *cfg, void *ptr);
 
 #ifdef __cplusplus
 }
@@ -0,0 +1,272 @@
+/* cfg.hpp - header-only C++17 wrapper for cfg. */
+
+/* This work is dedicated to the public domain under CC0 1.0 Universal:
+ * http://creativecommons.org/publicdomain/zero/1.0/
+ *
+ * To the extent possible under law, Steven Ford has waived all copyright
+ * and related or neighboring rights to this work. In other words, you can
+ * use this code for any purpose without any restrictions.
+ * This work is published from: United States.
+ * Project home: https://github.com/fordsfords/cfg
+ */
+
+#ifndef CFG_HPP
+#define CFG_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <limits>
+#include <optional>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <type_traits>
+#include <utility>
+#include "cfg.h"
+
+namespace cfg {
+
+/* Same result as hmap_murmur3_32(), usable in constant expressions.
+ * It reproduces the C version exactly, including reading block i at
+ * byte offset i, so hashes match the ones in the tables. */
+constexpr uint32_t murmur3_32(const char *key, std::size_t key_len, uint32_t seed) {
+  uint32_t h1 = seed;
+  const uint32_t c1 = 0xcc9e2d51;
+  const uint32_t c2 = 0x1b873593;
+  const int r1 = 15;
+  const int r2 = 13;
+
+  int nblocks = key_len / 4;
+  for (int i = 0; i < nblocks; i++) {
+    /* Native byte order, like the C version's memcpy(). */
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+    uint32_t k1 = (uint32_t)(uint8_t)key[i] << 24 | (uint32_t)(uint8_t)key[i + 1] << 16 |
+                  (uint32_t)(uint8_t)key[i + 2] << 8 | (uint32_t)(uint8_t)key[i + 3];
+#else
+    uint32_t k1 = (uint32_t)(uint8_t)key[i] | (uint32_t)(uint8_t)key[i + 1] << 8 |
+                  (uint32_t)(uint8_t)key[i + 2] << 16 | (uint32_t)(uint8_t)key[i + 3] << 24;
+#endif
+    k1 *= c1;
+    k1 = (k1 << r1) | (k1 >> (32 - r1));
+    k1 *= c2;
+
+    h1 ^= k1;
+    h1 = (h1 << r2) | (h1 >> (32 - r2));
+    h1 = h1 * 5 + 0xe6546b64;
+  }
+
+  uint32_t k1 = 0;
+  int tail_size = key_len & 3;
+  if (tail_size >= 3) k1 ^= (uint32_t)(uint8_t)key[nblocks * 4 + 2] << 16;
+  if (tail_size >= 2) k1 ^= (uint32_t)(uint8_t)key[nblocks * 4 + 1] << 8;
+  if (tail_size >= 1) {
+    k1 ^= (uint8_t)key[nblocks * 4];
+    k1 *= c1;
+    k1 = (k1 << r1) | (k1 >> (32 - r1));
+    k1 *= c2;
+    h1 ^= k1;
+  }
+
+  h1 ^= (uint32_t)key_len;
+  h1 ^= (h1 >> 16);
+  h1 *= 0x85ebca6b;
+  h1 ^= (h1 >> 13);
+  h1 *= 0xc2b2ae35;
+  h1 ^= (h1 >> 16);
+
+  return h1;
+}  /* murmur3_32 */
+
+
+/* A key with its table hash. A key built from a plain string is hashed
+ * at run time. For compile-time hashing, make it constexpr:
+ *   static constexpr cfg::key k_port("port");
+ * or use CFG_KEY("port") in place of the literal. The string must
+ * outlive the key. */
+class key {
+ public:
+  constexpr key(const char *str) : hkey_(make(str)) {}
+
+  /* For CFG_KEY(); hash must match key and key_size. */
+  constexpr key(const char *str, std::size_t key_size, uint32_t hash) : hkey_{str, key_size, hash} {}
+
+  const cfg_hkey_t *c_ptr() const noexcept { return &hkey_; }
+  constexpr std::string_view name() const noexcept { return std::string_view(hkey_.key, hkey_.key_size - 1); }
+  constexpr uint32_t hash() const noexcept { return hkey_.hash; }
+
+ private:
+  static constexpr cfg_hkey_t make(const char *str) {
+    std::size_t key_size = 1;  /* Tables count the null. */
+    while (str[key_size - 1] != '\0') {
+      key_size++;
+    }
+    return cfg_hkey_t{str, key_size, murmur3_32(str, key_size, HMAP_SEED)};
+  }
+
+  cfg_hkey_t hkey_;
+};  /* key */
+
+/* Literal key hashed at compile time even in an unoptimized build; the
+ * template argument forces constant evaluation. */
+#define CFG_KEY(cfg__lit) (::cfg::key((cfg__lit), sizeof(cfg__lit), \
+  std::integral_constant<uint32_t, ::cfg::murmur3_32((cfg__lit), sizeof(cfg__lit), HMAP_SEED)>::value))
+
+
+/* Thrown in place of an err_t. code() is the err code (compare with,
+ * e.g., HMAP_ERR_NOTFOUND); what() is the stack trace. */
+class error : public std::runtime_error {
+ public:
+  error(const char *code, const std::string &what) : std::runtime_error(what), code_(code) {}
+
+  const char *code() const noexcept { return code_; }
+
+ private:
+  const char *code_;
+};  /* error */
+
+
+/* Throw err, if any, as cfg::error. Takes care of disposing it. */
+inline void check(err_t *err) {
+  if (err == ERR_OK) {
+    return;
+  }
+  const char *code = err->code;
+  std::string what;
+  for (err_t *frame = err; frame != NULL; frame = frame->stacktrace) {
+    const char *mesg = err_mesg(frame);
+    what += std::string("[") + frame->file + ":" + std::to_string(frame->line) + " " + frame->func +
+            "()]: Code: " + frame->code + ", Mesg: " + (mesg ? mesg : "(no mesg)") + "\n";
+  }
+  err_dispose(err);
+  throw error(code, what);
+}  /* check */
+
+
+namespace detail {
+
+template <typename T> inline constexpr bool always_false = false;
+
+template <typename T> constexpr unsigned int conv_for() {
+  if constexpr (std::is_same_v<T, std::string_view>) {
+    return 0;
+  } else if constexpr (std::is_same_v<T, bool>) {
+    return CFG_CONV_BOOL;
+  } else if constexpr (std::is_integral_v<T>) {
+    return CFG_CONV_LONG;
+  } else if constexpr (std::is_floating_point_v<T>) {
+    return CFG_CONV_DOUBLE;
+  } else {
+    static_assert(always_false<T>, "cfg: get<T>() supports integral, floating, bool, and std::string_view");
+  }
+}  /* conv_for */
+
+
+template <typename T> T option_value(const cfg_option_t *option, const key &k) {
+  if constexpr (std::is_same_v<T, std::string_view>) {
+    return std::string_view(option->expanded ? option->expanded : option->value);
+  } else if constexpr (std::is_same_v<T, bool>) {
+    return option->bool_val != 0;
+  } else if constexpr (std::is_integral_v<T>) {
+    long val = option->long_val;
+    bool fits;
+    if constexpr (std::is_signed_v<T>) {
+      fits = val >= (long long)std::numeric_limits<T>::min() && val <= (long long)std::numeric_limits<T>::max();
+    } else {
+      fits = val >= 0 && (unsigned long long)val <= std::numeric_limits<T>::max();
+    }
+    if (!fits) {
+      throw error(CFG_ERR_RANGE, "key '" + std::string(k.name()) + "' value " + std::to_string(val) + " out of range");
+    }
+    return static_cast<T>(val);
+  } else {
+    return static_cast<T>(option->double_val);
+  }
+}  /* option_value */
+
+}  /* namespace detail */
+
+
+/* Owns a cfg_t. Lookups use pre-hashed keys and return values without
+ * copying; a std::string_view stays valid until the key is changed or
+ * the cfg is deleted, like cfg_get_str_val(). */
+class config {
+ public:
+  config() { check(cfg_create(&cfg_)); }
+
+  explicit config(const err_allocator_t *allocator) {
+    cfg_create_opts_t opts = {allocator, 0};
+    check(cfg_create_ex(&cfg_, &opts));
+  }
+
+  /* Take ownership of an existing cfg. */
+  explicit config(cfg_t *cfg) noexcept : cfg_(cfg) {}
+
+  ~config() { reset(); }
+
+  config(const config &) = delete;
+  config &operator=(const config &) = delete;
+
+  config(config &&other) noexcept : cfg_(std::exchange(other.cfg_, nullptr)) {}
+
+  config &operator=(config &&other) noexcept {
+    if (this != &other) {
+      reset();
+      cfg_ = std::exchange(other.cfg_, nullptr);
+    }
+    return *this;
+  }
+
+  cfg_t *c_ptr() const noexcept { return cfg_; }
+
+  cfg_t *release() noexcept { return std::exchange(cfg_, nullptr); }
+
+  void parse_file(const char *filename, int mode = CFG_MODE_ADD) {
+    check(cfg_parse_file(cfg_, mode, filename));
+  }
+
+  void parse_line(const char *line, int mode = CFG_MODE_ADD, const char *filename = "", int line_num = 0) {
+    check(cfg_parse_line(cfg_, mode, line, filename, line_num));
+  }
+
+  void freeze() { check(cfg_freeze(cfg_)); }
+
+  /* New layer on top of this (frozen) cfg, which must outlive it. */
+  config overlay() const {
+    cfg_t *overlay_cfg;
+    check(cfg_create_overlay(&overlay_cfg, cfg_));
+    return config(overlay_cfg);
+  }
+
+  /* Missing key: std::nullopt. Bad value: throws cfg::error. */
+  template <typename T> std::optional<T> try_get(const key &k) const {
+    cfg_option_t *option;
+    check(cfg_try_get_option_h(cfg_, k.c_ptr(), detail::conv_for<T>(), &option));
+    if (option == NULL) {
+      return std::nullopt;
+    }
+    return detail::option_value<T>(option, k);
+  }
+
+  /* Missing key: throws cfg::error with code HMAP_ERR_NOTFOUND. */
+  template <typename T> T get(const key &k) const {
+    std::optional<T> val = try_get<T>(k);
+    if (!val) {
+      throw error(HMAP_ERR_NOTFOUND, "key '" + std::string(k.name()) + "' not found");
+    }
+    return *val;
+  }
+
+ private:
+  void reset() noexcept {
+    if (cfg_) {
+      err_dispose(cfg_delete(cfg_));
+      cfg_ = nullptr;
+    }
+  }
+
+  cfg_t *cfg_ = nullptr;
+};  /* config */
+
+}  /* namespace cfg */
+
+#endif  /* CFG_HPP */
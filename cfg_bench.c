@@ -0,0 +1,527 @@
+/* cfg_bench.c - performance benchmarks for cfg and hmap. */
+
+/* This work is dedicated to the public domain under CC0 1.0 Universal:
+ * http://creativecommons.org/publicdomain/zero/1.0/
+ *
+ * To the extent possible under law, Steven Ford has waived all copyright
+ * and related or neighboring rights to this work. In other words, you can
+ * use this code for any purpose without any restrictions.
+ * This work is published from: United States.
+ * Project home: https://github.com/fordsfords/cfg
+ */
+
+#define _POSIX_C_SOURCE 200809L  /* For clock_gettime(), mkstemp(). */
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+#include "err.h"
+#include "hmap.h"
+#include "phash.h"
+#include "cfg.h"
+
+
+#define E(e__test) do { \
+  err_t *e__err = (e__test); \
+  if (e__err != ERR_OK) { \
+    printf("ERROR [%s:%d]: '%s' returned error\n", __FILE__, __LINE__, #e__test); \
+    ERR_ABRT_ON_ERR(e__err, stdout); \
+    exit(1); \
+  } \
+} while (0)
+
+#define KEY_SIZE 64
+#define MAX_THREADS 64
+
+
+/* Options */
+int o_max_keys = 10000;
+int o_max_threads = 4;
+int o_samples = 100000;
+
+
+/* Timed loops add their results here so the compiler keeps them. */
+volatile long sink;
+
+
+char usage_str[] = "Usage: cfg_bench [-h] [-n max_keys] [-s samples] [-t max_threads]";
+void usage(char *msg) {
+  if (msg) fprintf(stderr, "\n%s\n\n", msg);
+  fprintf(stderr, "%s\n", usage_str);
+  exit(1);
+}  /* usage */
+
+void help() {
+  printf("%s\n"
+    "where:\n"
+    "  -h - print help\n"
+    "  -n max_keys - largest config, in keys; sizes are 1000, 10000, ... [10000].\n"
+    "  -s samples - timed lookups per latency measurement [100000].\n"
+    "  -t max_threads - largest thread count for read scaling and bulk builds [4].\n"
+    "Output is CSV: benchmark,keys,param,metric,value\n",
+    usage_str);
+  exit(0);
+}  /* help */
+
+
+void parse_cmdline(int argc, char **argv) {
+  int i;
+
+  for (i = 1; i < argc; i++) {
+    if (strcmp(argv[i], "-h") == 0) {
+      help();  exit(0);
+
+    } else if (strcmp(argv[i], "-n") == 0) {
+      if ((i + 1) < argc) {
+        i++;
+        o_max_keys = atoi(argv[i]);
+        if (o_max_keys < 1000) { usage("-n must be at least 1000"); }
+      } else { usage("-n requires max_keys"); }
+
+    } else if (strcmp(argv[i], "-s") == 0) {
+      if ((i + 1) < argc) {
+        i++;
+        o_samples = atoi(argv[i]);
+        if (o_samples <= 0) { usage("-s must be positive"); }
+      } else { usage("-s requires samples"); }
+
+    } else if (strcmp(argv[i], "-t") == 0) {
+      if ((i + 1) < argc) {
+        i++;
+        o_max_threads = atoi(argv[i]);
+        if (o_max_threads <= 0 || o_max_threads > MAX_THREADS) { usage("-t must be 1 to 64"); }
+      } else { usage("-t requires max_threads"); }
+
+    } else { usage("unknown option"); }
+  }  /* for i */
+}  /* parse_cmdline */
+
+
+uint64_t now_ns() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}  /* now_ns */
+
+
+/* Deterministic so runs are comparable. */
+uint64_t rand_state = 0x9E3779B97F4A7C15ULL;
+uint64_t rand64() {
+  rand_state ^= rand_state << 13;
+  rand_state ^= rand_state >> 7;
+  rand_state ^= rand_state << 17;
+  return rand_state;
+}  /* rand64 */
+
+
+void result(const char *benchmark, int num_keys, const char *param, const char *metric, double value) {
+  printf("%s,%d,%s,%s,%.2f\n", benchmark, num_keys, param, metric, value);
+  fflush(stdout);
+}  /* result */
+
+
+/* Synthetic config. Keys are 8 to ~60 characters; the value type cycles
+ * through what real configs hold. Every 8th key starting at 0, 1, and 2
+ * has a long value. */
+char *keys;  /* num_keys * KEY_SIZE. */
+char *miss_keys;
+char cfg_path[] = "/tmp/cfg_bench_XXXXXX";
+size_t cfg_bytes;
+
+#define KEY(keys__, i__) (&(keys__)[(size_t)(i__) * KEY_SIZE])
+
+void gen_config(int num_keys) {
+  static const char *sections[] = {"md", "order_entry", "risk", "log", "net_tcp", "net_udp", "feed", "x"};
+  int i;
+
+  free(keys);
+  free(miss_keys);
+  keys = malloc((size_t)num_keys * KEY_SIZE);
+  miss_keys = malloc((size_t)num_keys * KEY_SIZE);
+  if (keys == NULL || miss_keys == NULL) { fprintf(stderr, "malloc failed\n"); exit(1); }
+
+  strcpy(cfg_path, "/tmp/cfg_bench_XXXXXX");
+  int fd = mkstemp(cfg_path);
+  if (fd == -1) { perror("mkstemp"); exit(1); }
+  FILE *fp = fdopen(fd, "w");
+  if (fp == NULL) { perror("fdopen"); exit(1); }
+
+  for (i = 0; i < num_keys; i++) {
+    int pad = (int)(rand64() % 40);
+    snprintf(KEY(keys, i), KEY_SIZE, "%s_%.*s%d", sections[i % 8], pad,
+      "symbol_limit_threshold_interval_window_", i);
+    snprintf(KEY(miss_keys, i), KEY_SIZE, "%s_%.*s%dx", sections[i % 8], pad,
+      "symbol_limit_threshold_interval_window_", i);
+
+    switch (i % 8) {
+      case 0: fprintf(fp, "%s = %ld\n", KEY(keys, i), (long)(rand64() % 10000000)); break;
+      case 1: fprintf(fp, "%s = %d %03d %03d\n", KEY(keys, i), (int)(rand64() % 1000),
+                (int)(rand64() % 1000), (int)(rand64() % 1000)); break;
+      case 2: fprintf(fp, "%s = 0x%lx\n", KEY(keys, i), (unsigned long)(rand64() % 0xffffff)); break;
+      case 3: fprintf(fp, "%s = %.2f\n", KEY(keys, i), (double)(rand64() % 100000) / 100.0); break;
+      case 4: fprintf(fp, "%s = %s\n", KEY(keys, i), (i & 8) ? "yes" : "off"); break;
+      case 5: fprintf(fp, "%s = %dK\n", KEY(keys, i), (int)(rand64() % 1024)); break;
+      case 6: fprintf(fp, "%s = %dms  # Timeout.\n", KEY(keys, i), (int)(rand64() % 5000)); break;
+      default: fprintf(fp, "%s = host%d.example.com, 10.0.0.%d, eth%d\n", KEY(keys, i),
+                 (int)(rand64() % 100), (int)(rand64() % 256), (int)(rand64() % 4)); break;
+    }
+  }
+  cfg_bytes = (size_t)ftell(fp);
+  fclose(fp);
+}  /* gen_config */
+
+
+cfg_t *load_config() {
+  cfg_t *cfg;
+  E(cfg_create(&cfg));
+  E(cfg_parse_file(cfg, CFG_MODE_ADD, cfg_path));
+  return cfg;
+}  /* load_config */
+
+
+void bench_parse(int num_keys) {
+  int reps = 200000 / num_keys;  /* Best of several for small configs. */
+  uint64_t best_ns = UINT64_MAX;
+  int rep;
+
+  if (reps < 1) { reps = 1; }
+  for (rep = 0; rep < reps; rep++) {
+    cfg_t *cfg;
+    E(cfg_create(&cfg));
+    uint64_t start = now_ns();
+    E(cfg_parse_file(cfg, CFG_MODE_ADD, cfg_path));
+    uint64_t elapsed = now_ns() - start;
+    if (elapsed < best_ns) { best_ns = elapsed; }
+    E(cfg_delete(cfg));
+  }
+
+  double secs = (double)best_ns / 1e9;
+  result("parse", num_keys, "-", "mb_per_s", (double)cfg_bytes / 1e6 / secs);
+  result("parse", num_keys, "-", "lines_per_s", (double)num_keys / secs);
+}  /* bench_parse */
+
+
+int u64_cmp(const void *a, const void *b) {
+  uint64_t va = *(const uint64_t *)a;
+  uint64_t vb = *(const uint64_t *)b;
+  return (va > vb) - (va < vb);
+}  /* u64_cmp */
+
+
+/* Cost of the two clock reads around each timed call. */
+uint64_t timer_overhead_ns() {
+  uint64_t samples[1001];
+  int i;
+  for (i = 0; i < 1001; i++) {
+    uint64_t start = now_ns();
+    samples[i] = now_ns() - start;
+  }
+  qsort(samples, 1001, sizeof(uint64_t), u64_cmp);
+  return samples[500];
+}  /* timer_overhead_ns */
+
+
+void percentiles(const char *benchmark, int num_keys, uint64_t *samples, int num_samples) {
+  static const double pcts[] = {50.0, 90.0, 99.0, 99.9};
+  static const char *names[] = {"p50_ns", "p90_ns", "p99_ns", "p999_ns"};
+  size_t i;
+
+  qsort(samples, num_samples, sizeof(uint64_t), u64_cmp);
+  for (i = 0; i < sizeof(pcts) / sizeof(pcts[0]); i++) {
+    int idx = (int)(pcts[i] / 100.0 * (num_samples - 1));
+    result(benchmark, num_keys, "-", names[i], (double)samples[idx]);
+  }
+}  /* percentiles */
+
+
+void bench_lookup(cfg_t *cfg, int num_keys) {
+  uint64_t *samples = malloc(o_samples * sizeof(uint64_t));
+  uint64_t overhead = timer_overhead_ns();
+  char *val;
+  int found;
+  int i;
+
+  if (samples == NULL) { fprintf(stderr, "malloc failed\n"); exit(1); }
+
+  for (i = 0; i < o_samples; i++) {
+    const char *key = KEY(keys, rand64() % num_keys);
+    uint64_t start = now_ns();
+    E(cfg_try_get_str_val(cfg, key, &val, &found));
+    uint64_t elapsed = now_ns() - start;
+    samples[i] = (elapsed > overhead) ? (elapsed - overhead) : 0;
+    if (! found) { fprintf(stderr, "lookup: '%s' not found\n", key); exit(1); }
+  }
+  percentiles("lookup_hit", num_keys, samples, o_samples);
+
+  for (i = 0; i < o_samples; i++) {
+    const char *key = KEY(miss_keys, rand64() % num_keys);
+    uint64_t start = now_ns();
+    E(cfg_try_get_str_val(cfg, key, &val, &found));
+    uint64_t elapsed = now_ns() - start;
+    samples[i] = (elapsed > overhead) ? (elapsed - overhead) : 0;
+    if (found) { fprintf(stderr, "lookup: '%s' found\n", key); exit(1); }
+  }
+  percentiles("lookup_miss", num_keys, samples, o_samples);
+
+  free(samples);
+}  /* bench_lookup */
+
+
+/* First get converts and caches; later gets return the cached value. */
+void bench_get_long(int num_keys) {
+  cfg_t *cfg = load_config();
+  long value;
+  long sum = 0;
+  int num_gets = 0;
+  int i, pass;
+
+  for (pass = 0; pass < 2; pass++) {
+    uint64_t start = now_ns();
+    for (i = 0; i < num_keys; i++) {
+      if (i % 8 <= 2) {
+        E(cfg_get_long_val(cfg, KEY(keys, i), &value));
+        sum += value;
+        num_gets++;
+      }
+    }
+    uint64_t elapsed = now_ns() - start;
+    result("get_long", num_keys, (pass == 0) ? "cold" : "cached", "ns_per_op", (double)elapsed / num_gets);
+    num_gets = 0;
+  }
+  sink += sum;
+
+  E(cfg_delete(cfg));
+}  /* bench_get_long */
+
+
+/* A dozen keys read over and over, with and without the hot-key cache. */
+void bench_hot_keys(int num_keys) {
+  cfg_t *cfg = load_config();
+  const char *hot[12];
+  long value;
+  long sum = 0;
+  int num_gets = o_samples * 10;
+  int i, pass;
+
+  for (i = 0; i < 12; i++) {
+    hot[i] = KEY(keys, (i * 8) % num_keys);  /* Multiples of 8: long values. */
+  }
+  for (pass = 0; pass < 2; pass++) {
+    E(cfg_hot_cache_enable(cfg, (pass == 0) ? 0 : CFG_HOT_CACHE_ON));
+    uint64_t start = now_ns();
+    for (i = 0; i < num_gets; i++) {
+      E(cfg_get_long_val(cfg, hot[i % 12], &value));
+      sum += value;
+    }
+    uint64_t elapsed = now_ns() - start;
+    result("get_long_hot", num_keys, (pass == 0) ? "no_cache" : "hot_cache", "ns_per_op", (double)elapsed / num_gets);
+  }
+  sink += sum;
+
+  E(cfg_delete(cfg));
+}  /* bench_hot_keys */
+
+
+void bench_hmap(int num_keys) {
+  static const double loads[] = {0.5, 1.0, 2.0, 4.0};
+  size_t l;
+  int i;
+
+  for (l = 0; l < sizeof(loads) / sizeof(loads[0]); l++) {
+    hmap_t *hmap;
+    hmap_entry_t *entry = NULL;
+    char param[32];
+    size_t table_size = (size_t)(num_keys / loads[l]);
+    int num_entries = 0;
+
+    snprintf(param, sizeof(param), "load_%.1f", loads[l]);
+    E(hmap_create(&hmap, table_size));
+
+    uint64_t start = now_ns();
+    for (i = 0; i < num_keys; i++) {
+      E(hmap_swrite(hmap, KEY(keys, i), KEY(keys, i)));
+    }
+    uint64_t elapsed = now_ns() - start;
+    result("hmap_insert", num_keys, param, "ns_per_op", (double)elapsed / num_keys);
+
+    start = now_ns();
+    do {
+      E(hmap_next(hmap, &entry));
+      if (entry) { num_entries++; }
+    } while (entry);
+    elapsed = now_ns() - start;
+    if (num_entries != num_keys) { fprintf(stderr, "hmap: iterated %d of %d\n", num_entries, num_keys); exit(1); }
+    result("hmap_iterate", num_keys, param, "ns_per_entry", (double)elapsed / num_keys);
+
+    E(hmap_delete(hmap));
+  }
+
+  /* Bulk build at load 1.0, by thread count. */
+  const void **key_ptrs = (const void **)malloc(num_keys * sizeof(void *));
+  if (key_ptrs == NULL) { fprintf(stderr, "malloc failed\n"); exit(1); }
+  for (i = 0; i < num_keys; i++) {
+    key_ptrs[i] = KEY(keys, i);
+  }
+  int num_threads;
+  for (num_threads = 1; num_threads <= o_max_threads; num_threads *= 2) {
+    hmap_t *hmap;
+    char param[32];
+
+    snprintf(param, sizeof(param), "threads_%d", num_threads);
+    E(hmap_create(&hmap, num_keys));
+    uint64_t start = now_ns();
+    E(hmap_bulk_build(hmap, key_ptrs, NULL, (void *const *)key_ptrs, num_keys, num_threads));
+    uint64_t elapsed = now_ns() - start;
+    if (hmap->num_entries != num_keys) { fprintf(stderr, "hmap: built %d of %d\n", hmap->num_entries, num_keys); exit(1); }
+    result("hmap_bulk_build", num_keys, param, "ns_per_op", (double)elapsed / num_keys);
+    E(hmap_delete(hmap));
+  }
+  free(key_ptrs);
+}  /* bench_hmap */
+
+
+/* What cfg_compile tables use, against the hmap a parsed cfg uses. */
+void bench_phash(int num_keys) {
+  const char **key_ptrs = malloc(num_keys * sizeof(char *));
+  phash_t *phash;
+  hmap_t *hmap;
+  uint64_t state = 0x9E3779B97F4A7C15ULL;
+  long sum = 0;
+  int i;
+
+  if (key_ptrs == NULL) { fprintf(stderr, "malloc failed\n"); exit(1); }
+  for (i = 0; i < num_keys; i++) {
+    key_ptrs[i] = KEY(keys, i);
+  }
+  uint64_t start = now_ns();
+  E(phash_build(&phash, key_ptrs, num_keys, NULL));
+  uint64_t elapsed = now_ns() - start;
+  result("phash_build", num_keys, "-", "ns_per_op", (double)elapsed / num_keys);
+
+  E(hmap_create(&hmap, num_keys));
+  for (i = 0; i < num_keys; i++) {
+    E(hmap_swrite(hmap, key_ptrs[i], (void *)key_ptrs[i]));
+  }
+
+  start = now_ns();
+  for (i = 0; i < o_samples; i++) {
+    state ^= state << 13;  state ^= state >> 7;  state ^= state << 17;
+    const char *key = key_ptrs[state % num_keys];
+    sum += phash_find(phash, key, strlen(key) + 1);
+  }
+  elapsed = now_ns() - start;
+  result("static_lookup", num_keys, "phash", "ns_per_op", (double)elapsed / o_samples);
+
+  start = now_ns();
+  for (i = 0; i < o_samples; i++) {
+    void *val;
+    state ^= state << 13;  state ^= state >> 7;  state ^= state << 17;
+    sum += hmap_try_slookup(hmap, key_ptrs[state % num_keys], &val);
+  }
+  elapsed = now_ns() - start;
+  result("static_lookup", num_keys, "hmap", "ns_per_op", (double)elapsed / o_samples);
+  sink += sum;
+
+  E(hmap_delete(hmap));
+  E(phash_delete(phash, NULL));
+  free(key_ptrs);
+}  /* bench_phash */
+
+
+typedef struct reader_s reader_t;
+struct reader_s {
+  pthread_t thread;
+  cfg_t *cfg;
+  int num_keys;
+  int num_reads;
+  uint64_t seed;
+  uint64_t elapsed_ns;
+};
+
+void *reader_thread(void *arg) {
+  reader_t *reader = (reader_t *)arg;
+  uint64_t state = reader->seed;
+  long value;
+  long sum = 0;
+  int i;
+
+  uint64_t start = now_ns();
+  for (i = 0; i < reader->num_reads; i++) {
+    state ^= state << 13;  state ^= state >> 7;  state ^= state << 17;
+    int k = (int)(state % reader->num_keys) & ~7;  /* Multiple of 8: a long value. */
+    E(cfg_get_long_val(reader->cfg, KEY(keys, k), &value));
+    sum += value;
+  }
+  reader->elapsed_ns = now_ns() - start;
+  __atomic_fetch_add(&sink, sum, __ATOMIC_RELAXED);  /* Readers run at once. */
+
+  return NULL;
+}  /* reader_thread */
+
+
+/* Frozen cfgs are read-only, so readers need no locking. */
+void bench_threads(int num_keys) {
+  reader_t readers[MAX_THREADS];
+  cfg_t *cfg = load_config();
+  int num_threads, i;
+
+  E(cfg_freeze(cfg));
+  num_threads = 1;
+  while (1) {
+    uint64_t max_ns = 0;
+    char param[32];
+
+    for (i = 0; i < num_threads; i++) {
+      readers[i].cfg = cfg;
+      readers[i].num_keys = num_keys;
+      readers[i].num_reads = o_samples * 10;
+      readers[i].seed = rand64() | 1;
+      if (pthread_create(&readers[i].thread, NULL, reader_thread, &readers[i]) != 0) {
+        fprintf(stderr, "pthread_create failed\n");  exit(1);
+      }
+    }
+    for (i = 0; i < num_threads; i++) {
+      pthread_join(readers[i].thread, NULL);
+      if (readers[i].elapsed_ns > max_ns) { max_ns = readers[i].elapsed_ns; }
+    }
+
+    snprintf(param, sizeof(param), "threads_%d", num_threads);
+    result("read_scaling", num_keys, param, "mops_per_s",
+      (double)num_threads * o_samples * 10 / ((double)max_ns / 1e3));
+    if (num_threads == o_max_threads) { break; }
+    num_threads *= 2;
+    if (num_threads > o_max_threads) { num_threads = o_max_threads; }  /* Always end with the maximum. */
+  }
+
+  E(cfg_delete(cfg));
+}  /* bench_threads */
+
+
+int main(int argc, char **argv) {
+  int num_keys;
+  parse_cmdline(argc, argv);
+
+  printf("benchmark,keys,param,metric,value\n");
+  for (num_keys = 1000; num_keys <= o_max_keys; num_keys *= 10) {
+    gen_config(num_keys);
+
+    bench_parse(num_keys);
+    cfg_t *cfg = load_config();
+    bench_lookup(cfg, num_keys);
+    E(cfg_delete(cfg));
+    bench_get_long(num_keys);
+    bench_hot_keys(num_keys);
+    bench_hmap(num_keys);
+    bench_phash(num_keys);
+    bench_threads(num_keys);
+
+    unlink(cfg_path);
+  }
+
+  free(keys);
+  free(miss_keys);
+  return 0;
+}  /* main */
@@ -0,0 +1,253 @@
+/* cfg_compile.c - compile a config file into a C table for cfg_create_static(). */
+
+/* This work is dedicated to the public domain under CC0 1.0 Universal:
+ * http://creativecommons.org/publicdomain/zero/1.0/
+ *
+ * To the extent possible under law, Steven Ford has waived all copyright
+ * and related or neighboring rights to this work. In other words, you can
+ * use this code for any purpose without any restrictions.
+ * This work is published from: United States.
+ * Project home: https://github.com/fordsfords/cfg
+ */
+
+#define _POSIX_C_SOURCE 200809L  /* For strndup(). */
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include "err.h"
+#include "hmap.h"
+#include "phash.h"
+#include "cfg.h"
+
+
+/* Errors in the input are the user's, so no core file. */
+#define E(e__test) ERR_EXIT_ON_ERR(e__test, stderr)
+
+
+/* Options */
+char *o_name = "cfg_static";
+char *o_input = NULL;
+char *o_output = NULL;
+
+
+char usage_str[] = "Usage: cfg_compile [-h] [-n name] input.cfg output.c";
+void usage(char *msg) {
+  if (msg) fprintf(stderr, "\n%s\n\n", msg);
+  fprintf(stderr, "%s\n", usage_str);
+  exit(1);
+}  /* usage */
+
+void help() {
+  printf("%s\n"
+    "where:\n"
+    "  -h - print help\n"
+    "  -n name - C name of the generated cfg_static_t [cfg_static].\n"
+    "  input.cfg - config file, in the cfg_parse_file() format.\n"
+    "  output.c - generated C source; link it and pass &name to cfg_create_static().\n"
+    "References to other keys are substituted now; ${env:VAR} is left for run time.\n",
+    usage_str);
+  exit(0);
+}  /* help */
+
+
+void parse_cmdline(int argc, char **argv) {
+  int i;
+
+  for (i = 1; i < argc; i++) {
+    if (strcmp(argv[i], "-h") == 0) {
+      help();  exit(0);
+
+    } else if (strcmp(argv[i], "-n") == 0) {
+      if ((i + 1) < argc) {
+        i++;
+        o_name = argv[i];
+      } else { usage("-n requires name"); }
+
+    } else if (argv[i][0] == '-') { usage("unknown option");
+
+    } else if (o_input == NULL) { o_input = argv[i];
+    } else if (o_output == NULL) { o_output = argv[i];
+    } else { usage("too many files"); }
+  }  /* for i */
+
+  if (o_output == NULL) { usage("input and output files required"); }
+}  /* parse_cmdline */
+
+
+/* Growable output for compiled values. */
+typedef struct buf_s buf_t;
+struct buf_s {
+  char *str;
+  size_t len;
+  size_t size;
+};
+
+void buf_append(buf_t *buf, const char *str, size_t len) {
+  /* A literal "$" followed by "{" would read as a reference at run
+   * time; "$${" is the escape for a literal "${". */
+  if (len > 0 && buf->len > 0 && buf->str[buf->len - 1] == '$' && str[0] == '{') {
+    buf->len--;
+    buf_append(buf, "$$", 2);
+  }
+  if (buf->len + len + 1 > buf->size) {
+    while (buf->len + len + 1 > buf->size) {
+      buf->size = (buf->size == 0) ? 64 : buf->size * 2;
+    }
+    buf->str = realloc(buf->str, buf->size);
+    if (buf->str == NULL) { fprintf(stderr, "cfg_compile: out of memory\n"); exit(1); }
+  }
+  memcpy(&buf->str[buf->len], str, len);
+  buf->len += len;
+  buf->str[buf->len] = '\0';
+}  /* buf_append */
+
+
+/* Copy a raw value with each ${key} replaced by that key's compiled
+ * value. "$${" escapes and ${env:VAR} are kept for the run-time
+ * expansion. */
+void compile_value(cfg_t *cfg, const char *key, const char *value, int depth, buf_t *buf) {
+  const char *src = value;
+
+  if (depth > cfg->option_infos->num_entries) {
+    fprintf(stderr, "cfg_compile: key '%s': reference loop\n", key);
+    exit(1);
+  }
+  buf_append(buf, "", 0);  /* Empty value still needs a buffer. */
+  while (*src != '\0') {
+    if (src[0] == '$' && src[1] == '$' && src[2] == '{') {
+      buf_append(buf, src, 3);
+      src += 3;
+    }
+    else if (src[0] == '$' && src[1] == '{') {
+      const char *close = strchr(&src[2], '}');
+      if (close == NULL) {
+        fprintf(stderr, "cfg_compile: key '%s': unterminated '${'\n", key);
+        exit(1);
+      }
+      if (strncmp(&src[2], "env:", 4) == 0) {
+        buf_append(buf, src, close + 1 - src);
+      } else {
+        char *name = strndup(&src[2], close - &src[2]);
+        cfg_option_t *ref;
+        if (! hmap_try_slookup(cfg->option_infos, name, (void **)&ref)) {
+          fprintf(stderr, "cfg_compile: key '%s': undefined key '%s'\n", key, name);
+          exit(1);
+        }
+        compile_value(cfg, name, ref->value, depth + 1, buf);
+        free(name);
+      }
+      src = close + 1;
+    }
+    else {
+      const char *dollar = strchr(src + 1, '$');
+      size_t len = dollar ? (size_t)(dollar - src) : strlen(src);
+      buf_append(buf, src, len);
+      src += len;
+    }
+  }
+}  /* compile_value */
+
+
+/* C string literal, or NULL. Every byte that could end the literal, start
+ * an escape or a trigraph, or isn't printable is escaped. */
+void print_str(FILE *fp, const char *str) {
+  if (str == NULL) {
+    fprintf(fp, "NULL");
+    return;
+  }
+  fputc('"', fp);
+  for (; *str != '\0'; str++) {
+    unsigned char c = (unsigned char)*str;
+    if (c == '"' || c == '\\' || c == '?') {
+      fprintf(fp, "\\%c", c);
+    } else if (c < ' ' || c > '~') {
+      fprintf(fp, "\\%03o", c);
+    } else {
+      fputc(c, fp);
+    }
+  }
+  fputc('"', fp);
+}  /* print_str */
+
+
+void print_strs(FILE *fp, const char *suffix, const char **strs, uint32_t num_strs) {
+  uint32_t i;
+
+  fprintf(fp, "static const char *const %s_%s[%u] = {\n", o_name, suffix, (unsigned)num_strs);
+  for (i = 0; i < num_strs; i++) {
+    fprintf(fp, "  ");
+    print_str(fp, strs[i]);
+    fprintf(fp, ",\n");
+  }
+  fprintf(fp, "};\n\n");
+}  /* print_strs */
+
+
+int main(int argc, char **argv) {
+  cfg_t *cfg;
+  phash_t *phash;
+  cfg_layer_pos_t pos;
+  cfg_option_t *option;
+  int num_keys = 0;
+  int i;
+  uint32_t slot;
+
+  parse_cmdline(argc, argv);
+
+  E(cfg_create(&cfg));
+  E(cfg_parse_file(cfg, CFG_MODE_ADD, o_input));
+
+  const char **keys = calloc(cfg->option_infos->num_entries + 1, sizeof(char *));
+  if (keys == NULL) { fprintf(stderr, "cfg_compile: out of memory\n"); exit(1); }
+  memset(&pos, 0, sizeof(pos));
+  do {
+    E(cfg_layer_next(cfg, &pos, &option));
+    if (option) {
+      keys[num_keys++] = option->key;
+    }
+  } while (option);
+  E(phash_build(&phash, keys, num_keys, NULL));
+
+  /* Per slot, like phash->keys; NULL in empty slots. */
+  const char **values = calloc(phash->table_size, sizeof(char *));
+  const char **locations = calloc(phash->table_size, sizeof(char *));
+  if (values == NULL || locations == NULL) { fprintf(stderr, "cfg_compile: out of memory\n"); exit(1); }
+  for (i = 0; i < num_keys; i++) {
+    buf_t buf = {NULL, 0, 0};
+    cfg_option_t *key_option;
+    slot = (uint32_t)phash_find(phash, keys[i], strlen(keys[i]) + 1);
+    E(hmap_slookup(cfg->option_infos, keys[i], (void **)&key_option));
+    compile_value(cfg, keys[i], key_option->value, 0, &buf);
+    values[slot] = buf.str;
+    E(cfg_get_source(cfg, keys[i], NULL, &locations[slot]));
+  }
+
+  FILE *fp = fopen(o_output, "w");
+  if (fp == NULL) { perror(o_output); exit(1); }
+  fprintf(fp, "/* %s - generated by cfg_compile from %s; do not edit. */\n\n", o_output, o_input);
+  fprintf(fp, "#include \"cfg.h\"\n\n");
+  fprintf(fp, "static const uint32_t %s_seeds[%u] = {\n", o_name, (unsigned)phash->num_buckets);
+  for (slot = 0; slot < phash->num_buckets; slot++) {
+    fprintf(fp, "  %u,\n", (unsigned)phash->seeds[slot]);
+  }
+  fprintf(fp, "};\n\n");
+  print_strs(fp, "keys", (const char **)phash->keys, phash->table_size);
+  print_strs(fp, "values", values, phash->table_size);
+  print_strs(fp, "locations", locations, phash->table_size);
+  fprintf(fp, "const cfg_static_t %s = {\n", o_name);
+  fprintf(fp, "  {%u, %u, %s_seeds, %s_keys},\n", (unsigned)phash->table_size, (unsigned)phash->num_buckets, o_name, o_name);
+  fprintf(fp, "  %d, %s_values, %s_locations\n", num_keys, o_name, o_name);
+  fprintf(fp, "};\n");
+  if (fclose(fp) != 0) { perror(o_output); exit(1); }
+
+  for (slot = 0; slot < phash->table_size; slot++) {
+    free((char *)values[slot]);
+  }
+  free(values);
+  free(locations);
+  free(keys);
+  E(phash_delete(phash, NULL));
+  E(cfg_delete(cfg));
+
+  return 0;
+}  /* main */
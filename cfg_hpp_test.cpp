@@ -0,0 +1,152 @@
+/* cfg_hpp_test.cpp - self-test for the C++ wrapper. */
+
+/* This work is dedicated to the public domain under CC0 1.0 Universal:
+ * http://creativecommons.org/publicdomain/zero/1.0/
+ *
+ * To the extent possible under law, Steven Ford has waived all copyright
+ * and related or neighboring rights to this work. In other words, you can
+ * use this code for any purpose without any restrictions.
+ * This work is published from: United States.
+ * Project home: https://github.com/fordsfords/cfg
+ */
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include "cfg.hpp"
+
+#define ASSRT(assrt__cond) do { \
+  if (! (assrt__cond)) { \
+    printf("ERROR [%s:%d]: assert '%s' failed\n", __FILE__, __LINE__, #assrt__cond); \
+    exit(1); \
+  } \
+} while (0)
+
+/* Expects the statement to throw cfg::error with the given code. */
+#define ASSRT_THROWS(assrt__stmt, assrt__code) do { \
+  const char *assrt__thrown = NULL; \
+  try { assrt__stmt; } catch (const cfg::error &e) { assrt__thrown = e.code(); } \
+  ASSRT(assrt__thrown == (assrt__code)); \
+} while (0)
+
+/* Hashed at compile time. */
+static constexpr cfg::key k_opt1("opt1");
+static_assert(k_opt1.name() == "opt1");
+static_assert(k_opt1.hash() == cfg::murmur3_32("opt1", 5, HMAP_SEED));
+static_assert(cfg::murmur3_32("", 0, 0) == 0);
+
+
+void test_hash() {
+  char buf[64];
+  size_t len;
+
+  /* Every block count and tail size, against the C function. */
+  for (len = 0; len < sizeof(buf); len++) {
+    buf[len] = (char)('a' + (len * 7) % 26);
+    ASSRT(cfg::murmur3_32(buf, len, HMAP_SEED) == hmap_murmur3_32(buf, len, HMAP_SEED));
+  }
+  buf[10] = (char)0xe9;  /* High bit set. */
+  ASSRT(cfg::murmur3_32(buf, 11, 7) == hmap_murmur3_32(buf, 11, 7));
+
+  buf[20] = '\0';
+  cfg::key k(buf);  /* Built at run time. */
+  ASSRT(k.name().size() == strlen(buf));
+  cfg_hkey_t hkey;
+  cfg_hkey_init(&hkey, buf);
+  ASSRT(k.hash() == hkey.hash && k.c_ptr()->key_size == hkey.key_size);
+}  /* test_hash */
+
+
+void test_get() {
+  cfg::config cfg;
+  cfg.parse_file("tst2.cfg");
+  cfg.parse_line("port = 0x1f90");
+  cfg.parse_line("neg = -5");
+  cfg.parse_line("big = 300");
+  cfg.parse_line("ratio = 2.5");
+  cfg.parse_line("on = yes");
+  cfg.parse_line("greeting = ${opt1}-abc");
+  cfg.parse_line("bad = 12z");
+
+  ASSRT(cfg.get<std::string_view>(k_opt1) == "xyz");
+  ASSRT(cfg.get<std::string_view>("opt2").empty());
+  ASSRT(cfg.get<int>("opt3") == 3);
+  ASSRT(cfg.get<int>(CFG_KEY("opt3")) == 3);
+  ASSRT(CFG_KEY("opt3").hash() == cfg::key("opt3").hash());
+  ASSRT(CFG_KEY("opt3").c_ptr()->key_size == 5);
+  ASSRT(cfg.get<unsigned short>("port") == 8080);
+  ASSRT(cfg.get<long long>("neg") == -5);
+  ASSRT(cfg.get<double>("ratio") == 2.5);
+  ASSRT(cfg.get<float>("ratio") == 2.5f);
+  ASSRT(cfg.get<bool>("on"));
+  ASSRT(cfg.get<std::string_view>("greeting") == "xyz-abc");
+
+  /* No copy: the view is the library's string. */
+  char *c_val;
+  cfg::check(cfg_get_str_val(cfg.c_ptr(), "greeting", &c_val));
+  ASSRT(cfg.get<std::string_view>("greeting").data() == c_val);
+
+  ASSRT_THROWS(cfg.get<long>("opt1"), ERR_ERR_BAD_NUMBER);
+  ASSRT_THROWS(cfg.get<long>("bad"), ERR_ERR_BAD_NUMBER);
+  ASSRT_THROWS(cfg.get<unsigned int>("neg"), CFG_ERR_RANGE);
+  ASSRT_THROWS(cfg.get<signed char>("big"), CFG_ERR_RANGE);
+  ASSRT_THROWS(cfg.get<long>("missing"), HMAP_ERR_NOTFOUND);
+  ASSRT_THROWS(cfg.parse_line("opt3 = 4"), CFG_ERR_ADD_KEY_ALREADY_EXIST);
+
+  ASSRT(!cfg.try_get<long>("missing").has_value());
+  ASSRT(cfg.try_get<long>("missing").value_or(7) == 7);
+  ASSRT(cfg.try_get<long>("opt3").value() == 3);
+
+  try {
+    (void)cfg.get<long>("bad");
+    ASSRT(0);
+  } catch (const cfg::error &e) {
+    ASSRT(strstr(e.what(), "Code: ERR_ERR_BAD_NUMBER") != NULL);
+  }
+
+  /* Changes are seen through the same key. */
+  cfg.parse_line("opt3 = 33", CFG_MODE_UPDATE);
+  ASSRT(cfg.get<int>("opt3") == 33);
+}  /* test_get */
+
+
+void test_overlay() {
+  cfg::config base;
+  base.parse_line("opt1 = base");
+  base.parse_line("opt2 = 2");
+  base.freeze();
+  ASSRT_THROWS(base.parse_line("opt3 = 3"), CFG_ERR_FROZEN);
+
+  cfg::config over = base.overlay();
+  over.parse_line("opt1 = over", CFG_MODE_UPDATE);
+  ASSRT(over.get<std::string_view>(k_opt1) == "over");
+  ASSRT(base.get<std::string_view>(k_opt1) == "base");
+  ASSRT(over.get<int>("opt2") == 2);  /* Inherited, then cached. */
+  ASSRT(over.get<int>("opt2") == 2);
+
+  /* Moves transfer ownership. */
+  cfg::config moved(std::move(over));
+  ASSRT(over.c_ptr() == NULL);
+  ASSRT(moved.get<std::string_view>(k_opt1) == "over");
+  cfg::config other;
+  other = std::move(moved);
+  ASSRT(other.get<int>("opt2") == 2);
+
+  cfg_t *raw = other.release();
+  ASSRT(other.c_ptr() == NULL);
+  cfg::config adopted(raw);
+  ASSRT(adopted.get<int>("opt2") == 2);
+}  /* test_overlay */
+
+
+int main() {
+  test_hash();
+  printf("test_hash: success\n");
+  test_get();
+  printf("test_get: success\n");
+  test_overlay();
+  printf("test_overlay: success\n");
+
+  return 0;
+}  /* main */
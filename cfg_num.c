@@ -0,0 +1,364 @@
+/* cfg_num.c - fast numeric parsing for cfg values. */
+
+/* This work is dedicated to the public domain under CC0 1.0 Universal:
+ * http://creativecommons.org/publicdomain/zero/1.0/
+ *
+ * To the extent possible under law, Steven Ford has waived all copyright
+ * and related or neighboring rights to this work. In other words, you can
+ * use this code for any purpose without any restrictions.
+ * This work is published from: United States.
+ * Project home: https://github.com/fordsfords/cfg
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <limits.h>
+#include <errno.h>
+#include "err.h"
+#include "cfg_num.h"
+
+
+/* The 8-at-a-time kernels load digits into a uint64_t and assume the
+ * first character lands in the low byte. */
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+#  define CFG_NUM_SWAR 1
+#else
+#  define CFG_NUM_SWAR 0
+#endif
+
+/* Hex digit values; 0xff for anything else. */
+static const uint8_t cfg_num_hex_vals[256] = {
+  0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+  0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+  0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+  0x00, 0x01, 0x02, 0x03, 0x04, 0x05, 0x06, 0x07, 0x08, 0x09, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+  0xff, 0x0a, 0x0b, 0x0c, 0x0d, 0x0e, 0x0f, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+  0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+  0xff, 0x0a, 0x0b, 0x0c, 0x0d, 0x0e, 0x0f, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+  0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+  0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+  0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+  0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+  0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+  0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+  0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+  0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+  0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+};
+
+
+/* True if all 8 bytes are '0'..'9'. */
+static int cfg_num_is_8_digits(uint64_t chunk) {
+  return (((chunk & 0xF0F0F0F0F0F0F0F0) |
+    (((chunk + 0x0606060606060606) & 0xF0F0F0F0F0F0F0F0) >> 4)) ==
+    0x3333333333333333);
+}  /* cfg_num_is_8_digits */
+
+
+/* Convert 8 decimal digits with three multiplies instead of eight. */
+static uint32_t cfg_num_swar_8_digits(uint64_t chunk) {
+  chunk -= 0x3030303030303030;
+  chunk = (chunk * 10) + (chunk >> 8);  /* Pairs. */
+  chunk = (((chunk & 0x000000FF000000FF) * (100 + (1000000ULL << 32))) +
+    (((chunk >> 16) & 0x000000FF000000FF) * (1 + (10000ULL << 32)))) >> 32;
+  return (uint32_t)chunk;
+}  /* cfg_num_swar_8_digits */
+
+
+static int cfg_num_is_8_hex(const char *p) {
+  uint8_t bad = 0;
+  int i;
+  for (i = 0; i < 8; i++) {  /* No early exit; compiles branch-free. */
+    bad |= cfg_num_hex_vals[(uint8_t)p[i]];
+  }
+  return (bad & 0xf0) == 0;
+}  /* cfg_num_is_8_hex */
+
+
+/* Convert 8 hex digits (either case) by folding nibbles together. */
+static uint32_t cfg_num_swar_8_hex(uint64_t chunk) {
+  chunk = (chunk & 0x0F0F0F0F0F0F0F0F) + 9 * ((chunk >> 6) & 0x0101010101010101);
+  chunk = ((chunk & 0x000F000F000F000F) << 4) | ((chunk >> 8) & 0x000F000F000F000F);
+  chunk = ((chunk & 0x000000FF000000FF) << 8) | ((chunk >> 16) & 0x000000FF000000FF);
+  chunk = ((chunk & 0xFFFF) << 16) | ((chunk >> 32) & 0xFFFF);
+  return (uint32_t)chunk;
+}  /* cfg_num_swar_8_hex */
+
+
+static const char *cfg_num_skip_spaces(const char *p, const char *end) {
+  while (p < end && *p == ' ') {
+    p++;
+  }
+  return p;
+}  /* cfg_num_skip_spaces */
+
+
+/* Accumulate decimal digits into *val. Returns -1 on a non-digit or if
+ * the value reaches 10^19, which is out of range for a long either way. */
+static int cfg_num_decimal(const char *p, const char *end, uint64_t *val, int *ndigits) {
+  uint64_t v = 0;
+  int n = 0;
+
+  while (p < end) {
+#if CFG_NUM_SWAR
+    if (end - p >= 8) {
+      uint64_t chunk;
+      memcpy(&chunk, p, sizeof(chunk));
+      if (cfg_num_is_8_digits(chunk)) {
+        if (v >= 100000000000ULL) { return -1; }  /* v * 10^8 >= 10^19. */
+        v = v * 100000000 + cfg_num_swar_8_digits(chunk);
+        p += 8;
+        n += 8;
+        continue;
+      }
+    }
+#endif
+    char c = *p++;
+    if (c == ' ') { continue; }
+    unsigned int d = (unsigned char)c - '0';
+    if (d > 9) { return -1; }
+    if (v >= 1000000000000000000ULL) { return -1; }  /* v * 10 >= 10^19. */
+    v = v * 10 + d;
+    n++;
+  }
+
+  *val = v;
+  *ndigits = n;
+  return 0;
+}  /* cfg_num_decimal */
+
+
+/* Accumulate hex digits; -1 on a non-hex-digit or if the value would
+ * not fit in 64 bits. */
+static int cfg_num_hex(const char *p, const char *end, uint64_t *val, int *ndigits) {
+  uint64_t v = 0;
+  int n = 0;
+
+  while (p < end) {
+#if CFG_NUM_SWAR
+    if (end - p >= 8 && cfg_num_is_8_hex(p)) {
+      uint64_t chunk;
+      memcpy(&chunk, p, sizeof(chunk));
+      if (v >= (1ULL << 32)) { return -1; }
+      v = (v << 32) | cfg_num_swar_8_hex(chunk);
+      p += 8;
+      n += 8;
+      continue;
+    }
+#endif
+    char c = *p++;
+    if (c == ' ') { continue; }
+    uint8_t d = cfg_num_hex_vals[(uint8_t)c];
+    if (d > 15) { return -1; }
+    if (v >= (1ULL << 60)) { return -1; }
+    v = (v << 4) | d;
+    n++;
+  }
+
+  *val = v;
+  *ndigits = n;
+  return 0;
+}  /* cfg_num_hex */
+
+
+int cfg_num_parse_long(const char *str, size_t len, long *rtn_value) {
+  const char *end = str + len;
+  const char *p = cfg_num_skip_spaces(str, end);
+  int hex = 0;
+  int negative = 0;
+
+  /* Same prefix rules as err_atol(): "0x" first, then the sign. */
+  if (p < end && *p == '0') {
+    const char *q = cfg_num_skip_spaces(p + 1, end);
+    if (q < end && (*q == 'x' || *q == 'X')) {
+      hex = 1;
+      p = cfg_num_skip_spaces(q + 1, end);
+    }
+  }
+  if (p < end && (*p == '-' || *p == '+')) {
+    negative = (*p == '-');
+    p++;
+  }
+
+  uint64_t val;
+  int ndigits;
+  int status = hex ? cfg_num_hex(p, end, &val, &ndigits) : cfg_num_decimal(p, end, &val, &ndigits);
+  if (status != 0 || ndigits == 0) {
+    return -1;
+  }
+
+  if (negative) {
+    if (val > (uint64_t)LONG_MAX + 1) { return -1; }
+    *rtn_value = (val == (uint64_t)LONG_MAX + 1) ? LONG_MIN : -(long)val;
+  } else {
+    if (val > (uint64_t)LONG_MAX) { return -1; }
+    *rtn_value = (long)val;
+  }
+  return 0;
+}  /* cfg_num_parse_long */
+
+
+/* Anything the fast path doesn't handle: remove spaces and use strtod. */
+static int cfg_num_parse_double_slow(const char *str, size_t len, double *rtn_value) {
+  char local_str[1024];
+  char *buf = local_str;
+  size_t i, j = 0;
+
+  if (len >= sizeof(local_str)) {  /* Only absurdly long values. */
+    buf = err_mem_alloc(NULL, len + 1);
+    if (buf == NULL) { return -1; }
+  }
+  for (i = 0; i < len; i++) {
+    if (str[i] != ' ') { buf[j++] = str[i]; }
+  }
+  buf[j] = '\0';
+
+  errno = 0;
+  char *p = NULL;
+  double value = strtod(buf, &p);
+  int status = (errno != 0 || p == buf || *p != '\0') ? -1 : 0;
+  if (buf != local_str) { err_mem_free(NULL, buf); }
+
+  if (status == 0) {
+    *rtn_value = value;
+  }
+  return status;
+}  /* cfg_num_parse_double_slow */
+
+
+/* Exactly representable powers of ten. */
+static const double cfg_num_pow10[] = {
+  1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+  1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22};
+
+
+/* Decimal mantissa and exponent, then Clinger's fast path: when the
+ * mantissa fits in 53 bits and the power of ten is exact, one IEEE
+ * multiply or divide gives the correctly rounded result. Everything
+ * else (long mantissas, big exponents, hex floats, inf, nan) goes to
+ * strtod(), so results always match it. */
+int cfg_num_parse_double(const char *str, size_t len, double *rtn_value) {
+  const char *end = str + len;
+  const char *p = cfg_num_skip_spaces(str, end);
+  int negative = 0;
+  uint64_t mant = 0;
+  int exp10 = 0;
+  int ndigits = 0;
+
+  if (p < end && (*p == '-' || *p == '+')) {
+    negative = (*p == '-');
+    p++;
+  }
+
+  /* Integer part, then fraction (which lowers the exponent). */
+  int fraction;
+  for (fraction = 0; fraction <= 1; fraction++) {
+    while (p < end) {
+#if CFG_NUM_SWAR
+      if (end - p >= 8) {
+        uint64_t chunk;
+        memcpy(&chunk, p, sizeof(chunk));
+        if (cfg_num_is_8_digits(chunk) && mant < 100000000000ULL) {
+          mant = mant * 100000000 + cfg_num_swar_8_digits(chunk);
+          p += 8;
+          ndigits += 8;
+          exp10 -= fraction * 8;
+          continue;
+        }
+      }
+#endif
+      if (*p == ' ') { p++; continue; }
+      unsigned int d = (unsigned char)*p - '0';
+      if (d > 9) { break; }
+      if (mant >= 1000000000000000000ULL) {  /* Would lose digits. */
+        return cfg_num_parse_double_slow(str, len, rtn_value);
+      }
+      mant = mant * 10 + d;
+      ndigits++;
+      exp10 -= fraction;
+      p++;
+    }
+    if (fraction == 0) {
+      if (p < end && *p == '.') { p++; }
+      else { break; }
+    }
+  }
+  if (ndigits == 0) {  /* Let strtod() decide on "inf", "nan", ".". */
+    return cfg_num_parse_double_slow(str, len, rtn_value);
+  }
+
+  if (p < end && (*p == 'e' || *p == 'E')) {
+    int exp_negative = 0;
+    int exp_val = 0;
+    int exp_digits = 0;
+    p = cfg_num_skip_spaces(p + 1, end);
+    if (p < end && (*p == '-' || *p == '+')) {
+      exp_negative = (*p == '-');
+      p++;
+    }
+    while (p < end) {
+      if (*p == ' ') { p++; continue; }
+      unsigned int d = (unsigned char)*p - '0';
+      if (d > 9) { break; }
+      if (exp_val < 100000) { exp_val = exp_val * 10 + d; }
+      exp_digits++;
+      p++;
+    }
+    if (exp_digits == 0) {
+      return -1;  /* "1e" has trailing garbage for strtod() too. */
+    }
+    exp10 += exp_negative ? -exp_val : exp_val;
+  }
+
+  if (p != end) {  /* Something else, like "0x1p3". */
+    return cfg_num_parse_double_slow(str, len, rtn_value);
+  }
+
+  double value;
+  if (mant == 0) {
+    value = 0.0;
+  } else if (mant > (1ULL << 53)) {
+    return cfg_num_parse_double_slow(str, len, rtn_value);
+  } else if (exp10 >= 0 && exp10 <= 22) {
+    value = (double)mant * cfg_num_pow10[exp10];
+  } else if (exp10 < 0 && exp10 >= -22) {
+    value = (double)mant / cfg_num_pow10[-exp10];
+  } else if (exp10 > 22 && exp10 <= 22 + 15) {
+    /* Move some of the exponent into the mantissa if it stays exact. */
+    uint64_t scale = 1;
+    int i;
+    for (i = 22; i < exp10; i++) { scale *= 10; }
+    if (mant > (1ULL << 53) / scale) {
+      return cfg_num_parse_double_slow(str, len, rtn_value);
+    }
+    value = (double)(mant * scale) * 1e22;
+  } else {
+    return cfg_num_parse_double_slow(str, len, rtn_value);
+  }
+
+  *rtn_value = negative ? -value : value;
+  return 0;
+}  /* cfg_num_parse_double */
+
+
+ERR_F cfg_num_atol(const char *str, long *rtn_value) {
+  ERR_ASSRT(str, ERR_ERR_PARAM);
+  ERR_ASSRT(rtn_value, ERR_ERR_PARAM);
+
+  if (cfg_num_parse_long(str, strlen(str), rtn_value) != 0) {
+    ERR_THROW(ERR_ERR_BAD_NUMBER, "'%s'", str);
+  }
+  return ERR_OK;
+}  /* cfg_num_atol */
+
+
+ERR_F cfg_num_atod(const char *str, double *rtn_value) {
+  ERR_ASSRT(str, ERR_ERR_PARAM);
+  ERR_ASSRT(rtn_value, ERR_ERR_PARAM);
+
+  if (cfg_num_parse_double(str, strlen(str), rtn_value) != 0) {
+    ERR_THROW(ERR_ERR_BAD_NUMBER, "'%s'", str);
+  }
+  return ERR_OK;
+}  /* cfg_num_atod */
@@ -0,0 +1,42 @@
+/* cfg_num.h - fast numeric parsing for cfg values. */
+
+/* This work is dedicated to the public domain under CC0 1.0 Universal:
+ * http://creativecommons.org/publicdomain/zero/1.0/
+ *
+ * To the extent possible under law, Steven Ford has waived all copyright
+ * and related or neighboring rights to this work. In other words, you can
+ * use this code for any purpose without any restrictions.
+ * This work is published from: United States.
+ * Project home: https://github.com/fordsfords/cfg
+ */
+
+#ifndef CFG_NUM_H
+#define CFG_NUM_H
+
+#include <stddef.h>
+#include "err.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* These parse the first "len" characters of "str" (which need not be
+ * null-terminated). Spaces anywhere are ignored, so "1 000 000" is a
+ * million. They return 0 on success and -1 if the string is not a valid
+ * number or is out of range; they never allocate.
+ *
+ * Long: decimal with optional sign, or "0x" followed by hex digits
+ * (optionally signed), same as err_atol() after removing spaces.
+ * Double: same results as strtod(), including rounding. */
+int cfg_num_parse_long(const char *str, size_t len, long *rtn_value);
+int cfg_num_parse_double(const char *str, size_t len, double *rtn_value);
+
+/* Null-terminated, ERR-compliant forms; throw ERR_ERR_BAD_NUMBER. */
+ERR_F cfg_num_atol(const char *str, long *rtn_value);
+ERR_F cfg_num_atod(const char *str, double *rtn_value);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif  /* CFG_NUM_H */
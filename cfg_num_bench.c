@@ -0,0 +1,254 @@
+/* cfg_num_bench.c - compare cfg_num parsing with strtol/strtod. */
+
+/* This work is dedicated to the public domain under CC0 1.0 Universal:
+ * http://creativecommons.org/publicdomain/zero/1.0/
+ *
+ * To the extent possible under law, Steven Ford has waived all copyright
+ * and related or neighboring rights to this work. In other words, you can
+ * use this code for any purpose without any restrictions.
+ * This work is published from: United States.
+ * Project home: https://github.com/fordsfords/cfg
+ */
+
+#define _POSIX_C_SOURCE 200809L  /* For clock_gettime(). */
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <errno.h>
+#include <time.h>
+#include "err.h"
+#include "cfg_num.h"
+
+
+/* Options */
+int o_count = 1000000;
+
+
+char usage_str[] = "Usage: cfg_num_bench [-h] [-n count]";
+void usage(char *msg) {
+  if (msg) fprintf(stderr, "\n%s\n\n", msg);
+  fprintf(stderr, "%s\n", usage_str);
+  exit(1);
+}  /* usage */
+
+void help() {
+  printf("%s\n"
+    "where:\n"
+    "  -h - print help\n"
+    "  -n count - number of values per benchmark [1000000].\n"
+    "Output is CSV: benchmark,parser,ns_per_value\n",
+    usage_str);
+  exit(0);
+}  /* help */
+
+
+void parse_cmdline(int argc, char **argv) {
+  int i;
+
+  for (i = 1; i < argc; i++) {
+    if (strcmp(argv[i], "-h") == 0) {
+      help();  exit(0);
+
+    } else if (strcmp(argv[i], "-n") == 0) {
+      if ((i + 1) < argc) {
+        i++;
+        o_count = atoi(argv[i]);
+        if (o_count <= 0) { usage("-n must be positive"); }
+      } else { usage("-n requires count"); }
+
+    } else { usage("unknown option"); }
+  }  /* for i */
+}  /* parse_cmdline */
+
+
+uint64_t now_ns() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}  /* now_ns */
+
+
+/* Deterministic so runs are comparable. */
+uint64_t rand_state = 0x9E3779B97F4A7C15ULL;
+uint64_t rand64() {
+  rand_state ^= rand_state << 13;
+  rand_state ^= rand_state >> 7;
+  rand_state ^= rand_state << 17;
+  return rand_state;
+}  /* rand64 */
+
+
+/* Old cfg_get_long_val() path: copy, remove spaces, strtol. */
+int old_parse_long(const char *str, long *rtn_value) {
+  char local_str[64];
+  char *dst = local_str;
+  while (*str != '\0' && dst < &local_str[sizeof(local_str) - 1]) {
+    if (*str != ' ') { *dst++ = *str; }
+    str++;
+  }
+  *dst = '\0';
+
+  int base = 10;
+  char *in_str = local_str;
+  if (in_str[0] == '0' && (in_str[1] == 'x' || in_str[1] == 'X')) {
+    base = 16;
+    in_str += 2;
+  }
+  errno = 0;
+  char *p = NULL;
+  *rtn_value = strtol(in_str, &p, base);
+  return (errno != 0 || p == in_str || *p != '\0') ? -1 : 0;
+}  /* old_parse_long */
+
+
+int old_parse_double(const char *str, double *rtn_value) {
+  errno = 0;
+  char *p = NULL;
+  *rtn_value = strtod(str, &p);
+  return (errno != 0 || p == str || *p != '\0') ? -1 : 0;
+}  /* old_parse_double */
+
+
+/* Format a long with a space every 3 digits, as config files do. */
+void format_grouped(char *buf, long value) {
+  char digits[32];
+  int len = snprintf(digits, sizeof(digits), "%ld", value < 0 ? -value : value);
+  int i;
+  char *dst = buf;
+  if (value < 0) { *dst++ = '-'; }
+  for (i = 0; i < len; i++) {
+    if (i > 0 && (len - i) % 3 == 0) { *dst++ = ' '; }
+    *dst++ = digits[i];
+  }
+  *dst = '\0';
+}  /* format_grouped */
+
+
+typedef int (*long_parser_t)(const char *str, long *rtn_value);
+typedef int (*double_parser_t)(const char *str, double *rtn_value);
+
+int new_parse_long(const char *str, long *rtn_value) {
+  return cfg_num_parse_long(str, strlen(str), rtn_value);
+}  /* new_parse_long */
+
+int new_parse_double(const char *str, double *rtn_value) {
+  return cfg_num_parse_double(str, strlen(str), rtn_value);
+}  /* new_parse_double */
+
+
+volatile long long_sink;
+volatile double double_sink;
+
+void bench_long(const char *name, char **strs, const char *parser_name, long_parser_t parser) {
+  int i;
+  long sum = 0;
+  uint64_t start = now_ns();
+  for (i = 0; i < o_count; i++) {
+    long value;
+    if (parser(strs[i], &value) != 0) {
+      fprintf(stderr, "%s: %s failed on '%s'\n", name, parser_name, strs[i]);
+      exit(1);
+    }
+    sum += value;
+  }
+  uint64_t elapsed = now_ns() - start;
+  long_sink = sum;
+  printf("%s,%s,%.2f\n", name, parser_name, (double)elapsed / o_count);
+}  /* bench_long */
+
+
+void bench_double(const char *name, char **strs, const char *parser_name, double_parser_t parser) {
+  int i;
+  double sum = 0;
+  uint64_t start = now_ns();
+  for (i = 0; i < o_count; i++) {
+    double value;
+    if (parser(strs[i], &value) != 0) {
+      fprintf(stderr, "%s: %s failed on '%s'\n", name, parser_name, strs[i]);
+      exit(1);
+    }
+    sum += value;
+  }
+  uint64_t elapsed = now_ns() - start;
+  double_sink = sum;
+  printf("%s,%s,%.2f\n", name, parser_name, (double)elapsed / o_count);
+}  /* bench_double */
+
+
+/* Both parsers must agree exactly, including double rounding. */
+void verify(char **long_strs, char **double_strs) {
+  int i;
+  for (i = 0; i < o_count; i++) {
+    long l1, l2;
+    int s1 = old_parse_long(long_strs[i], &l1);
+    int s2 = new_parse_long(long_strs[i], &l2);
+    if (s1 != s2 || (s1 == 0 && l1 != l2)) {
+      fprintf(stderr, "verify: long mismatch on '%s'\n", long_strs[i]);
+      exit(1);
+    }
+    double d1, d2;
+    s1 = old_parse_double(double_strs[i], &d1);
+    s2 = new_parse_double(double_strs[i], &d2);
+    if (s1 != s2 || (s1 == 0 && memcmp(&d1, &d2, sizeof(d1)) != 0)) {
+      fprintf(stderr, "verify: double mismatch on '%s'\n", double_strs[i]);
+      exit(1);
+    }
+  }
+}  /* verify */
+
+
+char **alloc_strs() {
+  int i;
+  char **strs = malloc(o_count * sizeof(char *));
+  if (strs == NULL) { fprintf(stderr, "malloc failed\n"); exit(1); }
+  for (i = 0; i < o_count; i++) {
+    strs[i] = malloc(48);
+    if (strs[i] == NULL) { fprintf(stderr, "malloc failed\n"); exit(1); }
+  }
+  return strs;
+}  /* alloc_strs */
+
+
+int main(int argc, char **argv) {
+  int i;
+  parse_cmdline(argc, argv);
+
+  char **dec_strs = alloc_strs();  /* Per-symbol limits: up to 10 digits. */
+  char **grouped_strs = alloc_strs();  /* "1 000 000" style. */
+  char **hex_strs = alloc_strs();
+  char **double_strs = alloc_strs();  /* Prices: few decimals. */
+  char **full_double_strs = alloc_strs();  /* Round-trip precision. */
+
+  for (i = 0; i < o_count; i++) {
+    long value = (long)(rand64() % 10000000000ULL);
+    if (i % 8 == 0) { value = -value; }
+    snprintf(dec_strs[i], 48, "%ld", value);
+    format_grouped(grouped_strs[i], value);
+    snprintf(hex_strs[i], 48, "0x%lx", (unsigned long)(rand64() >> 1));
+    snprintf(double_strs[i], 48, "%.2f", (double)(rand64() % 100000000) / 100.0);
+    double d;
+    /* Finite and normal (strtod sets ERANGE on subnormals). */
+    uint64_t bits = (rand64() & 0x7FEFFFFFFFFFFFFFULL) | 0x0010000000000000ULL;
+    memcpy(&d, &bits, sizeof(d));
+    snprintf(full_double_strs[i], 48, "%.17g", d);
+  }
+
+  verify(dec_strs, double_strs);
+  verify(grouped_strs, full_double_strs);
+  verify(hex_strs, double_strs);
+
+  printf("benchmark,parser,ns_per_value\n");
+  bench_long("long_decimal", dec_strs, "strtol", old_parse_long);
+  bench_long("long_decimal", dec_strs, "cfg_num", new_parse_long);
+  bench_long("long_grouped", grouped_strs, "strtol", old_parse_long);
+  bench_long("long_grouped", grouped_strs, "cfg_num", new_parse_long);
+  bench_long("long_hex", hex_strs, "strtol", old_parse_long);
+  bench_long("long_hex", hex_strs, "cfg_num", new_parse_long);
+  bench_double("double_short", double_strs, "strtod", old_parse_double);
+  bench_double("double_short", double_strs, "cfg_num", new_parse_double);
+  bench_double("double_full", full_double_strs, "strtod", old_parse_double);
+  bench_double("double_full", full_double_strs, "cfg_num", new_parse_double);
+
+  return 0;
+}  /* main */
@@ -0,0 +1,457 @@
+/* cfg_numa.c - read-only copies of a cfg on each NUMA node. */
+
+/* This work is dedicated to the public domain under CC0 1.0 Universal:
+ * http://creativecommons.org/publicdomain/zero/1.0/
+ *
+ * To the extent possible under law, Steven Ford has waived all copyright
+ * and related or neighboring rights to this work. In other words, you can
+ * use this code for any purpose without any restrictions.
+ * This work is published from: United States.
+ * Project home: https://github.com/fordsfords/cfg
+ */
+
+#define _GNU_SOURCE  /* For sched_getcpu(), syscall(). */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sched.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include "err.h"
+#include "cfg.h"
+#include "cfg_num.h"
+#include "cfg_shm.h"
+#define CFG_NUMA_C
+#include "cfg_numa.h"
+
+/* From <linux/mempolicy.h>; not worth a libnuma dependency. */
+#define CFG_NUMA_MPOL_PREFERRED 1
+
+#define CFG_NUMA_MAX_LINE 4096
+
+
+/* Images replaced by one cfg_numa_update(). Readers may still be using
+ * them, so they stay mapped for a grace period; see cfg_numa_reclaim(). */
+typedef struct cfg_numa_retired_s cfg_numa_retired_t;
+struct cfg_numa_retired_s {
+  int num_images;
+  void *images[CFG_NUMA_MAX_NODES];
+  size_t map_sizes[CFG_NUMA_MAX_NODES];
+  cfg_numa_retired_t *next;
+};
+
+
+/* Read a one-line sysfs file like "0-3,8,10-11". Returns 0 if it
+ * can't be read. */
+int cfg_numa_read_list(const char *dir, const char *file, char *buf, size_t buf_size) {
+  char path[1024];
+  FILE *fp;
+
+  snprintf(path, sizeof(path), "%s/%s", dir, file);
+  fp = fopen(path, "r");
+  if (fp == NULL) {
+    return 0;
+  }
+  if (fgets(buf, (int)buf_size, fp) == NULL) {
+    buf[0] = '\0';
+  }
+  fclose(fp);
+
+  return 1;
+}  /* cfg_numa_read_list */
+
+
+/* Step through a list like "0-3,8,10-11". *in_pos starts at str; sets
+ * *rtn_first and *rtn_last and returns 1, or returns 0 at the end. */
+int cfg_numa_next_range(const char **in_pos, int *rtn_first, int *rtn_last) {
+  const char *pos = *in_pos;
+  char *end;
+  long first;
+  long last;
+
+  while (*pos == ',' || *pos == ' ') {
+    pos++;
+  }
+  if (*pos < '0' || *pos > '9') {
+    return 0;
+  }
+  first = strtol(pos, &end, 10);
+  last = first;
+  if (*end == '-') {
+    last = strtol(end + 1, &end, 10);
+  }
+  *in_pos = end;
+  if (first < 0 || last < first || last > 65535) {
+    return 0;
+  }
+
+  *rtn_first = (int)first;
+  *rtn_last = (int)last;
+  return 1;
+}  /* cfg_numa_next_range */
+
+
+/* One replica per node that has CPUs, and a CPU to replica map. Falls
+ * back to a single replica if the topology can't be read. */
+ERR_F cfg_numa_detect(cfg_numa_t *numa, const char *sysfs_dir) {
+  char buf[CFG_NUMA_MAX_LINE];
+  const char *nodes_pos;
+  int first_node;
+  int last_node;
+
+  numa->num_replicas = 1;
+  numa->replicas[0].node = 0;
+  numa->num_cpus = 0;
+
+  if (!cfg_numa_read_list(sysfs_dir, "online", buf, sizeof(buf))) {
+    return ERR_OK;
+  }
+
+  nodes_pos = buf;
+  numa->num_replicas = 0;
+  while (cfg_numa_next_range(&nodes_pos, &first_node, &last_node)) {
+    int node;
+    for (node = first_node; node <= last_node && node < CFG_NUMA_MAX_NODES; node++) {
+      char file[64];
+      char cpus[CFG_NUMA_MAX_LINE];
+      const char *cpus_pos;
+      int first_cpu;
+      int last_cpu;
+      int has_cpus = 0;
+
+      snprintf(file, sizeof(file), "node%d/cpulist", node);
+      if (!cfg_numa_read_list(sysfs_dir, file, cpus, sizeof(cpus))) {
+        continue;
+      }
+      cpus_pos = cpus;
+      while (cfg_numa_next_range(&cpus_pos, &first_cpu, &last_cpu)) {
+        if (last_cpu >= numa->num_cpus) {
+          int *new_map = (int *)err_mem_realloc(NULL, numa->cpu_replicas, (last_cpu + 1) * sizeof(int));
+          int cpu;
+          ERR_ASSRT(new_map, CFG_NUMA_ERR_NOMEM);
+          for (cpu = numa->num_cpus; cpu <= last_cpu; cpu++) {
+            new_map[cpu] = 0;
+          }
+          numa->cpu_replicas = new_map;
+          numa->num_cpus = last_cpu + 1;
+        }
+        for (; first_cpu <= last_cpu; first_cpu++) {
+          numa->cpu_replicas[first_cpu] = numa->num_replicas;
+        }
+        has_cpus = 1;
+      }
+      if (has_cpus) {  /* Memory-only nodes run no readers. */
+        numa->replicas[numa->num_replicas].node = node;
+        numa->num_replicas++;
+      }
+    }
+  }
+
+  if (numa->num_replicas == 0) {
+    numa->num_replicas = 1;
+    numa->replicas[0].node = 0;
+    numa->num_cpus = 0;
+  }
+
+  return ERR_OK;
+}  /* cfg_numa_detect */
+
+
+/* Page-aligned memory, preferably on the node. Placement is best
+ * effort: if mbind is unavailable, pages land wherever first touched. */
+ERR_F cfg_numa_map(cfg_numa_t *numa, int node, size_t size, void **rtn_addr, size_t *rtn_map_size) {
+  long page_size = sysconf(_SC_PAGESIZE);
+  size_t map_size;
+  void *addr;
+
+  if (page_size <= 0) {
+    page_size = 4096;
+  }
+  map_size = (size + (size_t)page_size - 1) & ~((size_t)page_size - 1);
+  addr = mmap(NULL, map_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (addr == MAP_FAILED) {
+    ERR_THROW(CFG_NUMA_ERR_SYS, "mmap %lu bytes: %s", (unsigned long)map_size, strerror(errno));
+  }
+
+#if defined(__linux__) && defined(SYS_mbind)
+  if (numa->num_replicas > 1) {
+    unsigned long nodemask[CFG_NUMA_MAX_NODES / (8 * sizeof(unsigned long))];
+    memset(nodemask, 0, sizeof(nodemask));
+    nodemask[node / (8 * sizeof(unsigned long))] |= 1UL << (node % (8 * sizeof(unsigned long)));
+    /* Pages aren't touched yet, so the policy applies to all of them. */
+    (void)syscall(SYS_mbind, addr, map_size, CFG_NUMA_MPOL_PREFERRED, nodemask, CFG_NUMA_MAX_NODES + 1, 0);
+  }
+#else
+  (void)numa;
+  (void)node;
+#endif
+
+  *rtn_addr = addr;
+  *rtn_map_size = map_size;
+  return ERR_OK;
+}  /* cfg_numa_map */
+
+
+ERR_F cfg_numa_create_common(cfg_numa_t **rtn_numa, cfg_t *cfg, cfg_shm_t *shm, const char *sysfs_dir) {
+  cfg_numa_t *numa;
+  err_t *err;
+
+  ERR(err_calloc((void **)&numa, 1, sizeof(cfg_numa_t)));
+  numa->cfg = cfg;
+  numa->shm = shm;
+
+  err = cfg_numa_detect(numa, sysfs_dir ? sysfs_dir : CFG_NUMA_SYSFS_DIR);
+  if (err == ERR_OK) {
+    err = cfg_numa_update(numa);
+  }
+  if (err) {
+    err_t *delete_err = cfg_numa_delete(numa);
+    if (delete_err) { err_dispose(delete_err); }
+    ERR_RETHROW(err, err->code);
+  }
+
+  *rtn_numa = numa;
+  return ERR_OK;
+}  /* cfg_numa_create_common */
+
+
+ERR_F cfg_numa_create(cfg_numa_t **rtn_numa, cfg_t *cfg, const char *sysfs_dir) {
+  ERR_ASSRT(rtn_numa, CFG_NUMA_ERR_PARAM);
+  ERR_ASSRT(cfg, CFG_NUMA_ERR_PARAM);
+  ERR(cfg_numa_create_common(rtn_numa, cfg, NULL, sysfs_dir));
+
+  return ERR_OK;
+}  /* cfg_numa_create */
+
+
+ERR_F cfg_numa_create_shm(cfg_numa_t **rtn_numa, cfg_shm_t *shm, const char *sysfs_dir) {
+  ERR_ASSRT(rtn_numa, CFG_NUMA_ERR_PARAM);
+  ERR_ASSRT(shm, CFG_NUMA_ERR_PARAM);
+  ERR(cfg_numa_create_common(rtn_numa, NULL, shm, sysfs_dir));
+
+  return ERR_OK;
+}  /* cfg_numa_create_shm */
+
+
+void cfg_numa_retired_free(cfg_numa_retired_t *retired) {
+  int i;
+
+  while (retired) {
+    cfg_numa_retired_t *next = retired->next;
+    for (i = 0; i < retired->num_images; i++) {
+      munmap(retired->images[i], retired->map_sizes[i]);
+    }
+    err_mem_free(NULL, retired);
+    retired = next;
+  }
+}  /* cfg_numa_retired_free */
+
+
+ERR_F cfg_numa_delete(cfg_numa_t *numa) {
+  int i;
+
+  ERR_ASSRT(numa, CFG_NUMA_ERR_PARAM);
+
+  for (i = 0; i < numa->num_replicas; i++) {
+    if (numa->replicas[i].image) {
+      munmap((void *)numa->replicas[i].image, numa->replicas[i].map_size);
+    }
+  }
+  cfg_numa_retired_free(numa->retired);
+  cfg_numa_retired_free(numa->old_retired);
+  err_mem_free(NULL, numa->cpu_replicas);
+  err_mem_free(NULL, numa);
+
+  return ERR_OK;
+}  /* cfg_numa_delete */
+
+
+/* Build each node's new image completely, then switch readers to it.
+ * A shm source is only copied if a new generation was published. */
+ERR_F cfg_numa_update(cfg_numa_t *numa) {
+  void *images[CFG_NUMA_MAX_NODES];
+  size_t map_sizes[CFG_NUMA_MAX_NODES];
+  cfg_numa_retired_t *retired = NULL;
+  const void *source = NULL;
+  size_t image_size = 0;
+  uint64_t generation;
+  int num_mapped = 0;
+  err_t *err = ERR_OK;
+  int i;
+
+  ERR_ASSRT(numa, CFG_NUMA_ERR_PARAM);
+
+  if (numa->shm) {
+    int changed;
+    ERR(cfg_shm_refresh(numa->shm, &changed));
+    if (!changed && numa->replicas[0].image) {
+      return ERR_OK;
+    }
+    source = numa->shm->image;
+    image_size = (size_t)numa->shm->image->image_size;
+    generation = numa->shm->image->generation;
+  } else {
+    ERR(cfg_shm_image_size(numa->cfg, &image_size));
+    generation = numa->generation + 1;
+  }
+
+  /* Allocated up front so nothing can fail after readers switch. */
+  if (numa->replicas[0].image) {
+    ERR(err_calloc((void **)&retired, 1, sizeof(cfg_numa_retired_t)));
+  }
+
+  while (err == ERR_OK && num_mapped < numa->num_replicas) {
+    i = num_mapped;
+    err = cfg_numa_map(numa, numa->replicas[i].node, image_size, &images[i], &map_sizes[i]);
+    if (err == ERR_OK) {
+      num_mapped++;
+      if (source == NULL) {  /* Build the first, copy it to the rest. */
+        err = cfg_shm_image_write(numa->cfg, images[i], map_sizes[i], generation);
+        source = images[i];
+      } else {
+        memcpy(images[i], source, image_size);
+      }
+    }
+  }
+  for (i = 0; i < num_mapped && err == ERR_OK; i++) {
+    if (mprotect(images[i], map_sizes[i], PROT_READ) == -1) {
+      err = err_throw_v(__FILE__, __LINE__, __func__, CFG_NUMA_ERR_SYS, "mprotect: %s", strerror(errno));
+    }
+  }
+  if (err) {
+    for (i = 0; i < num_mapped; i++) {
+      munmap(images[i], map_sizes[i]);
+    }
+    err_mem_free(NULL, retired);
+    ERR_RETHROW(err, err->code);
+  }
+
+  for (i = 0; i < numa->num_replicas; i++) {
+    cfg_numa_replica_t *replica = &numa->replicas[i];
+    if (retired) {
+      retired->images[i] = (void *)replica->image;
+      retired->map_sizes[i] = replica->map_size;
+      retired->num_images++;
+    }
+    replica->map_size = map_sizes[i];
+    /* The image is complete before readers can see it. */
+    __atomic_store_n(&replica->image, (const cfg_shm_hdr_t *)images[i], __ATOMIC_RELEASE);
+  }
+  if (retired) {
+    retired->next = numa->retired;
+    numa->retired = retired;
+  }
+  numa->generation = generation;
+
+  return ERR_OK;
+}  /* cfg_numa_update */
+
+
+ERR_F cfg_numa_reclaim(cfg_numa_t *numa) {
+  ERR_ASSRT(numa, CFG_NUMA_ERR_PARAM);
+
+  /* Replaced before the previous call, so readers have had a whole
+   * interval to drop them. */
+  cfg_numa_retired_free(numa->old_retired);
+  numa->old_retired = numa->retired;
+  numa->retired = NULL;
+
+  return ERR_OK;
+}  /* cfg_numa_reclaim */
+
+
+int cfg_numa_cpu_replica(cfg_numa_t *numa, int cpu) {
+  if (cpu < 0 || cpu >= numa->num_cpus) {
+    return 0;
+  }
+
+  return numa->cpu_replicas[cpu];
+}  /* cfg_numa_cpu_replica */
+
+
+ERR_F cfg_numa_image(cfg_numa_t *numa, const cfg_shm_hdr_t **rtn_image) {
+  int replica;
+
+  ERR_ASSRT(numa, CFG_NUMA_ERR_PARAM);
+  ERR_ASSRT(rtn_image, CFG_NUMA_ERR_PARAM);
+
+  /* A thread that migrates afterward just reads a remote copy. */
+  replica = cfg_numa_cpu_replica(numa, sched_getcpu());
+  *rtn_image = __atomic_load_n(&numa->replicas[replica].image, __ATOMIC_ACQUIRE);
+  return ERR_OK;
+}  /* cfg_numa_image */
+
+
+ERR_F cfg_numa_get_str_val(cfg_numa_t *numa, const char *key, const char **rtn_value) {
+  const cfg_shm_hdr_t *image;
+  const cfg_shm_entry_t *entry;
+
+  ERR(cfg_numa_image(numa, &image));
+  ERR(cfg_shm_image_lookup(image, key, &entry));
+
+  *rtn_value = (const char *)image + entry->value_off;
+  return ERR_OK;
+}  /* cfg_numa_get_str_val */
+
+
+ERR_F cfg_numa_get_long_val(cfg_numa_t *numa, const char *key, long *rtn_value) {
+  const char *value;
+
+  ERR(cfg_numa_get_str_val(numa, key, &value));
+  if (cfg_num_parse_long(value, strlen(value), rtn_value) != 0) {
+    ERR_THROW(ERR_ERR_BAD_NUMBER, "key '%s': bad value '%s'", key, value);
+  }
+
+  return ERR_OK;
+}  /* cfg_numa_get_long_val */
+
+
+ERR_F cfg_numa_get_double_val(cfg_numa_t *numa, const char *key, double *rtn_value) {
+  const char *value;
+
+  ERR(cfg_numa_get_str_val(numa, key, &value));
+  if (cfg_conv_double(value, rtn_value) != 0) {
+    ERR_THROW(ERR_ERR_BAD_NUMBER, "key '%s': bad value '%s'", key, value);
+  }
+
+  return ERR_OK;
+}  /* cfg_numa_get_double_val */
+
+
+ERR_F cfg_numa_get_bool_val(cfg_numa_t *numa, const char *key, int *rtn_value) {
+  const char *value;
+
+  ERR(cfg_numa_get_str_val(numa, key, &value));
+  if (cfg_conv_bool(value, rtn_value) != 0) {
+    ERR_THROW(CFG_ERR_BAD_BOOL, "key '%s': bad value '%s'", key, value);
+  }
+
+  return ERR_OK;
+}  /* cfg_numa_get_bool_val */
+
+
+ERR_F cfg_numa_get_size_val(cfg_numa_t *numa, const char *key, size_t *rtn_value) {
+  const char *value;
+
+  ERR(cfg_numa_get_str_val(numa, key, &value));
+  if (cfg_conv_size(value, rtn_value) != 0) {
+    ERR_THROW(ERR_ERR_BAD_NUMBER, "key '%s': bad value '%s'", key, value);
+  }
+
+  return ERR_OK;
+}  /* cfg_numa_get_size_val */
+
+
+ERR_F cfg_numa_get_duration_val(cfg_numa_t *numa, const char *key, long *rtn_ms) {
+  const char *value;
+
+  ERR(cfg_numa_get_str_val(numa, key, &value));
+  if (cfg_conv_duration(value, rtn_ms) != 0) {
+    ERR_THROW(ERR_ERR_BAD_NUMBER, "key '%s': bad value '%s'", key, value);
+  }
+
+  return ERR_OK;
+}  /* cfg_numa_get_duration_val */
@@ -0,0 +1,97 @@
+/* cfg_numa.h - read-only copies of a cfg on each NUMA node. */
+
+/* This work is dedicated to the public domain under CC0 1.0 Universal:
+ * http://creativecommons.org/publicdomain/zero/1.0/
+ *
+ * To the extent possible under law, Steven Ford has waived all copyright
+ * and related or neighboring rights to this work. In other words, you can
+ * use this code for any purpose without any restrictions.
+ * This work is published from: United States.
+ * Project home: https://github.com/fordsfords/cfg
+ */
+
+#ifndef CFG_NUMA_H
+#define CFG_NUMA_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include "err.h"
+#include "cfg.h"
+#include "cfg_shm.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define CFG_NUMA_MAX_NODES 64
+#define CFG_NUMA_SYSFS_DIR "/sys/devices/system/node"
+
+/* One copy of the cfg, in the compact cfg_shm image layout, with its
+ * pages placed on the node. */
+typedef struct cfg_numa_replica_s cfg_numa_replica_t;
+struct cfg_numa_replica_s {
+  int node;  /* NUMA node number. */
+  const cfg_shm_hdr_t *image;  /* Accessed atomically. */
+  size_t map_size;
+};
+
+typedef struct cfg_numa_s cfg_numa_t;
+struct cfg_numa_s {
+  cfg_t *cfg;  /* Source: a cfg, */
+  cfg_shm_t *shm;  /* or a published one. */
+  uint64_t generation;
+  int num_replicas;  /* Nodes that have CPUs; at least 1. */
+  cfg_numa_replica_t replicas[CFG_NUMA_MAX_NODES];
+  int *cpu_replicas;  /* Replica index by CPU number. */
+  int num_cpus;
+  struct cfg_numa_retired_s *retired;  /* Replaced since the last cfg_numa_reclaim(). */
+  struct cfg_numa_retired_s *old_retired;  /* Replaced before it; freed by the next. */
+};
+
+
+#ifdef CFG_NUMA_C
+#  define ERR_CODE(err__code) ERR_API char *err__code = #err__code
+#else
+#  define ERR_CODE(err__code) ERR_API extern char *err__code
+#endif
+
+ERR_CODE(CFG_NUMA_ERR_PARAM);
+ERR_CODE(CFG_NUMA_ERR_NOMEM);
+ERR_CODE(CFG_NUMA_ERR_SYS);  /* A system call failed; see the message. */
+
+#undef ERR_CODE
+
+
+/* Replicate a cfg, or a consumer's view of a published one. sysfs_dir
+ * is normally NULL (CFG_NUMA_SYSFS_DIR); without it, there is one copy. */
+ERR_F cfg_numa_create(cfg_numa_t **rtn_numa, cfg_t *cfg, const char *sysfs_dir);
+ERR_F cfg_numa_create_shm(cfg_numa_t **rtn_numa, cfg_shm_t *shm, const char *sysfs_dir);
+ERR_F cfg_numa_delete(cfg_numa_t *numa);
+
+/* Copy the source's current contents to every node. Call from the
+ * thread that owns the source cfg; one updater at a time. */
+ERR_F cfg_numa_update(cfg_numa_t *numa);
+
+/* Unmap the images replaced before the previous call; the ones replaced
+ * since are kept until the next call. Call from the updating thread,
+ * for example on a timer; the interval between calls is the grace
+ * period readers get. */
+ERR_F cfg_numa_reclaim(cfg_numa_t *numa);
+
+/* Readers, any thread. Use the copy on the calling thread's node.
+ * Strings and images stay valid until the second cfg_numa_reclaim()
+ * after the read (or cfg_numa_delete()). */
+int cfg_numa_cpu_replica(cfg_numa_t *numa, int cpu);
+ERR_F cfg_numa_image(cfg_numa_t *numa, const cfg_shm_hdr_t **rtn_image);
+ERR_F cfg_numa_get_str_val(cfg_numa_t *numa, const char *key, const char **rtn_value);
+ERR_F cfg_numa_get_long_val(cfg_numa_t *numa, const char *key, long *rtn_value);
+ERR_F cfg_numa_get_double_val(cfg_numa_t *numa, const char *key, double *rtn_value);
+ERR_F cfg_numa_get_bool_val(cfg_numa_t *numa, const char *key, int *rtn_value);
+ERR_F cfg_numa_get_size_val(cfg_numa_t *numa, const char *key, size_t *rtn_value);
+ERR_F cfg_numa_get_duration_val(cfg_numa_t *numa, const char *key, long *rtn_ms);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif  /* CFG_NUMA_H */
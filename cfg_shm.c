@@ -0,0 +1,558 @@
+/* cfg_shm.c - publish a parsed cfg in shared memory for other processes. */
+
+/* This work is dedicated to the public domain under CC0 1.0 Universal:
+ * http://creativecommons.org/publicdomain/zero/1.0/
+ *
+ * To the extent possible under law, Steven Ford has waived all copyright
+ * and related or neighboring rights to this work. In other words, you can
+ * use this code for any purpose without any restrictions.
+ * This work is published from: United States.
+ * Project home: https://github.com/fordsfords/cfg
+ */
+
+#define _POSIX_C_SOURCE 200809L  /* For shm_open(), ftruncate(). */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "err.h"
+#include "hmap.h"
+#include "cfg.h"
+#include "cfg_num.h"
+#define CFG_SHM_C
+#include "cfg_shm.h"
+
+/* Consumers retry this many times if the publisher keeps replacing the
+ * segment while they are trying to map it. */
+#define CFG_SHM_MAX_TRIES 100
+
+
+#define CFG_SHM_ALIGN8(cfg_shm__size) (((cfg_shm__size) + 7) & ~(size_t)7)
+
+
+/* Step through the options visible in cfg: its own, then those of its
+ * parents that aren't overridden. Start with *in_layer NULL and *in_pos
+ * zeroed. */
+ERR_F cfg_shm_next_option(cfg_t *cfg, cfg_t **in_layer, cfg_layer_pos_t *in_pos, cfg_option_t **rtn_option) {
+  cfg_option_t *option;
+
+  if (*in_layer == NULL) {
+    *in_layer = cfg;
+  }
+  while (*in_layer) {
+    ERR(cfg_layer_next(*in_layer, in_pos, &option));
+    if (option == NULL) {
+      *in_layer = (*in_layer)->parent;
+      memset(in_pos, 0, sizeof(*in_pos));
+      continue;
+    }
+    cfg_t *source = option->owner;
+    if (*in_layer != cfg) {
+      ERR(cfg_get_source(cfg, option->key, &source, NULL));
+    }
+    if (source == option->owner) {
+      *rtn_option = option;
+      return ERR_OK;
+    }
+  }
+
+  *rtn_option = NULL;
+  return ERR_OK;
+}  /* cfg_shm_next_option */
+
+
+/* An option's expanded value, read straight from the option so that
+ * building an image counts no reads and fills no hot-key cache. */
+ERR_F cfg_shm_option_value(cfg_option_t *option, const char **rtn_value) {
+  ERR(cfg_option_expand(option->owner, option));
+
+  *rtn_value = option->expanded ? option->expanded : option->value;
+  return ERR_OK;
+}  /* cfg_shm_option_value */
+
+
+/* Build the image, or just size it if image is NULL. Values are fully
+ * expanded, so consumers never need the other keys. An overlay's image
+ * includes what it inherits. */
+ERR_F cfg_shm_image_build(cfg_t *cfg, void *image, size_t image_size, uint64_t generation, size_t *rtn_size) {
+  cfg_layer_pos_t pos;
+  cfg_t *layer;
+  cfg_option_t *option;
+  uint32_t num_entries = 0;
+  uint32_t num_buckets = 8;
+  size_t strs_size = 0;
+
+  /* Sizing pass. */
+  layer = NULL;
+  memset(&pos, 0, sizeof(pos));  /* Start at beginning. */
+  do {
+    ERR(cfg_shm_next_option(cfg, &layer, &pos, &option));
+    if (option) {
+      const char *value;
+      const char *location;
+      ERR(cfg_shm_option_value(option, &value));
+      ERR(cfg_get_source(cfg, option->key, NULL, &location));
+      strs_size += strlen(option->key) + strlen(value) + strlen(location) + 3;
+      num_entries++;
+    }
+  } while (option);
+
+  while (num_buckets < num_entries * 2) {
+    num_buckets *= 2;
+  }
+
+  size_t buckets_off = CFG_SHM_ALIGN8(sizeof(cfg_shm_hdr_t));
+  size_t entries_off = CFG_SHM_ALIGN8(buckets_off + num_buckets * sizeof(uint32_t));
+  size_t strs_off = entries_off + num_entries * sizeof(cfg_shm_entry_t);
+  size_t total_size = strs_off + strs_size;
+  ERR_ASSRT(total_size < UINT32_MAX, CFG_SHM_ERR_TOO_BIG);
+  *rtn_size = total_size;
+  if (image == NULL) {
+    return ERR_OK;
+  }
+  ERR_ASSRT(image_size >= total_size, CFG_SHM_ERR_PARAM);
+
+  char *base = (char *)image;
+  cfg_shm_hdr_t *hdr = (cfg_shm_hdr_t *)base;
+  uint32_t *buckets = (uint32_t *)(base + buckets_off);
+  cfg_shm_entry_t *entries = (cfg_shm_entry_t *)(base + entries_off);
+  size_t str_pos = strs_off;
+  uint32_t entry_idx = 0;
+
+  memset(base, 0, strs_off);
+  layer = NULL;
+  memset(&pos, 0, sizeof(pos));  /* Start at beginning. */
+  do {
+    ERR(cfg_shm_next_option(cfg, &layer, &pos, &option));
+    if (option) {
+      ERR_ASSRT(entry_idx < num_entries, CFG_ERR_INTERNAL);
+      cfg_shm_entry_t *shm_entry = &entries[entry_idx];
+      const char *value;
+      const char *location;
+      ERR(cfg_shm_option_value(option, &value));
+      ERR(cfg_get_source(cfg, option->key, NULL, &location));
+
+      size_t key_len = strlen(option->key) + 1;
+      shm_entry->hash = hmap_murmur3_32(option->key, key_len, HMAP_SEED);
+      shm_entry->key_off = (uint32_t)str_pos;
+      memcpy(base + str_pos, option->key, key_len);
+      str_pos += key_len;
+      shm_entry->value_off = (uint32_t)str_pos;
+      memcpy(base + str_pos, value, strlen(value) + 1);
+      str_pos += strlen(value) + 1;
+      shm_entry->location_off = (uint32_t)str_pos;
+      memcpy(base + str_pos, location, strlen(location) + 1);
+      str_pos += strlen(location) + 1;
+
+      uint32_t bucket = shm_entry->hash & (num_buckets - 1);
+      while (buckets[bucket] != 0) {
+        bucket = (bucket + 1) & (num_buckets - 1);
+      }
+      buckets[bucket] = entry_idx + 1;
+      entry_idx++;
+    }
+  } while (option);
+  ERR_ASSRT(str_pos == total_size, CFG_ERR_INTERNAL);
+
+  hdr->magic = CFG_SHM_MAGIC;
+  hdr->version = CFG_SHM_VERSION;
+  hdr->generation = generation;
+  hdr->image_size = total_size;
+  hdr->num_buckets = num_buckets;
+  hdr->num_entries = num_entries;
+
+  return ERR_OK;
+}  /* cfg_shm_image_build */
+
+
+ERR_F cfg_shm_image_size(cfg_t *cfg, size_t *rtn_size) {
+  ERR_ASSRT(cfg, CFG_SHM_ERR_PARAM);
+  ERR_ASSRT(rtn_size, CFG_SHM_ERR_PARAM);
+  ERR(cfg_shm_image_build(cfg, NULL, 0, 0, rtn_size));
+
+  return ERR_OK;
+}  /* cfg_shm_image_size */
+
+
+ERR_F cfg_shm_image_write(cfg_t *cfg, void *image, size_t image_size, uint64_t generation) {
+  size_t size;
+
+  ERR_ASSRT(cfg, CFG_SHM_ERR_PARAM);
+  ERR_ASSRT(image, CFG_SHM_ERR_PARAM);
+  ERR(cfg_shm_image_build(cfg, image, image_size, generation, &size));
+
+  return ERR_OK;
+}  /* cfg_shm_image_write */
+
+
+/* The string at off must end inside the image. */
+int cfg_shm_str_ok(const char *base, size_t strs_off, size_t image_size, uint32_t off) {
+  return off >= strs_off && off < image_size && memchr(base + off, '\0', image_size - off) != NULL;
+}  /* cfg_shm_str_ok */
+
+
+ERR_F cfg_shm_image_check(const cfg_shm_hdr_t *image, size_t size) {
+  uint32_t i;
+
+  ERR_ASSRT(image, CFG_SHM_ERR_PARAM);
+  if (size < sizeof(cfg_shm_hdr_t) || image->magic != CFG_SHM_MAGIC || image->version != CFG_SHM_VERSION) {
+    ERR_THROW(CFG_SHM_ERR_BAD_IMAGE, "not a cfg_shm image");
+  }
+  uint32_t num_buckets = image->num_buckets;
+  uint32_t num_entries = image->num_entries;
+  if (image->image_size > size || num_buckets == 0 || (num_buckets & (num_buckets - 1)) != 0 ||
+      num_entries >= num_buckets) {
+    ERR_THROW(CFG_SHM_ERR_BAD_IMAGE, "bad header");
+  }
+  size_t image_size = (size_t)image->image_size;
+  size_t buckets_off = CFG_SHM_ALIGN8(sizeof(cfg_shm_hdr_t));
+  size_t entries_off = CFG_SHM_ALIGN8(buckets_off + (size_t)num_buckets * sizeof(uint32_t));
+  size_t strs_off = entries_off + (size_t)num_entries * sizeof(cfg_shm_entry_t);
+  if (strs_off > image_size) {
+    ERR_THROW(CFG_SHM_ERR_BAD_IMAGE, "%u buckets and %u entries don't fit", num_buckets, num_entries);
+  }
+
+  const char *base = (const char *)image;
+  const uint32_t *buckets = (const uint32_t *)(base + buckets_off);
+  const cfg_shm_entry_t *entries = (const cfg_shm_entry_t *)(base + entries_off);
+  int have_empty = 0;
+  for (i = 0; i < num_buckets; i++) {
+    if (buckets[i] > num_entries) {
+      ERR_THROW(CFG_SHM_ERR_BAD_IMAGE, "bucket %u: bad entry %u", i, buckets[i]);
+    }
+    if (buckets[i] == 0) { have_empty = 1; }
+  }
+  if (! have_empty) {  /* A probe for a missing key would never end. */
+    ERR_THROW(CFG_SHM_ERR_BAD_IMAGE, "no empty bucket");
+  }
+  for (i = 0; i < num_entries; i++) {
+    if (! cfg_shm_str_ok(base, strs_off, image_size, entries[i].key_off) ||
+        ! cfg_shm_str_ok(base, strs_off, image_size, entries[i].value_off) ||
+        ! cfg_shm_str_ok(base, strs_off, image_size, entries[i].location_off)) {
+      ERR_THROW(CFG_SHM_ERR_BAD_IMAGE, "entry %u: bad string offset", i);
+    }
+  }
+
+  return ERR_OK;
+}  /* cfg_shm_image_check */
+
+
+ERR_F cfg_shm_image_lookup(const cfg_shm_hdr_t *image, const char *key, const cfg_shm_entry_t **rtn_entry) {
+  ERR_ASSRT(image, CFG_SHM_ERR_PARAM);
+  ERR_ASSRT(key, CFG_SHM_ERR_PARAM);
+
+  const char *base = (const char *)image;
+  const uint32_t *buckets = (const uint32_t *)(base + CFG_SHM_ALIGN8(sizeof(cfg_shm_hdr_t)));
+  const cfg_shm_entry_t *entries = (const cfg_shm_entry_t *)
+    (base + CFG_SHM_ALIGN8(CFG_SHM_ALIGN8(sizeof(cfg_shm_hdr_t)) + image->num_buckets * sizeof(uint32_t)));
+  uint32_t mask = image->num_buckets - 1;
+  uint32_t hash = hmap_murmur3_32(key, strlen(key) + 1, HMAP_SEED);
+  uint32_t bucket = hash & mask;
+
+  while (buckets[bucket] != 0) {  /* Load factor <= 1/2, so there's an empty one. */
+    const cfg_shm_entry_t *entry = &entries[buckets[bucket] - 1];
+    if (entry->hash == hash && strcmp(base + entry->key_off, key) == 0) {
+      *rtn_entry = entry;
+      return ERR_OK;
+    }
+    bucket = (bucket + 1) & mask;
+  }
+
+  ERR_THROW(HMAP_ERR_NOTFOUND, "key '%s' not found", key);
+}  /* cfg_shm_image_lookup */
+
+
+/* Open and map a segment. If min_size is non-zero and the segment is
+ * smaller, it is grown first (needs O_RDWR). A missing segment throws
+ * CFG_SHM_ERR_NOT_PUBLISHED. */
+ERR_F cfg_shm_map(const char *name, int oflag, size_t min_size, void **rtn_addr, size_t *rtn_size) {
+  int fd = shm_open(name, oflag, 0644);
+  if (fd == -1) {
+    if (errno == ENOENT) {
+      ERR_THROW(CFG_SHM_ERR_NOT_PUBLISHED, "'%s'", name);
+    }
+    ERR_THROW(CFG_SHM_ERR_SYS, "shm_open '%s': %s", name, strerror(errno));
+  }
+
+  struct stat st;
+  if (fstat(fd, &st) == -1) {
+    int errno_save = errno;
+    close(fd);
+    ERR_THROW(CFG_SHM_ERR_SYS, "fstat '%s': %s", name, strerror(errno_save));
+  }
+  size_t size = (size_t)st.st_size;
+  if (size < min_size) {
+    if (ftruncate(fd, min_size) == -1) {
+      int errno_save = errno;
+      close(fd);
+      ERR_THROW(CFG_SHM_ERR_SYS, "ftruncate '%s': %s", name, strerror(errno_save));
+    }
+    size = min_size;
+  }
+  if (size == 0) {  /* Being created by the publisher. */
+    close(fd);
+    ERR_THROW(CFG_SHM_ERR_NOT_PUBLISHED, "'%s' is empty", name);
+  }
+
+  int prot = ((oflag & O_ACCMODE) == O_RDWR) ? (PROT_READ | PROT_WRITE) : PROT_READ;
+  void *addr = mmap(NULL, size, prot, MAP_SHARED, fd, 0);
+  int errno_save = errno;
+  close(fd);  /* Mapping stays valid. */
+  if (addr == MAP_FAILED) {
+    ERR_THROW(CFG_SHM_ERR_SYS, "mmap '%s': %s", name, strerror(errno_save));
+  }
+
+  *rtn_addr = addr;
+  *rtn_size = size;
+  return ERR_OK;
+}  /* cfg_shm_map */
+
+
+ERR_F cfg_shm_data_name(char **rtn_name, const char *name, uint64_t generation) {
+  ERR(err_asprintf(rtn_name, "%s.%llu", name, (unsigned long long)generation));
+
+  return ERR_OK;
+}  /* cfg_shm_data_name */
+
+
+/* Write a new generation and switch consumers to it. The previous data
+ * segment is unlinked; consumers that still map it keep their mapping
+ * until they refresh. */
+ERR_F cfg_shm_publish(cfg_t *cfg, const char *name) {
+  cfg_shm_ctl_t *ctl;
+  size_t ctl_size;
+  size_t image_size;
+  char *data_name;
+  void *image;
+  size_t mapped_size;
+  err_t *err;
+
+  ERR_ASSRT(cfg, CFG_SHM_ERR_PARAM);
+  ERR_ASSRT(name, CFG_SHM_ERR_PARAM);
+
+  ERR(cfg_shm_image_size(cfg, &image_size));
+  ERR(cfg_shm_map(name, O_RDWR | O_CREAT, sizeof(cfg_shm_ctl_t), (void **)&ctl, &ctl_size));
+  if (ctl->magic == 0) {  /* New control segment. */
+    ctl->version = CFG_SHM_VERSION;
+    ctl->magic = CFG_SHM_MAGIC;
+  }
+  if (ctl->magic != CFG_SHM_MAGIC || ctl->version != CFG_SHM_VERSION) {
+    munmap(ctl, ctl_size);
+    ERR_THROW(CFG_SHM_ERR_BAD_IMAGE, "'%s' is not a cfg_shm control segment", name);
+  }
+  uint64_t old_generation = __atomic_load_n(&ctl->generation, __ATOMIC_ACQUIRE);
+  uint64_t new_generation = old_generation + 1;
+
+  err = cfg_shm_data_name(&data_name, name, new_generation);
+  if (err) {
+    munmap(ctl, ctl_size);
+    ERR_RETHROW(err, err->code);
+  }
+  shm_unlink(data_name);  /* Left over from a publisher that died. */
+  err = cfg_shm_map(data_name, O_RDWR | O_CREAT | O_EXCL, image_size, &image, &mapped_size);
+  if (err == ERR_OK) {
+    err = cfg_shm_image_write(cfg, image, mapped_size, new_generation);
+    munmap(image, mapped_size);
+    if (err) {
+      shm_unlink(data_name);
+    }
+  }
+  err_mem_free(NULL, data_name);
+  if (err) {
+    munmap(ctl, ctl_size);
+    ERR_RETHROW(err, err->code);
+  }
+
+  /* The image is complete before consumers can see its generation. */
+  __atomic_store_n(&ctl->generation, new_generation, __ATOMIC_RELEASE);
+  munmap(ctl, ctl_size);
+
+  if (old_generation > 0) {
+    ERR(cfg_shm_data_name(&data_name, name, old_generation));
+    shm_unlink(data_name);
+    err_mem_free(NULL, data_name);
+  }
+
+  return ERR_OK;
+}  /* cfg_shm_publish */
+
+
+/* Remove the control segment and the current data segment. Attached
+ * consumers keep their mappings. */
+ERR_F cfg_shm_unlink(const char *name) {
+  cfg_shm_ctl_t *ctl;
+  size_t ctl_size;
+  char *data_name;
+
+  ERR_ASSRT(name, CFG_SHM_ERR_PARAM);
+
+  ERR(cfg_shm_map(name, O_RDONLY, 0, (void **)&ctl, &ctl_size));
+  uint64_t generation = __atomic_load_n(&ctl->generation, __ATOMIC_ACQUIRE);
+  munmap(ctl, ctl_size);
+
+  if (generation > 0) {
+    ERR(cfg_shm_data_name(&data_name, name, generation));
+    shm_unlink(data_name);
+    err_mem_free(NULL, data_name);
+  }
+  if (shm_unlink(name) == -1) {
+    ERR_THROW(CFG_SHM_ERR_SYS, "shm_unlink '%s': %s", name, strerror(errno));
+  }
+
+  return ERR_OK;
+}  /* cfg_shm_unlink */
+
+
+ERR_F cfg_shm_attach(cfg_shm_t **rtn_shm, const char *name) {
+  cfg_shm_t *shm;
+  int changed;
+  err_t *err;
+
+  ERR_ASSRT(rtn_shm, CFG_SHM_ERR_PARAM);
+  ERR_ASSRT(name, CFG_SHM_ERR_PARAM);
+
+  ERR(err_calloc((void **)&shm, 1, sizeof(cfg_shm_t)));
+  err = err_strdup(&shm->name, name);
+  if (err == ERR_OK) {
+    err = cfg_shm_map(name, O_RDONLY, 0, (void **)&shm->ctl, &shm->ctl_size);
+  }
+  if (err == ERR_OK && shm->ctl_size >= sizeof(cfg_shm_ctl_t) && shm->ctl->magic == 0) {
+    err = err_throw_v(__FILE__, __LINE__, __func__, CFG_SHM_ERR_NOT_PUBLISHED,
+      "'%s' is being created", name);
+  }
+  if (err == ERR_OK && (shm->ctl_size < sizeof(cfg_shm_ctl_t) || shm->ctl->magic != CFG_SHM_MAGIC)) {
+    err = err_throw_v(__FILE__, __LINE__, __func__, CFG_SHM_ERR_BAD_IMAGE,
+      "'%s' is not a cfg_shm control segment", name);
+  }
+  if (err == ERR_OK) {
+    err = cfg_shm_refresh(shm, &changed);
+  }
+  if (err) {
+    err_t *detach_err = cfg_shm_detach(shm);
+    if (detach_err) { err_dispose(detach_err); }
+    ERR_RETHROW(err, err->code);
+  }
+
+  *rtn_shm = shm;
+  return ERR_OK;
+}  /* cfg_shm_attach */
+
+
+ERR_F cfg_shm_detach(cfg_shm_t *shm) {
+  ERR_ASSRT(shm, CFG_SHM_ERR_PARAM);
+
+  if (shm->image) {
+    munmap((void *)shm->image, shm->image_size);
+  }
+  if (shm->ctl) {
+    munmap(shm->ctl, shm->ctl_size);
+  }
+  err_mem_free(NULL, shm->name);
+  err_mem_free(NULL, shm);
+
+  return ERR_OK;
+}  /* cfg_shm_detach */
+
+
+/* Switch to the latest generation if there is a newer one. Cheap when
+ * there isn't (one atomic load), so it can be called often. */
+ERR_F cfg_shm_refresh(cfg_shm_t *shm, int *rtn_changed) {
+  int tries;
+
+  ERR_ASSRT(shm, CFG_SHM_ERR_PARAM);
+  if (rtn_changed) { *rtn_changed = 0; }
+
+  for (tries = 0; tries < CFG_SHM_MAX_TRIES; tries++) {
+    uint64_t generation = __atomic_load_n(&shm->ctl->generation, __ATOMIC_ACQUIRE);
+    ERR_ASSRT(generation > 0, CFG_SHM_ERR_NOT_PUBLISHED);
+    if (shm->image && shm->image->generation == generation) {
+      return ERR_OK;
+    }
+
+    char *data_name;
+    void *image;
+    size_t image_size;
+    ERR(cfg_shm_data_name(&data_name, shm->name, generation));
+    err_t *err = cfg_shm_map(data_name, O_RDONLY, 0, &image, &image_size);
+    err_mem_free(NULL, data_name);
+    if (err) {
+      /* Unlinked because a newer one was just published; try that. */
+      if (err->code == CFG_SHM_ERR_NOT_PUBLISHED &&
+          __atomic_load_n(&shm->ctl->generation, __ATOMIC_ACQUIRE) != generation) {
+        err_dispose(err);
+        continue;
+      }
+      ERR_RETHROW(err, err->code);
+    }
+
+    /* Checked once here, so lookups can trust the offsets. */
+    const cfg_shm_hdr_t *hdr = (const cfg_shm_hdr_t *)image;
+    err = cfg_shm_image_check(hdr, image_size);
+    if (err == ERR_OK && hdr->generation != generation) {
+      err = err_throw_v(__FILE__, __LINE__, __func__, CFG_SHM_ERR_BAD_IMAGE,
+        "'%s' generation %llu", shm->name, (unsigned long long)generation);
+    }
+    if (err) {
+      munmap(image, image_size);
+      ERR_RETHROW(err, err->code);
+    }
+
+    if (shm->image) {
+      munmap((void *)shm->image, shm->image_size);
+    }
+    shm->image = hdr;
+    shm->image_size = image_size;
+    if (rtn_changed) { *rtn_changed = 1; }
+    return ERR_OK;
+  }
+
+  ERR_THROW(CFG_SHM_ERR_NOT_PUBLISHED, "'%s' keeps changing", shm->name);
+}  /* cfg_shm_refresh */
+
+
+ERR_F cfg_shm_generation(cfg_shm_t *shm, uint64_t *rtn_generation) {
+  ERR_ASSRT(shm, CFG_SHM_ERR_PARAM);
+  ERR_ASSRT(rtn_generation, CFG_SHM_ERR_PARAM);
+
+  *rtn_generation = shm->image->generation;
+  return ERR_OK;
+}  /* cfg_shm_generation */
+
+
+ERR_F cfg_shm_get_str_val(cfg_shm_t *shm, const char *key, const char **rtn_value) {
+  const cfg_shm_entry_t *entry;
+
+  ERR_ASSRT(shm, CFG_SHM_ERR_PARAM);
+  ERR(cfg_shm_image_lookup(shm->image, key, &entry));
+
+  *rtn_value = (const char *)shm->image + entry->value_off;
+  return ERR_OK;
+}  /* cfg_shm_get_str_val */
+
+
+ERR_F cfg_shm_get_long_val(cfg_shm_t *shm, const char *key, long *rtn_value) {
+  const char *value;
+
+  ERR(cfg_shm_get_str_val(shm, key, &value));
+  if (cfg_num_parse_long(value, strlen(value), rtn_value) != 0) {
+    ERR_THROW(ERR_ERR_BAD_NUMBER, "key '%s': bad value '%s'", key, value);
+  }
+
+  return ERR_OK;
+}  /* cfg_shm_get_long_val */
+
+
+ERR_F cfg_shm_get_location(cfg_shm_t *shm, const char *key, const char **rtn_location) {
+  const cfg_shm_entry_t *entry;
+
+  ERR_ASSRT(shm, CFG_SHM_ERR_PARAM);
+  ERR(cfg_shm_image_lookup(shm->image, key, &entry));
+
+  *rtn_location = (const char *)shm->image + entry->location_off;
+  return ERR_OK;
+}  /* cfg_shm_get_location */
@@ -0,0 +1,116 @@
+/* cfg_shm.h - publish a parsed cfg in shared memory for other processes. */
+
+/* This work is dedicated to the public domain under CC0 1.0 Universal:
+ * http://creativecommons.org/publicdomain/zero/1.0/
+ *
+ * To the extent possible under law, Steven Ford has waived all copyright
+ * and related or neighboring rights to this work. In other words, you can
+ * use this code for any purpose without any restrictions.
+ * This work is published from: United States.
+ * Project home: https://github.com/fordsfords/cfg
+ */
+
+#ifndef CFG_SHM_H
+#define CFG_SHM_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include "err.h"
+#include "cfg.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define CFG_SHM_MAGIC 0x4d484643  /* "CFHM" */
+#define CFG_SHM_VERSION 1
+
+/* Compact image of a cfg. Contains no pointers, only offsets from the
+ * start of the image, so it can be mapped at any address. Values have
+ * substitutions already resolved. Layout:
+ *   cfg_shm_hdr_t
+ *   uint32_t buckets[num_buckets];  (entry index + 1; 0 is empty)
+ *   cfg_shm_entry_t entries[num_entries];
+ *   null-terminated strings */
+typedef struct cfg_shm_hdr_s cfg_shm_hdr_t;
+struct cfg_shm_hdr_s {
+  uint32_t magic;
+  uint32_t version;
+  uint64_t generation;
+  uint64_t image_size;
+  uint32_t num_buckets;  /* Power of 2; linear probing. */
+  uint32_t num_entries;
+};
+
+typedef struct cfg_shm_entry_s cfg_shm_entry_t;
+struct cfg_shm_entry_s {
+  uint32_t hash;  /* hmap_murmur3_32(key, strlen(key) + 1, HMAP_SEED). */
+  uint32_t key_off;
+  uint32_t value_off;
+  uint32_t location_off;
+};
+
+/* Control segment, named by the caller. Points consumers at the current
+ * data segment, which is named "<name>.<generation>". */
+typedef struct cfg_shm_ctl_s cfg_shm_ctl_t;
+struct cfg_shm_ctl_s {
+  uint32_t magic;
+  uint32_t version;
+  uint64_t generation;  /* 0 until first publish; accessed atomically. */
+};
+
+/* Consumer's view of a published cfg. */
+typedef struct cfg_shm_s cfg_shm_t;
+struct cfg_shm_s {
+  char *name;
+  cfg_shm_ctl_t *ctl;
+  size_t ctl_size;  /* As mapped. */
+  const cfg_shm_hdr_t *image;
+  size_t image_size;
+};
+
+
+#ifdef CFG_SHM_C
+#  define ERR_CODE(err__code) ERR_API char *err__code = #err__code
+#else
+#  define ERR_CODE(err__code) ERR_API extern char *err__code
+#endif
+
+ERR_CODE(CFG_SHM_ERR_PARAM);
+ERR_CODE(CFG_SHM_ERR_NOMEM);
+ERR_CODE(CFG_SHM_ERR_SYS);  /* A system call failed; see the message. */
+ERR_CODE(CFG_SHM_ERR_BAD_IMAGE);
+ERR_CODE(CFG_SHM_ERR_NOT_PUBLISHED);
+ERR_CODE(CFG_SHM_ERR_TOO_BIG);
+
+#undef ERR_CODE
+
+
+/* Image building and lookup, usable on any memory. */
+ERR_F cfg_shm_image_size(cfg_t *cfg, size_t *rtn_size);
+ERR_F cfg_shm_image_write(cfg_t *cfg, void *image, size_t image_size, uint64_t generation);
+/* Throws CFG_SHM_ERR_BAD_IMAGE unless every offset and bucket in the
+ * image is in bounds. Lookups trust the image, so check one from
+ * elsewhere first; cfg_shm_refresh() checks each one it maps. */
+ERR_F cfg_shm_image_check(const cfg_shm_hdr_t *image, size_t size);
+ERR_F cfg_shm_image_lookup(const cfg_shm_hdr_t *image, const char *key, const cfg_shm_entry_t **rtn_entry);
+
+/* Publisher. Only one process may publish a given name at a time. */
+ERR_F cfg_shm_publish(cfg_t *cfg, const char *name);
+ERR_F cfg_shm_unlink(const char *name);
+
+/* Consumers. Strings returned by the getters are in shared memory and
+ * stay valid until the next cfg_shm_refresh() or cfg_shm_detach(). */
+ERR_F cfg_shm_attach(cfg_shm_t **rtn_shm, const char *name);
+ERR_F cfg_shm_detach(cfg_shm_t *shm);
+ERR_F cfg_shm_refresh(cfg_shm_t *shm, int *rtn_changed);
+ERR_F cfg_shm_generation(cfg_shm_t *shm, uint64_t *rtn_generation);
+ERR_F cfg_shm_get_str_val(cfg_shm_t *shm, const char *key, const char **rtn_value);
+ERR_F cfg_shm_get_long_val(cfg_shm_t *shm, const char *key, long *rtn_value);
+ERR_F cfg_shm_get_location(cfg_shm_t *shm, const char *key, const char **rtn_location);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif  /* CFG_SHM_H */
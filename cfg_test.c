@@ -10,16 +10,27 @@
  * Project home: https://github.com/fordsfords/cfg
  */
 
+#if ! defined(_WIN32)
+#define _POSIX_C_SOURCE 200809L  /* For setenv(). */
+#endif
 #include <stdio.h>
 #include <string.h>
 #if ! defined(_WIN32)
 #include <stdlib.h>
 #include <unistd.h>
 #include <pthread.h>
+#include <sys/wait.h>
+#include <sys/stat.h>
+#include <poll.h>
 #endif
 #include "err.h"
 #include "hmap.h"
 #include "cfg.h"
+#include "cfg_num.h"
+#include "intern.h"
+#include "cfg_shm.h"
+#include "cfg_numa.h"
+#include "hamt.h"
 
 #if defined(_WIN32)
 #define MY_SLEEP_MS(msleep_msecs) Sleep(msleep_msecs)
@@ -265,27 +276,2738 @@ void test4() {
 }  /* test4 */
 
 
-int main(int argc, char **argv) {
-  parse_cmdline(argc, argv);
+/* Records notifications for test5. */
+int notify_count;
+char notify_key[64];
+char notify_old[64];
+char notify_new[64];
 
-  if (o_testnum == 0 || o_testnum == 1) {
-    test1();
-    printf("test1: success\n");
+err_t *test5_cb(cfg_t *cfg, const char *key, const char *old_value, const char *new_value, void *clientd) {
+  (void)cfg;
+  ASSRT(clientd == &notify_count);
+  notify_count++;
+  strcpy(notify_key, key);
+  strcpy(notify_old, old_value ? old_value : "(null)");
+  strcpy(notify_new, new_value);
+  return ERR_OK;
+}  /* test5_cb */
+
+
+/* Unsubscribes another subscription (clientd) from inside a callback. */
+err_t *test5_unsub_cb(cfg_t *cfg, const char *key, const char *old_value, const char *new_value, void *clientd) {
+  (void)key;  (void)old_value;  (void)new_value;
+  cfg_sub_t **victim = (cfg_sub_t **)clientd;
+  if (*victim) {
+    E(cfg_unsubscribe(cfg, *victim));
+    *victim = NULL;
   }
+  return ERR_OK;
+}  /* test5_unsub_cb */
 
-  if (o_testnum == 0 || o_testnum == 2) {
-    test2();
-    printf("test1: success\n");
+
+void test5() {
+  cfg_t *cfg;
+  cfg_sub_t *sub;
+  cfg_sub_t *qsub;
+  int fd;
+  char *defaults[] = {"feed-a-port=1", "feed-b-port=2", "other=3", NULL};
+  char *updates[] = {"feed-a-port=10", "other=4", "feed-a-port=11", NULL};
+  char *same[] = {"feed-a-port=5", "feed-a-port=11", NULL};
+
+  E(cfg_create(&cfg));
+  E(cfg_subscribe(cfg, "feed-a-", CFG_SUB_PREFIX, test5_cb, &notify_count, &sub));
+
+  /* Added keys are reported with a NULL old value. */
+  notify_count = 0;
+  E(cfg_parse_string_list(cfg, CFG_MODE_ADD, defaults));
+  ASSRT(notify_count == 1);
+  ASSRT(strcmp(notify_key, "feed-a-port") == 0);
+  ASSRT(strcmp(notify_old, "(null)") == 0);
+  ASSRT(strcmp(notify_new, "1") == 0);
+
+  /* Key set twice in one batch is reported once, first old to last new. */
+  notify_count = 0;
+  E(cfg_parse_string_list(cfg, CFG_MODE_UPDATE, updates));
+  ASSRT(notify_count == 1);
+  ASSRT(strcmp(notify_old, "1") == 0);
+  ASSRT(strcmp(notify_new, "11") == 0);
+
+  /* Net change of nothing is not reported. */
+  notify_count = 0;
+  E(cfg_parse_string_list(cfg, CFG_MODE_UPDATE, same));
+  ASSRT(notify_count == 0);
+
+  /* Outside of a batch, each line is its own batch. */
+  E(cfg_parse_line(cfg, CFG_MODE_UPDATE, "feed-a-port=12", "test5", 1));
+  ASSRT(notify_count == 1);
+  E(cfg_batch_begin(cfg));
+  E(cfg_parse_line(cfg, CFG_MODE_UPDATE, "feed-a-port=13", "test5", 2));
+  E(cfg_parse_line(cfg, CFG_MODE_UPDATE, "feed-a-port=14", "test5", 3));
+  ASSRT(notify_count == 1);
+  E(cfg_batch_end(cfg));
+  ASSRT(notify_count == 2);
+  ASSRT(strcmp(notify_old, "12") == 0);
+  ASSRT(strcmp(notify_new, "14") == 0);
+
+  /* A read error still ends the file's batch. */
+  err_t *err = cfg_parse_file(cfg, CFG_MODE_ADD, ".");
+  ASSRT(err);
+  ASSRT(err->code == CFG_ERR_READ_ERROR);
+  err_dispose(err);
+  ASSRT(cfg->batch_depth == 0);
+  E(cfg_parse_line(cfg, CFG_MODE_UPDATE, "feed-a-port=15", "test5", 6));
+  ASSRT(notify_count == 3);
+  ASSRT(strcmp(notify_new, "15") == 0);
+
+  E(cfg_unsubscribe(cfg, sub));
+
+  /* Queued delivery through the eventfd. */
+  E(cfg_subscribe(cfg, "other", CFG_SUB_QUEUED, test5_cb, &notify_count, &qsub));
+  E(cfg_notify_fd(cfg, &fd));
+  notify_count = 0;
+  E(cfg_parse_line(cfg, CFG_MODE_UPDATE, "other=5", "test5", 4));
+  ASSRT(notify_count == 0);
+  uint64_t count;
+  ASSRT(read(fd, &count, sizeof(count)) == sizeof(count));
+  ASSRT(count == 1);
+  E(cfg_notify_drain(cfg));
+  ASSRT(notify_count == 1);
+  ASSRT(strcmp(notify_old, "4") == 0);
+  ASSRT(strcmp(notify_new, "5") == 0);
+
+  /* Undelivered notifications are freed by cfg_delete. */
+  E(cfg_parse_line(cfg, CFG_MODE_UPDATE, "other=6", "test5", 5));
+  E(cfg_delete(cfg));
+
+  /* A callback unsubscribes the next subscription in line, during a
+   * flush and during a drain. The victim is never called. */
+  cfg_sub_t *victim;
+  E(cfg_create(&cfg));
+  E(cfg_parse_line(cfg, CFG_MODE_ADD, "k=1", "test5", 1));
+  E(cfg_subscribe(cfg, "k", 0, test5_cb, &notify_count, &victim));
+  E(cfg_subscribe(cfg, "k", 0, test5_unsub_cb, &victim, &sub));  /* Called first. */
+  notify_count = 0;
+  E(cfg_parse_line(cfg, CFG_MODE_UPDATE, "k=2", "test5", 2));
+  ASSRT(victim == NULL);
+  ASSRT(notify_count == 0);
+  E(cfg_unsubscribe(cfg, sub));
+
+  E(cfg_subscribe(cfg, "k", CFG_SUB_QUEUED, test5_cb, &notify_count, &victim));
+  E(cfg_subscribe(cfg, "k", CFG_SUB_QUEUED, test5_unsub_cb, &victim, &sub));
+  E(cfg_parse_line(cfg, CFG_MODE_UPDATE, "k=3", "test5", 3));
+  E(cfg_notify_drain(cfg));
+  ASSRT(victim == NULL);
+  ASSRT(notify_count == 0);
+  E(cfg_delete(cfg));
+}  /* test5 */
+
+
+/* First reads of values that need expanding, converting and splitting. */
+void *test6_reader(void *arg) {
+  cfg_t *cfg = (cfg_t *)arg;
+  const cfg_span_t *strs;
+  const long *longs;
+  char *val;
+  long lval;
+  int num;
+
+  E(cfg_get_str_val(cfg, "err_log", &val));
+  ASSRT(strcmp(val, "/var/logs/err.log") == 0);
+  E(cfg_get_str_val(cfg, "other", &val));
+  ASSRT(strcmp(val, "/var") == 0);
+  E(cfg_get_long_val(cfg, "num", &lval));
+  ASSRT(lval == 16);
+  E(cfg_get_str_list(cfg, "dirs", &strs, &num));
+  ASSRT(num == 2 && strs[1].len == 13 && strncmp(strs[1].ptr, "/var/logs/err", 13) == 0);
+  E(cfg_get_long_list(cfg, "nums", &longs, &num));
+  ASSRT(num == 3 && longs[2] == 16);
+
+  return NULL;
+}  /* test6_reader */
+
+
+void test6() {
+  cfg_t *cfg;
+  char *val;
+  long lval;
+  err_t *err;
+  char *opt_list[] = {
+    "base_dir = /opt/app",
+    "log_dir = ${base_dir}/logs",
+    "err_log = ${log_dir}/err.log  # Nested.",
+    "home = ${env:CFG_TEST_HOME}",
+    "literal = $${base_dir} costs $5",
+    "other = ${base_dir}",
+    "num_base = 0x1",
+    "num = ${num_base}0",
+    NULL};
+
+  setenv("CFG_TEST_HOME", "/home/test", 1);
+  E(cfg_create(&cfg));
+  E(cfg_parse_string_list(cfg, CFG_MODE_ADD, opt_list));
+
+  /* Raw value is stored; expansion happens on get. */
+  E(hmap_slookup(cfg->option_vals, "log_dir", (void **)&val));
+  ASSRT(strcmp(val, "${base_dir}/logs") == 0);
+
+  E(cfg_get_str_val(cfg, "err_log", &val));
+  ASSRT(strcmp(val, "/opt/app/logs/err.log") == 0);
+  E(cfg_get_str_val(cfg, "home", &val));
+  ASSRT(strcmp(val, "/home/test") == 0);
+  E(cfg_get_str_val(cfg, "literal", &val));
+  ASSRT(strcmp(val, "${base_dir} costs $5") == 0);
+  E(cfg_get_long_val(cfg, "num", &lval));
+  ASSRT(lval == 16);
+
+  /* Memoized: same buffer on second get. */
+  char *val2;
+  E(cfg_get_str_val(cfg, "err_log", &val));
+  E(cfg_get_str_val(cfg, "err_log", &val2));
+  ASSRT(val2 == val);
+
+  /* Update invalidates dependents only. */
+  E(cfg_get_str_val(cfg, "other", &val));
+  E(cfg_get_str_val(cfg, "err_log", &val));
+  cfg_option_t *option;
+  E(hmap_slookup(cfg->option_infos, "home", (void **)&option));
+  ASSRT(option->expanded != NULL);
+  E(cfg_parse_line(cfg, CFG_MODE_UPDATE, "base_dir = /srv", "test6", 1));
+  ASSRT(option->expanded != NULL);  /* Not a dependent. */
+  E(hmap_slookup(cfg->option_infos, "err_log", (void **)&option));
+  ASSRT(option->expanded == NULL);
+  E(cfg_get_str_val(cfg, "err_log", &val));
+  ASSRT(strcmp(val, "/srv/logs/err.log") == 0);
+  E(cfg_get_str_val(cfg, "other", &val));
+  ASSRT(strcmp(val, "/srv") == 0);
+
+  /* Errors are reported at get time. */
+  E(cfg_parse_line(cfg, CFG_MODE_UPDATE, "base_dir = ${err_log}", "test6", 2));
+  err = cfg_get_str_val(cfg, "log_dir", &val);
+  ASSRT(err);
+  ASSRT(err->code == CFG_ERR_SUBST);
+  err_dispose(err);
+  E(cfg_parse_line(cfg, CFG_MODE_UPDATE, "base_dir = ${nokey}", "test6", 3));
+  err = cfg_get_str_val(cfg, "base_dir", &val);
+  ASSRT(err);
+  ASSRT(err->code == CFG_ERR_SUBST);
+  err_dispose(err);
+  E(cfg_parse_line(cfg, CFG_MODE_UPDATE, "base_dir = ${base", "test6", 4));
+  err = cfg_get_str_val(cfg, "base_dir", &val);
+  ASSRT(err);
+  ASSRT(err->code == CFG_ERR_SUBST);
+  err_dispose(err);
+  E(cfg_parse_line(cfg, CFG_MODE_UPDATE, "base_dir = /var", "test6", 5));
+  E(cfg_get_str_val(cfg, "err_log", &val));
+  ASSRT(strcmp(val, "/var/logs/err.log") == 0);
+
+  /* Threads can race to be first to read a value (see cfg.h). */
+  pthread_t threads[4];
+  int i;
+  E(cfg_parse_line(cfg, CFG_MODE_UPDATE, "base_dir = /var", "test6", 6));
+  E(cfg_parse_line(cfg, CFG_MODE_UPDATE, "num_base = 0x1", "test6", 7));
+  E(cfg_parse_line(cfg, CFG_MODE_ADD, "dirs = ${base_dir}, ${log_dir}/err", "test6", 8));
+  E(cfg_parse_line(cfg, CFG_MODE_ADD, "nums = 1 ${num_base} ${num}", "test6", 9));
+  for (i = 0; i < 4; i++) {
+    ASSRT(pthread_create(&threads[i], NULL, test6_reader, cfg) == 0);
+  }
+  for (i = 0; i < 4; i++) {
+    ASSRT(pthread_join(threads[i], NULL) == 0);
   }
 
-  if (o_testnum == 0 || o_testnum == 3) {
-    test3();
-    printf("test1: success\n");
+  E(cfg_delete(cfg));
+}  /* test6 */
+
+
+void test7() {
+  cfg_t *cfg;
+  long lval;
+  double dval;
+  int bval;
+  size_t sval;
+  err_t *err;
+  char *opt_list[] = {
+    "lng = 1 000",
+    "dbl = -1.5e3",
+    "yes = Yes", "off = off", "one = 1", "maybe = maybe",
+    "buf = 64K", "big = 2 g", "plain = 100", "neg = -1K",
+    "tmo = 250ms", "tmo_s = 1.5 s", "tmo_m = 2m", "tmo_bare = 30", "tmo_bad = 3 days",
+    NULL};
+
+  E(cfg_create(&cfg));
+  E(cfg_parse_string_list(cfg, CFG_MODE_ADD, opt_list));
+
+  E(cfg_get_long_val(cfg, "lng", &lval));
+  ASSRT(lval == 1000);
+  E(cfg_get_double_val(cfg, "dbl", &dval));
+  ASSRT(dval == -1500.0);
+  E(cfg_get_double_val(cfg, "lng", &dval));
+  ASSRT(dval == 1000.0);
+
+  E(cfg_get_bool_val(cfg, "yes", &bval));
+  ASSRT(bval == 1);
+  E(cfg_get_bool_val(cfg, "off", &bval));
+  ASSRT(bval == 0);
+  E(cfg_get_bool_val(cfg, "one", &bval));
+  ASSRT(bval == 1);
+  err = cfg_get_bool_val(cfg, "maybe", &bval);
+  ASSRT(err);
+  ASSRT(err->code == CFG_ERR_BAD_BOOL);
+  err_dispose(err);
+
+  E(cfg_get_size_val(cfg, "buf", &sval));
+  ASSRT(sval == 64 * 1024);
+  E(cfg_get_size_val(cfg, "big", &sval));
+  ASSRT(sval == (size_t)2 * 1024 * 1024 * 1024);
+  E(cfg_get_size_val(cfg, "plain", &sval));
+  ASSRT(sval == 100);
+  err = cfg_get_size_val(cfg, "neg", &sval);
+  ASSRT(err);
+  ASSRT(err->code == ERR_ERR_BAD_NUMBER);
+  err_dispose(err);
+
+  E(cfg_get_duration_val(cfg, "tmo", &lval));
+  ASSRT(lval == 250);
+  E(cfg_get_duration_val(cfg, "tmo_s", &lval));
+  ASSRT(lval == 1500);
+  E(cfg_get_duration_val(cfg, "tmo_m", &lval));
+  ASSRT(lval == 120000);
+  E(cfg_get_duration_val(cfg, "tmo_bare", &lval));
+  ASSRT(lval == 30);
+  err = cfg_get_duration_val(cfg, "tmo_bad", &lval);
+  ASSRT(err);
+  ASSRT(err->code == ERR_ERR_BAD_NUMBER);
+  err_dispose(err);
+
+  /* Conversions are cached, including failures. */
+  cfg_option_t *option;
+  E(hmap_slookup(cfg->option_infos, "maybe", (void **)&option));
+  ASSRT(option->conv_done == CFG_CONV_BOOL);
+  ASSRT(option->conv_bad == CFG_CONV_BOOL);
+  E(hmap_slookup(cfg->option_infos, "lng", (void **)&option));
+  ASSRT(option->conv_done == (CFG_CONV_LONG | CFG_CONV_DOUBLE));
+  option->long_val = 7;  /* Prove the cache is used. */
+  E(cfg_get_long_val(cfg, "lng", &lval));
+  ASSRT(lval == 7);
+
+  /* Update invalidates the cache. */
+  E(cfg_parse_line(cfg, CFG_MODE_UPDATE, "lng = 0x20", "test7", 1));
+  ASSRT(option->conv_done == 0);
+  E(cfg_get_long_val(cfg, "lng", &lval));
+  ASSRT(lval == 32);
+  E(cfg_get_double_val(cfg, "lng", &dval));
+  ASSRT(dval == 32.0);
+
+  E(cfg_parse_line(cfg, CFG_MODE_UPDATE, "maybe = no", "test7", 2));
+  E(cfg_get_bool_val(cfg, "maybe", &bval));
+  ASSRT(bval == 0);
+
+  E(cfg_delete(cfg));
+}  /* test7 */
+
+
+void test8() {
+  cfg_t *cfg;
+  long threads = 0;
+  double rate = 0;
+  const char *log_dir = NULL;
+  const char *first_log_dir;
+  err_t *err;
+  char *opt_list[] = {"threads = 4", "rate = 2.5", "base = /opt", "log_dir = ${base}/log", NULL};
+
+  E(cfg_create(&cfg));
+  E(cfg_parse_string_list(cfg, CFG_MODE_ADD, opt_list));
+
+  /* Initial values written on bind. */
+  E(cfg_bind_long(cfg, "threads", &threads));
+  E(cfg_bind_double(cfg, "rate", &rate));
+  E(cfg_bind_str(cfg, "log_dir", &log_dir));
+  ASSRT(threads == 4);
+  ASSRT(rate == 2.5);
+  ASSRT(strcmp(log_dir, "/opt/log") == 0);
+
+  err = cfg_bind_long(cfg, "base", &threads);  /* Not a number. */
+  ASSRT(err);
+  ASSRT(err->code == ERR_ERR_BAD_NUMBER);
+  err_dispose(err);
+  err = cfg_bind_long(cfg, "nokey", &threads);
+  ASSRT(err);
+  ASSRT(err->code == HMAP_ERR_NOTFOUND);
+  err_dispose(err);
+
+  /* Updates, including through substitution. */
+  E(cfg_parse_line(cfg, CFG_MODE_UPDATE, "threads = 0x10", "test8", 1));
+  ASSRT(threads == 16);
+  E(cfg_parse_line(cfg, CFG_MODE_UPDATE, "rate = 1e3", "test8", 2));
+  ASSRT(rate == 1000.0);
+  first_log_dir = log_dir;
+  E(cfg_parse_line(cfg, CFG_MODE_UPDATE, "base = /srv", "test8", 3));
+  ASSRT(strcmp(log_dir, "/srv/log") == 0);
+  ASSRT(strcmp(first_log_dir, "/opt/log") == 0);  /* Old string still valid. */
+
+  /* A retired string survives one reclaim and is freed by the next. */
+  E(cfg_bind_reclaim(cfg));
+  ASSRT(cfg->num_retired_strs == 1);
+  ASSRT(strcmp(first_log_dir, "/opt/log") == 0);
+  E(cfg_parse_line(cfg, CFG_MODE_UPDATE, "base = /var", "test8", 3));
+  ASSRT(cfg->num_retired_strs == 2);
+  E(cfg_bind_reclaim(cfg));
+  ASSRT(cfg->num_retired_strs == 1 && cfg->retired_strs[0] != first_log_dir);
+  ASSRT(strcmp(cfg->retired_strs[0], "/srv/log") == 0);
+  E(cfg_bind_reclaim(cfg));
+  ASSRT(cfg->num_retired_strs == 0);
+  ASSRT(strcmp(log_dir, "/var/log") == 0);
+
+  /* Bad update leaves the variable alone. */
+  err = cfg_parse_line(cfg, CFG_MODE_UPDATE, "threads = many", "test8", 4);
+  ASSRT(err);
+  ASSRT(err->code == ERR_ERR_BAD_NUMBER);
+  err_dispose(err);
+  ASSRT(threads == 16);
+
+  E(cfg_unbind(cfg, "threads", &threads));
+  E(cfg_parse_line(cfg, CFG_MODE_UPDATE, "threads = 8", "test8", 5));
+  ASSRT(threads == 16);
+  err = cfg_unbind(cfg, "threads", &threads);
+  ASSRT(err);
+  ASSRT(err->code == CFG_ERR_PARAM);
+  err_dispose(err);
+
+  E(cfg_delete(cfg));
+}  /* test8 */
+
+
+#define TEST9_OPTIONS(X) \
+  X(T9_MAX_LEN, "max_len", CFG_TYPE_LONG, "1024", 0, 1, 65536) \
+  X(T9_TAG, "tag-name", CFG_TYPE_STR, NULL, 1, 0, 0) \
+  X(T9_RATE, "rate", CFG_TYPE_DOUBLE, "0.5", 0, 0.0, 1.0) \
+  X(T9_VERBOSE, "verbose", CFG_TYPE_BOOL, "no", 0, 0, 0)
+
+enum { TEST9_OPTIONS(CFG_SCHEMA_ENUM) T9_NUM_OPTS };
+cfg_schema_t test9_schema[] = { TEST9_OPTIONS(CFG_SCHEMA_TABLE) };
+
+void test9() {
+  cfg_t *cfg;
+  char *val;
+  long lval;
+  double dval;
+  int bval;
+  int idx;
+  err_t *err;
+
+  E(cfg_create(&cfg));
+  E(cfg_schema_apply(cfg, test9_schema, T9_NUM_OPTS));
+
+  /* Defaults. */
+  E(cfg_get_idx_long_val(cfg, T9_MAX_LEN, &lval));
+  ASSRT(lval == 1024);
+  E(cfg_get_idx_double_val(cfg, T9_RATE, &dval));
+  ASSRT(dval == 0.5);
+  E(cfg_get_idx_bool_val(cfg, T9_VERBOSE, &bval));
+  ASSRT(bval == 0);
+  E(cfg_get_str_val(cfg, "max_len", &val));  /* Still reachable by name. */
+  ASSRT(strcmp(val, "1024") == 0);
+
+  E(cfg_schema_idx(cfg, "tag-name", &idx));
+  ASSRT(idx == T9_TAG);
+  err = cfg_get_idx_long_val(cfg, T9_NUM_OPTS, &lval);
+  ASSRT(err);
+  ASSRT(err->code == CFG_ERR_PARAM);
+  err_dispose(err);
+
+  /* Required key not set yet. */
+  err = cfg_schema_validate(cfg);
+  ASSRT(err);
+  ASSRT(err->code == CFG_ERR_REQUIRED);
+  err_dispose(err);
+
+  E(cfg_parse_line(cfg, CFG_MODE_UPDATE, "tag-name = abc", "test9", 1));
+  E(cfg_parse_line(cfg, CFG_MODE_UPDATE, "max_len = 99999", "test9", 2));
+  err = cfg_schema_validate(cfg);
+  ASSRT(err);
+  ASSRT(err->code == CFG_ERR_RANGE);
+  err_dispose(err);
+
+  E(cfg_parse_line(cfg, CFG_MODE_UPDATE, "max_len = 2048", "test9", 3));
+  E(cfg_parse_line(cfg, CFG_MODE_UPDATE, "verbose = maybe", "test9", 4));
+  err = cfg_schema_validate(cfg);
+  ASSRT(err);
+  ASSRT(err->code == CFG_ERR_BAD_BOOL);
+  err_dispose(err);
+
+  E(cfg_parse_line(cfg, CFG_MODE_UPDATE, "verbose = on", "test9", 5));
+  E(cfg_schema_validate(cfg));
+  E(cfg_get_idx_long_val(cfg, T9_MAX_LEN, &lval));
+  ASSRT(lval == 2048);
+  E(cfg_get_idx_str_val(cfg, T9_TAG, &val));
+  ASSRT(strcmp(val, "abc") == 0);
+
+  /* Keys outside the schema are not indexed. */
+  E(cfg_parse_line(cfg, CFG_MODE_ADD, "extra = 1", "test9", 6));
+  E(cfg_schema_idx(cfg, "extra", &idx));
+  ASSRT(idx == -1);
+
+  E(cfg_delete(cfg));
+}  /* test9 */
+
+
+#define T10_LONG(s__str) cfg_num_parse_long((s__str), strlen(s__str), &lval)
+#define T10_DOUBLE(s__str) cfg_num_parse_double((s__str), strlen(s__str), &dval)
+
+void test10() {
+  long lval;
+  double dval;
+  err_t *err;
+
+  ASSRT(T10_LONG("0") == 0 && lval == 0);
+  ASSRT(T10_LONG("12345678") == 0 && lval == 12345678);
+  ASSRT(T10_LONG(" 1 000 000 ") == 0 && lval == 1000000);
+  ASSRT(T10_LONG("-42") == 0 && lval == -42);
+  ASSRT(T10_LONG("+42") == 0 && lval == 42);
+  ASSRT(T10_LONG("9223372036854775807") == 0 && lval == 9223372036854775807L);
+  ASSRT(T10_LONG("9223372036854775808") == -1);
+  ASSRT(T10_LONG("-9223372036854775808") == 0 && lval == (-9223372036854775807L - 1));
+  ASSRT(T10_LONG("-9223372036854775809") == -1);
+  ASSRT(T10_LONG("99999999999999999999999") == -1);
+  ASSRT(T10_LONG("0xdead beef") == 0 && lval == 0xdeadbeef);
+  ASSRT(T10_LONG("0X7FFFFFFFFFFFFFFF") == 0 && lval == 0x7fffffffffffffffL);
+  ASSRT(T10_LONG("0x8000000000000000") == -1);
+  ASSRT(T10_LONG("0x-10") == 0 && lval == -16);
+  ASSRT(T10_LONG("") == -1);
+  ASSRT(T10_LONG("-") == -1);
+  ASSRT(T10_LONG("0x") == -1);
+  ASSRT(T10_LONG("12a") == -1);
+  ASSRT(T10_LONG("1.5") == -1);
+  /* Only "len" characters are looked at. */
+  ASSRT(cfg_num_parse_long("123456789", 4, &lval) == 0 && lval == 1234);
+
+  ASSRT(T10_DOUBLE("0.5") == 0 && dval == 0.5);
+  ASSRT(T10_DOUBLE("-1 000.25") == 0 && dval == -1000.25);
+  ASSRT(T10_DOUBLE("1e23") == 0 && dval == strtod("1e23", NULL));
+  ASSRT(T10_DOUBLE("0.1") == 0 && dval == strtod("0.1", NULL));
+  ASSRT(T10_DOUBLE("123456789012345678901234") == 0 &&
+      dval == strtod("123456789012345678901234", NULL));
+  ASSRT(T10_DOUBLE("2.2250738585072014e-308") == 0 &&
+      dval == strtod("2.2250738585072014e-308", NULL));
+  ASSRT(T10_DOUBLE("0x1p3") == 0 && dval == 8.0);
+  ASSRT(T10_DOUBLE("1e999") == -1);
+  ASSRT(T10_DOUBLE("1e") == -1);
+  ASSRT(T10_DOUBLE("") == -1);
+  ASSRT(T10_DOUBLE("abc") == -1);
+
+  E(cfg_num_atol("0x10", &lval));
+  ASSRT(lval == 16);
+  err = cfg_num_atod("1.2.3", &dval);
+  ASSRT(err);
+  ASSRT(err->code == ERR_ERR_BAD_NUMBER);
+  err_dispose(err);
+}  /* test10 */
+
+
+#define T11_SPAN_IS(s__span, s__str) \
+  ((s__span).len == strlen(s__str) && strncmp((s__span).ptr, (s__str), (s__span).len) == 0)
+
+void test11() {
+  cfg_t *cfg;
+  const cfg_span_t *strs;
+  const cfg_span_t *strs2;
+  const long *longs;
+  int num;
+  err_t *err;
+
+  E(cfg_create(&cfg));
+  E(cfg_parse_line(cfg, CFG_MODE_ADD, "hosts = alpha, beta ,gamma", "test11", 1));
+  E(cfg_parse_line(cfg, CFG_MODE_ADD, "cpus = 2 4\t6  8", "test11", 2));
+  E(cfg_parse_line(cfg, CFG_MODE_ADD, "limits = 1 000, 0x10, -5", "test11", 3));
+  E(cfg_parse_line(cfg, CFG_MODE_ADD, "empty =", "test11", 4));
+  E(cfg_parse_line(cfg, CFG_MODE_ADD, "holes = a,,b,", "test11", 5));
+  E(cfg_parse_line(cfg, CFG_MODE_ADD, "more = ${cpus} 10", "test11", 6));
+
+  E(cfg_get_str_list(cfg, "hosts", &strs, &num));
+  ASSRT(num == 3);
+  ASSRT(T11_SPAN_IS(strs[0], "alpha"));
+  ASSRT(T11_SPAN_IS(strs[1], "beta"));
+  ASSRT(T11_SPAN_IS(strs[2], "gamma"));
+  /* Cached: same array, no re-split. */
+  E(cfg_get_str_list(cfg, "hosts", &strs2, &num));
+  ASSRT(strs2 == strs);
+
+  E(cfg_get_long_list(cfg, "cpus", &longs, &num));
+  ASSRT(num == 4);
+  ASSRT(longs[0] == 2 && longs[1] == 4 && longs[2] == 6 && longs[3] == 8);
+
+  E(cfg_get_long_list(cfg, "limits", &longs, &num));
+  ASSRT(num == 3);
+  ASSRT(longs[0] == 1000 && longs[1] == 16 && longs[2] == -5);
+
+  E(cfg_get_str_list(cfg, "empty", &strs, &num));
+  ASSRT(num == 0);
+  E(cfg_get_long_list(cfg, "empty", &longs, &num));
+  ASSRT(num == 0);
+
+  E(cfg_get_str_list(cfg, "holes", &strs, &num));
+  ASSRT(num == 4);
+  ASSRT(T11_SPAN_IS(strs[0], "a"));
+  ASSRT(strs[1].len == 0);
+  ASSRT(T11_SPAN_IS(strs[2], "b"));
+  ASSRT(strs[3].len == 0);
+  err = cfg_get_long_list(cfg, "holes", &longs, &num);
+  ASSRT(err);
+  ASSRT(err->code == ERR_ERR_BAD_NUMBER);
+  err_dispose(err);
+
+  E(cfg_get_long_list(cfg, "more", &longs, &num));
+  ASSRT(num == 5);
+  ASSRT(longs[4] == 10);
+
+  /* Updates (including of a referenced key) re-split. */
+  E(cfg_parse_line(cfg, CFG_MODE_UPDATE, "cpus = 1", "test11", 7));
+  E(cfg_get_long_list(cfg, "cpus", &longs, &num));
+  ASSRT(num == 1);
+  ASSRT(longs[0] == 1);
+  E(cfg_get_long_list(cfg, "more", &longs, &num));
+  ASSRT(num == 2);
+  ASSRT(longs[0] == 1 && longs[1] == 10);
+
+  err = cfg_get_str_list(cfg, "nokey", &strs, &num);
+  ASSRT(err);
+  ASSRT(err->code == HMAP_ERR_NOTFOUND);
+  err_dispose(err);
+
+  E(cfg_delete(cfg));
+}  /* test11 */
+
+
+typedef struct {
+  char keys[1000];
+  int num_calls;
+  int stop_after;
+} test12_clientd_t;
+
+ERR_F test12_cb(cfg_t *cfg, const char *key, const char *value, void *clientd) {
+  test12_clientd_t *t12 = (test12_clientd_t *)clientd;
+  (void)cfg;
+
+  t12->num_calls++;
+  if (t12->stop_after > 0 && t12->num_calls > t12->stop_after) {
+    ERR_THROW(CFG_ERR_PARAM, "stop");
   }
+  strcat(t12->keys, key);
+  strcat(t12->keys, "=");
+  strcat(t12->keys, value);
+  strcat(t12->keys, ";");
+  return ERR_OK;
+}  /* test12_cb */
 
-  if (o_testnum == 0 || o_testnum == 4) {
-    test4();
-    printf("test1: success\n");
+
+void test12_run(cfg_t *cfg, const char *prefix, const char *expected) {
+  test12_clientd_t t12;
+
+  memset(&t12, 0, sizeof(t12));
+  E(cfg_iterate_prefix(cfg, prefix, test12_cb, &t12));
+  if (strcmp(t12.keys, expected) != 0) {
+    printf("test12: prefix '%s': got '%s'\n", prefix, t12.keys);
+    ASSRT(strcmp(t12.keys, expected) == 0);
+  }
+}  /* test12_run */
+
+
+void test12() {
+  cfg_t *cfg;
+  test12_clientd_t t12;
+  err_t *err;
+  int indexed;
+
+  for (indexed = 0; indexed <= 1; indexed++) {
+    E(cfg_create(&cfg));
+    E(cfg_parse_line(cfg, CFG_MODE_ADD, "feed-nyse-port = 1234", "test12", 1));
+    E(cfg_parse_line(cfg, CFG_MODE_ADD, "feed-arca-port = 5678", "test12", 2));
+    if (indexed) {
+      E(cfg_key_index_enable(cfg));
+    }
+    E(cfg_parse_line(cfg, CFG_MODE_ADD, "feed-nyse-iface = eth${n}", "test12", 3));
+    E(cfg_parse_line(cfg, CFG_MODE_ADD, "n = 1", "test12", 4));
+    E(cfg_parse_line(cfg, CFG_MODE_ADD, "feed-nyse = x", "test12", 5));
+
+    test12_run(cfg, "feed-nyse-", "feed-nyse-iface=eth1;feed-nyse-port=1234;");
+    test12_run(cfg, "feed-nyse", "feed-nyse=x;feed-nyse-iface=eth1;feed-nyse-port=1234;");
+    test12_run(cfg, "", "feed-arca-port=5678;feed-nyse=x;feed-nyse-iface=eth1;"
+      "feed-nyse-port=1234;n=1;");
+    test12_run(cfg, "zzz", "");
+    test12_run(cfg, "feed-nyse-port-", "");
+
+    /* Keys added after sorting are merged in. */
+    E(cfg_parse_line(cfg, CFG_MODE_ADD, "feed-nyse-a = 0", "test12", 6));
+    E(cfg_parse_line(cfg, CFG_MODE_ADD, "a = 0", "test12", 7));
+    test12_run(cfg, "feed-nyse-", "feed-nyse-a=0;feed-nyse-iface=eth1;feed-nyse-port=1234;");
+    test12_run(cfg, "a", "a=0;");
+
+    /* Callback error stops the iteration. */
+    memset(&t12, 0, sizeof(t12));
+    t12.stop_after = 2;
+    err = cfg_iterate_prefix(cfg, "", test12_cb, &t12);
+    ASSRT(err);
+    ASSRT(err->code == CFG_ERR_PARAM);
+    err_dispose(err);
+    ASSRT(t12.num_calls == 3);
+    ASSRT(strcmp(t12.keys, "a=0;feed-arca-port=5678;") == 0);
+
+    E(cfg_delete(cfg));
+  }
+}  /* test12 */
+
+
+void *test13_thread(void *arg) {
+  intern_pool_t *pool = (intern_pool_t *)arg;
+  char str[32];
+  char *interned;
+  int i;
+
+  for (i = 0; i < 20000; i++) {
+    snprintf(str, sizeof(str), "str%d", i % 100);
+    E(intern_get(pool, str, &interned));
+    ASSRT(strcmp(interned, str) == 0);
+    intern_release(pool, interned);
+  }
+  return NULL;
+}  /* test13_thread */
+
+
+void test13() {
+  intern_pool_t *pool;
+  cfg_t *cfg1;
+  cfg_t *cfg2;
+  char *val1;
+  char *val2;
+  char *loc1;
+  char *loc2;
+  cfg_option_t *option1;
+  cfg_option_t *option2;
+  size_t num_strs;
+  size_t num_bytes;
+  char *str1;
+  char *str2;
+  pthread_t threads[4];
+  err_t *err;
+  int i;
+
+  E(intern_create(&pool, 2));  /* Small, to exercise growth. */
+  E(intern_get(pool, "abc", &str1));
+  E(intern_get(pool, "abc", &str2));
+  ASSRT(str1 == str2);
+  E(intern_stats(pool, &num_strs, &num_bytes));
+  ASSRT(num_strs == 1 && num_bytes == 4);
+  intern_release(pool, str1);
+  intern_release(pool, str2);
+  E(intern_stats(pool, &num_strs, &num_bytes));
+  ASSRT(num_strs == 0 && num_bytes == 0);
+  intern_release(pool, NULL);
+
+  /* Two tenants loading the same settings share the strings. */
+  E(cfg_create(&cfg1));
+  E(cfg_create(&cfg2));
+  E(cfg_intern_pool(cfg1, pool));
+  E(cfg_intern_pool(cfg2, pool));
+  for (i = 0; i < 2; i++) {
+    cfg_t *cfg = (i == 0) ? cfg1 : cfg2;
+    E(cfg_parse_line(cfg, CFG_MODE_ADD, "enabled = true", "tenant.cfg", 1));
+    E(cfg_parse_line(cfg, CFG_MODE_ADD, "verbose = true", "tenant.cfg", 2));
+    E(cfg_parse_line(cfg, CFG_MODE_ADD, "name = x${enabled}", "tenant.cfg", 3));
+  }
+  E(cfg_get_str_val(cfg1, "enabled", &val1));
+  E(cfg_get_str_val(cfg2, "verbose", &val2));
+  ASSRT(val1 == val2);
+  E(hmap_slookup(cfg1->option_locations, "enabled", (void **)&loc1));
+  E(hmap_slookup(cfg2->option_locations, "enabled", (void **)&loc2));
+  ASSRT(loc1 == loc2);
+  ASSRT(strcmp(loc1, "tenant.cfg:1") == 0);
+  E(hmap_slookup(cfg1->option_infos, "name", (void **)&option1));
+  E(hmap_slookup(cfg2->option_infos, "name", (void **)&option2));
+  ASSRT(option1->key == option2->key);
+  /* Keys: enabled, verbose, name. Values: true, x${enabled}.
+   * Locations: tenant.cfg:1, :2, :3. */
+  E(intern_stats(pool, &num_strs, &num_bytes));
+  ASSRT(num_strs == 8);
+
+  /* Lookup with the canonical pointer. */
+  E(cfg_get_str_val(cfg1, option2->key, &val1));
+  ASSRT(strcmp(val1, "xtrue") == 0);
+
+  /* Only allowed on an empty cfg. */
+  err = cfg_intern_pool(cfg1, pool);
+  ASSRT(err);
+  ASSRT(err->code == CFG_ERR_PARAM);
+  err_dispose(err);
+
+  E(cfg_parse_line(cfg1, CFG_MODE_UPDATE, "enabled = false", "other.cfg", 9));
+  E(cfg_get_str_val(cfg2, "enabled", &val2));
+  ASSRT(strcmp(val2, "true") == 0);
+  E(cfg_get_str_val(cfg1, "name", &val1));
+  ASSRT(strcmp(val1, "xfalse") == 0);
+
+  E(cfg_delete(cfg1));
+  E(cfg_delete(cfg2));
+  E(intern_stats(pool, &num_strs, &num_bytes));
+  ASSRT(num_strs == 0 && num_bytes == 0);
+
+  for (i = 0; i < 4; i++) {
+    ASSRT(pthread_create(&threads[i], NULL, test13_thread, pool) == 0);
+  }
+  for (i = 0; i < 4; i++) {
+    ASSRT(pthread_join(threads[i], NULL) == 0);
+  }
+  E(intern_stats(pool, &num_strs, &num_bytes));
+  ASSRT(num_strs == 0);
+
+  E(intern_delete(pool));
+}  /* test13 */
+
+
+void test14() {
+  cfg_t *cfg;
+  cfg_shm_t *shm;
+  cfg_shm_t *shm2;
+  const char *val;
+  const char *loc;
+  long lval;
+  uint64_t generation;
+  char name[64];
+  int changed;
+  err_t *err;
+
+  snprintf(name, sizeof(name), "/cfg_test14_%ld", (long)getpid());
+
+  E(cfg_create(&cfg));
+  E(cfg_parse_line(cfg, CFG_MODE_ADD, "port = 12 345", "test14", 1));
+  E(cfg_parse_line(cfg, CFG_MODE_ADD, "host = h${port}", "test14", 2));
+  E(cfg_parse_line(cfg, CFG_MODE_ADD, "empty =", "test14", 3));
+
+  err = cfg_shm_attach(&shm, name);  /* Nothing published yet. */
+  ASSRT(err);
+  ASSRT(err->code == CFG_SHM_ERR_NOT_PUBLISHED);
+  err_dispose(err);
+
+  E(cfg_shm_publish(cfg, name));
+
+  /* Another process reads it without parsing. */
+  pid_t pid = fork();
+  ASSRT(pid >= 0);
+  if (pid == 0) {
+    E(cfg_shm_attach(&shm2, name));
+    E(cfg_shm_get_long_val(shm2, "port", &lval));
+    ASSRT(lval == 12345);
+    E(cfg_shm_get_str_val(shm2, "host", &val));
+    ASSRT(strcmp(val, "h12 345") == 0);
+    E(cfg_shm_detach(shm2));
+    exit(0);
+  }
+  int status;
+  ASSRT(waitpid(pid, &status, 0) == pid);
+  ASSRT(WIFEXITED(status) && WEXITSTATUS(status) == 0);
+
+  E(cfg_shm_attach(&shm, name));
+  E(cfg_shm_generation(shm, &generation));
+  ASSRT(generation == 1);
+  E(cfg_shm_get_str_val(shm, "host", &val));
+  ASSRT(strcmp(val, "h12 345") == 0);
+  E(cfg_shm_get_str_val(shm, "empty", &val));
+  ASSRT(strcmp(val, "") == 0);
+  E(cfg_shm_get_location(shm, "host", &loc));
+  ASSRT(strcmp(loc, "test14:2") == 0);
+  err = cfg_shm_get_str_val(shm, "nokey", &val);
+  ASSRT(err);
+  ASSRT(err->code == HMAP_ERR_NOTFOUND);
+  err_dispose(err);
+  err = cfg_shm_get_long_val(shm, "host", &lval);
+  ASSRT(err);
+  ASSRT(err->code == ERR_ERR_BAD_NUMBER);
+  err_dispose(err);
+
+  E(cfg_shm_refresh(shm, &changed));
+  ASSRT(changed == 0);
+
+  /* Republish; the consumer sees it on refresh. */
+  E(cfg_parse_line(cfg, CFG_MODE_UPDATE, "port = 80", "test14", 4));
+  E(cfg_shm_publish(cfg, name));
+  E(cfg_shm_get_str_val(shm, "host", &val));  /* Old generation still mapped. */
+  ASSRT(strcmp(val, "h12 345") == 0);
+  E(cfg_shm_refresh(shm, &changed));
+  ASSRT(changed == 1);
+  E(cfg_shm_generation(shm, &generation));
+  ASSRT(generation == 2);
+  E(cfg_shm_get_str_val(shm, "host", &val));
+  ASSRT(strcmp(val, "h80") == 0);
+  E(cfg_shm_get_location(shm, "port", &loc));
+  ASSRT(strcmp(loc, "test14:4") == 0);
+
+  E(cfg_shm_unlink(name));
+  E(cfg_shm_get_long_val(shm, "port", &lval));  /* Mapping outlives the name. */
+  ASSRT(lval == 80);
+  E(cfg_shm_detach(shm));
+
+  /* Building an image doesn't count as reading the keys. */
+  cfg_option_t *option;
+  size_t image_size;
+  E(cfg_profile_enable(cfg, 1));
+  E(cfg_shm_image_size(cfg, &image_size));
+  cfg_shm_hdr_t *image = (cfg_shm_hdr_t *)malloc(image_size);
+  ASSRT(image != NULL);
+  E(cfg_shm_image_write(cfg, image, image_size, 1));
+  E(hmap_slookup(cfg->option_infos, "host", (void **)&option));
+  ASSRT(option->num_reads == 0);
+
+  /* Offsets and buckets are checked before a lookup can trust them. */
+  E(cfg_shm_image_check(image, image_size));
+  err = cfg_shm_image_check(image, image_size - 1);  /* Truncated. */
+  ASSRT(err && err->code == CFG_SHM_ERR_BAD_IMAGE);
+  err_dispose(err);
+  image->num_buckets = 3;
+  err = cfg_shm_image_check(image, image_size);
+  ASSRT(err && err->code == CFG_SHM_ERR_BAD_IMAGE);
+  err_dispose(err);
+  image->num_buckets = 1u << 30;
+  err = cfg_shm_image_check(image, image_size);
+  ASSRT(err && err->code == CFG_SHM_ERR_BAD_IMAGE);
+  err_dispose(err);
+  image->num_buckets = 8;
+  uint32_t *buckets = (uint32_t *)((char *)image + ((sizeof(cfg_shm_hdr_t) + 7) & ~(size_t)7));
+  cfg_shm_entry_t *entries = (cfg_shm_entry_t *)&buckets[8];
+  E(cfg_shm_image_check(image, image_size));
+  entries[1].value_off = (uint32_t)image_size;
+  err = cfg_shm_image_check(image, image_size);
+  ASSRT(err && err->code == CFG_SHM_ERR_BAD_IMAGE);
+  err_dispose(err);
+  entries[1].value_off = entries[1].key_off;
+  buckets[0] = 4;  /* Only 3 entries. */
+  err = cfg_shm_image_check(image, image_size);
+  ASSRT(err && err->code == CFG_SHM_ERR_BAD_IMAGE);
+  err_dispose(err);
+  free(image);
+  E(cfg_delete(cfg));
+}  /* test14 */
+
+
+#define TEST15_OPTIONS(X) \
+  X(T15_THREADS, "threads", CFG_TYPE_LONG, "4", 0, 1, 64) \
+  X(T15_HOST, "host", CFG_TYPE_STR, "localhost", 0, 0, 0)
+
+enum { TEST15_OPTIONS(CFG_SCHEMA_ENUM) T15_NUM_OPTS };
+cfg_schema_t test15_schema[] = { TEST15_OPTIONS(CFG_SCHEMA_TABLE) };
+
+/* First lookups through an overlay fill its layer cache. */
+void *test15_reader(void *arg) {
+  cfg_t *tenant = (cfg_t *)arg;
+  char *val;
+  long lval;
+
+  E(cfg_get_long_val(tenant, "port", &lval));
+  ASSRT(lval == 80);
+  E(cfg_get_str_val(tenant, "host", &val));
+  ASSRT(strcmp(val, "site.example") == 0);
+  E(cfg_get_str_val(tenant, "url", &val));
+  ASSRT(strcmp(val, "http://localhost:80") == 0);
+
+  return NULL;
+}  /* test15_reader */
+
+
+void test15() {
+  cfg_t *defaults;
+  cfg_t *site;
+  cfg_t *tenant1;
+  cfg_t *tenant2;
+  cfg_t *layer;
+  const char *loc;
+  char *val;
+  long lval;
+  const long *longs;
+  int num;
+  test12_clientd_t t12;
+  err_t *err;
+
+  E(cfg_create(&defaults));
+  E(cfg_schema_apply(defaults, test15_schema, T15_NUM_OPTS));
+  E(cfg_parse_line(defaults, CFG_MODE_ADD, "port = 80", "defaults", 1));
+  E(cfg_parse_line(defaults, CFG_MODE_ADD, "url = http://${host}:${port}", "defaults", 2));
+  E(cfg_parse_line(defaults, CFG_MODE_ADD, "cpus = 1 2", "defaults", 3));
+
+  err = cfg_create_overlay(&site, defaults);  /* Parent must be frozen. */
+  ASSRT(err);
+  ASSRT(err->code == CFG_ERR_PARAM);
+  err_dispose(err);
+  E(cfg_freeze(defaults));
+  err = cfg_parse_line(defaults, CFG_MODE_UPDATE, "port = 81", "defaults", 4);
+  ASSRT(err);
+  ASSRT(err->code == CFG_ERR_FROZEN);
+  err_dispose(err);
+
+  E(cfg_create_overlay(&site, defaults));
+  E(cfg_parse_line(site, CFG_MODE_UPDATE, "host = site.example", "site", 1));
+  E(cfg_parse_line(site, CFG_MODE_ADD, "site_name = east", "site", 2));
+  err = cfg_parse_line(site, CFG_MODE_ADD, "port = 1", "site", 3);
+  ASSRT(err);
+  ASSRT(err->code == CFG_ERR_ADD_KEY_ALREADY_EXIST);
+  err_dispose(err);
+  err = cfg_parse_line(site, CFG_MODE_UPDATE, "nokey = 1", "site", 4);
+  ASSRT(err);
+  ASSRT(err->code == CFG_ERR_UPDATE_KEY_NOT_FOUND);
+  err_dispose(err);
+  E(cfg_freeze(site));
+
+  E(cfg_create_overlay(&tenant1, site));
+  E(cfg_create_overlay(&tenant2, site));
+  E(cfg_parse_line(tenant1, CFG_MODE_UPDATE, "threads = 8", "tenant1", 1));
+  E(cfg_parse_line(tenant1, CFG_MODE_ADD, "me = ${site_name}-${port}", "tenant1", 2));
+
+  /* Fall-through. */
+  E(cfg_get_long_val(tenant2, "threads", &lval));
+  ASSRT(lval == 4);
+  E(cfg_get_long_val(tenant1, "threads", &lval));
+  ASSRT(lval == 8);
+  E(cfg_get_str_val(tenant1, "host", &val));
+  ASSRT(strcmp(val, "site.example") == 0);
+  E(cfg_get_long_list(tenant2, "cpus", &longs, &num));
+  ASSRT(num == 2 && longs[1] == 2);
+  /* Inherited values are expanded in their own layer. */
+  E(cfg_get_str_val(tenant1, "url", &val));
+  ASSRT(strcmp(val, "http://localhost:80") == 0);
+  E(cfg_get_str_val(tenant1, "me", &val));
+  ASSRT(strcmp(val, "east-80") == 0);
+
+  /* Overriding an inherited key that an own value refers to. */
+  E(cfg_parse_line(tenant1, CFG_MODE_UPDATE, "port = 8080", "tenant1", 3));
+  E(cfg_get_str_val(tenant1, "me", &val));
+  ASSRT(strcmp(val, "east-8080") == 0);
+  E(cfg_get_str_val(tenant2, "port", &val));
+  ASSRT(strcmp(val, "80") == 0);
+
+  E(cfg_get_source(tenant1, "port", &layer, &loc));
+  ASSRT(layer == tenant1);
+  ASSRT(strcmp(loc, "tenant1:3") == 0);
+  E(cfg_get_source(tenant1, "host", &layer, &loc));
+  ASSRT(layer == site);
+  ASSRT(strcmp(loc, "site:1") == 0);
+  E(cfg_get_source(tenant2, "cpus", &layer, &loc));
+  ASSRT(layer == defaults);
+  ASSRT(strcmp(loc, "defaults:3") == 0);
+
+  /* Schema indexes follow overrides. */
+  E(cfg_get_idx_long_val(tenant1, T15_THREADS, &lval));
+  ASSRT(lval == 8);
+  E(cfg_get_idx_long_val(tenant2, T15_THREADS, &lval));
+  ASSRT(lval == 4);
+  E(cfg_get_idx_str_val(tenant2, T15_HOST, &val));
+  ASSRT(strcmp(val, "site.example") == 0);
+  E(cfg_parse_line(tenant2, CFG_MODE_UPDATE, "threads = 100", "tenant2", 1));
+  err = cfg_schema_validate(tenant2);
+  ASSRT(err);
+  ASSRT(err->code == CFG_ERR_RANGE);
+  err_dispose(err);
+  E(cfg_schema_validate(tenant1));
+
+  /* Only own keys can be bound. */
+  err = cfg_bind_long(tenant2, "port", &lval);
+  ASSRT(err);
+  ASSRT(err->code == CFG_ERR_PARAM);
+  err_dispose(err);
+  E(cfg_bind_long(tenant1, "port", &lval));
+  ASSRT(lval == 8080);
+
+  /* Iteration shows the merged view. */
+  memset(&t12, 0, sizeof(t12));
+  E(cfg_iterate_prefix(tenant1, "", test12_cb, &t12));
+  ASSRT(strcmp(t12.keys, "cpus=1 2;host=site.example;me=east-8080;port=8080;"
+    "site_name=east;threads=8;url=http://localhost:80;") == 0);
+
+  /* Lookups don't modify the overlay beyond atomic cache stores, so
+   * threads can read one at once (see cfg.h). */
+  cfg_t *tenant3;
+  pthread_t threads[4];
+  int i;
+  E(cfg_create_overlay(&tenant3, site));
+  for (i = 0; i < 4; i++) {
+    ASSRT(pthread_create(&threads[i], NULL, test15_reader, tenant3) == 0);
+  }
+  for (i = 0; i < 4; i++) {
+    ASSRT(pthread_join(threads[i], NULL) == 0);
+  }
+  E(cfg_delete(tenant3));
+
+  E(cfg_delete(tenant1));
+  E(cfg_delete(tenant2));
+  E(cfg_delete(site));
+  E(cfg_delete(defaults));
+}  /* test15 */
+
+
+void test16() {
+  cfg_t *cfg;
+  cfg_t *overlay;
+  hmap_t *hmap;
+  char *val;
+  long lval;
+  int found;
+  err_t *err;
+
+  E(hmap_create(&hmap, 8));
+  E(hmap_swrite(hmap, "a", "A"));
+  ASSRT(hmap_try_slookup(hmap, "a", (void **)&val) == 1);
+  ASSRT(strcmp(val, "A") == 0);
+  ASSRT(hmap_try_slookup(hmap, "b", (void **)&val) == 0);
+  ASSRT(val == NULL);
+  ASSRT(hmap_try_lookup(hmap, "a", 2, NULL) == 1);
+  E(hmap_delete(hmap));
+
+  E(cfg_create(&cfg));
+  E(cfg_parse_line(cfg, CFG_MODE_ADD, "port = 8 080", "test16", 1));
+  E(cfg_parse_line(cfg, CFG_MODE_ADD, "name = x${port}", "test16", 2));
+  E(cfg_parse_line(cfg, CFG_MODE_ADD, "bad = 12z", "test16", 3));
+
+  E(cfg_try_get_str_val(cfg, "name", &val, &found));
+  ASSRT(found == 1);
+  ASSRT(strcmp(val, "x8 080") == 0);
+  E(cfg_try_get_long_val(cfg, "port", &lval, &found));
+  ASSRT(found == 1);
+  ASSRT(lval == 8080);
+
+  /* Misses are not errors and leave the value alone. */
+  val = "unchanged";
+  E(cfg_try_get_str_val(cfg, "missing", &val, &found));
+  ASSRT(found == 0);
+  ASSRT(strcmp(val, "unchanged") == 0);
+  lval = 7;
+  E(cfg_try_get_long_val(cfg, "missing", &lval, &found));
+  ASSRT(found == 0);
+  ASSRT(lval == 7);
+
+  /* A present but unconvertible value is still an error. */
+  err = cfg_try_get_long_val(cfg, "bad", &lval, &found);
+  ASSRT(err);
+  ASSRT(err->code == ERR_ERR_BAD_NUMBER);
+  err_dispose(err);
+
+  /* Overlays fall through to the parent. */
+  E(cfg_freeze(cfg));
+  E(cfg_create_overlay(&overlay, cfg));
+  E(cfg_parse_line(overlay, CFG_MODE_UPDATE, "port = 9090", "test16", 4));
+  E(cfg_try_get_str_val(overlay, "name", &val, &found));
+  ASSRT(found == 1);
+  ASSRT(strcmp(val, "x8 080") == 0);
+  E(cfg_try_get_long_val(overlay, "port", &lval, &found));
+  ASSRT(found == 1);
+  ASSRT(lval == 9090);
+  E(cfg_try_get_str_val(overlay, "missing", &val, &found));
+  ASSRT(found == 0);
+
+  E(cfg_delete(overlay));
+  E(cfg_delete(cfg));
+}  /* test16 */
+
+
+ERR_F test17_throw(const char *str) {
+  ERR_THROW(ERR_ERR_PARAM, "s=%s n=%d l=%ld z=%zu x=%#x d=%.2f c=%c pct=%%", str, -5, 123456789012L, (size_t)42, 255u, 3.14159, 'q');
+}  /* test17_throw */
+
+
+ERR_F test17_rethrow(const char *str) {
+  ERR(test17_throw(str));
+  return ERR_OK;
+}  /* test17_rethrow */
+
+
+ERR_F test17_star(int width) {
+  ERR_THROW(ERR_ERR_PARAM, "[%*d]", width, 7);
+}  /* test17_star */
+
+
+void *test17_thread(void *arg) {
+  (void)arg;
+  return test17_rethrow("from thread");
+}  /* test17_thread */
+
+
+void test17() {
+  err_t *err;
+  err_t *err2;
+  char *str;
+  char long_str[300];
+  pthread_t thread;
+
+  E(err_pool_prealloc(4));
+  err = err_pool_prealloc(ERR_POOL_MAX_FREE + 1);
+  ASSRT(err && err->code == ERR_ERR_PARAM);
+  err_dispose(err);
+
+  /* Default mode formats immediately, with no deferral block. */
+  ASSRT(sizeof(err_t) < sizeof(err_defer_t));
+  err = test17_throw("now");
+  ASSRT(err->mesg != NULL);
+  ASSRT(err->defer == NULL);
+  ASSRT(strcmp(err_mesg(err), "s=now n=-5 l=123456789012 z=42 x=0xff d=3.14 c=q pct=%") == 0);
+  err_dispose(err);
+
+  err_set_deferred(1);
+
+  /* Arguments are copied, so the caller's string can go away. */
+  E(err_strdup(&str, "later"));
+  err = test17_rethrow(str);
+  err_mem_free(NULL, str);
+  ASSRT(err->mesg == NULL);
+  ASSRT(err->stacktrace->mesg == NULL);
+  ASSRT(err->stacktrace->defer != NULL);
+  ASSRT(err->code == ERR_ERR_PARAM);
+  ASSRT(strcmp(err_mesg(err), "ERR_ERR_PARAM") == 0);
+  ASSRT(strcmp(err_mesg(err->stacktrace), "s=later n=-5 l=123456789012 z=42 x=0xff d=3.14 c=q pct=%") == 0);
+  ASSRT(err_mesg(err->stacktrace) == err->stacktrace->mesg);  /* Cached. */
+
+  /* Disposed objects are reused. */
+  err2 = err->stacktrace;
+  err_dispose(err);
+  err = test17_throw("again");
+  ASSRT(err == err2);
+  ASSRT(strcmp(err_mesg(err), "s=again n=-5 l=123456789012 z=42 x=0xff d=3.14 c=q pct=%") == 0);
+  err_dispose(err);
+
+  /* Unsupported conversions and long strings are formatted immediately. */
+  err = test17_star(3);
+  ASSRT(err->mesg != NULL);
+  ASSRT(err->defer == NULL);
+  ASSRT(strcmp(err_mesg(err), "[  7]") == 0);
+  err_dispose(err);
+
+  memset(long_str, 'x', sizeof(long_str) - 1);
+  long_str[sizeof(long_str) - 1] = '\0';
+  err = test17_throw(long_str);
+  ASSRT(err->mesg != NULL);
+  ASSRT(strncmp(err_mesg(err), "s=xxx", 5) == 0);
+  err_dispose(err);
+
+  /* Objects may be disposed by a different thread. */
+  ASSRT(pthread_create(&thread, NULL, test17_thread, NULL) == 0);
+  ASSRT(pthread_join(thread, (void **)&err) == 0);
+  ASSRT(strcmp(err_mesg(err->stacktrace), "s=from thread n=-5 l=123456789012 z=42 x=0xff d=3.14 c=q pct=%") == 0);
+  err_dispose(err);
+
+  err_set_deferred(0);
+}  /* test17 */
+
+
+ERR_F test18_throw_a() {
+  ERR_THROW(ERR_ERR_PARAM, "a");
+}  /* test18_throw_a */
+
+
+ERR_F test18_throw_b() {
+  ERR_THROW(ERR_ERR_PARAM, "b");
+}  /* test18_throw_b */
+
+
+void *test18_thread(void *arg) {
+  int i;
+  (void)arg;
+  for (i = 0; i < 5; i++) {
+    err_dispose(test18_throw_a());
+  }
+  return NULL;
+}  /* test18_thread */
+
+
+void test18() {
+  cfg_t *cfg;
+  err_stat_t *stats;
+  int num_stats;
+  uint64_t num_dropped;
+  long lval;
+  int i;
+  pthread_t thread;
+  char *dump;
+  size_t dump_size;
+  FILE *stream;
+
+  /* Disabled by default. */
+  err_dispose(test18_throw_a());
+  E(err_stats_snapshot(&stats, &num_stats, NULL));
+  ASSRT(num_stats == 0);
+  err_mem_free(NULL, stats);
+
+  err_stats_enable(1);
+  for (i = 0; i < 3; i++) {
+    err_dispose(test18_throw_a());
+  }
+  for (i = 0; i < 2; i++) {
+    err_dispose(test18_throw_b());
+  }
+  ASSRT(pthread_create(&thread, NULL, test18_thread, NULL) == 0);
+  ASSRT(pthread_join(thread, NULL) == 0);
+
+  E(cfg_create(&cfg));
+  E(cfg_parse_line(cfg, CFG_MODE_ADD, "bad = 12z", "test18", 1));
+  err_dispose(cfg_get_long_val(cfg, "bad", &lval));  /* Counted at the throw, not the rethrows. */
+  E(cfg_delete(cfg));
+
+  E(err_stats_snapshot(&stats, &num_stats, &num_dropped));
+  ASSRT(num_stats == 3);
+  ASSRT(num_dropped == 0);
+  ASSRT(stats[0].code == ERR_ERR_PARAM && stats[0].count == 8);  /* Both threads merged. */
+  ASSRT(strcmp(stats[0].file, "cfg_test.c") == 0);
+  ASSRT(stats[1].code == ERR_ERR_PARAM && stats[1].count == 2);
+  ASSRT(stats[2].code == ERR_ERR_BAD_NUMBER && stats[2].count == 1);
+  ASSRT(strcmp(stats[2].file, "cfg.c") == 0);
+  err_mem_free(NULL, stats);
+
+  stream = open_memstream(&dump, &dump_size);
+  ASSRT(stream);
+  err_stats_dump(stream);
+  fclose(stream);
+  printf("%s", dump);
+  ASSRT(strncmp(dump, "ERR_ERR_PARAM 10 cfg_test.c:", 28) == 0);
+  ASSRT(strstr(dump, "\nERR_ERR_BAD_NUMBER 1 cfg.c:") != NULL);
+  free(dump);
+
+  err_stats_reset();
+  E(err_stats_snapshot(&stats, &num_stats, NULL));
+  ASSRT(num_stats == 0);
+  err_mem_free(NULL, stats);
+
+  err_stats_enable(0);
+  err_dispose(test18_throw_a());
+  E(err_stats_snapshot(&stats, &num_stats, NULL));
+  ASSRT(num_stats == 0);
+  err_mem_free(NULL, stats);
+}  /* test18 */
+
+
+void test19() {
+  cfg_t *cfg;
+  cfg_t *overlay;
+  cfg_key_stat_t *keys;
+  const cfg_file_stat_t *files;
+  cfg_mem_stat_t mem;
+  int num_keys, num_files;
+  char *val;
+  long lval;
+  int i;
+  char *dump;
+  size_t dump_size;
+  FILE *stream;
+
+  E(cfg_create(&cfg));
+  E(cfg_parse_file(cfg, CFG_MODE_ADD, "tst2.cfg"));  /* Not profiled yet. */
+  E(cfg_profile_files(cfg, &files, &num_files));
+  ASSRT(num_files == 0);
+
+  E(cfg_profile_enable(cfg, 1));
+  E(cfg_parse_file(cfg, CFG_MODE_UPDATE, "tst2.cfg"));
+  E(cfg_parse_file(cfg, CFG_MODE_UPDATE, "tst2.cfg"));
+  E(cfg_profile_files(cfg, &files, &num_files));
+  ASSRT(num_files == 1);
+  ASSRT(strcmp(files[0].filename, "tst2.cfg") == 0);
+  ASSRT(files[0].num_parses == 2);
+  ASSRT(files[0].last_lines == 4);
+  ASSRT(files[0].last_bytes == 123);
+  ASSRT(files[0].total_ns >= files[0].last_ns);
+
+  for (i = 0; i < 5; i++) {
+    E(cfg_get_long_val(cfg, "opt3", &lval));
+  }
+  E(cfg_get_str_val(cfg, "opt1", &val));
+  E(cfg_profile_keys(cfg, &keys, &num_keys));
+  ASSRT(num_keys == 3);
+  ASSRT(strcmp(keys[0].key, "opt3") == 0 && keys[0].num_reads == 5);
+  ASSRT(strcmp(keys[1].key, "opt1") == 0 && keys[1].num_reads == 1);
+  ASSRT(strcmp(keys[2].key, "opt2") == 0 && keys[2].num_reads == 0);  /* Never read. */
+  cfg_mem_free(cfg, keys);
+
+  E(cfg_profile_memory(cfg, &mem));
+  ASSRT(mem.num_keys == 3);
+  ASSRT(mem.key_bytes == 5 + 5 + 5);
+  ASSRT(mem.value_bytes >= 4 + 1 + 2);
+  ASSRT(mem.location_bytes > 0);
+  ASSRT(mem.table_bytes > 0);
+
+  stream = open_memstream(&dump, &dump_size);
+  ASSRT(stream);
+  E(cfg_profile_dump(cfg, stream));
+  fclose(stream);
+  printf("%s", dump);
+  ASSRT(strstr(dump, "\nfile tst2.cfg parses=2 ") != NULL);
+  ASSRT(strstr(dump, "\nreads keys=3 unread=1\nkey opt3 reads=5\n") != NULL);
+  free(dump);
+
+  /* Reads through an overlay count on the layer holding the key. */
+  E(cfg_freeze(cfg));
+  E(cfg_create_overlay(&overlay, cfg));
+  E(cfg_profile_enable(overlay, 1));
+  E(cfg_get_str_val(overlay, "opt2", &val));
+  E(cfg_profile_keys(cfg, &keys, &num_keys));
+  ASSRT(strcmp(keys[2].key, "opt2") == 0 && keys[2].num_reads == 1);
+  cfg_mem_free(cfg, keys);
+
+  E(cfg_profile_reset(cfg));
+  E(cfg_profile_files(cfg, &files, &num_files));
+  ASSRT(num_files == 0);
+  E(cfg_profile_keys(cfg, &keys, &num_keys));
+  ASSRT(keys[0].num_reads == 0);
+  cfg_mem_free(cfg, keys);
+
+  E(cfg_delete(overlay));
+  E(cfg_delete(cfg));
+}  /* test19 */
+
+
+/* Allocator that counts what goes through it. */
+typedef struct {
+  long num_allocs;
+  long num_frees;
+  long fail_in;  /* If > 0, the fail_in'th allocation from now fails. */
+} test20_tracker_t;
+
+int test20_fail(void *ctx) {
+  test20_tracker_t *tracker = (test20_tracker_t *)ctx;
+  return tracker->fail_in > 0 && --tracker->fail_in == 0;
+}  /* test20_fail */
+
+void *test20_alloc(void *ctx, size_t size) {
+  if (test20_fail(ctx)) { return NULL; }
+  void *ptr = malloc(size);
+  if (ptr) { ((test20_tracker_t *)ctx)->num_allocs++; }
+  return ptr;
+}  /* test20_alloc */
+
+void *test20_calloc(void *ctx, size_t nmemb, size_t size) {
+  if (test20_fail(ctx)) { return NULL; }
+  void *ptr = calloc(nmemb, size);
+  if (ptr) { ((test20_tracker_t *)ctx)->num_allocs++; }
+  return ptr;
+}  /* test20_calloc */
+
+void *test20_realloc(void *ctx, void *ptr, size_t size) {
+  if (test20_fail(ctx)) { return NULL; }
+  void *new_ptr = realloc(ptr, size);
+  if (new_ptr && ptr == NULL) { ((test20_tracker_t *)ctx)->num_allocs++; }
+  return new_ptr;
+}  /* test20_realloc */
+
+void test20_free(void *ctx, void *ptr) {
+  if (ptr) { ((test20_tracker_t *)ctx)->num_frees++; }
+  free(ptr);
+}  /* test20_free */
+
+err_t *test20_notify_cb(cfg_t *cfg, const char *key, const char *old_value, const char *new_value, void *clientd) {
+  (void)cfg; (void)key; (void)old_value; (void)new_value;
+  (*(int *)clientd)++;
+  return ERR_OK;
+}  /* test20_notify_cb */
+
+err_t *test20_iterate_cb(cfg_t *cfg, const char *key, const char *value, void *clientd) {
+  (void)cfg; (void)key; (void)value;
+  (*(int *)clientd)++;
+  return ERR_OK;
+}  /* test20_iterate_cb */
+
+
+void test20() {
+  test20_tracker_t tracker = {0, 0, 0};
+  test20_tracker_t global_tracker = {0, 0, 0};
+  err_allocator_t allocator = {test20_alloc, test20_calloc, test20_realloc, test20_free, &tracker};
+  err_allocator_t global_allocator = {test20_alloc, test20_calloc, test20_realloc, test20_free, &global_tracker};
+  err_allocator_t bad_allocator = {test20_alloc, test20_calloc, NULL, test20_free, &tracker};
+  cfg_create_opts_t opts = {&allocator, 0};
+  cfg_t *cfg;
+  cfg_t *overlay;
+  cfg_sub_t *sub;
+  cfg_key_stat_t *keys;
+  hmap_t *hmap;
+  const cfg_span_t *strs;
+  const long *longs;
+  const char *bound;
+  char *val;
+  int num, num_keys;
+  int num_notifies = 0;
+  int num_matches = 0;
+  err_t *err;
+
+  /* Everything a cfg owns comes from its allocator. */
+  E(cfg_create_ex(&cfg, &opts));
+  ASSRT(cfg->allocator == &allocator);
+  E(cfg_profile_enable(cfg, 1));
+  E(cfg_subscribe(cfg, "net", CFG_SUB_PREFIX | CFG_SUB_QUEUED, test20_notify_cb, &num_notifies, &sub));
+  E(cfg_parse_file(cfg, CFG_MODE_ADD, "tst2.cfg"));
+  E(cfg_parse_line(cfg, CFG_MODE_ADD, "net_hosts = a, b, c", "test20", 1));
+  E(cfg_parse_line(cfg, CFG_MODE_ADD, "net_ports = 1, 2", "test20", 2));
+  E(cfg_parse_line(cfg, CFG_MODE_ADD, "net_name = ${opt1}-x", "test20", 3));
+  E(cfg_notify_drain(cfg));
+  ASSRT(num_notifies == 3);
+  E(cfg_get_str_list(cfg, "net_hosts", &strs, &num));
+  ASSRT(num == 3);
+  E(cfg_get_long_list(cfg, "net_ports", &longs, &num));
+  ASSRT(num == 2 && longs[1] == 2);
+  E(cfg_bind_str(cfg, "net_name", &bound));
+  E(cfg_parse_line(cfg, CFG_MODE_UPDATE, "net_name = y", "test20", 4));
+  ASSRT(strcmp(bound, "y") == 0);
+  E(cfg_key_index_enable(cfg));
+  E(cfg_iterate_prefix(cfg, "net", test20_iterate_cb, &num_matches));
+  ASSRT(num_matches == 3);
+  E(cfg_profile_keys(cfg, &keys, &num_keys));
+  cfg_mem_free(cfg, keys);
+  E(cfg_unbind(cfg, "net_name", &bound));
+  E(cfg_freeze(cfg));
+  E(cfg_create_overlay(&overlay, cfg));
+  ASSRT(overlay->allocator == &allocator);
+  E(cfg_parse_line(overlay, CFG_MODE_UPDATE, "opt1 = z", "test20", 5));
+  E(cfg_get_str_val(overlay, "opt1", &val));
+  ASSRT(strcmp(val, "z") == 0);
+  E(cfg_delete(overlay));
+  E(cfg_delete(cfg));
+  ASSRT(tracker.num_allocs > 0);
+  ASSRT(tracker.num_allocs == tracker.num_frees);
+
+  /* A set that runs out of memory at any step leaves the cfg as it was. */
+  int fail_in;
+  for (fail_in = 1; ; fail_in++) {
+    cfg_snapshot_t *snap;
+    int found;
+    E(cfg_create_ex(&cfg, &opts));
+    E(cfg_subscribe(cfg, "", CFG_SUB_PREFIX, test20_notify_cb, &num_notifies, &sub));
+    E(cfg_subscribe(cfg, "", CFG_SUB_PREFIX | CFG_SUB_QUEUED, test20_notify_cb, &num_matches, &sub));
+    E(cfg_key_index_enable(cfg));
+    E(cfg_parse_line(cfg, CFG_MODE_ADD, "old = 1", "test20", 1));
+    E(cfg_snapshot(cfg, &snap));
+    num_notifies = 0;
+    tracker.fail_in = fail_in;
+    err = cfg_parse_line(cfg, CFG_MODE_ADD, "new = 2", "test20", 2);
+    if (err == ERR_OK) {
+      err = cfg_parse_line(cfg, CFG_MODE_UPDATE, "old = 3", "test20", 3);
+    }
+    int done = (tracker.fail_in > 0);  /* Every allocation succeeded. */
+    tracker.fail_in = 0;
+    if (err) {
+      ASSRT(err->code == CFG_ERR_NOMEM || err->code == HMAP_ERR_NOMEM || err->code == HAMT_ERR_NOMEM);
+      err_dispose(err);
+      E(cfg_get_str_val(cfg, "old", &val));
+      int updated = (strcmp(val, "3") == 0);
+      ASSRT(updated || strcmp(val, "1") == 0);
+      E(cfg_try_get_str_val(cfg, "new", &val, &found));
+      ASSRT(! found || strcmp(val, "2") == 0);
+      ASSRT(num_notifies == found + updated);
+    } else {
+      ASSRT(done && num_notifies == 2);
+    }
+    E(cfg_snapshot_delete(snap));
+    E(cfg_delete(cfg));
+    ASSRT(tracker.num_allocs == tracker.num_frees);
+    if (done) { break; }
+  }
+  ASSRT(fail_in > 10);
+
+  tracker.num_allocs = 0;
+  tracker.num_frees = 0;
+  E(hmap_create_ex(&hmap, 16, &allocator));
+  E(hmap_swrite(hmap, "a", NULL));
+  E(hmap_swrite(hmap, "b", NULL));
+  E(hmap_delete(hmap));
+  ASSRT(tracker.num_allocs == 2 + 2 * 2);  /* hmap, table, entry and key per write. */
+  ASSRT(tracker.num_allocs == tracker.num_frees);
+
+  /* The global allocator covers err and default-created objects. */
+  E(err_set_allocator(&global_allocator));
+  ASSRT(err_get_allocator() == &global_allocator);
+  E(err_strdup(&val, "abc"));
+  ASSRT(global_tracker.num_allocs == 1);
+  err_mem_free(NULL, val);
+  ASSRT(global_tracker.num_frees == 1);
+  E(cfg_create(&cfg));
+  ASSRT(cfg->allocator == &global_allocator);
+  E(cfg_parse_line(cfg, CFG_MODE_ADD, "k = v", "test20", 1));
+  E(cfg_delete(cfg));
+  ASSRT(global_tracker.num_allocs == global_tracker.num_frees);
+  E(err_set_allocator(NULL));
+  ASSRT(err_get_allocator() != &global_allocator);
+
+  err = err_set_allocator(&bad_allocator);
+  ASSRT(err && err->code == ERR_ERR_PARAM);
+  err_dispose(err);
+}  /* test20 */
+
+
+void test21() {
+  cfg_t *cfg;
+  cfg_t *overlay;
+  cfg_option_t *option;
+  cfg_hkey_t hkey;
+  hmap_t *hmap;
+  void *val;
+  err_t *err;
+
+  E(hmap_create(&hmap, 7));
+  ASSRT(hmap->seed == HMAP_SEED);
+  E(hmap_swrite(hmap, "abc", (void *)1));
+  cfg_hkey_init(&hkey, "abc");
+  ASSRT(hkey.key_size == 4);
+  ASSRT(hkey.hash == hmap_murmur3_32("abc", 4, HMAP_SEED));
+  ASSRT(hmap_try_lookup_hashed(hmap, hkey.hash, hkey.key, hkey.key_size, &val) == 1);
+  ASSRT(val == (void *)1);
+  cfg_hkey_init(&hkey, "abd");
+  ASSRT(hmap_try_lookup_hashed(hmap, hkey.hash, hkey.key, hkey.key_size, &val) == 0);
+  ASSRT(val == NULL);
+  E(hmap_delete(hmap));
+
+  E(cfg_create(&cfg));
+  E(cfg_parse_file(cfg, CFG_MODE_ADD, "tst2.cfg"));
+  E(cfg_parse_line(cfg, CFG_MODE_ADD, "ref = ${opt1}!", "test21", 1));
+  E(cfg_profile_enable(cfg, 1));
+
+  cfg_hkey_init(&hkey, "ref");
+  E(cfg_try_get_option_h(cfg, &hkey, 0, &option));
+  ASSRT(option && strcmp(option->expanded, "xyz!") == 0);
+  ASSRT(option->num_reads == 1);
+  cfg_hkey_init(&hkey, "opt3");
+  E(cfg_try_get_option_h(cfg, &hkey, CFG_CONV_LONG, &option));
+  ASSRT(option && option->long_val == 3);
+  cfg_hkey_init(&hkey, "nokey");
+  E(cfg_try_get_option_h(cfg, &hkey, CFG_CONV_LONG, &option));
+  ASSRT(option == NULL);
+  cfg_hkey_init(&hkey, "opt1");
+  err = cfg_try_get_option_h(cfg, &hkey, CFG_CONV_LONG, &option);
+  ASSRT(err && err->code == ERR_ERR_BAD_NUMBER);
+  err_dispose(err);
+
+  /* Overlays fall through to the parent with the same hash. */
+  E(cfg_freeze(cfg));
+  E(cfg_create_overlay(&overlay, cfg));
+  E(cfg_parse_line(overlay, CFG_MODE_UPDATE, "opt1 = abc", "test21", 2));
+  E(cfg_try_get_option_h(overlay, &hkey, 0, &option));
+  ASSRT(option && option->owner == overlay && strcmp(option->value, "abc") == 0);
+  cfg_hkey_init(&hkey, "opt3");
+  E(cfg_try_get_option_h(overlay, &hkey, 0, &option));
+  ASSRT(option && option->owner == cfg);
+  E(cfg_try_get_option_h(overlay, &hkey, 0, &option));  /* From the layer cache. */
+  ASSRT(option && option->owner == cfg);
+
+  E(cfg_delete(overlay));
+  E(cfg_delete(cfg));
+}  /* test21 */
+
+
+void test22_write(const char *filename, const char *contents) {
+  FILE *fp = fopen(filename, "w");
+  ASSRT(fp);
+  ASSRT(fputs(contents, fp) >= 0);
+  ASSRT(fclose(fp) == 0);
+}  /* test22_write */
+
+char test22_order[64];
+
+err_t *test22_load_cb(cfg_t *cfg, const char *filename, err_t *load_err, void *clientd) {
+  (void)filename;
+  strcat(test22_order, (const char *)clientd);
+  if (load_err) {
+    strcat(test22_order, load_err->code == CFG_ERR_BADFILE ? "(badfile)" : "(err)");
+  }
+  if (strcmp((const char *)clientd, "c") == 0) {  /* Chain another load. */
+    ERR(cfg_load_submit(cfg, CFG_MODE_ADD, "tst22d.cfg", test22_load_cb, "d"));
+  }
+  return ERR_OK;
+}  /* test22_load_cb */
+
+
+void test22() {
+  cfg_t *cfg;
+  char *val;
+  long lval;
+  int fd, num_pending;
+  struct pollfd pfd;
+  FILE *fifo_fp;
+  const cfg_file_stat_t *files;
+  const char *location;
+  int num_files;
+  err_t *err;
+  err_t *frame;
+
+  test22_write("tst22a.cfg", "# first\nk1 = 1\n\nk2 = ${k1}2\n");
+  test22_write("tst22b.cfg", "k1 = 10\n");
+  test22_write("tst22c.cfg", "k3 = 3\n");
+  test22_write("tst22d.cfg", "k4 = 4\n");
+  test22_write("tst22e.cfg", "k5 = 5\nk6 = 6\nnot a setting\nk7 = 7\n");
+  unlink("tst22f.fifo");
+  ASSRT(mkfifo("tst22f.fifo", 0600) == 0);
+
+  /* Several files in flight, applied in submission order. */
+  E(cfg_create(&cfg));
+  E(cfg_profile_enable(cfg, 1));
+  test22_order[0] = '\0';
+  E(cfg_load_submit(cfg, CFG_MODE_ADD, "tst22a.cfg", test22_load_cb, "a"));
+  E(cfg_load_submit(cfg, CFG_MODE_UPDATE, "tst22b.cfg", test22_load_cb, "b"));
+  E(cfg_load_submit(cfg, CFG_MODE_ADD, "tst22c.cfg", test22_load_cb, "c"));
+  E(cfg_load_submit(cfg, CFG_MODE_ADD, "tst22x.cfg", test22_load_cb, "x"));
+  E(cfg_load_fd(cfg, &fd));
+  pfd.fd = fd;
+  pfd.events = POLLIN;
+  num_pending = 1;
+  while (num_pending > 0) {
+    ASSRT(poll(&pfd, 1, 5000) == 1);
+    E(cfg_load_poll(cfg, &num_pending));
+  }
+  ASSRT(strcmp(test22_order, "abcx(badfile)d") == 0);
+  E(cfg_get_long_val(cfg, "k1", &lval));
+  ASSRT(lval == 10);  /* b after a. */
+  E(cfg_get_str_val(cfg, "k2", &val));
+  ASSRT(strcmp(val, "102") == 0);
+  E(cfg_get_long_val(cfg, "k4", &lval));
+  ASSRT(lval == 4);
+  E(cfg_get_source(cfg, "k2", NULL, &location));
+  ASSRT(strcmp(location, "tst22a.cfg:4") == 0);
+  E(cfg_profile_files(cfg, &files, &num_files));
+  ASSRT(num_files == 4);
+  ASSRT(strcmp(files[0].filename, "tst22a.cfg") == 0);
+  ASSRT(files[0].last_lines == 4 && files[0].last_bytes == 28);
+
+  /* A slow file holds back the ones submitted after it. */
+  test22_order[0] = '\0';
+  E(cfg_load_submit(cfg, CFG_MODE_ADD, "tst22f.fifo", test22_load_cb, "f"));
+  E(cfg_load_submit(cfg, CFG_MODE_UPDATE, "tst22b.cfg", test22_load_cb, "b"));
+  ASSRT(poll(&pfd, 1, 5000) == 1);  /* b finished reading. */
+  E(cfg_load_poll(cfg, &num_pending));
+  ASSRT(num_pending == 2);
+  ASSRT(test22_order[0] == '\0');
+  fifo_fp = fopen("tst22f.fifo", "w");
+  ASSRT(fifo_fp);
+  fputs("k8 = 8\n", fifo_fp);
+  fclose(fifo_fp);
+  E(cfg_load_wait(cfg));
+  ASSRT(strcmp(test22_order, "fb") == 0);
+  E(cfg_load_poll(cfg, &num_pending));
+  ASSRT(num_pending == 0);
+
+  /* Without a callback, the error comes from poll/wait. Lines before
+   * the bad one are applied. */
+  E(cfg_load_submit(cfg, CFG_MODE_ADD, "tst22e.cfg", NULL, NULL));
+  err = cfg_load_wait(cfg);
+  ASSRT(err && err->code == CFG_ERR_NOEQUALS);
+  for (frame = err; frame; frame = frame->stacktrace) {  /* Location is in the trace. */
+    if (err_mesg(frame) && strcmp(err_mesg(frame), "tst22e.cfg:3") == 0) { break; }
+  }
+  ASSRT(frame);
+  err_dispose(err);
+  E(cfg_get_long_val(cfg, "k6", &lval));
+  ASSRT(lval == 6);
+  err = cfg_get_long_val(cfg, "k7", &lval);
+  ASSRT(err && err->code == HMAP_ERR_NOTFOUND);
+  err_dispose(err);
+
+  /* Conflicts are found when the lines are applied. */
+  E(cfg_load_submit(cfg, CFG_MODE_ADD, "tst22c.cfg", NULL, NULL));
+  err = cfg_load_wait(cfg);
+  ASSRT(err && err->code == CFG_ERR_ADD_KEY_ALREADY_EXIST);
+  err_dispose(err);
+
+  err = cfg_load_submit(cfg, 99, "tst22c.cfg", NULL, NULL);
+  ASSRT(err && err->code == CFG_ERR_PARAM);
+  err_dispose(err);
+
+  /* Deleting with loads outstanding discards them. */
+  E(cfg_load_submit(cfg, CFG_MODE_UPDATE, "tst22b.cfg", NULL, NULL));
+  E(cfg_delete(cfg));
+
+  unlink("tst22a.cfg");
+  unlink("tst22b.cfg");
+  unlink("tst22c.cfg");
+  unlink("tst22d.cfg");
+  unlink("tst22e.cfg");
+  unlink("tst22f.fifo");
+}  /* test22 */
+
+
+int test23_stop;
+
+void *test23_reader(void *arg) {
+  cfg_numa_t *numa = (cfg_numa_t *)arg;
+  long lval;
+  long prev = 0;
+
+  while (!__atomic_load_n(&test23_stop, __ATOMIC_ACQUIRE)) {
+    E(cfg_numa_get_long_val(numa, "count", &lval));
+    ASSRT(lval >= prev);  /* Never goes back. */
+    prev = lval;
+  }
+  return NULL;
+}  /* test23_reader */
+
+
+void test23() {
+  cfg_t *cfg;
+  cfg_numa_t *numa;
+  cfg_shm_t *shm;
+  const cfg_shm_hdr_t *image;
+  const char *str;
+  const char *old_str;
+  long lval;
+  char name[64];
+  pthread_t thread;
+  int i;
+  err_t *err;
+
+  /* Fake topology: node 2 has memory but no CPUs. */
+  mkdir("tst23_sys", 0700);
+  mkdir("tst23_sys/node0", 0700);
+  mkdir("tst23_sys/node1", 0700);
+  test22_write("tst23_sys/online", "0-1,2\n");
+  test22_write("tst23_sys/node0/cpulist", "1-3,5\n");
+  test22_write("tst23_sys/node1/cpulist", "0,4\n");
+
+  E(cfg_create(&cfg));
+  E(cfg_parse_line(cfg, CFG_MODE_ADD, "host = h${port}", "test23", 1));
+  E(cfg_parse_line(cfg, CFG_MODE_ADD, "port = 80", "test23", 2));
+  E(cfg_parse_line(cfg, CFG_MODE_ADD, "count = 0", "test23", 3));
+  E(cfg_parse_line(cfg, CFG_MODE_ADD, "rate = 2.5", "test23", 4));
+  E(cfg_parse_line(cfg, CFG_MODE_ADD, "debug = yes", "test23", 5));
+  E(cfg_parse_line(cfg, CFG_MODE_ADD, "buf = 4k", "test23", 6));
+  E(cfg_parse_line(cfg, CFG_MODE_ADD, "timeout = 2s", "test23", 7));
+
+  E(cfg_numa_create(&numa, cfg, "tst23_sys"));
+  ASSRT(numa->num_replicas == 2);
+  ASSRT(numa->replicas[0].node == 0 && numa->replicas[1].node == 1);
+  ASSRT(cfg_numa_cpu_replica(numa, 0) == 1);
+  ASSRT(cfg_numa_cpu_replica(numa, 3) == 0);
+  ASSRT(cfg_numa_cpu_replica(numa, 4) == 1);
+  ASSRT(cfg_numa_cpu_replica(numa, 5) == 0);
+  ASSRT(cfg_numa_cpu_replica(numa, 6) == 0);  /* Unknown CPU. */
+  ASSRT(cfg_numa_cpu_replica(numa, -1) == 0);
+
+  /* Separate, identical copies. */
+  ASSRT(numa->replicas[0].image != numa->replicas[1].image);
+  ASSRT(numa->replicas[0].image->image_size == numa->replicas[1].image->image_size);
+  ASSRT(memcmp(numa->replicas[0].image, numa->replicas[1].image, numa->replicas[0].image->image_size) == 0);
+  E(cfg_numa_image(numa, &image));
+  ASSRT(image == numa->replicas[0].image || image == numa->replicas[1].image);
+  ASSRT(image->generation == 1);
+
+  E(cfg_numa_get_str_val(numa, "host", &str));
+  ASSRT(strcmp(str, "h80") == 0);
+  E(cfg_numa_get_long_val(numa, "port", &lval));
+  ASSRT(lval == 80);
+  err = cfg_numa_get_long_val(numa, "host", &lval);
+  ASSRT(err && err->code == ERR_ERR_BAD_NUMBER);
+  err_dispose(err);
+  err = cfg_numa_get_str_val(numa, "missing", &str);
+  ASSRT(err && err->code == HMAP_ERR_NOTFOUND);
+  err_dispose(err);
+  double dval;
+  int bval;
+  size_t sval;
+  E(cfg_numa_get_double_val(numa, "rate", &dval));
+  ASSRT(dval == 2.5);
+  E(cfg_numa_get_bool_val(numa, "debug", &bval));
+  ASSRT(bval == 1);
+  E(cfg_numa_get_size_val(numa, "buf", &sval));
+  ASSRT(sval == 4096);
+  E(cfg_numa_get_duration_val(numa, "timeout", &lval));
+  ASSRT(lval == 2000);
+  err = cfg_numa_get_bool_val(numa, "port", &bval);
+  ASSRT(err && err->code == CFG_ERR_BAD_BOOL);
+  err_dispose(err);
+  err = cfg_numa_get_size_val(numa, "rate", &sval);
+  ASSRT(err && err->code == ERR_ERR_BAD_NUMBER);
+  err_dispose(err);
+
+  /* Updates reach every node; old strings stay valid. */
+  E(cfg_numa_get_str_val(numa, "host", &old_str));
+  E(cfg_parse_line(cfg, CFG_MODE_UPDATE, "port = 8080", "test23", 8));
+  E(cfg_numa_update(numa));
+  ASSRT(numa->generation == 2);
+  for (i = 0; i < numa->num_replicas; i++) {
+    const cfg_shm_entry_t *entry;
+    E(cfg_shm_image_lookup(numa->replicas[i].image, "host", &entry));
+    ASSRT(strcmp((const char *)numa->replicas[i].image + entry->value_off, "h8080") == 0);
+  }
+  ASSRT(strcmp(old_str, "h80") == 0);
+
+  /* Replaced images survive one reclaim and are unmapped by the next. */
+  ASSRT(numa->retired != NULL);
+  E(cfg_numa_reclaim(numa));
+  ASSRT(numa->retired == NULL && numa->old_retired != NULL);
+  ASSRT(strcmp(old_str, "h80") == 0);
+  E(cfg_numa_reclaim(numa));
+  ASSRT(numa->retired == NULL && numa->old_retired == NULL);
+
+  /* Readers running during updates. */
+  test23_stop = 0;
+  ASSRT(pthread_create(&thread, NULL, test23_reader, numa) == 0);
+  for (i = 1; i <= 20; i++) {
+    char line[64];
+    snprintf(line, sizeof(line), "count = %d", i);
+    E(cfg_parse_line(cfg, CFG_MODE_UPDATE, line, "test23", 9));
+    E(cfg_numa_update(numa));
+  }
+  __atomic_store_n(&test23_stop, 1, __ATOMIC_RELEASE);
+  ASSRT(pthread_join(thread, NULL) == 0);
+  E(cfg_numa_get_long_val(numa, "count", &lval));
+  ASSRT(lval == 20);
+  E(cfg_numa_delete(numa));
+
+  /* No topology: one copy. */
+  E(cfg_numa_create(&numa, cfg, "tst23_none"));
+  ASSRT(numa->num_replicas == 1 && numa->num_cpus == 0);
+  E(cfg_numa_get_str_val(numa, "host", &str));
+  ASSRT(strcmp(str, "h8080") == 0);
+  E(cfg_numa_delete(numa));
+
+  /* The real one. */
+  E(cfg_numa_create(&numa, cfg, NULL));
+  ASSRT(numa->num_replicas >= 1);
+  E(cfg_numa_get_long_val(numa, "port", &lval));
+  ASSRT(lval == 8080);
+  E(cfg_numa_delete(numa));
+
+  /* From a published cfg; copied only when it changes. */
+  snprintf(name, sizeof(name), "/cfg_test23_%ld", (long)getpid());
+  E(cfg_shm_publish(cfg, name));
+  E(cfg_shm_attach(&shm, name));
+  E(cfg_numa_create_shm(&numa, shm, "tst23_sys"));
+  ASSRT(numa->generation == 1);
+  image = numa->replicas[1].image;
+  E(cfg_numa_update(numa));
+  ASSRT(numa->replicas[1].image == image);
+  E(cfg_parse_line(cfg, CFG_MODE_UPDATE, "port = 81", "test23", 10));
+  E(cfg_shm_publish(cfg, name));
+  E(cfg_numa_update(numa));
+  ASSRT(numa->generation == 2);
+  ASSRT(numa->replicas[1].image != image);
+  E(cfg_numa_get_str_val(numa, "host", &str));
+  ASSRT(strcmp(str, "h81") == 0);
+  E(cfg_numa_delete(numa));
+  E(cfg_shm_detach(shm));
+  E(cfg_shm_unlink(name));
+
+  err = cfg_numa_create(&numa, NULL, NULL);
+  ASSRT(err && err->code == CFG_NUMA_ERR_PARAM);
+  err_dispose(err);
+
+  E(cfg_delete(cfg));
+  unlink("tst23_sys/node0/cpulist");
+  unlink("tst23_sys/node1/cpulist");
+  unlink("tst23_sys/online");
+  rmdir("tst23_sys/node0");
+  rmdir("tst23_sys/node1");
+  rmdir("tst23_sys");
+}  /* test23 */
+
+
+#define TEST24_NUM_KEYS 100000
+
+void test24() {
+  hmap_t *hmap;
+  hmap_t *ref;
+  hmap_entry_t *entry;
+  char *key_buf;
+  const void **keys;
+  size_t *key_sizes;
+  void **vals;
+  void *val;
+  int num_entries;
+  int i;
+  err_t *err;
+
+  /* Every 10th key repeats an earlier one. */
+  key_buf = (char *)malloc(TEST24_NUM_KEYS * 16);
+  keys = (const void **)malloc(TEST24_NUM_KEYS * sizeof(void *));
+  key_sizes = (size_t *)malloc(TEST24_NUM_KEYS * sizeof(size_t));
+  vals = (void **)malloc(TEST24_NUM_KEYS * sizeof(void *));
+  ASSRT(key_buf && keys && key_sizes && vals);
+  for (i = 0; i < TEST24_NUM_KEYS; i++) {
+    char *key = &key_buf[i * 16];
+    snprintf(key, 16, "key%d", (i % 10 == 9) ? i / 3 : i);
+    keys[i] = key;
+    key_sizes[i] = strlen(key) + 1;
+    vals[i] = (void *)(uintptr_t)(i + 1);
+  }
+
+  /* Same result as writing them one at a time. */
+  E(hmap_create(&ref, 50000));
+  for (i = 0; i < TEST24_NUM_KEYS; i++) {
+    E(hmap_write(ref, keys[i], key_sizes[i], vals[i]));
+  }
+  E(hmap_create(&hmap, 50000));
+  E(hmap_bulk_build(hmap, keys, key_sizes, vals, TEST24_NUM_KEYS, 4));
+  ASSRT(hmap->num_entries == ref->num_entries);
+  ASSRT(hmap->num_entries < TEST24_NUM_KEYS);
+  entry = NULL;
+  num_entries = 0;
+  do {
+    E(hmap_next(ref, &entry));
+    if (entry) {
+      ASSRT(hmap_try_lookup(hmap, entry->key, entry->key_size, &val));
+      ASSRT(val == entry->value);
+      num_entries++;
+    }
+  } while (entry);
+  ASSRT(num_entries == hmap->num_entries);
+  E(hmap_slookup(hmap, "key3", &val));
+  ASSRT(val == (void *)(uintptr_t)(9 + 1));  /* Last of key3 (i=3, 9). */
+
+  /* Keys are copied; the map can still grow and update. */
+  memset(key_buf, 0, TEST24_NUM_KEYS * 16);
+  E(hmap_slookup(hmap, "key7", &val));
+  ASSRT(val == (void *)(uintptr_t)(7 + 1));
+  E(hmap_swrite(hmap, "key7", (void *)77));
+  E(hmap_swrite(hmap, "new", (void *)88));
+  E(hmap_slookup(hmap, "key7", &val));
+  ASSRT(val == (void *)77);
+  E(hmap_slookup(hmap, "new", &val));
+  ASSRT(val == (void *)88);
+
+  err = hmap_bulk_build(hmap, keys, key_sizes, vals, 1, 1);  /* Not empty. */
+  ASSRT(err && err->code == HMAP_ERR_PARAM);
+  err_dispose(err);
+  E(hmap_delete(hmap));
+  E(hmap_delete(ref));
+
+  /* String keys, not copied, one thread by default for so few. */
+  static const char *skeys[] = {"a", "b", "c", "a"};
+  void *svals[] = {(void *)1, (void *)2, (void *)3, (void *)4};
+  E(hmap_create(&hmap, 3));
+  E(hmap_set_flags(hmap, HMAP_FLAG_NOCOPY_KEYS));
+  E(hmap_bulk_build(hmap, (const void **)skeys, NULL, svals, 4, 0));
+  ASSRT(hmap->num_entries == 3);
+  E(hmap_slookup(hmap, "a", &val));
+  ASSRT(val == (void *)4);
+  E(hmap_slookup(hmap, "c", &val));
+  ASSRT(val == (void *)3);
+  entry = NULL;
+  E(hmap_next(hmap, &entry));
+  ASSRT(entry->key == skeys[0] || entry->key == skeys[1] || entry->key == skeys[2]);
+  E(hmap_delete(hmap));
+
+  E(hmap_create(&hmap, 3));
+  E(hmap_bulk_build(hmap, NULL, NULL, NULL, 0, 0));
+  ASSRT(hmap->num_entries == 0 && hmap->slab == NULL);
+  E(hmap_delete(hmap));
+
+  free(key_buf);
+  free(keys);
+  free(key_sizes);
+  free(vals);
+}  /* test24 */
+
+
+void test25() {
+  hmap_t *hmap;
+  hmap_entry_t *entry;
+  cfg_t *cfg;
+  cfg_create_opts_t opts = {NULL, 5000};
+  cfg_mem_stat_t mem;
+  char key[32];
+  char line[64];
+  void *val;
+  long lval;
+  int i;
+
+  /* Keys that share a head and tail, so their tags match. */
+  E(hmap_create(&hmap, 101));
+  E(hmap_set_flags(hmap, HMAP_FLAG_SMALL));
+  ASSRT(hmap->table == NULL);
+  E(hmap_swrite(hmap, "abcd1wxyz", (void *)1));
+  E(hmap_swrite(hmap, "abcd2wxyz", (void *)2));
+  E(hmap_swrite(hmap, "a", (void *)3));
+  E(hmap_swrite(hmap, "", (void *)4));
+  E(hmap_swrite(hmap, "abcd1wxyz", (void *)5));  /* Update. */
+  ASSRT(hmap->table == NULL && hmap->num_entries == 4);
+  E(hmap_slookup(hmap, "abcd1wxyz", &val));
+  ASSRT(val == (void *)5);
+  E(hmap_slookup(hmap, "abcd2wxyz", &val));
+  ASSRT(val == (void *)2);
+  E(hmap_slookup(hmap, "", &val));
+  ASSRT(val == (void *)4);
+  ASSRT(! hmap_try_slookup(hmap, "abcd3wxyz", &val));
+  ASSRT(! hmap_try_slookup(hmap, "ab", &val));
+  ASSRT(hmap_try_lookup_hashed(hmap, hmap_murmur3_32("a", 2, HMAP_SEED), "a", 2, &val) && val == (void *)3);
+
+  /* Iteration is in insertion order while small. */
+  entry = NULL;
+  E(hmap_next(hmap, &entry));
+  ASSRT(strcmp((char *)entry->key, "abcd1wxyz") == 0);
+  E(hmap_next(hmap, &entry));
+  ASSRT(strcmp((char *)entry->key, "abcd2wxyz") == 0);
+
+  /* Past HMAP_SMALL_MAX, it becomes a hash table. */
+  for (i = 4; i < HMAP_SMALL_MAX; i++) {
+    snprintf(key, sizeof(key), "key%d", i);
+    E(hmap_swrite(hmap, key, (void *)(uintptr_t)i));
+  }
+  ASSRT(hmap->table == NULL && hmap->num_entries == HMAP_SMALL_MAX);
+  E(hmap_swrite(hmap, "one_more", (void *)99));
+  ASSRT(hmap->table != NULL && hmap->small_entries == NULL);
+  ASSRT(hmap->num_entries == HMAP_SMALL_MAX + 1);
+  for (i = 4; i < HMAP_SMALL_MAX; i++) {
+    snprintf(key, sizeof(key), "key%d", i);
+    E(hmap_slookup(hmap, key, &val));
+    ASSRT(val == (void *)(uintptr_t)i);
+  }
+  E(hmap_slookup(hmap, "abcd1wxyz", &val));
+  ASSRT(val == (void *)5);
+  E(hmap_slookup(hmap, "one_more", &val));
+  ASSRT(val == (void *)99);
+  entry = NULL;
+  i = 0;
+  do {
+    E(hmap_next(hmap, &entry));
+    if (entry) { i++; }
+  } while (entry);
+  ASSRT(i == HMAP_SMALL_MAX + 1);
+  E(hmap_delete(hmap));
+
+  /* Without the flag, the table still waits for the first write. */
+  E(hmap_create(&hmap, 101));
+  ASSRT(hmap->table == NULL);
+  ASSRT(! hmap_try_slookup(hmap, "a", &val));
+  entry = NULL;
+  E(hmap_next(hmap, &entry));
+  ASSRT(entry == NULL);
+  E(hmap_swrite(hmap, "a", (void *)1));
+  ASSRT(hmap->table != NULL);
+  E(hmap_delete(hmap));
+
+  /* A tiny cfg has no tables. */
+  E(cfg_create(&cfg));
+  E(cfg_parse_file(cfg, CFG_MODE_ADD, "tst2.cfg"));
+  ASSRT(cfg->option_infos->table == NULL && cfg->option_vals->table == NULL);
+  E(cfg_get_long_val(cfg, "opt3", &lval));
+  ASSRT(lval == 3);
+  E(cfg_profile_memory(cfg, &mem));
+  ASSRT(mem.num_keys == 3);
+  ASSRT(mem.table_bytes < 4096);  /* Three 1009-bucket tables were 24 KB. */
+  for (i = 0; i < 40; i++) {
+    snprintf(line, sizeof(line), "k%d = %d", i, i);
+    E(cfg_parse_line(cfg, CFG_MODE_ADD, line, "test25", i + 1));
+  }
+  ASSRT(cfg->option_infos->table != NULL && cfg->option_infos->table_size == 1009);
+  E(cfg_get_long_val(cfg, "k39", &lval));
+  ASSRT(lval == 39);
+  E(cfg_get_long_val(cfg, "opt3", &lval));
+  ASSRT(lval == 3);
+  E(cfg_delete(cfg));
+
+  /* The hint sizes the tables. */
+  E(cfg_create_ex(&cfg, &opts));
+  for (i = 0; i < 40; i++) {
+    snprintf(line, sizeof(line), "k%d = %d", i, i);
+    E(cfg_parse_line(cfg, CFG_MODE_ADD, line, "test25", i + 1));
+  }
+  ASSRT(cfg->option_infos->table_size == 5001);
+  E(cfg_get_long_val(cfg, "k0", &lval));
+  ASSRT(lval == 0);
+  E(cfg_delete(cfg));
+}  /* test25 */
+
+
+typedef struct test26_diff_s test26_diff_t;
+struct test26_diff_s {
+  int num_changed;
+  int num_added;
+  int num_removed;
+  char last_key[32];
+  char last_old[32];
+  char last_new[32];
+};
+
+err_t *test26_hamt_diff_cb(void *clientd, const void *key, size_t key_size,
+    const void *old_val, size_t old_val_size, const void *new_val, size_t new_val_size) {
+  test26_diff_t *diff = (test26_diff_t *)clientd;
+  (void)key_size; (void)old_val_size; (void)new_val_size;
+
+  if (old_val == NULL) { diff->num_added++; }
+  else if (new_val == NULL) { diff->num_removed++; }
+  else { diff->num_changed++; }
+  snprintf(diff->last_key, sizeof(diff->last_key), "%s", (const char *)key);
+
+  return ERR_OK;
+}  /* test26_hamt_diff_cb */
+
+
+err_t *test26_cfg_diff_cb(const char *key, const char *old_value, const char *new_value, void *clientd) {
+  test26_diff_t *diff = (test26_diff_t *)clientd;
+
+  if (old_value == NULL) { diff->num_added++; }
+  else { diff->num_changed++; }
+  snprintf(diff->last_key, sizeof(diff->last_key), "%s", key);
+  snprintf(diff->last_old, sizeof(diff->last_old), "%s", old_value ? old_value : "(null)");
+  snprintf(diff->last_new, sizeof(diff->last_new), "%s", new_value ? new_value : "(null)");
+
+  return ERR_OK;
+}  /* test26_cfg_diff_cb */
+
+
+void test26() {
+  hamt_t *hamt;
+  hamt_t *v1;
+  hamt_t *v2;
+  cfg_t *cfg;
+  cfg_t *layer;
+  cfg_snapshot_t *snap1;
+  cfg_snapshot_t *snap2;
+  cfg_snapshot_t *snap3;
+  test26_diff_t diff;
+  const char *value;
+  const char *location;
+  const void *val;
+  size_t val_size;
+  char key[32];
+  char str[32];
+  err_t *err;
+  int i;
+
+  /* Versions share what they don't change. */
+  E(hamt_create(&hamt, NULL));
+  ASSRT(! hamt_try_lookup(hamt, "a", 2, &val, &val_size));
+  for (i = 0; i < 2000; i++) {
+    snprintf(key, sizeof(key), "key%d", i);
+    snprintf(str, sizeof(str), "v%d", i);
+    E(hamt_write(hamt, key, strlen(key) + 1, str, strlen(str) + 1));
+  }
+  ASSRT(hamt->num_entries == 2000);
+  E(hamt_copy(&v1, hamt));
+  E(hamt_write(hamt, "key5", 5, "five", 5));
+  E(hamt_write(hamt, "new", 4, "x", 2));
+  E(hamt_write(hamt, "empty", 6, NULL, 0));
+  ASSRT(hamt->num_entries == 2002 && v1->num_entries == 2000);
+  ASSRT(hamt_try_lookup(hamt, "key5", 5, &val, &val_size));
+  ASSRT(strcmp((const char *)val, "five") == 0 && val_size == 5);
+  ASSRT(hamt_try_lookup(v1, "key5", 5, &val, NULL));
+  ASSRT(strcmp((const char *)val, "v5") == 0);
+  ASSRT(! hamt_try_lookup(v1, "new", 4, &val, NULL));
+  ASSRT(hamt_try_lookup(hamt, "empty", 6, &val, &val_size) && val_size == 0);
+  for (i = 0; i < 2000; i++) {
+    snprintf(key, sizeof(key), "key%d", i);
+    snprintf(str, sizeof(str), "v%d", i);
+    ASSRT(hamt_try_lookup(v1, key, strlen(key) + 1, &val, NULL));
+    ASSRT(strcmp((const char *)val, str) == 0);
+  }
+
+  memset(&diff, 0, sizeof(diff));
+  E(hamt_diff(v1, hamt, test26_hamt_diff_cb, &diff));
+  ASSRT(diff.num_changed == 1 && diff.num_added == 2 && diff.num_removed == 0);
+  memset(&diff, 0, sizeof(diff));
+  E(hamt_diff(hamt, v1, test26_hamt_diff_cb, &diff));
+  ASSRT(diff.num_changed == 1 && diff.num_added == 0 && diff.num_removed == 2);
+  memset(&diff, 0, sizeof(diff));
+  E(hamt_diff(v1, v1, test26_hamt_diff_cb, &diff));
+  ASSRT(diff.num_changed == 0 && diff.num_added == 0);
+
+  /* Rewriting the same bytes makes a new leaf but no difference. */
+  E(hamt_copy(&v2, hamt));
+  E(hamt_write(hamt, "key7", 5, "v7", 3));
+  memset(&diff, 0, sizeof(diff));
+  E(hamt_diff(v2, hamt, test26_hamt_diff_cb, &diff));
+  ASSRT(diff.num_changed == 0 && diff.num_added == 0);
+  E(hamt_delete(v2));
+
+  /* These keys have the same hash. */
+  ASSRT(hmap_murmur3_32("k210200", 8, HMAP_SEED) == hmap_murmur3_32("k210201", 8, HMAP_SEED));
+  ASSRT(hmap_murmur3_32("k210200", 8, HMAP_SEED) == hmap_murmur3_32("k210202", 8, HMAP_SEED));
+  E(hamt_write(hamt, "k210200", 8, "c0", 3));
+  E(hamt_write(hamt, "k210201", 8, "c1", 3));
+  E(hamt_copy(&v2, hamt));
+  E(hamt_write(hamt, "k210202", 8, "c2", 3));
+  E(hamt_write(hamt, "k210201", 8, "C1", 3));
+  ASSRT(hamt_try_lookup(hamt, "k210200", 8, &val, NULL) && strcmp((const char *)val, "c0") == 0);
+  ASSRT(hamt_try_lookup(hamt, "k210201", 8, &val, NULL) && strcmp((const char *)val, "C1") == 0);
+  ASSRT(hamt_try_lookup(hamt, "k210202", 8, &val, NULL) && strcmp((const char *)val, "c2") == 0);
+  ASSRT(hamt_try_lookup(v2, "k210201", 8, &val, NULL) && strcmp((const char *)val, "c1") == 0);
+  ASSRT(! hamt_try_lookup(v2, "k210202", 8, &val, NULL));
+  ASSRT(! hamt_try_lookup(hamt, "k210203", 8, &val, NULL));
+  memset(&diff, 0, sizeof(diff));
+  E(hamt_diff(v2, hamt, test26_hamt_diff_cb, &diff));
+  ASSRT(diff.num_changed == 1 && diff.num_added == 1);
+  memset(&diff, 0, sizeof(diff));
+  E(hamt_diff(v1, hamt, test26_hamt_diff_cb, &diff));
+  ASSRT(diff.num_changed == 1 && diff.num_added == 5);
+  E(hamt_delete(v2));
+
+  /* Old versions outlive newer ones and vice versa. */
+  E(hamt_delete(hamt));
+  ASSRT(hamt_try_lookup(v1, "key1999", 8, &val, NULL) && strcmp((const char *)val, "v1999") == 0);
+  E(hamt_delete(v1));
+
+  /* A leaf and a collision node at the same place. */
+  E(hamt_create(&hamt, NULL));
+  E(hamt_write(hamt, "k210200", 8, "c0", 3));
+  E(hamt_copy(&v1, hamt));
+  E(hamt_write(hamt, "k210201", 8, "c1", 3));
+  memset(&diff, 0, sizeof(diff));
+  E(hamt_diff(v1, hamt, test26_hamt_diff_cb, &diff));
+  ASSRT(diff.num_added == 1 && strcmp(diff.last_key, "k210201") == 0);
+  E(hamt_delete(v1));
+  E(hamt_delete(hamt));
+
+  /* Snapshots of a cfg. */
+  E(cfg_create(&cfg));
+  E(cfg_parse_file(cfg, CFG_MODE_ADD, "tst2.cfg"));
+  ASSRT(cfg->history == NULL && cfg->version == 3);
+  E(cfg_snapshot(cfg, &snap1));
+  ASSRT(snap1->version == 3 && snap1->time_ns > 0);
+  E(cfg_parse_line(cfg, CFG_MODE_UPDATE, "opt1=abc", "t26", 7));
+  E(cfg_parse_line(cfg, CFG_MODE_UPDATE, "opt3=3", "t26", 8));  /* Same value, new location. */
+  E(cfg_snapshot(cfg, &snap2));
+  ASSRT(snap2->version == 5);
+
+  E(cfg_snapshot_get(snap1, "opt1", &value, &location));
+  ASSRT(strcmp(value, "xyz") == 0 && strcmp(location, "tst2.cfg:2") == 0);
+  E(cfg_snapshot_get(snap2, "opt1", &value, &location));
+  ASSRT(strcmp(value, "abc") == 0 && strcmp(location, "t26:7") == 0);
+  E(cfg_snapshot_get(snap1, "opt2", &value, NULL));
+  ASSRT(strcmp(value, "") == 0);
+  err = cfg_snapshot_get(snap1, "opt4", &value, NULL);
+  ASSRT(err && err->code == HMAP_ERR_NOTFOUND);
+  err_dispose(err);
+
+  memset(&diff, 0, sizeof(diff));
+  E(cfg_snapshot_diff(snap1, snap2, test26_cfg_diff_cb, &diff));
+  ASSRT(diff.num_changed == 1 && diff.num_added == 0);
+  ASSRT(strcmp(diff.last_key, "opt1") == 0);
+  ASSRT(strcmp(diff.last_old, "xyz") == 0 && strcmp(diff.last_new, "abc") == 0);
+
+  /* Rollback restores values and locations. */
+  E(cfg_rollback(cfg, snap1));
+  E(cfg_get_str_val(cfg, "opt1", (char **)&value));
+  ASSRT(strcmp(value, "xyz") == 0);
+  E(cfg_get_source(cfg, "opt3", &layer, &location));
+  ASSRT(strcmp(location, "tst2.cfg:4") == 0);
+  ASSRT(cfg->version == 7);
+  E(cfg_snapshot(cfg, &snap3));
+  memset(&diff, 0, sizeof(diff));
+  E(cfg_snapshot_diff(snap1, snap3, test26_cfg_diff_cb, &diff));
+  ASSRT(diff.num_changed == 0 && diff.num_added == 0);
+  E(cfg_snapshot_delete(snap3));
+
+  /* Keys can't be removed, so a rollback past an add is refused. */
+  E(cfg_parse_line(cfg, CFG_MODE_UPDATE, "opt1=def", "t26", 9));
+  E(cfg_parse_line(cfg, CFG_MODE_ADD, "opt4=4", "t26", 10));
+  err = cfg_rollback(cfg, snap1);
+  ASSRT(err && err->code == CFG_ERR_ROLLBACK);
+  err_dispose(err);
+  E(cfg_get_str_val(cfg, "opt1", (char **)&value));
+  ASSRT(strcmp(value, "def") == 0);
+  E(cfg_snapshot(cfg, &snap3));
+  memset(&diff, 0, sizeof(diff));
+  E(cfg_snapshot_diff(snap1, snap3, test26_cfg_diff_cb, &diff));
+  ASSRT(diff.num_changed == 1 && diff.num_added == 1);
+  E(cfg_snapshot_delete(snap3));
+  E(cfg_delete(cfg));
+
+  /* Snapshots outlive the cfg. */
+  E(cfg_snapshot_get(snap2, "opt1", &value, NULL));
+  ASSRT(strcmp(value, "abc") == 0);
+  E(cfg_snapshot_delete(snap1));
+  E(cfg_snapshot_delete(snap2));
+}  /* test26 */
+
+
+void *test27_reader(void *arg) {
+  cfg_t *cfg = (cfg_t *)arg;
+  long lval;
+  int i;
+
+  for (i = 0; i < 1000; i++) {
+    E(cfg_get_long_val(cfg, "opt3", &lval));
+    ASSRT(lval == 3);
+  }
+
+  return NULL;
+}  /* test27_reader */
+
+
+void test27() {
+  cfg_t *cfg;
+  cfg_t *cfg2;
+  pthread_t thread;
+  char key[32];
+  char *str;
+  long lval;
+  err_t *err;
+  int i;
+
+  E(cfg_create(&cfg));
+  E(cfg_parse_file(cfg, CFG_MODE_ADD, "tst2.cfg"));
+  E(cfg_parse_line(cfg, CFG_MODE_ADD, "num=${opt3}0", "test27", 1));
+  E(cfg_hot_cache_enable(cfg, CFG_HOT_CACHE_ON));
+  err = cfg_hot_cache_enable(cfg, 3);
+  ASSRT(err && err->code == CFG_ERR_PARAM);
+  err_dispose(err);
+
+  for (i = 0; i < 3; i++) {
+    E(cfg_get_str_val(cfg, "opt1", &str));
+    ASSRT(strcmp(str, "xyz") == 0);
+    E(cfg_get_long_val(cfg, "opt3", &lval));
+    ASSRT(lval == 3);
+    E(cfg_get_long_val(cfg, "num", &lval));
+    ASSRT(lval == 30);
+    E(cfg_get_str_val(cfg, "num", &str));
+    ASSRT(strcmp(str, "30") == 0);
+  }
+  err = cfg_get_long_val(cfg, "opt1", &lval);  /* Failures aren't cached. */
+  ASSRT(err && err->code == ERR_ERR_BAD_NUMBER);
+  err_dispose(err);
+  err = cfg_get_str_val(cfg, "nokey", &str);
+  ASSRT(err && err->code == HMAP_ERR_NOTFOUND);
+  err_dispose(err);
+
+  /* One buffer reused for different keys, as in a snprintf() loop. */
+  E(cfg_hot_cache_enable(cfg, CFG_HOT_CACHE_CHECK_KEY));
+  for (i = 0; i < 2; i++) {
+    strcpy(key, "opt1");
+    E(cfg_get_str_val(cfg, key, &str));
+    ASSRT(strcmp(str, "xyz") == 0);
+    strcpy(key, "opt3");
+    E(cfg_get_str_val(cfg, key, &str));
+    ASSRT(strcmp(str, "3") == 0);
+    E(cfg_get_long_val(cfg, key, &lval));
+    ASSRT(lval == 3);
+    strcpy(key, "num");
+    E(cfg_get_long_val(cfg, key, &lval));
+    ASSRT(lval == 30);
+  }
+  strcpy(key, "opt3");
+
+  /* Any set invalidates. */
+  E(cfg_parse_line(cfg, CFG_MODE_UPDATE, "opt3=4", "test27", 2));
+  E(cfg_get_str_val(cfg, key, &str));
+  ASSRT(strcmp(str, "4") == 0);
+  E(cfg_get_long_val(cfg, "opt3", &lval));
+  ASSRT(lval == 4);
+  E(cfg_get_long_val(cfg, "num", &lval));
+  ASSRT(lval == 40);
+  E(cfg_parse_line(cfg, CFG_MODE_UPDATE, "opt1=abc", "test27", 3));
+  E(cfg_get_str_val(cfg, "opt1", &str));
+  ASSRT(strcmp(str, "abc") == 0);
+
+  /* Same key pointer, different cfgs. */
+  E(cfg_create(&cfg2));
+  E(cfg_parse_line(cfg2, CFG_MODE_ADD, "opt1=other", "test27", 4));
+  E(cfg_hot_cache_enable(cfg2, CFG_HOT_CACHE_ON));
+  for (i = 0; i < 2; i++) {
+    E(cfg_get_str_val(cfg2, "opt1", &str));
+    ASSRT(strcmp(str, "other") == 0);
+    E(cfg_get_str_val(cfg, "opt1", &str));
+    ASSRT(strcmp(str, "abc") == 0);
+  }
+
+  /* A set only makes its own cfg's entries stale. */
+  uint64_t generation = cfg->generation;
+  E(cfg_parse_line(cfg2, CFG_MODE_UPDATE, "opt1=another", "test27", 5));
+  ASSRT(cfg->generation == generation);
+  E(cfg_get_str_val(cfg2, "opt1", &str));
+  ASSRT(strcmp(str, "another") == 0);
+  E(cfg_get_str_val(cfg, "opt1", &str));
+  ASSRT(strcmp(str, "abc") == 0);
+  E(cfg_delete(cfg2));
+
+  /* Each thread has its own cache. */
+  E(cfg_parse_line(cfg, CFG_MODE_UPDATE, "opt3=3", "test27", 6));
+  E(cfg_freeze(cfg));
+  ASSRT(pthread_create(&thread, NULL, test27_reader, cfg) == 0);
+  test27_reader(cfg);
+  ASSRT(pthread_join(thread, NULL) == 0);
+
+  /* Reads are still counted while profiling. */
+  E(cfg_profile_enable(cfg, 1));
+  E(cfg_get_long_val(cfg, "opt3", &lval));
+  E(cfg_get_long_val(cfg, "opt3", &lval));
+  cfg_option_t *option;
+  E(hmap_slookup(cfg->option_infos, "opt3", (void **)&option));
+  ASSRT(option->num_reads == 2);
+  E(cfg_delete(cfg));
+}  /* test27 */
+
+
+extern const cfg_static_t tst28_static;  /* bld.sh compiles tst28.cfg. */
+
+err_t *test28_count(cfg_t *cfg, const char *key, const char *value, void *clientd) {
+  (void)cfg;  (void)key;  (void)value;
+  (*(int *)clientd)++;
+  return ERR_OK;
+}  /* test28_count */
+
+
+void *test28_reader(void *arg) {
+  cfg_t *cfg = (cfg_t *)arg;
+  char *str;
+  long lval;
+  int i;
+
+  for (i = 0; i < 1000; i++) {
+    E(cfg_get_str_val(cfg, "url2", &str));
+    ASSRT(strcmp(str, "http://example.com:8080/index.html") == 0);
+    E(cfg_get_long_val(cfg, "port", &lval));
+    ASSRT(lval == 8080);
+  }
+
+  return NULL;
+}  /* test28_reader */
+
+
+void test28() {
+  cfg_t *base;
+  cfg_t *overlay;
+  cfg_t *parsed;
+  cfg_t *layer;
+  cfg_layer_pos_t pos;
+  cfg_option_t *option;
+  pthread_t thread;
+  const cfg_span_t *strs;
+  const cfg_shm_hdr_t *image;
+  const cfg_shm_entry_t *shm_entry;
+  const char *location;
+  char *str;
+  char *parsed_str;
+  long lval;
+  size_t image_size;
+  int num;
+  err_t *err;
+
+  setenv("CFG_TST28", "/opt", 1);
+  unsetenv("CFG_TST28_UNSET");
+  E(cfg_create_static(&base, &tst28_static));
+  ASSRT(base->frozen);
+  ASSRT(base->option_infos->num_entries == 0);  /* Nothing copied. */
+
+  /* Readers race to make the same options. */
+  ASSRT(pthread_create(&thread, NULL, test28_reader, base) == 0);
+  test28_reader(base);
+  ASSRT(pthread_join(thread, NULL) == 0);
+
+  E(cfg_get_str_val(base, "url", &str));
+  ASSRT(strcmp(str, "http://example.com:8080/") == 0);
+  E(cfg_get_str_val(base, "tmpl", &str));
+  ASSRT(strcmp(str, "${host}") == 0);
+  E(cfg_get_str_val(base, "path", &str));
+  ASSRT(strcmp(str, "/opt/data") == 0);
+  E(cfg_get_str_val(base, "joined", &str));
+  ASSRT(strcmp(str, "${x}") == 0);
+  E(cfg_get_str_val(base, "odd", &str));
+  ASSRT(strcmp(str, "a\\b?\?=c\"d") == 0);
+  E(cfg_get_str_val(base, "empty", &str));
+  ASSRT(strcmp(str, "") == 0);
+  E(cfg_get_str_list(base, "hosts", &strs, &num));
+  ASSRT(num == 3);
+  ASSRT(strs[2].len == 5 && strncmp(strs[2].ptr, "gamma", 5) == 0);
+  err = cfg_get_str_val(base, "nopath", &str);
+  ASSRT(err);
+  ASSRT(err->code == CFG_ERR_SUBST);
+  err_dispose(err);
+  err = cfg_get_str_val(base, "nokey", &str);
+  ASSRT(err);
+  ASSRT(err->code == HMAP_ERR_NOTFOUND);
+  err_dispose(err);
+  err = cfg_parse_line(base, CFG_MODE_UPDATE, "port = 81", "test28", 1);
+  ASSRT(err);
+  ASSRT(err->code == CFG_ERR_FROZEN);
+  err_dispose(err);
+  E(cfg_get_source(base, "port", &layer, &location));
+  ASSRT(layer == base);
+  ASSRT(strcmp(location, "tst28.cfg:3") == 0);
+
+  /* Same values as parsing the file. */
+  E(cfg_create(&parsed));
+  E(cfg_parse_file(parsed, CFG_MODE_ADD, "tst28.cfg"));
+  num = 0;
+  memset(&pos, 0, sizeof(pos));
+  do {
+    E(cfg_layer_next(parsed, &pos, &option));
+    if (option && strcmp(option->key, "nopath") != 0) {
+      E(cfg_get_str_val(base, option->key, &str));
+      E(cfg_get_str_val(parsed, option->key, &parsed_str));
+      ASSRT(strcmp(str, parsed_str) == 0);
+      num++;
+    }
+  } while (option);
+  ASSRT(num == 12);
+  num = 0;
+  E(cfg_iterate_prefix(base, "host", test28_count, &num));
+  ASSRT(num == 2);
+
+  E(cfg_create_overlay(&overlay, base));
+  E(cfg_parse_line(overlay, CFG_MODE_UPDATE, "port = 9090", "test28", 2));
+  E(cfg_parse_line(overlay, CFG_MODE_ADD, "me = ${host}:${port}", "test28", 3));
+  err = cfg_parse_line(overlay, CFG_MODE_ADD, "host = other", "test28", 4);
+  ASSRT(err);
+  ASSRT(err->code == CFG_ERR_ADD_KEY_ALREADY_EXIST);
+  err_dispose(err);
+  E(cfg_get_long_val(overlay, "port", &lval));
+  ASSRT(lval == 9090);
+  E(cfg_get_long_val(base, "port", &lval));
+  ASSRT(lval == 8080);
+  E(cfg_get_str_val(overlay, "me", &str));
+  ASSRT(strcmp(str, "example.com:9090") == 0);
+  E(cfg_get_source(overlay, "host", &layer, &location));
+  ASSRT(layer == base);
+  ASSRT(strcmp(location, "tst28.cfg:2") == 0);
+  num = 0;
+  E(cfg_iterate_prefix(overlay, "url", test28_count, &num));
+  ASSRT(num == 2);
+  E(cfg_delete(overlay));
+  E(cfg_delete(base));
+
+  /* Each static cfg reads the environment on first use. */
+  setenv("CFG_TST28_UNSET", "/srv", 1);
+  E(cfg_create_static(&base, &tst28_static));
+  E(cfg_create_overlay(&overlay, base));
+  E(cfg_parse_line(overlay, CFG_MODE_UPDATE, "port = 9090", "test28", 5));
+  E(cfg_shm_image_size(overlay, &image_size));
+  image = (const cfg_shm_hdr_t *)malloc(image_size);
+  ASSRT(image != NULL);
+  E(cfg_shm_image_write(overlay, (void *)image, image_size, 1));
+  E(cfg_shm_image_lookup(image, "nopath", &shm_entry));
+  ASSRT(strcmp((const char *)image + shm_entry->value_off, "/srv/data") == 0);
+  ASSRT(strcmp((const char *)image + shm_entry->location_off, "tst28.cfg:8") == 0);
+  E(cfg_shm_image_lookup(image, "port", &shm_entry));
+  ASSRT(strcmp((const char *)image + shm_entry->value_off, "9090") == 0);
+  free((void *)image);
+  E(cfg_delete(overlay));
+  E(cfg_delete(base));
+  E(cfg_delete(parsed));
+}  /* test28 */
+
+
+int main(int argc, char **argv) {
+  parse_cmdline(argc, argv);
+
+  if (o_testnum == 0 || o_testnum == 1) {
+    test1();
+    printf("test1: success\n");
+  }
+
+  if (o_testnum == 0 || o_testnum == 2) {
+    test2();
+    printf("test1: success\n");
+  }
+
+  if (o_testnum == 0 || o_testnum == 3) {
+    test3();
+    printf("test1: success\n");
+  }
+
+  if (o_testnum == 0 || o_testnum == 4) {
+    test4();
+    printf("test1: success\n");
+  }
+
+  if (o_testnum == 0 || o_testnum == 5) {
+    test5();
+    printf("test5: success\n");
+  }
+
+  if (o_testnum == 0 || o_testnum == 6) {
+    test6();
+    printf("test6: success\n");
+  }
+
+  if (o_testnum == 0 || o_testnum == 7) {
+    test7();
+    printf("test7: success\n");
+  }
+
+  if (o_testnum == 0 || o_testnum == 8) {
+    test8();
+    printf("test8: success\n");
+  }
+
+  if (o_testnum == 0 || o_testnum == 9) {
+    test9();
+    printf("test9: success\n");
+  }
+
+  if (o_testnum == 0 || o_testnum == 10) {
+    test10();
+    printf("test10: success\n");
+  }
+
+  if (o_testnum == 0 || o_testnum == 11) {
+    test11();
+    printf("test11: success\n");
+  }
+
+  if (o_testnum == 0 || o_testnum == 12) {
+    test12();
+    printf("test12: success\n");
+  }
+
+  if (o_testnum == 0 || o_testnum == 13) {
+    test13();
+    printf("test13: success\n");
+  }
+
+  if (o_testnum == 0 || o_testnum == 14) {
+    test14();
+    printf("test14: success\n");
+  }
+
+  if (o_testnum == 0 || o_testnum == 15) {
+    test15();
+    printf("test15: success\n");
+  }
+
+  if (o_testnum == 0 || o_testnum == 16) {
+    test16();
+    printf("test16: success\n");
+  }
+
+  if (o_testnum == 0 || o_testnum == 17) {
+    test17();
+    printf("test17: success\n");
+  }
+
+  if (o_testnum == 0 || o_testnum == 18) {
+    test18();
+    printf("test18: success\n");
+  }
+
+  if (o_testnum == 0 || o_testnum == 19) {
+    test19();
+    printf("test19: success\n");
+  }
+
+  if (o_testnum == 0 || o_testnum == 20) {
+    test20();
+    printf("test20: success\n");
+  }
+
+  if (o_testnum == 0 || o_testnum == 21) {
+    test21();
+    printf("test21: success\n");
+  }
+
+  if (o_testnum == 0 || o_testnum == 22) {
+    test22();
+    printf("test22: success\n");
+  }
+
+  if (o_testnum == 0 || o_testnum == 23) {
+    test23();
+    printf("test23: success\n");
+  }
+
+  if (o_testnum == 0 || o_testnum == 24) {
+    test24();
+    printf("test24: success\n");
+  }
+
+  if (o_testnum == 0 || o_testnum == 25) {
+    test25();
+    printf("test25: success\n");
+  }
+
+  if (o_testnum == 0 || o_testnum == 26) {
+    test26();
+    printf("test26: success\n");
+  }
+
+  if (o_testnum == 0 || o_testnum == 27) {
+    test27();
+    printf("test27: success\n");
+  }
+
+  if (o_testnum == 0 || o_testnum == 28) {
+    test28();
+    printf("test28: success\n");
   }
 
   return 0;
@@ -16,16 +16,92 @@
 #include <string.h>
 #include <stdlib.h>
 #include <errno.h>
+#include <stdint.h>
+#include <pthread.h>
 #define ERR_C
 #include "err.h"
 
 
+/* Default allocator: the C library. */
+void *err_libc_alloc(void *ctx, size_t size) {
+  (void)ctx;
+  return malloc(size);
+}  /* err_libc_alloc */
+
+
+void *err_libc_calloc(void *ctx, size_t nmemb, size_t size) {
+  (void)ctx;
+  return calloc(nmemb, size);
+}  /* err_libc_calloc */
+
+
+void *err_libc_realloc(void *ctx, void *ptr, size_t size) {
+  (void)ctx;
+  return realloc(ptr, size);
+}  /* err_libc_realloc */
+
+
+void err_libc_free(void *ctx, void *ptr) {
+  (void)ctx;
+  free(ptr);
+}  /* err_libc_free */
+
+
+const err_allocator_t err_libc_allocator = {
+  err_libc_alloc, err_libc_calloc, err_libc_realloc, err_libc_free, NULL
+};
+const err_allocator_t *err_allocator = &err_libc_allocator;
+
+
+ERR_F err_set_allocator(const err_allocator_t *allocator) {
+  if (allocator == NULL) {
+    allocator = &err_libc_allocator;
+  }
+  ERR_ASSRT(allocator->alloc && allocator->calloc && allocator->realloc && allocator->free, ERR_ERR_PARAM);
+
+  err_allocator = allocator;
+
+  return ERR_OK;
+}  /* err_set_allocator */
+
+
+const err_allocator_t *err_get_allocator() {
+  return err_allocator;
+}  /* err_get_allocator */
+
+
+void *err_mem_alloc(const err_allocator_t *allocator, size_t size) {
+  if (allocator == NULL) { allocator = err_allocator; }
+  return allocator->alloc(allocator->ctx, size);
+}  /* err_mem_alloc */
+
+
+void *err_mem_calloc(const err_allocator_t *allocator, size_t nmemb, size_t size) {
+  if (allocator == NULL) { allocator = err_allocator; }
+  return allocator->calloc(allocator->ctx, nmemb, size);
+}  /* err_mem_calloc */
+
+
+void *err_mem_realloc(const err_allocator_t *allocator, void *ptr, size_t size) {
+  if (allocator == NULL) { allocator = err_allocator; }
+  return allocator->realloc(allocator->ctx, ptr, size);
+}  /* err_mem_realloc */
+
+
+void err_mem_free(const err_allocator_t *allocator, void *ptr) {
+  if (allocator == NULL) { allocator = err_allocator; }
+  if (ptr != NULL) {
+    allocator->free(allocator->ctx, ptr);
+  }
+}  /* err_mem_free */
+
+
 /* Wrap a few functions to be ERR-compliant. */
 ERR_F err_calloc(void **rtn_ptr, size_t nmemb, size_t size) {
   ERR_ASSRT(rtn_ptr, ERR_ERR_PARAM);
   ERR_ASSRT(nmemb > 0, ERR_ERR_PARAM);
   ERR_ASSRT(size > 0, ERR_ERR_PARAM);
-  ERR_ASSRT(*rtn_ptr = calloc(nmemb, size), ERR_ERR_NOMEM);
+  ERR_ASSRT(*rtn_ptr = err_mem_calloc(NULL, nmemb, size), ERR_ERR_NOMEM);
 
   return ERR_OK;
 }  /* err_calloc */
@@ -36,7 +112,7 @@ ERR_F err_strdup(char **rtn_str, const char *src_str) {
   ERR_ASSRT(rtn_str, ERR_ERR_PARAM);
 
   size_t size = strlen(src_str) + 1;
-  ERR_ASSRT(*rtn_str = malloc(size), ERR_ERR_NOMEM);
+  ERR_ASSRT(*rtn_str = err_mem_alloc(NULL, size), ERR_ERR_NOMEM);
 
   memcpy(*rtn_str, src_str, size);
 
@@ -79,7 +155,7 @@ char *err_vasprintf(const char *format, va_list args) {
   }
 
   /* Allocate buffer */
-  char *str = malloc(size);
+  char *str = err_mem_alloc(NULL, size);
   if (str == NULL) {
     va_end(args_copy);
     return NULL;
@@ -90,7 +166,7 @@ char *err_vasprintf(const char *format, va_list args) {
   va_end(args_copy);
 
   if (result < 0) {
-    free(str);
+    err_mem_free(NULL, str);
     return NULL;
   }
 
@@ -111,27 +187,644 @@ ERR_F err_asprintf(char **rtn_str, const char *format, ...) {
 }  /* err_asprintf */
 
 
-err_t *err_throw_v(const char *file, int line, const char *func, char *code, const char *format, ...) {
-  err_t *err = NULL;
-  err = (err_t *)calloc(1, sizeof(err_t));
-  if (err == NULL) {
-    fprintf(stderr, "err_throw: calloc error, aborting.\n");  fflush(stderr);
-    abort();
+/* Deferred formatting. Each conversion in the format is classified so
+ * its argument can be pulled off the va_list with the right type now and
+ * passed back to snprintf() with the same type later. */
+#define ERR_SPEC_BAD 0
+#define ERR_SPEC_PCT 1
+#define ERR_SPEC_INT 2
+#define ERR_SPEC_UINT 3
+#define ERR_SPEC_CHR 4
+#define ERR_SPEC_DBL 5
+#define ERR_SPEC_STR 6
+#define ERR_SPEC_PTR 7
+
+#define ERR_LEN_NONE 0
+#define ERR_LEN_L 1
+#define ERR_LEN_LL 2
+#define ERR_LEN_Z 3
+
+#define ERR_SPEC_MAX_LEN 32
+
+int err_deferred = 0;
+
+
+void err_set_deferred(int enable) {
+  err_deferred = enable;
+}  /* err_set_deferred */
+
+
+/* Parse the conversion starting at the '%' in p. Returns its class and
+ * sets its length (including the '%') and its length modifier. "*"
+ * widths and less common length modifiers are not supported. */
+int err_spec_parse(const char *p, int *rtn_spec_len, int *rtn_len_mod) {
+  const char *s = p + 1;
+  int len_mod = ERR_LEN_NONE;
+  int spec_class;
+
+  while (*s != '\0' && strchr("-+ #0", *s) != NULL) { s++; }
+  while (*s >= '0' && *s <= '9') { s++; }
+  if (*s == '.') {
+    s++;
+    while (*s >= '0' && *s <= '9') { s++; }
+  }
+  if (*s == 'h') {
+    s++;
+    if (*s == 'h') { s++; }  /* Promoted to int either way. */
+  } else if (*s == 'l') {
+    s++;
+    len_mod = ERR_LEN_L;
+    if (*s == 'l') { s++;  len_mod = ERR_LEN_LL; }
+  } else if (*s == 'z') {
+    s++;
+    len_mod = ERR_LEN_Z;
   }
 
-  if (format != NULL) {
-    va_list args;
-    va_start(args, format);
-    err->mesg = err_vasprintf(format, args);
-    va_end(args);
+  switch (*s) {
+    case '%': spec_class = (s == p + 1) ? ERR_SPEC_PCT : ERR_SPEC_BAD; break;
+    case 'd': case 'i': spec_class = ERR_SPEC_INT; break;
+    case 'u': case 'o': case 'x': case 'X': spec_class = ERR_SPEC_UINT; break;
+    case 'c': spec_class = (len_mod == ERR_LEN_NONE) ? ERR_SPEC_CHR : ERR_SPEC_BAD; break;
+    case 'f': case 'F': case 'e': case 'E': case 'g': case 'G': case 'a': case 'A':
+      spec_class = (len_mod == ERR_LEN_NONE || len_mod == ERR_LEN_L) ? ERR_SPEC_DBL : ERR_SPEC_BAD; break;
+    case 's': spec_class = (len_mod == ERR_LEN_NONE) ? ERR_SPEC_STR : ERR_SPEC_BAD; break;
+    case 'p': spec_class = (len_mod == ERR_LEN_NONE) ? ERR_SPEC_PTR : ERR_SPEC_BAD; break;
+    default: spec_class = ERR_SPEC_BAD;
+  }
 
-    if (err->mesg == NULL) {
-      fprintf(stderr, "err_throw: message formatting error, aborting.\n");  fflush(stderr);
+  *rtn_spec_len = (int)(s - p) + 1;
+  if (*rtn_spec_len >= ERR_SPEC_MAX_LEN) {
+    spec_class = ERR_SPEC_BAD;
+  }
+  *rtn_len_mod = len_mod;
+  return spec_class;
+}  /* err_spec_parse */
+
+
+/* Copy the format and arguments into a deferred message. Returns 0 on
+ * success, -1 if they don't fit. */
+int err_defer_fill(err_defer_t *defer, const char *format, va_list args) {
+  size_t format_len = strlen(format) + 1;
+  size_t buf_used = format_len;
+  const char *p = format;
+  int num_args = 0;
+
+  if (format_len > ERR_DEFER_BUF_SIZE) {
+    return -1;
+  }
+  memcpy(defer->buf, format, format_len);
+
+  while ((p = strchr(p, '%')) != NULL) {
+    int spec_len, len_mod;
+    int spec_class = err_spec_parse(p, &spec_len, &len_mod);
+    err_arg_t *arg = &defer->args[num_args];
+
+    if (spec_class == ERR_SPEC_BAD) {
+      return -1;
+    }
+    if (spec_class != ERR_SPEC_PCT) {
+      if (num_args == ERR_DEFER_MAX_ARGS) {
+        return -1;
+      }
+      num_args++;
+    }
+
+    switch (spec_class) {
+      case ERR_SPEC_INT:
+        if (len_mod == ERR_LEN_L) { arg->i = va_arg(args, long); }
+        else if (len_mod == ERR_LEN_LL) { arg->i = va_arg(args, long long); }
+        else if (len_mod == ERR_LEN_Z) { arg->i = (long long)va_arg(args, size_t); }
+        else { arg->i = va_arg(args, int); }
+        break;
+      case ERR_SPEC_UINT:
+        if (len_mod == ERR_LEN_L) { arg->u = va_arg(args, unsigned long); }
+        else if (len_mod == ERR_LEN_LL) { arg->u = va_arg(args, unsigned long long); }
+        else if (len_mod == ERR_LEN_Z) { arg->u = va_arg(args, size_t); }
+        else { arg->u = va_arg(args, unsigned int); }
+        break;
+      case ERR_SPEC_CHR:
+        arg->i = va_arg(args, int);
+        break;
+      case ERR_SPEC_DBL:
+        arg->d = va_arg(args, double);
+        break;
+      case ERR_SPEC_PTR:
+        arg->p = va_arg(args, void *);
+        break;
+      case ERR_SPEC_STR: {
+        /* The caller's string may not outlive the err object. */
+        const char *str = va_arg(args, const char *);
+        if (str == NULL) {
+          arg->p = NULL;
+        } else {
+          size_t str_len = strlen(str) + 1;
+          if (buf_used + str_len > ERR_DEFER_BUF_SIZE) {
+            return -1;
+          }
+          memcpy(&defer->buf[buf_used], str, str_len);
+          arg->p = &defer->buf[buf_used];
+          buf_used += str_len;
+        }
+        break;
+      }
+      default:
+        break;
+    }
+    p += spec_len;
+  }
+
+  defer->num_args = num_args;
+  return 0;
+}  /* err_defer_fill */
+
+
+err_defer_t *err_defer_alloc(void);
+void err_defer_free(err_defer_t *defer);
+
+/* Returns 0 if the message was deferred, -1 if the caller must format
+ * it now (too big, or no memory). */
+int err_defer(err_t *err, const char *format, va_list args) {
+  err_defer_t *defer = err_defer_alloc();
+  if (defer == NULL) {
+    return -1;
+  }
+  if (err_defer_fill(defer, format, args) != 0) {
+    err_defer_free(defer);
+    return -1;
+  }
+
+  err->defer = defer;
+  return 0;
+}  /* err_defer */
+
+
+/* Like snprintf(): writes at most size bytes and returns the full length. */
+size_t err_deferred_format(err_t *err, char *out, size_t size) {
+  const char *p = err->defer->buf;
+  size_t pos = 0;
+  int arg_idx = 0;
+
+  while (*p != '\0') {
+    char *dst = (pos < size) ? &out[pos] : NULL;
+    size_t avail = (pos < size) ? (size - pos) : 0;
+
+    if (*p != '%') {
+      if (avail > 1) { *dst = *p; }
+      pos++;
+      p++;
+      continue;
+    }
+
+    char spec[ERR_SPEC_MAX_LEN];
+    int spec_len, len_mod;
+    int spec_class = err_spec_parse(p, &spec_len, &len_mod);
+    err_arg_t *arg = &err->defer->args[arg_idx];
+    int len = 0;
+    memcpy(spec, p, spec_len);
+    spec[spec_len] = '\0';
+
+    switch (spec_class) {
+      case ERR_SPEC_PCT:
+        if (avail > 1) { *dst = '%'; }
+        len = 1;
+        break;
+      case ERR_SPEC_INT:
+        if (len_mod == ERR_LEN_L) { len = snprintf(dst, avail, spec, (long)arg->i); }
+        else if (len_mod == ERR_LEN_LL) { len = snprintf(dst, avail, spec, arg->i); }
+        else if (len_mod == ERR_LEN_Z) { len = snprintf(dst, avail, spec, (size_t)arg->i); }
+        else { len = snprintf(dst, avail, spec, (int)arg->i); }
+        break;
+      case ERR_SPEC_UINT:
+        if (len_mod == ERR_LEN_L) { len = snprintf(dst, avail, spec, (unsigned long)arg->u); }
+        else if (len_mod == ERR_LEN_LL) { len = snprintf(dst, avail, spec, arg->u); }
+        else if (len_mod == ERR_LEN_Z) { len = snprintf(dst, avail, spec, (size_t)arg->u); }
+        else { len = snprintf(dst, avail, spec, (unsigned int)arg->u); }
+        break;
+      case ERR_SPEC_CHR:
+        len = snprintf(dst, avail, spec, (int)arg->i);
+        break;
+      case ERR_SPEC_DBL:
+        len = snprintf(dst, avail, spec, arg->d);
+        break;
+      case ERR_SPEC_PTR:
+        len = snprintf(dst, avail, spec, (void *)arg->p);
+        break;
+      case ERR_SPEC_STR:
+        len = snprintf(dst, avail, spec, (arg->p == NULL) ? "(null)" : (const char *)arg->p);
+        break;
+      default:
+        break;
+    }
+    if (spec_class != ERR_SPEC_PCT) { arg_idx++; }
+    if (len > 0) { pos += len; }
+    p += spec_len;
+  }
+
+  if (size > 0) {
+    out[(pos < size) ? pos : (size - 1)] = '\0';
+  }
+  return pos;
+}  /* err_deferred_format */
+
+
+/* Throw counters. Each thread counts into its own table, so counting
+ * needs no lock; a site's code is published last so readers can skip
+ * slots that are still being filled in. Tables are never freed. A table
+ * whose thread exits is kept, counts and all, for the next new thread. */
+typedef struct err_stats_table_s err_stats_table_t;
+struct err_stats_table_s {
+  err_stats_table_t *next;
+  int in_use;  /* Protected by err_stats_lock. */
+  uint64_t num_dropped;  /* Throws from new sites after the table filled. */
+  err_stat_t sites[ERR_STATS_MAX_SITES];
+};
+
+int err_stats_enabled = 0;
+err_stats_table_t *err_stats_tables = NULL;
+pthread_mutex_t err_stats_lock = PTHREAD_MUTEX_INITIALIZER;
+
+
+/* Disposed err objects are kept on a per-thread free list for reuse. */
+typedef struct err_pool_s err_pool_t;
+struct err_pool_s {
+  err_t *free_list;  /* Linked through stacktrace. */
+  int num_free;
+  err_defer_t *defer_free_list;
+  int num_defer_free;
+  err_stats_table_t *stats;  /* NULL until this thread counts a throw. */
+};
+
+pthread_key_t err_pool_key;
+pthread_once_t err_pool_once = PTHREAD_ONCE_INIT;
+
+
+/* Thread exit. */
+void err_pool_destroy(void *arg) {
+  err_pool_t *pool = (err_pool_t *)arg;
+  while (pool->free_list != NULL) {
+    err_t *next_err = pool->free_list->stacktrace;
+    err_mem_free(NULL, pool->free_list);
+    pool->free_list = next_err;
+  }
+  while (pool->defer_free_list != NULL) {
+    err_defer_t *next_defer = pool->defer_free_list->next;
+    err_mem_free(NULL, pool->defer_free_list);
+    pool->defer_free_list = next_defer;
+  }
+  if (pool->stats != NULL) {
+    pthread_mutex_lock(&err_stats_lock);
+    pool->stats->in_use = 0;
+    pthread_mutex_unlock(&err_stats_lock);
+  }
+  err_mem_free(NULL, pool);
+}  /* err_pool_destroy */
+
+
+void err_pool_key_create(void) {
+  pthread_key_create(&err_pool_key, err_pool_destroy);
+}  /* err_pool_key_create */
+
+
+/* Returns NULL if the pool can't be allocated; callers fall back to
+ * err_mem_alloc() and err_mem_free(). */
+err_pool_t *err_pool_get() {
+  pthread_once(&err_pool_once, err_pool_key_create);
+  err_pool_t *pool = (err_pool_t *)pthread_getspecific(err_pool_key);
+  if (pool == NULL) {
+    pool = (err_pool_t *)err_mem_calloc(NULL, 1, sizeof(err_pool_t));
+    if (pool != NULL && pthread_setspecific(err_pool_key, pool) != 0) {
+      err_mem_free(NULL, pool);
+      pool = NULL;
+    }
+  }
+  return pool;
+}  /* err_pool_get */
+
+
+err_t *err_frame_alloc(const char *caller) {
+  err_pool_t *pool = err_pool_get();
+  err_t *err;
+
+  if (pool != NULL && pool->free_list != NULL) {
+    err = pool->free_list;
+    pool->free_list = err->stacktrace;
+    pool->num_free--;
+  } else {
+    err = (err_t *)err_mem_alloc(NULL, sizeof(err_t));
+    if (err == NULL) {
+      fprintf(stderr, "%s: malloc error, aborting.\n", caller);  fflush(stderr);
       abort();
     }
+  }
+
+  err->mesg = NULL;
+  err->stacktrace = NULL;
+  err->defer = NULL;
+  return err;
+}  /* err_frame_alloc */
+
+
+void err_frame_free(err_t *err) {
+  err_pool_t *pool = err_pool_get();
+
+  if (pool != NULL && pool->num_free < ERR_POOL_MAX_FREE) {
+    err->stacktrace = pool->free_list;
+    pool->free_list = err;
+    pool->num_free++;
+  } else {
+    err_mem_free(NULL, err);
+  }
+}  /* err_frame_free */
+
+
+/* Returns NULL if there is no memory; the message is then formatted
+ * immediately. */
+err_defer_t *err_defer_alloc(void) {
+  err_pool_t *pool = err_pool_get();
+  err_defer_t *defer;
+
+  if (pool != NULL && pool->defer_free_list != NULL) {
+    defer = pool->defer_free_list;
+    pool->defer_free_list = defer->next;
+    pool->num_defer_free--;
+  } else {
+    defer = (err_defer_t *)err_mem_alloc(NULL, sizeof(err_defer_t));
+  }
+
+  return defer;
+}  /* err_defer_alloc */
+
+
+void err_defer_free(err_defer_t *defer) {
+  err_pool_t *pool = err_pool_get();
+
+  if (pool != NULL && pool->num_defer_free < ERR_POOL_MAX_FREE) {
+    defer->next = pool->defer_free_list;
+    pool->defer_free_list = defer;
+    pool->num_defer_free++;
   } else {
-    err->mesg = NULL;
+    err_mem_free(NULL, defer);
+  }
+}  /* err_defer_free */
+
+
+ERR_F err_pool_prealloc(int num_frames) {
+  ERR_ASSRT(num_frames >= 0 && num_frames <= ERR_POOL_MAX_FREE, ERR_ERR_PARAM);
+  err_pool_t *pool = err_pool_get();
+  ERR_ASSRT(pool, ERR_ERR_NOMEM);
+
+  while (pool->num_free < num_frames) {
+    err_t *err = (err_t *)err_mem_alloc(NULL, sizeof(err_t));
+    ERR_ASSRT(err, ERR_ERR_NOMEM);
+    err->stacktrace = pool->free_list;
+    pool->free_list = err;
+    pool->num_free++;
+  }
+  while (err_deferred && pool->num_defer_free < num_frames) {
+    err_defer_t *defer = (err_defer_t *)err_mem_alloc(NULL, sizeof(err_defer_t));
+    ERR_ASSRT(defer, ERR_ERR_NOMEM);
+    defer->next = pool->defer_free_list;
+    pool->defer_free_list = defer;
+    pool->num_defer_free++;
+  }
+
+  return ERR_OK;
+}  /* err_pool_prealloc */
+
+
+void err_stats_enable(int enable) {
+  __atomic_store_n(&err_stats_enabled, enable, __ATOMIC_RELAXED);
+}  /* err_stats_enable */
+
+
+/* Returns NULL if there is no memory; the throw just isn't counted. */
+err_stats_table_t *err_stats_table_get() {
+  err_pool_t *pool = err_pool_get();
+  if (pool == NULL) {
+    return NULL;
+  }
+  if (pool->stats == NULL) {
+    err_stats_table_t *table;
+    pthread_mutex_lock(&err_stats_lock);
+    for (table = err_stats_tables; table != NULL; table = table->next) {
+      if (! table->in_use) { break; }
+    }
+    if (table == NULL) {
+      table = (err_stats_table_t *)err_mem_calloc(NULL, 1, sizeof(err_stats_table_t));
+      if (table != NULL) {
+        table->next = err_stats_tables;
+        err_stats_tables = table;
+      }
+    }
+    if (table != NULL) {
+      table->in_use = 1;
+    }
+    pthread_mutex_unlock(&err_stats_lock);
+    pool->stats = table;
+  }
+  return pool->stats;
+}  /* err_stats_table_get */
+
+
+void err_stats_count(char *code, const char *file, int line) {
+  err_stats_table_t *table = err_stats_table_get();
+  if (table == NULL || code == NULL) {
+    return;
+  }
+
+  uint32_t mask = ERR_STATS_MAX_SITES - 1;
+  uint32_t idx = ((uint32_t)((uintptr_t)file >> 3) ^ ((uint32_t)line * 2654435761u)) & mask;
+  uint32_t probes;
+  for (probes = 0; probes < ERR_STATS_MAX_SITES; probes++) {
+    err_stat_t *site = &table->sites[idx];
+    /* Only this thread writes code, so a relaxed load is enough here. */
+    char *site_code = __atomic_load_n(&site->code, __ATOMIC_RELAXED);
+    if (site_code == NULL) {
+      site->file = file;
+      site->line = line;
+      site->count = 1;
+      __atomic_store_n(&site->code, code, __ATOMIC_RELEASE);
+      return;
+    }
+    if (site_code == code && site->line == line && site->file == file) {
+      __atomic_fetch_add(&site->count, 1, __ATOMIC_RELAXED);
+      return;
+    }
+    idx = (idx + 1) & mask;
+  }
+  __atomic_fetch_add(&table->num_dropped, 1, __ATOMIC_RELAXED);
+}  /* err_stats_count */
+
+
+/* Orders by code, then site, so equal sites from different threads are
+ * adjacent. */
+int err_stats_site_cmp(const void *a, const void *b) {
+  const err_stat_t *sa = (const err_stat_t *)a;
+  const err_stat_t *sb = (const err_stat_t *)b;
+  int cmp = strcmp(sa->code, sb->code);
+  if (cmp == 0) { cmp = strcmp(sa->file, sb->file); }
+  if (cmp == 0) { cmp = (sa->line > sb->line) - (sa->line < sb->line); }
+  return cmp;
+}  /* err_stats_site_cmp */
+
+
+int err_stats_count_cmp(const void *a, const void *b) {
+  const err_stat_t *sa = (const err_stat_t *)a;
+  const err_stat_t *sb = (const err_stat_t *)b;
+  if (sa->count != sb->count) { return (sa->count < sb->count) ? 1 : -1; }
+  return err_stats_site_cmp(a, b);
+}  /* err_stats_count_cmp */
+
+
+ERR_F err_stats_snapshot(err_stat_t **rtn_stats, int *rtn_num_stats, uint64_t *rtn_num_dropped) {
+  err_stats_table_t *table;
+  err_stat_t *stats;
+  uint64_t num_dropped = 0;
+  int num_stats = 0;
+  int max_stats = 0;
+  int i;
+
+  ERR_ASSRT(rtn_stats, ERR_ERR_PARAM);
+  ERR_ASSRT(rtn_num_stats, ERR_ERR_PARAM);
+
+  pthread_mutex_lock(&err_stats_lock);
+  for (table = err_stats_tables; table != NULL; table = table->next) {
+    max_stats += ERR_STATS_MAX_SITES;
+  }
+  stats = (err_stat_t *)err_mem_alloc(NULL, (max_stats > 0 ? max_stats : 1) * sizeof(err_stat_t));
+  if (stats == NULL) {
+    pthread_mutex_unlock(&err_stats_lock);
+    ERR_THROW(ERR_ERR_NOMEM, "stats");
+  }
+  for (table = err_stats_tables; table != NULL; table = table->next) {
+    num_dropped += __atomic_load_n(&table->num_dropped, __ATOMIC_RELAXED);
+    for (i = 0; i < ERR_STATS_MAX_SITES; i++) {
+      err_stat_t *site = &table->sites[i];
+      char *code = __atomic_load_n(&site->code, __ATOMIC_ACQUIRE);
+      uint64_t count = __atomic_load_n(&site->count, __ATOMIC_RELAXED);
+      if (code != NULL && count > 0) {
+        stats[num_stats].code = code;
+        stats[num_stats].file = site->file;
+        stats[num_stats].line = site->line;
+        stats[num_stats].count = count;
+        num_stats++;
+      }
+    }
+  }
+  pthread_mutex_unlock(&err_stats_lock);
+
+  /* Merge sites counted by more than one thread. */
+  if (num_stats > 1) {
+    int out = 0;
+    qsort(stats, num_stats, sizeof(err_stat_t), err_stats_site_cmp);
+    for (i = 1; i < num_stats; i++) {
+      if (err_stats_site_cmp(&stats[out], &stats[i]) == 0) {
+        stats[out].count += stats[i].count;
+      } else {
+        stats[++out] = stats[i];
+      }
+    }
+    num_stats = out + 1;
+    qsort(stats, num_stats, sizeof(err_stat_t), err_stats_count_cmp);
+  }
+
+  *rtn_stats = stats;
+  *rtn_num_stats = num_stats;
+  if (rtn_num_dropped) { *rtn_num_dropped = num_dropped; }
+  return ERR_OK;
+}  /* err_stats_snapshot */
+
+
+void err_stats_reset() {
+  err_stats_table_t *table;
+  int i;
+
+  pthread_mutex_lock(&err_stats_lock);
+  for (table = err_stats_tables; table != NULL; table = table->next) {
+    __atomic_store_n(&table->num_dropped, 0, __ATOMIC_RELAXED);
+    for (i = 0; i < ERR_STATS_MAX_SITES; i++) {
+      __atomic_store_n(&table->sites[i].count, 0, __ATOMIC_RELAXED);
+    }
+  }
+  pthread_mutex_unlock(&err_stats_lock);
+}  /* err_stats_reset */
+
+
+/* One line per code, busiest first:
+ *   CODE total file:line=count file:line=count ... */
+void err_stats_dump(FILE *stream) {
+  err_stat_t *stats;
+  int num_stats;
+  uint64_t num_dropped;
+  int i, j;
+
+  err_t *err = err_stats_snapshot(&stats, &num_stats, &num_dropped);
+  if (err) {
+    fprintf(stream, "err_stats: %s\n", err->code);
+    err_dispose(err);
+    return;
+  }
+
+  /* Snapshot is busiest site first; print each code at its busiest site. */
+  for (i = 0; i < num_stats; i++) {
+    if (stats[i].code == NULL) { continue; }  /* Already printed. */
+    char *code = stats[i].code;
+    uint64_t total = 0;
+    for (j = i; j < num_stats; j++) {
+      if (stats[j].code != NULL && strcmp(stats[j].code, code) == 0) { total += stats[j].count; }
+    }
+    fprintf(stream, "%s %llu", code, (unsigned long long)total);
+    for (j = i; j < num_stats; j++) {
+      if (stats[j].code != NULL && strcmp(stats[j].code, code) == 0) {
+        fprintf(stream, " %s:%d=%llu", stats[j].file, stats[j].line, (unsigned long long)stats[j].count);
+        if (j > i) { stats[j].code = NULL; }
+      }
+    }
+    fprintf(stream, "\n");
+  }
+  if (num_dropped > 0) {
+    fprintf(stream, "(dropped) %llu\n", (unsigned long long)num_dropped);
+  }
+  fflush(stream);
+
+  err_mem_free(NULL, stats);
+}  /* err_stats_dump */
+
+
+/* Record the message, deferred if enabled and it fits. */
+void err_set_mesg(err_t *err, const char *caller, const char *format, va_list args) {
+  if (format == NULL) {
+    return;
+  }
+
+  if (err_deferred) {
+    va_list args_copy;
+    va_copy(args_copy, args);
+    int status = err_defer(err, format, args_copy);
+    va_end(args_copy);
+    if (status == 0) {
+      return;
+    }
+  }
+
+  err->mesg = err_vasprintf(format, args);
+  if (err->mesg == NULL) {
+    fprintf(stderr, "%s: message formatting error, aborting.\n", caller);  fflush(stderr);
+    abort();
+  }
+}  /* err_set_mesg */
+
+
+err_t *err_throw_v(const char *file, int line, const char *func, char *code, const char *format, ...) {
+  if (__atomic_load_n(&err_stats_enabled, __ATOMIC_RELAXED)) {
+    err_stats_count(code, file, line);
   }
+  err_t *err = err_frame_alloc("err_throw");
+
+  va_list args;
+  va_start(args, format);
+  err_set_mesg(err, "err_throw", format, args);
+  va_end(args);
 
   err->file = file;
   err->line = line;
@@ -144,26 +837,12 @@ err_t *err_throw_v(const char *file, int line, const char *func, char *code, con
 
 
 err_t *err_rethrow_v(const char *file, int line, const char *func, err_t *in_err, const char *format, ...) {
-  err_t *new_err = NULL;
-  new_err = (err_t *)calloc(1, sizeof(err_t));
-  if (new_err == NULL) {
-    fprintf(stderr, "err_rethrow_v: calloc error, aborting.\n"); fflush(stderr);
-    abort();
-  }
+  err_t *new_err = err_frame_alloc("err_rethrow_v");
 
-  if (format != NULL) {
-    va_list args;
-    va_start(args, format);
-    new_err->mesg = err_vasprintf(format, args);
-    va_end(args);
-
-    if (new_err->mesg == NULL) {
-      fprintf(stderr, "err_rethrow_v: message formatting error, aborting.\n");  fflush(stderr);
-      abort();
-    }
-  } else {
-    new_err->mesg = NULL;
-  }
+  va_list args;
+  va_start(args, format);
+  err_set_mesg(new_err, "err_rethrow_v", format, args);
+  va_end(args);
 
   new_err->file = file;
   new_err->line = line;
@@ -175,11 +854,27 @@ err_t *err_rethrow_v(const char *file, int line, const char *func, err_t *in_err
 }  /* err_throw_v */
 
 
+const char *err_mesg(err_t *err) {
+  if (err->mesg == NULL && err->defer != NULL) {
+    size_t size = err_deferred_format(err, NULL, 0) + 1;
+    err->mesg = (char *)err_mem_alloc(NULL, size);
+    if (err->mesg == NULL) {
+      fprintf(stderr, "err_mesg: malloc error, aborting.\n");  fflush(stderr);
+      abort();
+    }
+    err_deferred_format(err, err->mesg, size);
+  }
+
+  return err->mesg;
+}  /* err_mesg */
+
+
 void err_print(err_t *err, FILE *stream) {
   while (err != NULL) {
+    const char *mesg = err_mesg(err);
     fprintf(stream, "[%s:%d %s()]: Code: %s, Mesg: %s\n",
       err->file, err->line, err->func, err->code,
-      (err->mesg == NULL) ? ("(no mesg)") : (err->mesg));
+      (mesg == NULL) ? ("(no mesg)") : (mesg));
     if (err->stacktrace != NULL) {
       fprintf(stream, "----------------\n");
     }
@@ -194,10 +889,14 @@ void err_dispose(err_t *err) {
   while (err != NULL) {
     err_t *next_err = err->stacktrace;
     if (err->mesg != NULL) {
-      free(err->mesg);
+      err_mem_free(NULL, err->mesg);
       err->mesg = NULL;
     }
-    free(err);
+    if (err->defer != NULL) {
+      err_defer_free(err->defer);
+      err->defer = NULL;
+    }
+    err_frame_free(err);
     err = next_err;
   }
 }  /* err_dispose */
@@ -18,6 +18,7 @@
 #include <string.h>
 #include <stdlib.h>
 #include <stdarg.h>
+#include <stdint.h>
 
 #if defined(__cplusplus)
 extern "C" {
@@ -56,6 +57,18 @@ ERR_CODE(ERR_ERR_BAD_NUMBER);
 /* Applications that return an err_t should be declared with this macro. */
 #define ERR_F __attribute__ ((__warn_unused_result__)) err_t *
 
+
+/* Memory allocator. err, hmap, and cfg allocate only through one of
+ * these; ctx is passed back to every call. */
+typedef struct err_allocator_s err_allocator_t;
+struct err_allocator_s {
+  void *(*alloc)(void *ctx, size_t size);
+  void *(*calloc)(void *ctx, size_t nmemb, size_t size);
+  void *(*realloc)(void *ctx, void *ptr, size_t size);
+  void (*free)(void *ctx, void *ptr);
+  void *ctx;
+};
+
 /* Thanks to Claude.ai for help with variadic macros and functions! */
 
 /* Throwing an error means creating an err object and returning it. */
@@ -129,24 +142,101 @@ ERR_CODE(ERR_ERR_BAD_NUMBER);
 } while (0)
 
 
-/* Internal structure of err object. Application is allowed to peek. */
+/* Limits for deferred formatting (see err_set_deferred()). A message that
+ * doesn't fit is formatted immediately instead. */
+#define ERR_DEFER_MAX_ARGS 8
+#define ERR_DEFER_BUF_SIZE 192  /* Format string plus "%s" arguments. */
+
+/* Per-thread cap on disposed err objects kept for reuse. */
+#define ERR_POOL_MAX_FREE 64
+
+typedef union err_arg_u err_arg_t;
+union err_arg_u {
+  long long i;
+  unsigned long long u;
+  double d;
+  const void *p;
+};
+
+/* A deferred message: the format, then copies of the "%s" args, in buf.
+ * Only allocated while deferral is on; pooled like err objects. */
+typedef struct err_defer_s err_defer_t;
+struct err_defer_s {
+  int num_args;
+  err_arg_t args[ERR_DEFER_MAX_ARGS];
+  char buf[ERR_DEFER_BUF_SIZE];
+  err_defer_t *next;  /* Free list. */
+};
+
+/* Internal structure of err object. Application is allowed to peek,
+ * but should read the message with err_mesg(). */
 typedef struct err_s err_t;  /* Forward def. */
 struct err_s {
   char *code;
   const char *file;
   int line;
   const char *func;
-  char *mesg;  /* Separately malloced. */
+  char *mesg;  /* Separately malloced. NULL until err_mesg() if deferred. */
   err_t *stacktrace;  /* Linked list. */
+  err_defer_t *defer;  /* NULL unless the message was deferred. */
 };
 
 
 /* Print stack trace to an open FILE pointer (like stderr). */
 ERR_API void err_print(err_t *err, FILE *stream);
 
+/* Returns the message, formatting it first if it was deferred. NULL if
+ * there is no message. Valid until the err object is disposed. */
+ERR_API const char *err_mesg(err_t *err);
+
+/* If enabled, throws copy the format and its arguments instead of
+ * formatting the message. Set before starting threads. Default off. */
+ERR_API void err_set_deferred(int enable);
+
+/* Fill the calling thread's pool so the first throws don't allocate. */
+ERR_API ERR_F err_pool_prealloc(int num_frames);
+
+/* Per-thread limit on distinct throw sites counted by err stats. */
+#define ERR_STATS_MAX_SITES 256  /* Power of 2. */
+
+/* Throw count for one code at one site. */
+typedef struct err_stat_s err_stat_t;
+struct err_stat_s {
+  char *code;
+  const char *file;
+  int line;
+  uint64_t count;
+};
+
+/* Count throws (not rethrows) by code and site. Default off. */
+ERR_API void err_stats_enable(int enable);
+
+/* Returns counts merged across threads, busiest first. Caller frees
+ * the array with err_mem_free(NULL, stats). rtn_num_dropped may be NULL. */
+ERR_API ERR_F err_stats_snapshot(err_stat_t **rtn_stats, int *rtn_num_stats, uint64_t *rtn_num_dropped);
+
+ERR_API void err_stats_reset(void);
+
+/* One line per code: "CODE total file:line=count ...". */
+ERR_API void err_stats_dump(FILE *stream);
+
 /* If an error is handled and not re-thrown, the err object must be deleted. */
 ERR_API void err_dispose(err_t *err);
 
+/* Sets the global allocator, used by err itself and by hmaps and cfgs
+ * created without one of their own. NULL restores the C library. Set it
+ * once, before anything is allocated; the allocator must stay valid. */
+ERR_API ERR_F err_set_allocator(const err_allocator_t *allocator);
+ERR_API const err_allocator_t *err_get_allocator(void);
+
+/* Allocate through an allocator; NULL means the global one. Memory from
+ * err_strdup(), err_calloc(), err_asprintf(), and err_vasprintf() comes
+ * from the global allocator and is freed with err_mem_free(NULL, ptr). */
+ERR_API void *err_mem_alloc(const err_allocator_t *allocator, size_t size);
+ERR_API void *err_mem_calloc(const err_allocator_t *allocator, size_t nmemb, size_t size);
+ERR_API void *err_mem_realloc(const err_allocator_t *allocator, void *ptr, size_t size);
+ERR_API void err_mem_free(const err_allocator_t *allocator, void *ptr);
+
 /* Helper function for "sprintf()" style functions that malloc their own buffer. */
 ERR_API char *err_vasprintf(const char *format, va_list args);
 
@@ -6,14 +6,15 @@
 #include "cfg.h"
 
 
-/* These are the configuraiton options defined and their
- * default values for this example program.
+/* These are the configuraiton options defined for this example program:
+ * index, name, type, default value, required, min, max.
  */
-char *valid_cfg_options[] = {
-  "my_max_length = 1024",
-  "my_tag_name=",             /* Default: empty string. */
-  NULL
-};
+#define MY_OPTIONS(X) \
+  X(OPT_MY_MAX_LENGTH, "my_max_length", CFG_TYPE_LONG, "1024", 0, 1, 65536) \
+  X(OPT_MY_TAG_NAME, "my_tag_name", CFG_TYPE_STR, "", 0, 0, 0)  /* Default: empty string. */
+
+enum { MY_OPTIONS(CFG_SCHEMA_ENUM) MY_NUM_OPTIONS };
+cfg_schema_t my_schema[] = { MY_OPTIONS(CFG_SCHEMA_TABLE) };
 
 
 ERR_F cfg_example_app()
@@ -22,17 +23,18 @@ ERR_F cfg_example_app()
   ERR(cfg_create(&cfg));
 
   /* Define valid keys and their default values. */
-  ERR(cfg_parse_string_list(cfg, CFG_MODE_ADD, valid_cfg_options));
+  ERR(cfg_schema_apply(cfg, my_schema, MY_NUM_OPTIONS));
 
   /* Read in config file (probably not a fixed name). */
   ERR(cfg_parse_file(cfg, CFG_MODE_UPDATE, "my_config_file.txt"));
+  ERR(cfg_schema_validate(cfg));
 
   /* Retrieve values. */
   long my_max_length;
-  ERR(cfg_get_long_val(cfg, "my_max_length ", &my_max_length));
+  ERR(cfg_get_idx_long_val(cfg, OPT_MY_MAX_LENGTH, &my_max_length));
 
   char *my_tag_name;
-  ERR(cfg_get_str_val(cfg, "my_tag_name", &my_tag_name));
+  ERR(cfg_get_idx_str_val(cfg, OPT_MY_TAG_NAME, &my_tag_name));
 
   printf("my_max_length=%ld, my_tag_name='%s'", my_max_length, my_tag_name);
   return ERR_OK;
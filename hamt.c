@@ -0,0 +1,390 @@
+/* hamt.c - persistent hash array mapped trie. */
+
+/* This work is dedicated to the public domain under CC0 1.0 Universal:
+ * http://creativecommons.org/publicdomain/zero/1.0/
+ *
+ * To the extent possible under law, Steven Ford has waived all copyright
+ * and related or neighboring rights to this work. In other words, you can
+ * use this code for any purpose without any restrictions.
+ * This work is published from: United States.
+ * Project home: https://github.com/fordsfords/cfg
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include "err.h"
+#include "hmap.h"
+#define HAMT_C
+#include "hamt.h"
+
+/* Each level uses 5 bits of the hash, lowest first; the 7th uses the
+ * last 2. Keys whose whole hashes match share a collision node. */
+#define HAMT_BITS 5
+#define HAMT_MASK 0x1f
+
+#define HAMT_BRANCH 0  /* children[] indexed by bitmap. */
+#define HAMT_LEAF 1  /* Key then value bytes follow the header. */
+#define HAMT_COLLISION 2  /* children[] are leaves with the same hash. */
+
+struct hamt_node_s {
+  int ref_count;  /* Accessed atomically. */
+  int type;
+  uint32_t hash;  /* Leaf and collision. */
+  uint32_t bitmap;  /* Branch. */
+  int num_children;  /* Branch and collision. */
+  size_t key_size;  /* Leaf. */
+  size_t val_size;
+  hamt_node_t *children[];
+};
+
+#define HAMT_LEAF_KEY(hamt__leaf) ((char *)(hamt__leaf)->children)
+#define HAMT_LEAF_VAL(hamt__leaf) (HAMT_LEAF_KEY(hamt__leaf) + (hamt__leaf)->key_size)
+
+
+ERR_F hamt_node_alloc(const err_allocator_t *allocator, int type, int num_children, size_t data_size,
+    hamt_node_t **rtn_node) {
+  hamt_node_t *node;
+
+  node = err_mem_calloc(allocator, 1, sizeof(hamt_node_t) + num_children * sizeof(hamt_node_t *) + data_size);
+  ERR_ASSRT(node, HAMT_ERR_NOMEM);
+  node->ref_count = 1;
+  node->type = type;
+  node->num_children = num_children;
+
+  *rtn_node = node;
+  return ERR_OK;
+}  /* hamt_node_alloc */
+
+
+hamt_node_t *hamt_node_retain(hamt_node_t *node) {
+  __atomic_add_fetch(&node->ref_count, 1, __ATOMIC_RELAXED);
+  return node;
+}  /* hamt_node_retain */
+
+
+void hamt_node_release(const err_allocator_t *allocator, hamt_node_t *node) {
+  int i;
+
+  if (node == NULL || __atomic_sub_fetch(&node->ref_count, 1, __ATOMIC_ACQ_REL) > 0) {
+    return;
+  }
+  if (node->type != HAMT_LEAF) {
+    for (i = 0; i < node->num_children; i++) {
+      hamt_node_release(allocator, node->children[i]);
+    }
+  }
+  err_mem_free(allocator, node);
+}  /* hamt_node_release */
+
+
+int hamt_leaf_is(const hamt_node_t *leaf, const void *key, size_t key_size) {
+  return leaf->key_size == key_size && memcmp(HAMT_LEAF_KEY(leaf), key, key_size) == 0;
+}  /* hamt_leaf_is */
+
+
+/* Find a key's leaf in the subtree at the given level. */
+hamt_node_t *hamt_node_find(hamt_node_t *node, int shift, uint32_t hash, const void *key, size_t key_size) {
+  int i;
+
+  while (node && node->type == HAMT_BRANCH) {
+    uint32_t bit = 1u << ((hash >> shift) & HAMT_MASK);
+    if ((node->bitmap & bit) == 0) {
+      return NULL;
+    }
+    node = node->children[__builtin_popcount(node->bitmap & (bit - 1))];
+    shift += HAMT_BITS;
+  }
+  if (node == NULL || node->hash != hash) {
+    return NULL;
+  }
+  if (node->type == HAMT_LEAF) {
+    return hamt_leaf_is(node, key, key_size) ? node : NULL;
+  }
+  for (i = 0; i < node->num_children; i++) {
+    if (hamt_leaf_is(node->children[i], key, key_size)) {
+      return node->children[i];
+    }
+  }
+  return NULL;
+}  /* hamt_node_find */
+
+
+/* Branch holding two subtrees (leaves or collision nodes) with different
+ * hashes, at the first level where they split. */
+ERR_F hamt_merge(const err_allocator_t *allocator, hamt_node_t *a, hamt_node_t *b, int shift,
+    hamt_node_t **rtn_node) {
+  uint32_t idx_a = (a->hash >> shift) & HAMT_MASK;
+  uint32_t idx_b = (b->hash >> shift) & HAMT_MASK;
+  hamt_node_t *branch = NULL;
+
+  if (idx_a == idx_b) {
+    hamt_node_t *child = NULL;
+    ERR(hamt_merge(allocator, a, b, shift + HAMT_BITS, &child));
+    err_t *err = hamt_node_alloc(allocator, HAMT_BRANCH, 1, 0, &branch);
+    if (err) {
+      hamt_node_release(allocator, child);
+      ERR_RETHROW(err, err->code);
+    }
+    branch->bitmap = 1u << idx_a;
+    branch->children[0] = child;
+  } else {
+    ERR(hamt_node_alloc(allocator, HAMT_BRANCH, 2, 0, &branch));
+    branch->bitmap = (1u << idx_a) | (1u << idx_b);
+    branch->children[idx_a < idx_b ? 0 : 1] = hamt_node_retain(a);
+    branch->children[idx_a < idx_b ? 1 : 0] = hamt_node_retain(b);
+  }
+
+  *rtn_node = branch;
+  return ERR_OK;
+}  /* hamt_merge */
+
+
+/* New subtree: node's contents plus leaf, which replaces any leaf with
+ * the same key. Nothing is modified; the new nodes reference the
+ * unchanged ones. */
+ERR_F hamt_insert(const err_allocator_t *allocator, hamt_node_t *node, int shift, hamt_node_t *leaf,
+    hamt_node_t **rtn_node, int *rtn_added) {
+  hamt_node_t *new_node = NULL;
+  const void *key = HAMT_LEAF_KEY(leaf);
+  int i;
+
+  *rtn_added = 1;
+  if (node == NULL) {
+    *rtn_node = hamt_node_retain(leaf);
+    return ERR_OK;
+  }
+
+  if (node->type == HAMT_LEAF && hamt_leaf_is(node, key, leaf->key_size)) {
+    *rtn_added = 0;
+    *rtn_node = hamt_node_retain(leaf);
+    return ERR_OK;
+  }
+
+  if (node->type != HAMT_BRANCH && node->hash != leaf->hash) {
+    ERR(hamt_merge(allocator, node, leaf, shift, rtn_node));
+    return ERR_OK;
+  }
+
+  if (node->type == HAMT_LEAF) {  /* Same hash, different key. */
+    ERR(hamt_node_alloc(allocator, HAMT_COLLISION, 2, 0, &new_node));
+    new_node->hash = leaf->hash;
+    new_node->children[0] = hamt_node_retain(node);
+    new_node->children[1] = hamt_node_retain(leaf);
+    *rtn_node = new_node;
+    return ERR_OK;
+  }
+
+  if (node->type == HAMT_COLLISION) {
+    int found = -1;
+    for (i = 0; i < node->num_children; i++) {
+      if (hamt_leaf_is(node->children[i], key, leaf->key_size)) {
+        found = i;
+      }
+    }
+    ERR(hamt_node_alloc(allocator, HAMT_COLLISION, node->num_children + (found < 0), 0, &new_node));
+    new_node->hash = node->hash;
+    for (i = 0; i < node->num_children; i++) {
+      new_node->children[i] = hamt_node_retain(i == found ? leaf : node->children[i]);
+    }
+    if (found < 0) {
+      new_node->children[i] = hamt_node_retain(leaf);
+    } else {
+      *rtn_added = 0;
+    }
+    *rtn_node = new_node;
+    return ERR_OK;
+  }
+
+  /* Branch. */
+  uint32_t bit = 1u << ((leaf->hash >> shift) & HAMT_MASK);
+  int pos = __builtin_popcount(node->bitmap & (bit - 1));
+  if (node->bitmap & bit) {
+    hamt_node_t *child = NULL;
+    ERR(hamt_insert(allocator, node->children[pos], shift + HAMT_BITS, leaf, &child, rtn_added));
+    err_t *err = hamt_node_alloc(allocator, HAMT_BRANCH, node->num_children, 0, &new_node);
+    if (err) {
+      hamt_node_release(allocator, child);
+      ERR_RETHROW(err, err->code);
+    }
+    new_node->bitmap = node->bitmap;
+    for (i = 0; i < node->num_children; i++) {
+      new_node->children[i] = (i == pos) ? child : hamt_node_retain(node->children[i]);
+    }
+  } else {
+    ERR(hamt_node_alloc(allocator, HAMT_BRANCH, node->num_children + 1, 0, &new_node));
+    new_node->bitmap = node->bitmap | bit;
+    for (i = 0; i < pos; i++) {
+      new_node->children[i] = hamt_node_retain(node->children[i]);
+    }
+    new_node->children[pos] = hamt_node_retain(leaf);
+    for (i = pos; i < node->num_children; i++) {
+      new_node->children[i + 1] = hamt_node_retain(node->children[i]);
+    }
+  }
+
+  *rtn_node = new_node;
+  return ERR_OK;
+}  /* hamt_insert */
+
+
+ERR_F hamt_create(hamt_t **rtn_hamt, const err_allocator_t *allocator) {
+  hamt_t *hamt;
+
+  ERR_ASSRT(rtn_hamt, HAMT_ERR_PARAM);
+  if (allocator == NULL) {
+    allocator = err_get_allocator();
+  }
+  hamt = err_mem_calloc(allocator, 1, sizeof(hamt_t));
+  ERR_ASSRT(hamt, HAMT_ERR_NOMEM);
+  hamt->allocator = allocator;
+
+  *rtn_hamt = hamt;
+  return ERR_OK;
+}  /* hamt_create */
+
+
+ERR_F hamt_copy(hamt_t **rtn_copy, const hamt_t *hamt) {
+  hamt_t *copy = NULL;
+
+  ERR_ASSRT(hamt, HAMT_ERR_PARAM);
+  ERR(hamt_create(&copy, hamt->allocator));
+  copy->root = hamt->root ? hamt_node_retain(hamt->root) : NULL;
+  copy->num_entries = hamt->num_entries;
+
+  *rtn_copy = copy;
+  return ERR_OK;
+}  /* hamt_copy */
+
+
+ERR_F hamt_delete(hamt_t *hamt) {
+  ERR_ASSRT(hamt, HAMT_ERR_PARAM);
+
+  hamt_node_release(hamt->allocator, hamt->root);
+  err_mem_free(hamt->allocator, hamt);
+
+  return ERR_OK;
+}  /* hamt_delete */
+
+
+ERR_F hamt_write(hamt_t *hamt, const void *key, size_t key_size, const void *val, size_t val_size) {
+  hamt_node_t *leaf = NULL;
+  hamt_node_t *new_root = NULL;
+  int added;
+  err_t *err;
+
+  ERR_ASSRT(hamt, HAMT_ERR_PARAM);
+  ERR_ASSRT(key, HAMT_ERR_PARAM);
+  ERR_ASSRT(val || val_size == 0, HAMT_ERR_PARAM);
+
+  ERR(hamt_node_alloc(hamt->allocator, HAMT_LEAF, 0, key_size + val_size, &leaf));
+  leaf->hash = hmap_murmur3_32(key, key_size, HMAP_SEED);
+  leaf->key_size = key_size;
+  leaf->val_size = val_size;
+  memcpy(HAMT_LEAF_KEY(leaf), key, key_size);
+  if (val_size > 0) {
+    memcpy(HAMT_LEAF_VAL(leaf), val, val_size);
+  }
+
+  err = hamt_insert(hamt->allocator, hamt->root, 0, leaf, &new_root, &added);
+  hamt_node_release(hamt->allocator, leaf);  /* The tree has its own reference. */
+  if (err) {
+    ERR_RETHROW(err, err->code);
+  }
+  hamt_node_release(hamt->allocator, hamt->root);
+  hamt->root = new_root;
+  hamt->num_entries += added;
+
+  return ERR_OK;
+}  /* hamt_write */
+
+
+int hamt_try_lookup(const hamt_t *hamt, const void *key, size_t key_size, const void **rtn_val, size_t *rtn_val_size) {
+  hamt_node_t *leaf = hamt_node_find(hamt->root, 0, hmap_murmur3_32(key, key_size, HMAP_SEED), key, key_size);
+
+  if (leaf == NULL) {
+    return 0;
+  }
+  if (rtn_val) { *rtn_val = HAMT_LEAF_VAL(leaf); }
+  if (rtn_val_size) { *rtn_val_size = leaf->val_size; }
+  return 1;
+}  /* hamt_try_lookup */
+
+
+/* Report the leaves under node that are missing from, or (if is_from)
+ * differ in, the other version's subtree "other" (which is at level
+ * "shift"). */
+ERR_F hamt_diff_side(hamt_node_t *node, hamt_node_t *other, int shift, int is_from, hamt_diff_cb_t cb, void *clientd) {
+  int i;
+
+  if (node == NULL) {
+    return ERR_OK;
+  }
+  if (node->type != HAMT_LEAF) {
+    for (i = 0; i < node->num_children; i++) {
+      ERR(hamt_diff_side(node->children[i], other, shift, is_from, cb, clientd));
+    }
+    return ERR_OK;
+  }
+
+  const char *key = HAMT_LEAF_KEY(node);
+  hamt_node_t *other_leaf = hamt_node_find(other, shift, node->hash, key, node->key_size);
+  if (other_leaf == NULL) {
+    if (is_from) {
+      ERR(cb(clientd, key, node->key_size, HAMT_LEAF_VAL(node), node->val_size, NULL, 0));
+    } else {
+      ERR(cb(clientd, key, node->key_size, NULL, 0, HAMT_LEAF_VAL(node), node->val_size));
+    }
+  } else if (is_from && other_leaf != node &&
+      (other_leaf->val_size != node->val_size ||
+       memcmp(HAMT_LEAF_VAL(other_leaf), HAMT_LEAF_VAL(node), node->val_size) != 0)) {
+    ERR(cb(clientd, key, node->key_size, HAMT_LEAF_VAL(node), node->val_size,
+      HAMT_LEAF_VAL(other_leaf), other_leaf->val_size));
+  }
+
+  return ERR_OK;
+}  /* hamt_diff_side */
+
+
+ERR_F hamt_diff_node(hamt_node_t *from, hamt_node_t *to, int shift, hamt_diff_cb_t cb, void *clientd) {
+  uint32_t bits;
+
+  if (from == to) {  /* Shared. */
+    return ERR_OK;
+  }
+
+  if (from && to && from->type == HAMT_BRANCH && to->type == HAMT_BRANCH) {
+    bits = from->bitmap | to->bitmap;
+    while (bits) {
+      uint32_t bit = bits & (~bits + 1);
+      hamt_node_t *from_child = NULL;
+      hamt_node_t *to_child = NULL;
+      if (from->bitmap & bit) {
+        from_child = from->children[__builtin_popcount(from->bitmap & (bit - 1))];
+      }
+      if (to->bitmap & bit) {
+        to_child = to->children[__builtin_popcount(to->bitmap & (bit - 1))];
+      }
+      ERR(hamt_diff_node(from_child, to_child, shift + HAMT_BITS, cb, clientd));
+      bits &= bits - 1;
+    }
+    return ERR_OK;
+  }
+
+  /* Different shapes, so at least one side is small: compare by key. */
+  ERR(hamt_diff_side(from, to, shift, 1, cb, clientd));
+  ERR(hamt_diff_side(to, from, shift, 0, cb, clientd));
+
+  return ERR_OK;
+}  /* hamt_diff_node */
+
+
+ERR_F hamt_diff(const hamt_t *from, const hamt_t *to, hamt_diff_cb_t cb, void *clientd) {
+  ERR_ASSRT(from, HAMT_ERR_PARAM);
+  ERR_ASSRT(to, HAMT_ERR_PARAM);
+  ERR_ASSRT(cb, HAMT_ERR_PARAM);
+
+  ERR(hamt_diff_node(from->root, to->root, 0, cb, clientd));
+
+  return ERR_OK;
+}  /* hamt_diff */
@@ -0,0 +1,81 @@
+/* hamt.h - persistent hash array mapped trie. */
+
+/* This work is dedicated to the public domain under CC0 1.0 Universal:
+ * http://creativecommons.org/publicdomain/zero/1.0/
+ *
+ * To the extent possible under law, Steven Ford has waived all copyright
+ * and related or neighboring rights to this work. In other words, you can
+ * use this code for any purpose without any restrictions.
+ * This work is published from: United States.
+ * Project home: https://github.com/fordsfords/cfg
+ */
+
+#ifndef HAMT_H
+#define HAMT_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stddef.h>
+#include <stdint.h>
+#include "err.h"
+
+typedef struct hamt_node_s hamt_node_t;  /* Defined in hamt.c. */
+
+/* One version of a map from keys to values (both copied bytes). A write
+ * makes a new version that shares all unchanged nodes with the old one,
+ * so hamt_copy() is O(1) and each version costs only what changed.
+ * Nodes are reference counted; versions may be used and deleted from
+ * different threads, but each hamt_t by one thread at a time. */
+typedef struct hamt_s hamt_t;
+struct hamt_s {
+  hamt_node_t *root;  /* NULL when empty. */
+  int num_entries;
+  const err_allocator_t *allocator;
+};
+
+/* Called for each key whose value differs; old_val or new_val is NULL
+ * if the key is only in one version. */
+typedef err_t *(*hamt_diff_cb_t)(void *clientd, const void *key, size_t key_size,
+  const void *old_val, size_t old_val_size, const void *new_val, size_t new_val_size);
+
+
+#ifdef HAMT_C
+#  define ERR_CODE(err__code) ERR_API char *err__code = #err__code
+#else
+#  define ERR_CODE(err__code) ERR_API extern char *err__code
+#endif
+
+ERR_CODE(HAMT_ERR_PARAM);
+ERR_CODE(HAMT_ERR_NOMEM);
+
+#undef ERR_CODE
+
+
+/* Empty map. A NULL allocator means the global one. */
+ERR_F hamt_create(hamt_t **rtn_hamt, const err_allocator_t *allocator);
+
+/* Another handle to the same version; later writes to either don't
+ * affect the other. */
+ERR_F hamt_copy(hamt_t **rtn_copy, const hamt_t *hamt);
+
+ERR_F hamt_delete(hamt_t *hamt);
+
+/* Add or replace; hamt moves to the new version. Keys are hashed with
+ * hmap_murmur3_32(key, key_size, HMAP_SEED). */
+ERR_F hamt_write(hamt_t *hamt, const void *key, size_t key_size, const void *val, size_t val_size);
+
+/* Returns 1 if found, 0 if not. The value stays valid while any version
+ * that contains it exists. */
+int hamt_try_lookup(const hamt_t *hamt, const void *key, size_t key_size, const void **rtn_val, size_t *rtn_val_size);
+
+/* Keys added, changed, or missing in "to" relative to "from". Subtrees
+ * the two versions share are skipped, so the cost follows the changes. */
+ERR_F hamt_diff(const hamt_t *from, const hamt_t *to, hamt_diff_cb_t cb, void *clientd);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif  /* HAMT_H */
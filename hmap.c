@@ -10,13 +10,21 @@
  * Project home: https://github.com/fordsfords/hmap
  */
 
+#define _POSIX_C_SOURCE 200809L  /* For sysconf(). */
 #include <stdlib.h>
 #include <string.h>
 #include <stdint.h>
+#include <unistd.h>
+#include <pthread.h>
 #include "err.h"
 #define HMAP_C
 #include "hmap.h"
 
+/* hmap_bulk_build() doesn't start a thread for fewer keys than this. */
+#define HMAP_BULK_MIN_PER_THREAD 16384
+#define HMAP_BULK_MAX_THREADS 64
+#define HMAP_BULK_PARTS_PER_THREAD 8
+
 
 /* Murmur3 32-bit hash function. */
 uint32_t hmap_murmur3_32(const void *key, size_t key_len, uint32_t seed) {
@@ -69,56 +77,191 @@ uint32_t hmap_murmur3_32(const void *key, size_t key_len, uint32_t seed) {
 
 
 ERR_F hmap_create(hmap_t **rtn_hmap, size_t table_size) {
+  ERR(hmap_create_ex(rtn_hmap, table_size, NULL));
+
+  return ERR_OK;
+}  /* hmap_create */
+
+
+/* A NULL allocator means the global one at the time of the call. */
+ERR_F hmap_create_ex(hmap_t **rtn_hmap, size_t table_size, const err_allocator_t *allocator) {
   ERR_ASSRT(rtn_hmap, HMAP_ERR_PARAM);
   ERR_ASSRT(table_size > 0, HMAP_ERR_PARAM);
 
-  hmap_t *hmap = calloc(1, sizeof(hmap_t));
+  if (allocator == NULL) {
+    allocator = err_get_allocator();
+  }
+  hmap_t *hmap = err_mem_calloc(allocator, 1, sizeof(hmap_t));
   ERR_ASSRT(hmap, HMAP_ERR_NOMEM);
 
+  (hmap)->allocator = allocator;
   (hmap)->table_size = table_size;
-  (hmap)->seed = 42;  /* Could be made an input parameter. */
+  (hmap)->seed = HMAP_SEED;
   (hmap)->num_entries = 0;
-  (hmap)->table = calloc(table_size, sizeof(hmap_entry_t*));
-  if (!(hmap)->table) {
-    free(hmap);
-    ERR_THROW(HMAP_ERR_NOMEM, "hmap->table");
-  }
+  (hmap)->table = NULL;  /* Allocated by the first write. */
 
   *rtn_hmap = hmap;
   return ERR_OK;
-}  /* hmap_create */
+}  /* hmap_create_ex */
 
 
 ERR_F hmap_delete(hmap_t *hmap) {
   uint32_t bucket;
+  uintptr_t slab_lo = (uintptr_t)hmap->slab;
+  uintptr_t slab_hi = slab_lo + hmap->slab_size;
+
+  /* The application is responsible for freeing the values. */
+  for (bucket = 0; hmap->small_entries && bucket < (uint32_t)hmap->num_entries; bucket++) {
+    if (! (hmap->flags & HMAP_FLAG_NOCOPY_KEYS)) {
+      err_mem_free(hmap->allocator, hmap->small_entries[bucket]->key);
+    }
+    err_mem_free(hmap->allocator, hmap->small_entries[bucket]);
+  }
 
   /* Step to each bucket and delete the list of entries. */
-  for (bucket = 0; bucket < hmap->table_size; bucket++) {
+  for (bucket = 0; hmap->table && bucket < hmap->table_size; bucket++) {
     hmap_entry_t *entry = hmap->table[bucket];
     while (entry) {
       hmap_entry_t *next = entry->next;
-      /* The application is responsible for freeing the value. */
-      free(entry->key);
-      free(entry);
+      /* Bulk-built entries and their keys go with the slab. */
+      if ((uintptr_t)entry < slab_lo || (uintptr_t)entry >= slab_hi) {
+        if (! (hmap->flags & HMAP_FLAG_NOCOPY_KEYS)) {
+          err_mem_free(hmap->allocator, entry->key);
+        }
+        err_mem_free(hmap->allocator, entry);
+      }
       entry = next;
     }
   }
 
-  free(hmap);
+  err_mem_free(hmap->allocator, hmap->small_entries);
+  err_mem_free(hmap->allocator, hmap->small_tags);
+  err_mem_free(hmap->allocator, hmap->slab);
+  err_mem_free(hmap->allocator, hmap->table);
+  err_mem_free(hmap->allocator, hmap);
   return ERR_OK;
 }  /* hmap_delete */
 
 
+ERR_F hmap_set_flags(hmap_t *hmap, unsigned int flags) {
+  ERR_ASSRT(hmap, HMAP_ERR_PARAM);
+  ERR_ASSRT(hmap->num_entries == 0, HMAP_ERR_PARAM);
+
+  hmap->flags = flags;
+  return ERR_OK;
+}  /* hmap_set_flags */
+
+
+/* Cheap stand-in for a hash in small mode: the first and last 4 bytes
+ * of the key, which tell apart most keys with a common prefix. */
+uint64_t hmap_small_tag(const void *key, size_t key_size) {
+  uint32_t head = 0;
+  uint32_t tail = 0;
+  size_t len = (key_size < 4) ? key_size : 4;
+
+  memcpy(&head, key, len);
+  memcpy(&tail, (const char *)key + key_size - len, len);
+  return ((uint64_t)tail << 32) | head;
+}  /* hmap_small_tag */
+
+
+/* Small mode lookup; returns the index, or -1. */
+int hmap_small_find(hmap_t *hmap, const void *key, size_t key_size) {
+  uint64_t tag = hmap_small_tag(key, key_size);
+  uint32_t matches = 0;
+  int i;
+
+  /* Branch-free so the compiler can vectorize it. */
+  for (i = 0; i < hmap->num_entries; i++) {
+    matches |= (uint32_t)(hmap->small_tags[i] == tag) << i;
+  }
+  while (matches) {
+    i = __builtin_ctz(matches);
+    hmap_entry_t *entry = hmap->small_entries[i];
+    if (key_size == entry->key_size && (entry->key == key || memcmp(entry->key, key, key_size) == 0)) {
+      return i;
+    }
+    matches &= matches - 1;
+  }
+
+  return -1;
+}  /* hmap_small_find */
+
+
+/* Leave small mode (or start with no entries): allocate the table and
+ * move any entries into it. */
+ERR_F hmap_table_alloc(hmap_t *hmap) {
+  int i;
+
+  hmap->table = err_mem_calloc(hmap->allocator, hmap->table_size, sizeof(hmap_entry_t*));
+  ERR_ASSRT(hmap->table, HMAP_ERR_NOMEM);
+
+  for (i = 0; hmap->small_entries && i < hmap->num_entries; i++) {
+    hmap_entry_t *entry = hmap->small_entries[i];
+    entry->bucket = hmap_murmur3_32(entry->key, entry->key_size, hmap->seed) % hmap->table_size;
+    entry->next = hmap->table[entry->bucket];
+    hmap->table[entry->bucket] = entry;
+  }
+  err_mem_free(hmap->allocator, hmap->small_entries);
+  err_mem_free(hmap->allocator, hmap->small_tags);
+  hmap->small_entries = NULL;
+  hmap->small_tags = NULL;
+  hmap->small_cap = 0;
+
+  return ERR_OK;
+}  /* hmap_table_alloc */
+
+
+/* Make room for one more entry in small mode. Starts at 4 and doubles,
+ * so a map with a few keys costs a few dozen bytes. */
+ERR_F hmap_small_grow(hmap_t *hmap) {
+  int new_cap = (hmap->small_cap == 0) ? 4 : hmap->small_cap * 2;
+  hmap_entry_t **new_entries;
+  uint64_t *new_tags;
+
+  new_entries = err_mem_realloc(hmap->allocator, hmap->small_entries, new_cap * sizeof(hmap_entry_t *));
+  ERR_ASSRT(new_entries, HMAP_ERR_NOMEM);
+  hmap->small_entries = new_entries;
+  new_tags = err_mem_realloc(hmap->allocator, hmap->small_tags, new_cap * sizeof(uint64_t));
+  ERR_ASSRT(new_tags, HMAP_ERR_NOMEM);
+  hmap->small_tags = new_tags;
+  hmap->small_cap = new_cap;
+
+  return ERR_OK;
+}  /* hmap_small_grow */
+
+
 ERR_F hmap_write(hmap_t *hmap, const void *key, size_t key_size, void *val) {
+  uint32_t bucket = 0;
+  int small = 0;
+
   ERR_ASSRT(hmap, HMAP_ERR_PARAM);
   ERR_ASSRT(key, HMAP_ERR_PARAM);
 
-  uint32_t bucket = hmap_murmur3_32(key, key_size, hmap->seed) % hmap->table_size;
+  if (hmap->table == NULL && (hmap->flags & HMAP_FLAG_SMALL)) {
+    int i = hmap_small_find(hmap, key, key_size);
+    if (i >= 0) {
+      hmap->small_entries[i]->value = val;
+      return ERR_OK;
+    }
+    if (hmap->num_entries < HMAP_SMALL_MAX) {
+      if (hmap->num_entries == hmap->small_cap) {
+        ERR(hmap_small_grow(hmap));
+      }
+      small = 1;
+    }
+  }
+  if (! small) {
+    if (hmap->table == NULL) {
+      ERR(hmap_table_alloc(hmap));
+    }
+    bucket = hmap_murmur3_32(key, key_size, hmap->seed) % hmap->table_size;
+  }
 
   /* Search linked list.  */
-  hmap_entry_t *entry = hmap->table[bucket];
+  hmap_entry_t *entry = small ? NULL : hmap->table[bucket];
   while (entry) {
-    if (key_size == entry->key_size && memcmp(entry->key, key, key_size) == 0) {
+    if (key_size == entry->key_size && (entry->key == key || memcmp(entry->key, key, key_size) == 0)) {
       entry->value = val;
       return ERR_OK;
     }
@@ -126,42 +269,67 @@ ERR_F hmap_write(hmap_t *hmap, const void *key, size_t key_size, void *val) {
   }
 
   /* Not found, create new entry. */
-  hmap_entry_t *new_entry = calloc(1, sizeof(hmap_entry_t));
+  hmap_entry_t *new_entry = err_mem_calloc(hmap->allocator, 1, sizeof(hmap_entry_t));
   ERR_ASSRT(new_entry, HMAP_ERR_NOMEM);
 
-  new_entry->key = malloc(key_size);
-  if (!new_entry->key) {
-    free(new_entry);
-    ERR_THROW(HMAP_ERR_NOMEM, "new_entry->key");
+  if (hmap->flags & HMAP_FLAG_NOCOPY_KEYS) {
+    new_entry->key = (void *)key;
+  } else {
+    new_entry->key = err_mem_alloc(hmap->allocator, key_size);
+    if (!new_entry->key) {
+      err_mem_free(hmap->allocator, new_entry);
+      ERR_THROW(HMAP_ERR_NOMEM, "new_entry->key");
+    }
+    memcpy(new_entry->key, key, key_size);
   }
-  memcpy(new_entry->key, key, key_size);
   new_entry->key_size = key_size;
   new_entry->value = val;
-  new_entry->bucket = bucket;
 
-  /* Insert at head of list for this bucket */
-  new_entry->next = hmap->table[bucket];
-  hmap->table[bucket] = new_entry;
+  if (small) {  /* Append; bucket is the index. */
+    new_entry->bucket = (uint32_t)hmap->num_entries;
+    hmap->small_entries[hmap->num_entries] = new_entry;
+    hmap->small_tags[hmap->num_entries] = hmap_small_tag(key, key_size);
+  } else {
+    new_entry->bucket = bucket;
+    /* Insert at head of list for this bucket */
+    new_entry->next = hmap->table[bucket];
+    hmap->table[bucket] = new_entry;
+  }
   hmap->num_entries ++;
 
   return ERR_OK;
 }  /* hmap_write */
 
 
-ERR_F hmap_lookup(hmap_t *hmap, const void *key, size_t key_size, void **rtn_val) {
-  ERR_ASSRT(hmap, HMAP_ERR_PARAM);
-  ERR_ASSRT(key, HMAP_ERR_PARAM);
+/* Returns 1 if found, 0 if not. Never allocates, so expected misses
+ * are cheap. */
+int hmap_try_lookup(hmap_t *hmap, const void *key, size_t key_size, void **rtn_val) {
+  if (hmap->table == NULL) {  /* Small or empty; no need to hash. */
+    return hmap_try_lookup_hashed(hmap, 0, key, key_size, rtn_val);
+  }
+  return hmap_try_lookup_hashed(hmap, hmap_murmur3_32(key, key_size, hmap->seed), key, key_size, rtn_val);
+}  /* hmap_try_lookup */
 
-  uint32_t bucket = hmap_murmur3_32(key, key_size, hmap->seed) % hmap->table_size;
+
+int hmap_try_lookup_hashed(hmap_t *hmap, uint32_t hash, const void *key, size_t key_size, void **rtn_val) {
+  hmap_entry_t *entry = NULL;
+
+  if (hmap->table) {
+    entry = hmap->table[hash % hmap->table_size];
+  } else if (hmap->small_entries) {
+    int i = hmap_small_find(hmap, key, key_size);
+    if (i >= 0) {
+      entry = hmap->small_entries[i];
+    }
+  }
 
   /* Search linked list */
-  hmap_entry_t *entry = hmap->table[bucket];
   while (entry) {
-    if (key_size == entry->key_size && memcmp(entry->key, key, key_size) == 0) {
+    if (key_size == entry->key_size && (entry->key == key || memcmp(entry->key, key, key_size) == 0)) {
       if (rtn_val) {
         *rtn_val = entry->value;
       }
-      return ERR_OK;
+      return 1;
     }
     entry = entry->next;
   }
@@ -169,7 +337,19 @@ ERR_F hmap_lookup(hmap_t *hmap, const void *key, size_t key_size, void **rtn_val
   if (rtn_val) {
     *rtn_val = NULL;
   }
-  ERR_THROW(HMAP_ERR_NOTFOUND, "key not found");
+  return 0;
+}  /* hmap_try_lookup_hashed */
+
+
+ERR_F hmap_lookup(hmap_t *hmap, const void *key, size_t key_size, void **rtn_val) {
+  ERR_ASSRT(hmap, HMAP_ERR_PARAM);
+  ERR_ASSRT(key, HMAP_ERR_PARAM);
+
+  if (! hmap_try_lookup(hmap, key, key_size, rtn_val)) {
+    ERR_THROW(HMAP_ERR_NOTFOUND, "key not found");
+  }
+
+  return ERR_OK;
 }  /* hmap_lookup */
 
 
@@ -182,6 +362,265 @@ ERR_F hmap_swrite(hmap_t *hmap, const char *skey, void *val) {
 }  /* hmap_swrite */
 
 
+/* Bulk build state. Each partition is a contiguous range of buckets,
+ * so one thread can build its chains without locking. */
+typedef struct hmap_bulk_s hmap_bulk_t;
+struct hmap_bulk_s {
+  hmap_t *hmap;
+  const void *const *keys;
+  const size_t *key_sizes;
+  void *const *vals;
+  int num_keys;
+  int num_threads;
+  int num_parts;
+  int phase;  /* HMAP_BULK_PHASE_* */
+  uint32_t *buckets;  /* Per key. */
+  int *order;  /* Key indexes grouped by partition, in input order. */
+  size_t *counts;  /* [thread * num_parts + part]: keys, then positions in order. */
+  size_t *key_bytes;  /* Same, for key bytes. */
+  size_t *part_starts;  /* [part]: first position in order and entries. */
+  size_t *part_key_starts;  /* [part]: first byte in key_mem. */
+  int *part_num_entries;  /* [part]: distinct keys. */
+  hmap_entry_t *entries;
+  char *key_mem;
+};
+
+typedef struct hmap_bulk_worker_s hmap_bulk_worker_t;
+struct hmap_bulk_worker_s {
+  hmap_bulk_t *bulk;
+  int thread;
+};
+
+#define HMAP_BULK_PHASE_COUNT 0  /* Hash; count keys per partition. */
+#define HMAP_BULK_PHASE_SCATTER 1  /* Group key indexes by partition. */
+#define HMAP_BULK_PHASE_CHAIN 2  /* Build each partition's chains. */
+
+
+void hmap_bulk_work(hmap_bulk_t *bulk, int thread) {
+  hmap_t *hmap = bulk->hmap;
+  size_t *counts = &bulk->counts[thread * bulk->num_parts];
+  size_t *key_bytes = &bulk->key_bytes[thread * bulk->num_parts];
+  int lo = (int)((int64_t)bulk->num_keys * thread / bulk->num_threads);
+  int hi = (int)((int64_t)bulk->num_keys * (thread + 1) / bulk->num_threads);
+  int i;
+
+  if (bulk->phase == HMAP_BULK_PHASE_COUNT) {
+    for (i = lo; i < hi; i++) {
+      uint32_t bucket = hmap_murmur3_32(bulk->keys[i], bulk->key_sizes[i], hmap->seed) % hmap->table_size;
+      int part = (int)((uint64_t)bucket * bulk->num_parts / hmap->table_size);
+      bulk->buckets[i] = bucket;
+      counts[part]++;
+      key_bytes[part] += bulk->key_sizes[i];
+    }
+  }
+
+  else if (bulk->phase == HMAP_BULK_PHASE_SCATTER) {
+    for (i = lo; i < hi; i++) {
+      int part = (int)((uint64_t)bulk->buckets[i] * bulk->num_parts / hmap->table_size);
+      bulk->order[counts[part]++] = i;
+    }
+  }
+
+  else {  /* HMAP_BULK_PHASE_CHAIN */
+    int part;
+    for (part = thread; part < bulk->num_parts; part += bulk->num_threads) {
+      hmap_entry_t *new_entry = &bulk->entries[bulk->part_starts[part]];
+      char *new_key = bulk->key_mem ? &bulk->key_mem[bulk->part_key_starts[part]] : NULL;
+      size_t pos;
+      int num_entries = 0;
+
+      /* In input order, so a later duplicate's value wins. */
+      for (pos = bulk->part_starts[part]; pos < bulk->part_starts[part + 1]; pos++) {
+        i = bulk->order[pos];
+        const void *key = bulk->keys[i];
+        size_t key_size = bulk->key_sizes[i];
+        uint32_t bucket = bulk->buckets[i];
+        hmap_entry_t *entry = hmap->table[bucket];
+        while (entry) {
+          if (key_size == entry->key_size && (entry->key == key || memcmp(entry->key, key, key_size) == 0)) {
+            break;
+          }
+          entry = entry->next;
+        }
+        if (entry) {
+          entry->value = bulk->vals[i];
+          continue;
+        }
+
+        if (hmap->flags & HMAP_FLAG_NOCOPY_KEYS) {
+          new_entry->key = (void *)key;
+        } else {
+          memcpy(new_key, key, key_size);
+          new_entry->key = new_key;
+          new_key += key_size;
+        }
+        new_entry->key_size = key_size;
+        new_entry->value = bulk->vals[i];
+        new_entry->bucket = bucket;
+        new_entry->next = hmap->table[bucket];
+        hmap->table[bucket] = new_entry;
+        new_entry++;
+        num_entries++;
+      }
+      bulk->part_num_entries[part] = num_entries;
+    }
+  }
+}  /* hmap_bulk_work */
+
+
+void *hmap_bulk_thread(void *arg) {
+  hmap_bulk_worker_t *worker = (hmap_bulk_worker_t *)arg;
+
+  hmap_bulk_work(worker->bulk, worker->thread);
+  return NULL;
+}  /* hmap_bulk_thread */
+
+
+/* Run a phase on every thread. The caller does thread 0's share; if a
+ * thread can't be started, the caller does its share too. */
+void hmap_bulk_run(hmap_bulk_t *bulk, int phase) {
+  pthread_t threads[HMAP_BULK_MAX_THREADS];
+  hmap_bulk_worker_t workers[HMAP_BULK_MAX_THREADS];
+  int started[HMAP_BULK_MAX_THREADS];
+  int thread;
+
+  bulk->phase = phase;
+  for (thread = 1; thread < bulk->num_threads; thread++) {
+    workers[thread].bulk = bulk;
+    workers[thread].thread = thread;
+    started[thread] = (pthread_create(&threads[thread], NULL, hmap_bulk_thread, &workers[thread]) == 0);
+  }
+  hmap_bulk_work(bulk, 0);
+  for (thread = 1; thread < bulk->num_threads; thread++) {
+    if (started[thread]) {
+      pthread_join(threads[thread], NULL);
+    } else {
+      hmap_bulk_work(bulk, thread);
+    }
+  }
+}  /* hmap_bulk_run */
+
+
+ERR_F hmap_bulk_build(hmap_t *hmap, const void *const *keys, const size_t *key_sizes, void *const *vals,
+    int num_keys, int num_threads) {
+  hmap_bulk_t bulk;
+  size_t *sizes = NULL;
+  size_t num_counts;
+  size_t pos, key_pos;
+  int part, thread, i;
+
+  ERR_ASSRT(hmap, HMAP_ERR_PARAM);
+  ERR_ASSRT(hmap->num_entries == 0 && hmap->slab == NULL, HMAP_ERR_PARAM);
+  ERR_ASSRT(num_keys >= 0, HMAP_ERR_PARAM);
+  ERR_ASSRT(num_threads >= 0, HMAP_ERR_PARAM);
+  if (num_keys == 0) {
+    return ERR_OK;
+  }
+  ERR_ASSRT(keys && vals, HMAP_ERR_PARAM);
+  if (hmap->table == NULL) {  /* Too big for small mode. */
+    ERR(hmap_table_alloc(hmap));
+  }
+
+  if (num_threads == 0) {
+    long num_cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    num_threads = (num_cpus > 0) ? (int)num_cpus : 1;
+  }
+  if (num_threads > num_keys / HMAP_BULK_MIN_PER_THREAD) {
+    num_threads = num_keys / HMAP_BULK_MIN_PER_THREAD;
+  }
+  if (num_threads > HMAP_BULK_MAX_THREADS) {
+    num_threads = HMAP_BULK_MAX_THREADS;
+  }
+  if (num_threads < 1) {
+    num_threads = 1;
+  }
+
+  memset(&bulk, 0, sizeof(bulk));
+  bulk.hmap = hmap;
+  bulk.keys = keys;
+  bulk.vals = vals;
+  bulk.num_keys = num_keys;
+  bulk.num_threads = num_threads;
+  bulk.num_parts = num_threads * HMAP_BULK_PARTS_PER_THREAD;
+  if ((size_t)bulk.num_parts > hmap->table_size) {
+    bulk.num_parts = (int)hmap->table_size;
+  }
+  num_counts = (size_t)num_threads * bulk.num_parts;
+
+  if (key_sizes == NULL) {
+    sizes = err_mem_alloc(hmap->allocator, num_keys * sizeof(size_t));
+    if (sizes) {
+      for (i = 0; i < num_keys; i++) {
+        sizes[i] = strlen((const char *)keys[i]) + 1;
+      }
+    }
+    key_sizes = sizes;
+  }
+  bulk.key_sizes = key_sizes;
+  bulk.buckets = err_mem_alloc(hmap->allocator, num_keys * sizeof(uint32_t));
+  bulk.order = err_mem_alloc(hmap->allocator, num_keys * sizeof(int));
+  bulk.counts = err_mem_calloc(hmap->allocator, num_counts, sizeof(size_t));
+  bulk.key_bytes = err_mem_calloc(hmap->allocator, num_counts, sizeof(size_t));
+  bulk.part_starts = err_mem_alloc(hmap->allocator, (bulk.num_parts + 1) * sizeof(size_t));
+  bulk.part_key_starts = err_mem_alloc(hmap->allocator, (bulk.num_parts + 1) * sizeof(size_t));
+  bulk.part_num_entries = err_mem_alloc(hmap->allocator, bulk.num_parts * sizeof(int));
+  if (key_sizes && bulk.buckets && bulk.order && bulk.counts && bulk.key_bytes &&
+      bulk.part_starts && bulk.part_key_starts && bulk.part_num_entries) {
+    hmap_bulk_run(&bulk, HMAP_BULK_PHASE_COUNT);
+
+    /* Turn counts into start positions, partition by partition. */
+    pos = 0;
+    key_pos = 0;
+    for (part = 0; part < bulk.num_parts; part++) {
+      bulk.part_starts[part] = pos;
+      bulk.part_key_starts[part] = key_pos;
+      for (thread = 0; thread < num_threads; thread++) {
+        size_t count = bulk.counts[thread * bulk.num_parts + part];
+        size_t bytes = bulk.key_bytes[thread * bulk.num_parts + part];
+        bulk.counts[thread * bulk.num_parts + part] = pos;
+        bulk.key_bytes[thread * bulk.num_parts + part] = key_pos;
+        pos += count;
+        key_pos += bytes;
+      }
+    }
+    bulk.part_starts[bulk.num_parts] = pos;
+    bulk.part_key_starts[bulk.num_parts] = key_pos;
+    if (hmap->flags & HMAP_FLAG_NOCOPY_KEYS) {
+      key_pos = 0;
+    }
+
+    hmap->slab_size = num_keys * sizeof(hmap_entry_t) + key_pos;
+    hmap->slab = err_mem_alloc(hmap->allocator, hmap->slab_size);
+  }
+
+  if (hmap->slab) {
+    bulk.entries = (hmap_entry_t *)hmap->slab;
+    if (! (hmap->flags & HMAP_FLAG_NOCOPY_KEYS)) {
+      bulk.key_mem = hmap->slab + num_keys * sizeof(hmap_entry_t);
+    }
+    hmap_bulk_run(&bulk, HMAP_BULK_PHASE_SCATTER);
+    hmap_bulk_run(&bulk, HMAP_BULK_PHASE_CHAIN);
+    for (part = 0; part < bulk.num_parts; part++) {
+      hmap->num_entries += bulk.part_num_entries[part];
+    }
+  } else {
+    hmap->slab_size = 0;
+  }
+
+  err_mem_free(hmap->allocator, sizes);
+  err_mem_free(hmap->allocator, bulk.buckets);
+  err_mem_free(hmap->allocator, bulk.order);
+  err_mem_free(hmap->allocator, bulk.counts);
+  err_mem_free(hmap->allocator, bulk.key_bytes);
+  err_mem_free(hmap->allocator, bulk.part_starts);
+  err_mem_free(hmap->allocator, bulk.part_key_starts);
+  err_mem_free(hmap->allocator, bulk.part_num_entries);
+  ERR_ASSRT(hmap->slab, HMAP_ERR_NOMEM);
+
+  return ERR_OK;
+}  /* hmap_bulk_build */
+
+
 ERR_F hmap_slookup(hmap_t *hmap, const char *skey, void **rtn_val) {
   ERR_ASSRT(hmap, HMAP_ERR_PARAM);
   ERR_ASSRT(skey, HMAP_ERR_PARAM);
@@ -191,12 +630,69 @@ ERR_F hmap_slookup(hmap_t *hmap, const char *skey, void **rtn_val) {
 }  /* hmap_slookup */
 
 
+int hmap_try_slookup(hmap_t *hmap, const char *skey, void **rtn_val) {
+  return hmap_try_lookup(hmap, skey, strlen(skey)+1, rtn_val);
+}  /* hmap_try_slookup */
+
+
+int hmap_try_remove(hmap_t *hmap, const void *key, size_t key_size) {
+  hmap_entry_t *entry;
+
+  if (hmap->table == NULL) {  /* Small or empty. */
+    int i = (hmap->small_entries == NULL) ? -1 : hmap_small_find(hmap, key, key_size);
+    if (i < 0) {
+      return 0;
+    }
+    entry = hmap->small_entries[i];
+    /* Keep insertion order; an entry's bucket is its index. */
+    for (; i + 1 < hmap->num_entries; i++) {
+      hmap->small_entries[i] = hmap->small_entries[i + 1];
+      hmap->small_tags[i] = hmap->small_tags[i + 1];
+      hmap->small_entries[i]->bucket = (uint32_t)i;
+    }
+  } else {
+    hmap_entry_t **link = &hmap->table[hmap_murmur3_32(key, key_size, hmap->seed) % hmap->table_size];
+    while (*link && ! (key_size == (*link)->key_size && memcmp((*link)->key, key, key_size) == 0)) {
+      link = &(*link)->next;
+    }
+    if (*link == NULL) {
+      return 0;
+    }
+    entry = *link;
+    *link = entry->next;
+  }
+  hmap->num_entries--;
+
+  /* Bulk-built entries and their keys go with the slab. */
+  uintptr_t slab_lo = (uintptr_t)hmap->slab;
+  if ((uintptr_t)entry < slab_lo || (uintptr_t)entry >= slab_lo + hmap->slab_size) {
+    if (! (hmap->flags & HMAP_FLAG_NOCOPY_KEYS)) {
+      err_mem_free(hmap->allocator, entry->key);
+    }
+    err_mem_free(hmap->allocator, entry);
+  }
+
+  return 1;
+}  /* hmap_try_remove */
+
+
+int hmap_try_sremove(hmap_t *hmap, const char *skey) {
+  return hmap_try_remove(hmap, skey, strlen(skey)+1);
+}  /* hmap_try_sremove */
+
+
 ERR_F hmap_next(hmap_t *hmap, hmap_entry_t **in_entry) {
   uint32_t bucket;
   hmap_entry_t *next_entry;
 
   ERR_ASSRT(hmap, HMAP_ERR_PARAM);
 
+  if (hmap->table == NULL) {  /* Small or empty. */
+    int i = (*in_entry == NULL) ? 0 : (int)(*in_entry)->bucket + 1;
+    *in_entry = (i < hmap->num_entries) ? hmap->small_entries[i] : NULL;
+    return ERR_OK;
+  }
+
   if (*in_entry == NULL) {
     /* If in_entry is NULL, user want's first entry in table. */
     bucket = 0;
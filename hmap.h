@@ -34,10 +34,34 @@ typedef struct hmap_s hmap_t;
 struct hmap_s {
     size_t table_size;
     uint32_t seed;
-    hmap_entry_t **table;
+    hmap_entry_t **table;  /* NULL until the first entry goes in it. */
     int num_entries;
+    unsigned int flags;  /* HMAP_FLAG_* */
+    const err_allocator_t *allocator;
+    char *slab;  /* Entries and keys from hmap_bulk_build(), if any. */
+    size_t slab_size;
+    /* HMAP_FLAG_SMALL, before the table exists: entries in insertion
+     * order, and a tag of each key (see hmap_small_tag()). */
+    hmap_entry_t **small_entries;
+    uint64_t *small_tags;
+    int small_cap;
 };
 
+/* Seed used by every hmap; hashes computed ahead of time for
+ * hmap_try_lookup_hashed() must use it. */
+#define HMAP_SEED 42
+
+/* Keys are canonical pointers (e.g. from intern_get()) owned by the
+ * caller; they are stored as given instead of copied, and must stay
+ * valid until hmap_delete(). */
+#define HMAP_FLAG_NOCOPY_KEYS 0x1
+
+/* Keep up to HMAP_SMALL_MAX entries in a packed array, searched without
+ * hashing, and only allocate the table when the map outgrows it. For
+ * maps that are usually tiny. */
+#define HMAP_FLAG_SMALL 0x2
+#define HMAP_SMALL_MAX 16
+
 
 #ifdef HMAP_C
 #  define ERR_CODE(err__code) ERR_API char *err__code = #err__code
@@ -56,16 +80,46 @@ uint32_t hmap_murmur3_32(const void *key, size_t len, uint32_t seed);
 
 ERR_F hmap_create(hmap_t **rtn_hmap, size_t table_size);
 
+ERR_F hmap_create_ex(hmap_t **rtn_hmap, size_t table_size, const err_allocator_t *allocator);
+
 ERR_F hmap_delete(hmap_t *hmap);
 
+/* Only allowed while the map is empty. */
+ERR_F hmap_set_flags(hmap_t *hmap, unsigned int flags);
+
 ERR_F hmap_write(hmap_t *hmap, const void *key, size_t key_size, void *val);
 
 ERR_F hmap_lookup(hmap_t *hmap, const void *key, size_t key_size, void **rtn_val);
 
 ERR_F hmap_swrite(hmap_t *hmap, const char *key, void *val);
 
+/* Fill an empty map with num_keys entries at once, like calling
+ * hmap_write() for each in order (a repeated key keeps its last value).
+ * Hashing and chain building are split across num_threads threads
+ * (0 for one per online CPU), and entries and keys go in one block.
+ * key_sizes may be NULL for null-terminated string keys. */
+ERR_F hmap_bulk_build(hmap_t *hmap, const void *const *keys, const size_t *key_sizes, void *const *vals,
+  int num_keys, int num_threads);
+
+/* Like hmap_lookup()/hmap_slookup(), but return 1 if found, 0 if not,
+ * instead of throwing HMAP_ERR_NOTFOUND. No parameter checking. */
+int hmap_try_lookup(hmap_t *hmap, const void *key, size_t key_size, void **rtn_val);
+
+int hmap_try_slookup(hmap_t *hmap, const char *key, void **rtn_val);
+
+/* Like hmap_try_lookup(), with hash already computed by the caller as
+ * hmap_murmur3_32(key, key_size, HMAP_SEED). */
+int hmap_try_lookup_hashed(hmap_t *hmap, uint32_t hash, const void *key, size_t key_size, void **rtn_val);
+
 ERR_F hmap_slookup(hmap_t *hmap, const char *key, void **rtn_val);
 
+/* Take a key out of the map. Return 1 if it was there, 0 if not. Never
+ * allocates, so it can undo a write on an error path. The value is the
+ * caller's to free. */
+int hmap_try_remove(hmap_t *hmap, const void *key, size_t key_size);
+
+int hmap_try_sremove(hmap_t *hmap, const char *key);
+
 ERR_F hmap_next(hmap_t *hmap, hmap_entry_t **in_entry);
 
 #ifdef __cplusplus
@@ -0,0 +1,167 @@
+/* intern.c - shared, thread-safe string interning pool. */
+
+/* This work is dedicated to the public domain under CC0 1.0 Universal:
+ * http://creativecommons.org/publicdomain/zero/1.0/
+ *
+ * To the extent possible under law, Steven Ford has waived all copyright
+ * and related or neighboring rights to this work. In other words, you can
+ * use this code for any purpose without any restrictions.
+ * This work is published from: United States.
+ * Project home: https://github.com/fordsfords/cfg
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <pthread.h>
+#include "err.h"
+#include "hmap.h"
+#define INTERN_C
+#include "intern.h"
+
+
+ERR_F intern_create(intern_pool_t **rtn_pool, size_t table_size) {
+  ERR_ASSRT(rtn_pool, INTERN_ERR_PARAM);
+  ERR_ASSRT(table_size > 0, INTERN_ERR_PARAM);
+
+  intern_pool_t *pool = err_mem_calloc(NULL, 1, sizeof(intern_pool_t));
+  ERR_ASSRT(pool, INTERN_ERR_NOMEM);
+
+  pool->table_size = table_size;
+  pool->table = err_mem_calloc(NULL, table_size, sizeof(intern_entry_t *));
+  if (! pool->table) {
+    err_mem_free(NULL, pool);
+    ERR_THROW(INTERN_ERR_NOMEM, "pool->table");
+  }
+  pthread_mutex_init(&pool->lock, NULL);
+
+  *rtn_pool = pool;
+  return ERR_OK;
+}  /* intern_create */
+
+
+ERR_F intern_delete(intern_pool_t *pool) {
+  size_t bucket;
+
+  ERR_ASSRT(pool, INTERN_ERR_PARAM);
+
+  for (bucket = 0; bucket < pool->table_size; bucket++) {
+    intern_entry_t *entry = pool->table[bucket];
+    while (entry) {
+      intern_entry_t *next = entry->next;
+      err_mem_free(NULL, entry);
+      entry = next;
+    }
+  }
+
+  pthread_mutex_destroy(&pool->lock);
+  err_mem_free(NULL, pool->table);
+  err_mem_free(NULL, pool);
+  return ERR_OK;
+}  /* intern_delete */
+
+
+/* Double the table. Called with the lock held. If memory is short, the
+ * pool keeps working with longer chains. */
+void intern_grow(intern_pool_t *pool) {
+  size_t new_size = pool->table_size * 2;
+  intern_entry_t **new_table = err_mem_calloc(NULL, new_size, sizeof(intern_entry_t *));
+  size_t bucket;
+
+  if (new_table == NULL) {
+    return;
+  }
+  for (bucket = 0; bucket < pool->table_size; bucket++) {
+    intern_entry_t *entry = pool->table[bucket];
+    while (entry) {
+      intern_entry_t *next = entry->next;
+      size_t new_bucket = entry->hash % new_size;
+      entry->next = new_table[new_bucket];
+      new_table[new_bucket] = entry;
+      entry = next;
+    }
+  }
+  err_mem_free(NULL, pool->table);
+  pool->table = new_table;
+  pool->table_size = new_size;
+}  /* intern_grow */
+
+
+ERR_F intern_get(intern_pool_t *pool, const char *str, char **rtn_str) {
+  ERR_ASSRT(pool, INTERN_ERR_PARAM);
+  ERR_ASSRT(str, INTERN_ERR_PARAM);
+  ERR_ASSRT(rtn_str, INTERN_ERR_PARAM);
+
+  size_t len = strlen(str);
+  uint32_t hash = hmap_murmur3_32(str, len, HMAP_SEED);
+
+  pthread_mutex_lock(&pool->lock);
+  intern_entry_t *entry = pool->table[hash % pool->table_size];
+  while (entry) {
+    if (entry->hash == hash && entry->len == len && memcmp(entry->str, str, len) == 0) {
+      entry->ref_count++;
+      pthread_mutex_unlock(&pool->lock);
+      *rtn_str = entry->str;
+      return ERR_OK;
+    }
+    entry = entry->next;
+  }
+
+  entry = err_mem_alloc(NULL, sizeof(intern_entry_t) + len + 1);
+  if (entry == NULL) {
+    pthread_mutex_unlock(&pool->lock);
+    ERR_THROW(INTERN_ERR_NOMEM, "entry");
+  }
+  entry->hash = hash;
+  entry->ref_count = 1;
+  entry->len = len;
+  memcpy(entry->str, str, len + 1);
+
+  if (pool->num_entries >= pool->table_size * 2) {
+    intern_grow(pool);
+  }
+  size_t bucket = hash % pool->table_size;
+  entry->next = pool->table[bucket];
+  pool->table[bucket] = entry;
+  pool->num_entries++;
+  pool->num_bytes += len + 1;
+  pthread_mutex_unlock(&pool->lock);
+
+  *rtn_str = entry->str;
+  return ERR_OK;
+}  /* intern_get */
+
+
+void intern_release(intern_pool_t *pool, char *str) {
+  if (str == NULL) {
+    return;
+  }
+  intern_entry_t *entry = (intern_entry_t *)(str - offsetof(intern_entry_t, str));
+
+  pthread_mutex_lock(&pool->lock);
+  entry->ref_count--;
+  if (entry->ref_count == 0) {
+    intern_entry_t **link = &pool->table[entry->hash % pool->table_size];
+    while (*link != entry) {
+      link = &(*link)->next;
+    }
+    *link = entry->next;
+    pool->num_entries--;
+    pool->num_bytes -= entry->len + 1;
+    err_mem_free(NULL, entry);
+  }
+  pthread_mutex_unlock(&pool->lock);
+}  /* intern_release */
+
+
+ERR_F intern_stats(intern_pool_t *pool, size_t *rtn_num_strs, size_t *rtn_num_bytes) {
+  ERR_ASSRT(pool, INTERN_ERR_PARAM);
+
+  pthread_mutex_lock(&pool->lock);
+  if (rtn_num_strs) { *rtn_num_strs = pool->num_entries; }
+  if (rtn_num_bytes) { *rtn_num_bytes = pool->num_bytes; }
+  pthread_mutex_unlock(&pool->lock);
+
+  return ERR_OK;
+}  /* intern_stats */
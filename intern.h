@@ -0,0 +1,76 @@
+/* intern.h - shared, thread-safe string interning pool. */
+
+/* This work is dedicated to the public domain under CC0 1.0 Universal:
+ * http://creativecommons.org/publicdomain/zero/1.0/
+ *
+ * To the extent possible under law, Steven Ford has waived all copyright
+ * and related or neighboring rights to this work. In other words, you can
+ * use this code for any purpose without any restrictions.
+ * This work is published from: United States.
+ * Project home: https://github.com/fordsfords/cfg
+ */
+
+#ifndef INTERN_H
+#define INTERN_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdint.h>
+#include <pthread.h>
+#include "err.h"
+
+/* One canonical string. The string itself follows the header, so the
+ * canonical pointer leads back to its entry. */
+typedef struct intern_entry_s intern_entry_t;  /* Forward definition. */
+struct intern_entry_s {
+  intern_entry_t *next;
+  uint32_t hash;
+  int ref_count;
+  size_t len;
+  char str[];
+};
+
+typedef struct intern_pool_s intern_pool_t;
+struct intern_pool_s {
+  pthread_mutex_t lock;
+  intern_entry_t **table;
+  size_t table_size;  /* Doubled when entries outnumber buckets 2 to 1. */
+  size_t num_entries;
+  size_t num_bytes;  /* Sum of string lengths, including nulls. */
+};
+
+
+#ifdef INTERN_C
+#  define ERR_CODE(err__code) ERR_API char *err__code = #err__code
+#else
+#  define ERR_CODE(err__code) ERR_API extern char *err__code
+#endif
+
+ERR_CODE(INTERN_ERR_PARAM);
+ERR_CODE(INTERN_ERR_NOMEM);
+
+#undef ERR_CODE
+
+
+ERR_F intern_create(intern_pool_t **rtn_pool, size_t table_size);
+
+/* Frees all strings, whether or not they are still referenced. */
+ERR_F intern_delete(intern_pool_t *pool);
+
+/* Returns the canonical copy of str, adding a reference. Equal strings
+ * always get the same pointer. The caller must not modify it. */
+ERR_F intern_get(intern_pool_t *pool, const char *str, char **rtn_str);
+
+/* Drops a reference from intern_get(); the string is freed with its last
+ * reference. Like free(), NULL is ignored. */
+void intern_release(intern_pool_t *pool, char *str);
+
+ERR_F intern_stats(intern_pool_t *pool, size_t *rtn_num_strs, size_t *rtn_num_bytes);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif  /* INTERN_H */
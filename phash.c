@@ -0,0 +1,206 @@
+/* phash.c - minimal perfect hash of a fixed set of string keys. */
+
+/* This work is dedicated to the public domain under CC0 1.0 Universal:
+ * http://creativecommons.org/publicdomain/zero/1.0/
+ *
+ * To the extent possible under law, Steven Ford has waived all copyright
+ * and related or neighboring rights to this work. In other words, you can
+ * use this code for any purpose without any restrictions.
+ * This work is published from: United States.
+ * Project home: https://github.com/fordsfords/cfg
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include "err.h"
+#define PHASH_C
+#include "phash.h"
+
+/* Seeds tried per bucket before giving up. The table is at most 80%
+ * full, so a bucket normally needs a handful. */
+#define PHASH_MAX_SEED 0x1000000
+
+
+/* FNV-1a, then a finalizer so the high and low halves are independent.
+ * Unlike hmap_murmur3_32(), every byte of the key counts, which the
+ * seed search depends on. */
+uint64_t phash_hash64(const void *key, size_t key_size) {
+  const uint8_t *data = (const uint8_t *)key;
+  uint64_t hash = 0xcbf29ce484222325ULL;
+  size_t i;
+
+  for (i = 0; i < key_size; i++) {
+    hash ^= data[i];
+    hash *= 0x100000001b3ULL;
+  }
+  hash ^= hash >> 33;
+  hash *= 0xc4ceb9fe1a85ec53ULL;
+  hash ^= hash >> 33;
+
+  return hash;
+}  /* phash_hash64 */
+
+
+uint32_t phash_slot(uint64_t hash, uint32_t seed, uint32_t table_size) {
+  uint64_t x = hash ^ (seed * 0x9e3779b97f4a7c15ULL);
+  x ^= x >> 33;
+  x *= 0xff51afd7ed558ccdULL;
+  x ^= x >> 33;
+
+  return (uint32_t)x & (table_size - 1);
+}  /* phash_slot */
+
+
+uint32_t phash_bucket(uint64_t hash, uint32_t num_buckets) {
+  return (uint32_t)(hash >> 32) & (num_buckets - 1);
+}  /* phash_bucket */
+
+
+/* Find a seed that puts every key of one bucket in a free slot, and
+ * fill those slots. */
+ERR_F phash_place(phash_t *phash, const char **slot_keys, uint32_t *seeds, uint32_t bucket,
+    const char *const *keys, const uint64_t *hashes, const int *members, int num_members, uint32_t *slots) {
+  uint32_t seed;
+  int i, j;
+
+  /* No seed separates keys whose whole hashes match. */
+  for (i = 0; i < num_members; i++) {
+    for (j = 0; j < i; j++) {
+      if (hashes[members[i]] == hashes[members[j]]) {
+        ERR_THROW(PHASH_ERR_BUILD, "keys '%s' and '%s' have the same hash", keys[members[j]], keys[members[i]]);
+      }
+    }
+  }
+
+  for (seed = 1; seed < PHASH_MAX_SEED; seed++) {
+    for (i = 0; i < num_members; i++) {
+      slots[i] = phash_slot(hashes[members[i]], seed, phash->table_size);
+      if (slot_keys[slots[i]] != NULL) {
+        break;
+      }
+      for (j = 0; j < i && slots[j] != slots[i]; j++) {
+      }
+      if (j < i) {
+        break;
+      }
+    }
+    if (i == num_members) {
+      for (i = 0; i < num_members; i++) {
+        slot_keys[slots[i]] = keys[members[i]];
+      }
+      seeds[bucket] = seed;
+      return ERR_OK;
+    }
+  }
+
+  ERR_THROW(PHASH_ERR_BUILD, "no seed for bucket of '%s'", keys[members[0]]);
+}  /* phash_place */
+
+
+ERR_F phash_build(phash_t **rtn_phash, const char *const *keys, int num_keys, const err_allocator_t *allocator) {
+  uint32_t table_size = 1;
+  uint32_t num_buckets = 1;
+  phash_t *phash;
+  uint64_t *hashes = NULL;
+  int *starts = NULL;  /* Per bucket, into members; num_buckets + 1. */
+  int *members = NULL;  /* Key indexes grouped by bucket. */
+  uint32_t *slots = NULL;
+  int max_members = 0;
+  err_t *err = ERR_OK;
+  int i, size;
+  uint32_t b;
+
+  ERR_ASSRT(rtn_phash, PHASH_ERR_PARAM);
+  ERR_ASSRT(keys || num_keys == 0, PHASH_ERR_PARAM);
+  ERR_ASSRT(num_keys >= 0 && num_keys < 0x10000000, PHASH_ERR_PARAM);
+
+  while (table_size < (uint32_t)num_keys + (uint32_t)num_keys / 4) {
+    table_size *= 2;
+  }
+  while (num_buckets * 2 < (uint32_t)num_keys) {
+    num_buckets *= 2;
+  }
+
+  /* The phash, then slot keys, then seeds, in one block. */
+  size_t keys_off = sizeof(phash_t);
+  size_t seeds_off = keys_off + table_size * sizeof(char *);
+  phash = (phash_t *)err_mem_calloc(allocator, 1, seeds_off + num_buckets * sizeof(uint32_t));
+  ERR_ASSRT(phash, PHASH_ERR_NOMEM);
+  const char **slot_keys = (const char **)((char *)phash + keys_off);
+  uint32_t *seeds = (uint32_t *)((char *)phash + seeds_off);
+  phash->table_size = table_size;
+  phash->num_buckets = num_buckets;
+  phash->seeds = seeds;
+  phash->keys = slot_keys;
+
+  hashes = (uint64_t *)err_mem_calloc(allocator, num_keys + 1, sizeof(uint64_t));
+  starts = (int *)err_mem_calloc(allocator, num_buckets + 1, sizeof(int));
+  members = (int *)err_mem_calloc(allocator, num_keys + 1, sizeof(int));
+  slots = (uint32_t *)err_mem_calloc(allocator, num_keys + 1, sizeof(uint32_t));
+  if (hashes == NULL || starts == NULL || members == NULL || slots == NULL) {
+    err = err_throw_v(__FILE__, __LINE__, __func__, PHASH_ERR_NOMEM, "%d keys", num_keys);
+  }
+
+  if (err == ERR_OK) {
+    /* Group the keys by bucket (counting sort). slots[] is the fill
+     * cursor per bucket until placement needs it. */
+    for (i = 0; i < num_keys; i++) {
+      hashes[i] = phash_hash64(keys[i], strlen(keys[i]) + 1);
+      starts[phash_bucket(hashes[i], num_buckets) + 1]++;
+    }
+    for (b = 0; b < num_buckets; b++) {
+      if (starts[b + 1] > max_members) {
+        max_members = starts[b + 1];
+      }
+      starts[b + 1] += starts[b];
+    }
+    for (i = 0; i < num_keys; i++) {
+      b = phash_bucket(hashes[i], num_buckets);
+      members[starts[b] + slots[b]++] = i;
+    }
+  }
+
+  /* Biggest buckets first, while there are the most free slots. */
+  for (size = max_members; size > 0 && err == ERR_OK; size--) {
+    for (b = 0; b < num_buckets && err == ERR_OK; b++) {
+      if (starts[b + 1] - starts[b] == size) {
+        err = phash_place(phash, slot_keys, seeds, b, keys, hashes, &members[starts[b]], size, slots);
+      }
+    }
+  }
+
+  err_mem_free(allocator, hashes);
+  err_mem_free(allocator, starts);
+  err_mem_free(allocator, members);
+  err_mem_free(allocator, slots);
+  if (err) {
+    err_mem_free(allocator, phash);
+    ERR_RETHROW(err, err->code);
+  }
+
+  *rtn_phash = phash;
+  return ERR_OK;
+}  /* phash_build */
+
+
+ERR_F phash_delete(phash_t *phash, const err_allocator_t *allocator) {
+  ERR_ASSRT(phash, PHASH_ERR_PARAM);
+
+  err_mem_free(allocator, phash);
+
+  return ERR_OK;
+}  /* phash_delete */
+
+
+int phash_find(const phash_t *phash, const char *key, size_t key_size) {
+  uint64_t hash = phash_hash64(key, key_size);
+  uint32_t seed = phash->seeds[phash_bucket(hash, phash->num_buckets)];
+  uint32_t slot = phash_slot(hash, seed, phash->table_size);
+  const char *slot_key = phash->keys[slot];
+
+  if (slot_key == NULL || strcmp(slot_key, key) != 0) {
+    return -1;
+  }
+  return (int)slot;
+}  /* phash_find */
@@ -0,0 +1,70 @@
+/* phash.h - minimal perfect hash of a fixed set of string keys. */
+
+/* This work is dedicated to the public domain under CC0 1.0 Universal:
+ * http://creativecommons.org/publicdomain/zero/1.0/
+ *
+ * To the extent possible under law, Steven Ford has waived all copyright
+ * and related or neighboring rights to this work. In other words, you can
+ * use this code for any purpose without any restrictions.
+ * This work is published from: United States.
+ * Project home: https://github.com/fordsfords/cfg
+ */
+
+#ifndef PHASH_H
+#define PHASH_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stddef.h>
+#include <stdint.h>
+#include "err.h"
+
+/* Hash and displace: a key's first hash picks a bucket, and the bucket's
+ * seed picks the key's slot with a second hash. phash_build() chooses
+ * the seeds so that no two keys share a slot. Lookups take one pass over
+ * the key and one compare, with no chains.
+ * All fields are plain arrays, so cfg_compile can emit a phash_t as
+ * const data. */
+typedef struct phash_s phash_t;
+struct phash_s {
+  uint32_t table_size;  /* Slots; a power of 2. */
+  uint32_t num_buckets;  /* A power of 2. */
+  const uint32_t *seeds;  /* Per bucket. */
+  const char *const *keys;  /* Per slot; NULL if empty. */
+};
+
+
+#ifdef PHASH_C
+#  define ERR_CODE(err__code) ERR_API char *err__code = #err__code
+#else
+#  define ERR_CODE(err__code) ERR_API extern char *err__code
+#endif
+
+ERR_CODE(PHASH_ERR_PARAM);
+ERR_CODE(PHASH_ERR_NOMEM);
+ERR_CODE(PHASH_ERR_BUILD);
+
+#undef ERR_CODE
+
+
+/* 64-bit hash of all key_size bytes. */
+uint64_t phash_hash64(const void *key, size_t key_size);
+
+/* Keys must be distinct null-terminated strings that outlive the
+ * phash. One allocation; free with phash_delete(). A NULL allocator
+ * means the global one. */
+ERR_F phash_build(phash_t **rtn_phash, const char *const *keys, int num_keys, const err_allocator_t *allocator);
+
+ERR_F phash_delete(phash_t *phash, const err_allocator_t *allocator);
+
+/* Slot of key, or -1 if it isn't one of the keys. key_size includes
+ * the null. */
+int phash_find(const phash_t *phash, const char *key, size_t key_size);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif  /* PHASH_H */
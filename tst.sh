@@ -58,3 +58,172 @@ if [ "$SINGLE_T" -eq 0 -o "$SINGLE_T" -eq "$T" ]; then :
   $B -t $T 2>&1 | tee -a $B.$T.log;  ST=${PIPESTATUS[0]}; ASSRT "$ST -eq 0"
   OK
 fi
+
+T=5
+if [ "$SINGLE_T" -eq 0 -o "$SINGLE_T" -eq "$T" ]; then :
+  TEST
+  $B -t $T 2>&1 | tee -a $B.$T.log;  ST=${PIPESTATUS[0]}; ASSRT "$ST -eq 0"
+  OK
+fi
+
+T=6
+if [ "$SINGLE_T" -eq 0 -o "$SINGLE_T" -eq "$T" ]; then :
+  TEST
+  $B -t $T 2>&1 | tee -a $B.$T.log;  ST=${PIPESTATUS[0]}; ASSRT "$ST -eq 0"
+  OK
+fi
+
+T=7
+if [ "$SINGLE_T" -eq 0 -o "$SINGLE_T" -eq "$T" ]; then :
+  TEST
+  $B -t $T 2>&1 | tee -a $B.$T.log;  ST=${PIPESTATUS[0]}; ASSRT "$ST -eq 0"
+  OK
+fi
+
+T=8
+if [ "$SINGLE_T" -eq 0 -o "$SINGLE_T" -eq "$T" ]; then :
+  TEST
+  $B -t $T 2>&1 | tee -a $B.$T.log;  ST=${PIPESTATUS[0]}; ASSRT "$ST -eq 0"
+  OK
+fi
+
+T=9
+if [ "$SINGLE_T" -eq 0 -o "$SINGLE_T" -eq "$T" ]; then :
+  TEST
+  $B -t $T 2>&1 | tee -a $B.$T.log;  ST=${PIPESTATUS[0]}; ASSRT "$ST -eq 0"
+  OK
+fi
+
+T=10
+if [ "$SINGLE_T" -eq 0 -o "$SINGLE_T" -eq "$T" ]; then :
+  TEST
+  $B -t $T 2>&1 | tee -a $B.$T.log;  ST=${PIPESTATUS[0]}; ASSRT "$ST -eq 0"
+  OK
+fi
+
+T=11
+if [ "$SINGLE_T" -eq 0 -o "$SINGLE_T" -eq "$T" ]; then :
+  TEST
+  $B -t $T 2>&1 | tee -a $B.$T.log;  ST=${PIPESTATUS[0]}; ASSRT "$ST -eq 0"
+  OK
+fi
+
+T=12
+if [ "$SINGLE_T" -eq 0 -o "$SINGLE_T" -eq "$T" ]; then :
+  TEST
+  $B -t $T 2>&1 | tee -a $B.$T.log;  ST=${PIPESTATUS[0]}; ASSRT "$ST -eq 0"
+  OK
+fi
+
+T=13
+if [ "$SINGLE_T" -eq 0 -o "$SINGLE_T" -eq "$T" ]; then :
+  TEST
+  $B -t $T 2>&1 | tee -a $B.$T.log;  ST=${PIPESTATUS[0]}; ASSRT "$ST -eq 0"
+  OK
+fi
+
+T=14
+if [ "$SINGLE_T" -eq 0 -o "$SINGLE_T" -eq "$T" ]; then :
+  TEST
+  $B -t $T 2>&1 | tee -a $B.$T.log;  ST=${PIPESTATUS[0]}; ASSRT "$ST -eq 0"
+  OK
+fi
+
+T=15
+if [ "$SINGLE_T" -eq 0 -o "$SINGLE_T" -eq "$T" ]; then :
+  TEST
+  $B -t $T 2>&1 | tee -a $B.$T.log;  ST=${PIPESTATUS[0]}; ASSRT "$ST -eq 0"
+  OK
+fi
+
+T=16
+if [ "$SINGLE_T" -eq 0 -o "$SINGLE_T" -eq "$T" ]; then :
+  TEST
+  $B -t $T 2>&1 | tee -a $B.$T.log;  ST=${PIPESTATUS[0]}; ASSRT "$ST -eq 0"
+  OK
+fi
+
+T=17
+if [ "$SINGLE_T" -eq 0 -o "$SINGLE_T" -eq "$T" ]; then :
+  TEST
+  $B -t $T 2>&1 | tee -a $B.$T.log;  ST=${PIPESTATUS[0]}; ASSRT "$ST -eq 0"
+  OK
+fi
+
+T=18
+if [ "$SINGLE_T" -eq 0 -o "$SINGLE_T" -eq "$T" ]; then :
+  TEST
+  $B -t $T 2>&1 | tee -a $B.$T.log;  ST=${PIPESTATUS[0]}; ASSRT "$ST -eq 0"
+  OK
+fi
+
+T=19
+if [ "$SINGLE_T" -eq 0 -o "$SINGLE_T" -eq "$T" ]; then :
+  TEST
+  $B -t $T 2>&1 | tee -a $B.$T.log;  ST=${PIPESTATUS[0]}; ASSRT "$ST -eq 0"
+  OK
+fi
+
+T=20
+if [ "$SINGLE_T" -eq 0 -o "$SINGLE_T" -eq "$T" ]; then :
+  TEST
+  $B -t $T 2>&1 | tee -a $B.$T.log;  ST=${PIPESTATUS[0]}; ASSRT "$ST -eq 0"
+  OK
+fi
+
+T=21
+if [ "$SINGLE_T" -eq 0 -o "$SINGLE_T" -eq "$T" ]; then :
+  TEST
+  $B -t $T 2>&1 | tee -a $B.$T.log;  ST=${PIPESTATUS[0]}; ASSRT "$ST -eq 0"
+  ./cfg_hpp_test 2>&1 | tee -a $B.$T.log;  ST=${PIPESTATUS[0]}; ASSRT "$ST -eq 0"
+  OK
+fi
+
+T=22
+if [ "$SINGLE_T" -eq 0 -o "$SINGLE_T" -eq "$T" ]; then :
+  TEST
+  $B -t $T 2>&1 | tee -a $B.$T.log;  ST=${PIPESTATUS[0]}; ASSRT "$ST -eq 0"
+  OK
+fi
+
+T=23
+if [ "$SINGLE_T" -eq 0 -o "$SINGLE_T" -eq "$T" ]; then :
+  TEST
+  $B -t $T 2>&1 | tee -a $B.$T.log;  ST=${PIPESTATUS[0]}; ASSRT "$ST -eq 0"
+  OK
+fi
+
+T=24
+if [ "$SINGLE_T" -eq 0 -o "$SINGLE_T" -eq "$T" ]; then :
+  TEST
+  $B -t $T 2>&1 | tee -a $B.$T.log;  ST=${PIPESTATUS[0]}; ASSRT "$ST -eq 0"
+  OK
+fi
+
+T=25
+if [ "$SINGLE_T" -eq 0 -o "$SINGLE_T" -eq "$T" ]; then :
+  TEST
+  $B -t $T 2>&1 | tee -a $B.$T.log;  ST=${PIPESTATUS[0]}; ASSRT "$ST -eq 0"
+  OK
+fi
+
+T=26
+if [ "$SINGLE_T" -eq 0 -o "$SINGLE_T" -eq "$T" ]; then :
+  TEST
+  $B -t $T 2>&1 | tee -a $B.$T.log;  ST=${PIPESTATUS[0]}; ASSRT "$ST -eq 0"
+  OK
+fi
+
+T=27
+if [ "$SINGLE_T" -eq 0 -o "$SINGLE_T" -eq "$T" ]; then :
+  TEST
+  $B -t $T 2>&1 | tee -a $B.$T.log;  ST=${PIPESTATUS[0]}; ASSRT "$ST -eq 0"
+  OK
+fi
+
+T=28
+if [ "$SINGLE_T" -eq 0 -o "$SINGLE_T" -eq "$T" ]; then :
+  TEST
+  $B -t $T 2>&1 | tee -a $B.$T.log;  ST=${PIPESTATUS[0]}; ASSRT "$ST -eq 0"
+  OK
+fi